@@ -194,11 +194,11 @@ int assemble_aggregates(void){
 	// probably don't always want to use -f FIXME
 	if(zpool){
 		diag("Scanning for zpools...\n");
-		vspopen_drain("zpool import -a -f");
+		spawn_drain("zpool","import","-a","-f",NULL);
 	}
 	if(mdraid){
 		diag("Scanning for MD devices...\n");
-		vspopen_drain("mdadm --assemble --scan");
+		spawn_drain("mdadm","--assemble","--scan",NULL);
 	}
 	return 0;
 }
@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+struct arenachunk {
+	struct arenachunk *next;
+	size_t size, used;
+	char data[];
+};
+
+// Arenas are filled from several discovery workers, so the counter is bumped
+// atomically. Only the (rare) chunk allocations are counted, keeping the
+// fast path free of atomics.
+static arena_stats stats;
+
+char *arena_strndup(strarena *a, const char *s, size_t n){
+	struct arenachunk *c = a->chunks;
+	char *ret;
+
+	if(c == NULL || c->size - c->used < n + 1){
+		size_t size = n + 1 > ARENA_CHUNK ? n + 1 : ARENA_CHUNK;
+
+		if((c = malloc(sizeof(*c) + size)) == NULL){
+			return NULL;
+		}
+		c->size = size;
+		c->used = 0;
+		// an oversized chunk goes behind the current one, which
+		// likely still has room for the next short string
+		if(size > ARENA_CHUNK && a->chunks){
+			c->next = a->chunks->next;
+			a->chunks->next = c;
+		}else{
+			c->next = a->chunks;
+			a->chunks = c;
+		}
+		__atomic_fetch_add(&stats.chunks, 1, __ATOMIC_RELAXED);
+	}
+	ret = c->data + c->used;
+	memcpy(ret, s, n);
+	ret[n] = '\0';
+	c->used += n + 1;
+	return ret;
+}
+
+char *arena_strdup(strarena *a, const char *s){
+	if(s == NULL){
+		return NULL;
+	}
+	return arena_strndup(a, s, strlen(s));
+}
+
+void arena_reset(strarena *a){
+	struct arenachunk *c;
+
+	if(a->chunks == NULL){
+		return;
+	}
+	while( (c = a->chunks->next) ){
+		a->chunks->next = c->next;
+		free(c);
+	}
+	a->chunks->used = 0;
+}
+
+void arena_free(strarena *a){
+	struct arenachunk *c;
+
+	while( (c = a->chunks) ){
+		a->chunks = c->next;
+		free(c);
+	}
+}
+
+void get_arena_stats(arena_stats *as){
+	as->chunks = __atomic_load_n(&stats.chunks, __ATOMIC_RELAXED);
+}
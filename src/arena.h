@@ -0,0 +1,43 @@
+#ifndef GROWLIGHT_ARENA
+#define GROWLIGHT_ARENA
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A bump allocator for strings sharing a lifetime, such as the metadata a
+// device acquires each time it's discovered. Strings can't be freed
+// individually: arena_reset() drops them all at once (retaining one chunk,
+// so that refilling the arena usually costs no malloc() at all), and
+// arena_free() releases everything. A zeroed strarena is a valid empty one.
+struct arenachunk;
+
+typedef struct strarena {
+	struct arenachunk *chunks;	// most recent first
+} strarena;
+
+// Chunks are at least this large; a longer string gets a chunk of its own.
+#define ARENA_CHUNK 256
+
+// Both return NULL on allocation failure. arena_strdup(a, NULL) is NULL.
+char *arena_strdup(strarena *a, const char *s);
+char *arena_strndup(strarena *a, const char *s, size_t n);
+
+void arena_reset(strarena *a);
+void arena_free(strarena *a);
+
+// Process-wide count of chunks malloc()ed.
+typedef struct arena_stats {
+	uint64_t chunks;
+} arena_stats;
+
+void get_arena_stats(arena_stats *as);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
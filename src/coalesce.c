@@ -0,0 +1,223 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+
+#include "coalesce.h"
+#include "devindex.h"
+#include "growlight.h"
+
+#define COALESCE_BUCKETS 256	// power of 2
+
+// An entry lives in the hash while it has kinds pending (in which case it's
+// on the arrival list), kinds held, or is being dispatched.
+struct pending {
+	struct pending *hnext;	// hash chain
+	struct pending *next;	// arrival order, for dispatch
+	struct pending *dnext;	// dispatch list, private to coalescer_flush()
+	unsigned hash;
+	unsigned kinds;		// pending; nonzero iff on the arrival list
+	unsigned held;		// dispatched, and not yet released
+	unsigned dispatching;	// kinds being handed to fxn
+	int busy;		// on a dispatch list; mustn't be freed
+	char name[];
+};
+
+struct coalescer {
+	pthread_mutex_t lock;
+	struct pending *buckets[COALESCE_BUCKETS];
+	struct pending *head, **tail;
+	unsigned windowms;
+	int timerfd;
+	int open;		// the timer is armed for the current window
+	coalesce_stats stats;
+};
+
+static struct pending *
+find_entry(struct coalescer *c, const char *name, unsigned hash){
+	struct pending *p;
+
+	for(p = c->buckets[hash & (COALESCE_BUCKETS - 1)] ; p ; p = p->hnext){
+		if(p->hash == hash && strcmp(p->name, name) == 0){
+			break;
+		}
+	}
+	return p;
+}
+
+// Free p if nothing refers to it any longer. Call with the lock held.
+static void
+reap_entry(struct coalescer *c, struct pending *p){
+	struct pending **pp;
+
+	if(p->kinds || p->held || p->busy){
+		return;
+	}
+	for(pp = &c->buckets[p->hash & (COALESCE_BUCKETS - 1)] ; *pp != p ; pp = &(*pp)->hnext){
+		;
+	}
+	*pp = p->hnext;
+	free(p);
+}
+
+struct coalescer *coalescer_create(unsigned windowms){
+	struct coalescer *c;
+
+	if((c = malloc(sizeof(*c))) == NULL){
+		return NULL;
+	}
+	memset(c, 0, sizeof(*c));
+	if((c->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC|TFD_NONBLOCK)) < 0){
+		diag("Couldn't create coalescing timer (%s)\n", strerror(errno));
+		free(c);
+		return NULL;
+	}
+	pthread_mutex_init(&c->lock, NULL);
+	c->tail = &c->head;
+	c->windowms = windowms ? windowms : 1;
+	return c;
+}
+
+int coalescer_add(struct coalescer *c, const char *name, unsigned kind){
+	unsigned hash = hash_name(name);
+	struct pending *p;
+
+	pthread_mutex_lock(&c->lock);
+	++c->stats.received;
+	if( (p = find_entry(c, name, hash)) ){
+		if(p->kinds){
+			p->kinds |= kind;
+			++c->stats.collapsed;
+			pthread_mutex_unlock(&c->lock);
+			return 0;
+		}
+	}else{
+		struct pending **b = &c->buckets[hash & (COALESCE_BUCKETS - 1)];
+
+		if((p = malloc(sizeof(*p) + strlen(name) + 1)) == NULL){
+			--c->stats.received;
+			pthread_mutex_unlock(&c->lock);
+			return -1;
+		}
+		strcpy(p->name, name);
+		p->hash = hash;
+		p->held = 0;
+		p->busy = 0;
+		p->hnext = *b;
+		*b = p;
+	}
+	p->kinds = kind;
+	p->next = NULL;
+	*c->tail = p;
+	c->tail = &p->next;
+	if(++c->stats.pending > c->stats.maxpending){
+		c->stats.maxpending = c->stats.pending;
+	}
+	if(!c->open){
+		struct itimerspec its;
+
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec = c->windowms / 1000;
+		its.it_value.tv_nsec = c->windowms % 1000 * 1000000ll;
+		if(timerfd_settime(c->timerfd, 0, &its, NULL)){
+			diag("Couldn't arm coalescing timer (%s)\n", strerror(errno));
+		}else{
+			c->open = 1;
+		}
+	}
+	pthread_mutex_unlock(&c->lock);
+	return 0;
+}
+
+int coalescer_fd(const struct coalescer *c){
+	return c->timerfd;
+}
+
+unsigned coalescer_flush(struct coalescer *c, coalescefxn fxn, void *arg){
+	struct pending *p, *list;
+	uint64_t expirations;
+	unsigned n = 0;
+
+	// drain the timerfd so that it isn't readable again until rearmed
+	while(read(c->timerfd, &expirations, sizeof(expirations)) > 0){
+		;
+	}
+	pthread_mutex_lock(&c->lock);
+	list = c->head;
+	c->head = NULL;
+	c->tail = &c->head;
+	c->stats.pending = 0;
+	if(list){
+		++c->stats.windows;
+	}
+	c->open = 0;
+	// an entry can rejoin the arrival list while fxn runs, so the dispatch
+	// list is threaded separately. kinds already held are dropped here.
+	for(p = list ; p ; p = p->next){
+		p->dnext = p->next;
+		p->dispatching = p->kinds & ~p->held;
+		if(p->dispatching == 0){
+			++c->stats.suppressed;
+		}else if(p->held == 0){
+			++c->stats.held;
+		}
+		p->held |= p->dispatching;
+		p->kinds = 0;
+		p->busy = 1;
+	}
+	pthread_mutex_unlock(&c->lock);
+	while( (p = list) ){
+		list = p->dnext;
+		if(p->dispatching){
+			fxn(p->name, p->dispatching, arg);
+			++n;
+		}
+		pthread_mutex_lock(&c->lock);
+		p->busy = 0;
+		reap_entry(c, p);
+		pthread_mutex_unlock(&c->lock);
+	}
+	pthread_mutex_lock(&c->lock);
+	c->stats.dispatched += n;
+	pthread_mutex_unlock(&c->lock);
+	return n;
+}
+
+void coalescer_release(struct coalescer *c, const char *name, unsigned kinds){
+	struct pending *p;
+
+	pthread_mutex_lock(&c->lock);
+	if( (p = find_entry(c, name, hash_name(name))) && (p->held & kinds) ){
+		if((p->held &= ~kinds) == 0){
+			--c->stats.held;
+		}
+		reap_entry(c, p);
+	}
+	pthread_mutex_unlock(&c->lock);
+}
+
+void coalescer_destroy(struct coalescer *c){
+	struct pending *p;
+	unsigned b;
+
+	if(c == NULL){
+		return;
+	}
+	for(b = 0 ; b < COALESCE_BUCKETS ; ++b){
+		while( (p = c->buckets[b]) ){
+			c->buckets[b] = p->hnext;
+			free(p);
+		}
+	}
+	close(c->timerfd);
+	pthread_mutex_destroy(&c->lock);
+	free(c);
+}
+
+void coalescer_get_stats(struct coalescer *c, coalesce_stats *stats){
+	pthread_mutex_lock(&c->lock);
+	*stats = c->stats;
+	pthread_mutex_unlock(&c->lock);
+}
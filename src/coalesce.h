@@ -0,0 +1,68 @@
+#ifndef GROWLIGHT_COALESCE
+#define GROWLIGHT_COALESCE
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// Collects named events over a short window, so that a burst of them (hot-
+// adding a shelf of disks generates hundreds of udev and inotify events)
+// results in one action per name rather than one per event. Each event has a
+// kind, a single bit chosen by the caller; kinds seen for the same name
+// within a window are ORed together. The window opens with the first event
+// following a flush, and closes windowms later, whereupon the coalescer's fd
+// (a timerfd) becomes readable and coalescer_flush() ought be called.
+//
+// Work handed off at flush time often sits queued for a while. Each kind
+// dispatched for a name is held until coalescer_release(), and later windows
+// drop events of held kinds for that name, since the queued work has yet to
+// look at it. The work ought release its kind as it starts.
+struct coalescer;
+
+// Called once per distinct name at flush time, with the union of kinds seen
+// (less those held). All of them are held upon the call; fxn must release
+// any for which it doesn't queue work.
+typedef void (*coalescefxn)(const char *name, unsigned kinds, void *arg);
+
+// Returns NULL on failure.
+struct coalescer *coalescer_create(unsigned windowms);
+
+// Record an event. Returns -1 if it couldn't be recorded, in which case the
+// caller ought act upon it directly.
+int coalescer_add(struct coalescer *c, const char *name, unsigned kind);
+
+// Suitable for epoll. Readable once the window has closed.
+int coalescer_fd(const struct coalescer *c);
+
+// Hand off everything pending, clearing it and rearming for the next event.
+// fxn is called without the coalescer's lock held, so it may add events
+// (which open a new window). Returns the number of names dispatched.
+unsigned coalescer_flush(struct coalescer *c, coalescefxn fxn, void *arg);
+
+// Release kinds held for name by a flush. Releasing what isn't held is a
+// no-op.
+void coalescer_release(struct coalescer *c, const char *name, unsigned kinds);
+
+// Pending events and holds are discarded.
+void coalescer_destroy(struct coalescer *c);
+
+typedef struct coalesce_stats {
+	uint64_t received;	// events recorded
+	uint64_t collapsed;	// events merged into one already pending
+	uint64_t dispatched;	// names handed off by coalescer_flush()
+	uint64_t suppressed;	// names dropped at flush, their work still queued
+	uint64_t windows;	// windows flushed
+	unsigned pending;	// names awaiting the close of the window
+	unsigned maxpending;	// high-water mark of pending
+	unsigned held;		// names with work queued
+} coalesce_stats;
+
+void coalescer_get_stats(struct coalescer *c, coalesce_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -10,8 +10,7 @@ int cryptondev(device *d){
 	struct crypt_device *cctx;
 	char path[PATH_MAX + 1];
 
-	if((unsigned)snprintf(path,sizeof(path),"/dev/%s",d->name) >= sizeof(path)){
-		diag("Bad path: /dev/%s\n",d->name);
+	if(devnode_path(path,sizeof(path),d->name)){
 		return -1;
 	}
 	if(crypt_init(&cctx,path)){
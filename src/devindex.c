@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "devindex.h"
+#include "growlight.h"
+
+int devindex_init(devindex *di,unsigned buckets){
+	unsigned b = 16;
+
+	while(b < buckets){
+		b <<= 1u;
+	}
+	memset(di,0,sizeof(*di));
+	if((di->byname = calloc(b,sizeof(*di->byname))) == NULL){
+		return -1;
+	}
+	if((di->bydevno = calloc(b,sizeof(*di->bydevno))) == NULL){
+		free(di->byname);
+		di->byname = NULL;
+		return -1;
+	}
+	di->buckets = b;
+	return 0;
+}
+
+void devindex_free(devindex *di){
+	free(di->byname);
+	free(di->bydevno);
+	memset(di,0,sizeof(*di));
+}
+
+static void
+link_device(struct device **byname,struct device **bydevno,unsigned buckets,
+		device *d){
+	unsigned b = d->idxname & (buckets - 1);
+
+	d->hnext_name = byname[b];
+	byname[b] = d;
+	if(d->idxdevno){
+		b = hash_devno(d->idxdevno) & (buckets - 1);
+		d->hnext_devno = bydevno[b];
+		bydevno[b] = d;
+	}else{
+		d->hnext_devno = NULL;
+	}
+}
+
+// Double the bucket count, relinking every device. On allocation failure we
+// simply keep the old (longer-chained) tables.
+static void
+grow_index(devindex *di){
+	unsigned nb = di->buckets * 2,z;
+	device **byname,**bydevno;
+
+	if(nb < di->buckets){
+		return;
+	}
+	if((byname = calloc(nb,sizeof(*byname))) == NULL){
+		return;
+	}
+	if((bydevno = calloc(nb,sizeof(*bydevno))) == NULL){
+		free(byname);
+		return;
+	}
+	// Every indexed device is on exactly one byname chain, so walking
+	// those finds them all (devno chains are rebuilt alongside).
+	for(z = 0 ; z < di->buckets ; ++z){
+		device *d;
+
+		while( (d = di->byname[z]) ){
+			di->byname[z] = d->hnext_name;
+			link_device(byname,bydevno,nb,d);
+		}
+	}
+	free(di->byname);
+	free(di->bydevno);
+	di->byname = byname;
+	di->bydevno = bydevno;
+	di->buckets = nb;
+}
+
+int devindex_add(devindex *di,device *d){
+	if(di->buckets == 0 && devindex_init(di,0)){
+		return -1;
+	}
+	devindex_del(di,d);
+	if(di->count >= di->buckets){
+		grow_index(di);
+	}
+	d->idxname = hash_name(d->name);
+	d->idxdevno = d->devno;
+	link_device(di->byname,di->bydevno,di->buckets,d);
+	d->indexed = 1;
+	++di->count;
+	return 0;
+}
+
+void devindex_del(devindex *di,device *d){
+	device **pre;
+
+	if(!d->indexed){
+		return;
+	}
+	for(pre = &di->byname[d->idxname & (di->buckets - 1)] ; *pre ; pre = &(*pre)->hnext_name){
+		if(*pre == d){
+			*pre = d->hnext_name;
+			break;
+		}
+	}
+	if(d->idxdevno){
+		unsigned b = hash_devno(d->idxdevno) & (di->buckets - 1);
+
+		for(pre = &di->bydevno[b] ; *pre ; pre = &(*pre)->hnext_devno){
+			if(*pre == d){
+				*pre = d->hnext_devno;
+				break;
+			}
+		}
+	}
+	d->hnext_name = d->hnext_devno = NULL;
+	d->indexed = 0;
+	--di->count;
+}
+
+device *devindex_name(const devindex *di,const char *name){
+	device *d;
+
+	if(di->buckets == 0){
+		return NULL;
+	}
+	for(d = di->byname[hash_name(name) & (di->buckets - 1)] ; d ; d = d->hnext_name){
+		if(strcmp(d->name,name) == 0){
+			return d;
+		}
+	}
+	return NULL;
+}
+
+device *devindex_devno(const devindex *di,dev_t devno){
+	device *d;
+
+	if(di->buckets == 0 || devno == 0){
+		return NULL;
+	}
+	for(d = di->bydevno[hash_devno(devno) & (di->buckets - 1)] ; d ; d = d->hnext_devno){
+		if(d->idxdevno == devno){
+			return d;
+		}
+	}
+	return NULL;
+}
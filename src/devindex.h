@@ -0,0 +1,65 @@
+#ifndef GROWLIGHT_DEVINDEX
+#define GROWLIGHT_DEVINDEX
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct device;
+
+// FNV-1a. Block device names are short and share long prefixes ("sdaa1",
+// "sdab1"...), which this handles fine. Shared by everything hashing names.
+static inline unsigned
+hash_name(const char *name){
+	uint32_t h = 2166136261u;
+
+	while(*name){
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static inline unsigned
+hash_devno(dev_t devno){
+	uint64_t h = (uint64_t)devno * 0x9e3779b97f4a7c15ull;
+
+	return h >> 32u;
+}
+
+// Hash index over every published block device and partition, keyed both by
+// name (as it appears in /sys/class/block and /dev) and by devno. Chains are
+// threaded through the devices themselves (device->hnext_name and
+// device->hnext_devno), so insertion never allocates except when the bucket
+// arrays are grown. Devices with a devno of 0 (i.e. zpools and other things
+// lacking a real block node) are only indexed by name. Not threadsafe; the
+// growlight lock protects the global instance.
+typedef struct devindex {
+	struct device **byname;
+	struct device **bydevno;
+	unsigned buckets;	// always a power of 2
+	unsigned count;		// number of indexed devices
+} devindex;
+
+int devindex_init(devindex *,unsigned);
+void devindex_free(devindex *);
+
+// Adding an already-indexed device first removes it, so that a renamed or
+// renumbered device can simply be readded. Returns -1 on allocation failure
+// (in which case the device is not indexed).
+int devindex_add(devindex *,struct device *);
+
+// Removing a device which isn't indexed is a no-op.
+void devindex_del(devindex *,struct device *);
+
+struct device *devindex_name(const devindex *,const char *);
+struct device *devindex_devno(const devindex *,dev_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
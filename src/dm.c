@@ -11,13 +11,13 @@ int explore_dm_sysfs(device *d,int dirfd){
 	mdslave **enqm;*/
 
 	d->dmdev.disks = 1;
-	if((d->model = strdup("Linux devmapper")) == NULL){
+	if((d->model = arena_strdup(&d->strings,"Linux devmapper")) == NULL){
 		return -1;
 	}
-	if((d->dmdev.uuid = get_sysfs_string(dirfd,"uuid")) == NULL){
+	if((d->dmdev.uuid = get_sysfs_string_arena(dirfd,"uuid",&d->strings)) == NULL){
 		verbf("Warning: no 'uuid' content in dm device %s\n",d->name);
 	}
-	if((d->dmdev.dmname = get_sysfs_string(dirfd,"name")) == NULL){
+	if((d->dmdev.dmname = get_sysfs_string_arena(dirfd,"name",&d->strings)) == NULL){
 		verbf("Warning: no 'name' content in dm device %s\n",d->name);
 	}
 	d->dmdev.transport = AGGREGATE_UNKNOWN;
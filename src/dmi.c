@@ -1,27 +1,27 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 #include "sysfs.h"
 #include "growlight.h"
 
-#define DMI_PATH "/sys/devices/virtual/dmi/id"
-
 static char *bios_vendor;
 static char *bios_version;
 
-int dmi_init(void){
+int dmi_init(const char *path){
 	int dfd;
 
-	if((dfd = open(DMI_PATH,O_RDONLY|O_DIRECTORY)) < 0){
-		diag("Couldn't open %s (%s)\n",DMI_PATH,strerror(errno));
+	if((dfd = open(path,O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0){
+		diag("Couldn't open %s (%s)\n",path,strerror(errno));
 		return -1;
 	}
 	if((bios_version = get_sysfs_string(dfd,"bios_version")) == NULL){
-		diag("Couldn't open %s/%s (%s)\n",DMI_PATH,"bios_version",strerror(errno));
+		diag("Couldn't open %s/%s (%s)\n",path,"bios_version",strerror(errno));
 	}
 	if((bios_vendor = get_sysfs_string(dfd,"bios_vendor")) == NULL){
-		diag("Couldn't open %s/%s (%s)\n",DMI_PATH,"bios_vendor",strerror(errno));
+		diag("Couldn't open %s/%s (%s)\n",path,"bios_vendor",strerror(errno));
 	}
+	close(dfd);
 	return 0;
 }
 
@@ -5,8 +5,8 @@
 extern "C" {
 #endif
 
-// Load the DMI configuration from sysfs
-int dmi_init(void);
+// Load the DMI configuration from its sysfs directory (path)
+int dmi_init(const char *path);
 
 const char *get_bios_version(void);
 const char *get_bios_vendor(void);
@@ -19,7 +19,7 @@ create_btrfs(const char *dev,const struct mkfsmarshal *mkm){
 	if(name == NULL){
 		name = "SprezzaBTRFS";
 	}
-	if(vspopen_drain("mkfs.btrfs -L \"%s\" %s", mkm->name, dev)){
+	if(spawn_rescan(dev, "mkfs.btrfs", "-L", name, dev, NULL) == 0){
 		return -1;
 	}
 	return 0;
@@ -32,7 +32,7 @@ hfs_mkfs(const char *dev,const struct mkfsmarshal *mkm){
 	if(name == NULL){
 		name = "SprezzaHFS";
 	}
-	if(vspopen_drain("mkfs.hfs -h -v \"%s\" %s", mkm->name, dev)){
+	if(spawn_rescan(dev, "mkfs.hfs", "-h", "-v", name, dev, NULL) == 0){
 		return -1;
 	}
 	return 0;
@@ -45,7 +45,7 @@ hfsplus_mkfs(const char *dev,const struct mkfsmarshal *mkm){
 	if(name == NULL){
 		name = "SprezzaHFS+";
 	}
-	if(vspopen_drain("mkfs.hfsplus -s -J -v \"%s\" %s",mkm->name,dev)){
+	if(spawn_rescan(dev,"mkfs.hfsplus","-s","-J","-v",name,dev,NULL) == 0){
 		return -1;
 	}
 	return 0;
@@ -60,7 +60,7 @@ jfs_mkfs(const char *dev,const struct mkfsmarshal *mkm){
 		name = "SprezzaJFS";
 	}
 	// FIXME what about external journals?
-	if(vspopen_drain("mkfs.jfs -q -L \"%s\" %s",mkm->name,dev)){
+	if(spawn_rescan(dev,"mkfs.jfs","-q","-L",name,dev,NULL) == 0){
 		return -1;
 	}
 	return 0;
@@ -75,8 +75,8 @@ xfs_mkfs(const char *dev,const struct mkfsmarshal *mkm){
 		name = "SprezzaXFS";
 	}
 	// FIXME set -s to the physical sector size
-	if(vspopen_drain("mkfs.xfs %s-L \"%s\" %s",
-			mkm->force ? "-f ": "",mkm->name,dev)){
+	if((mkm->force ? spawn_rescan(dev,"mkfs.xfs","-f","-L",name,dev,NULL) :
+			spawn_rescan(dev,"mkfs.xfs","-L",name,dev,NULL)) == 0){
 		return -1;
 	}
 	return 0;
@@ -89,8 +89,8 @@ create_ntfs(const char *dev,const struct mkfsmarshal *mkm){
 	if(name == NULL){
 		name = "SprezzaNTFS";
 	}
-	if(vspopen_drain("mkfs.ntfs -v %s-U -L \"%s\" %s",
-			mkm->force ? "-F " : "",mkm->name,dev)){
+	if((mkm->force ? spawn_rescan(dev,"mkfs.ntfs","-v","-F","-U","-L",name,dev,NULL) :
+			spawn_rescan(dev,"mkfs.ntfs","-v","-U","-L",name,dev,NULL)) == 0){
 		return -1;
 	}
 	return 0;
@@ -103,7 +103,7 @@ f2fs_mkfs(const char *dev,const struct mkfsmarshal *mkm){
 	if(name == NULL){
 		name = "SprezzaF2FS";
 	}
-	if(vspopen_drain("mkfs.f2fs -l \"%s\" %s",mkm->name,dev)){
+	if(spawn_rescan(dev,"mkfs.f2fs","-l",name,dev,NULL) == 0){
 		return -1;
 	}
 	return 0;
@@ -116,7 +116,7 @@ cramfs_mkfs(const char *dev,const struct mkfsmarshal *mkm){
 	if(name == NULL){
 		name = "SprezzaCram";
 	}
-	if(vspopen_drain("mkcramfs -v -E -n \"%s\" %s",mkm->name,dev)){
+	if(spawn_rescan(dev,"mkcramfs","-v","-E","-n",name,dev,NULL) == 0){
 		return -1;
 	}
 	return 0;
@@ -130,8 +130,8 @@ vfat_mkfs(const char *dev,const struct mkfsmarshal *mkm){
 	if(name == NULL){
 		name = "SprezzaVFAT";
 	}
-	if(vspopen_drain("mkfs.vfat %s-F 32 -n \"%s\" %s",
-				mkm->force ? "-I " : "",mkm->name,dev)){
+	if((mkm->force ? spawn_rescan(dev,"mkfs.vfat","-I","-F","32","-n",name,dev,NULL) :
+			spawn_rescan(dev,"mkfs.vfat","-F","32","-n",name,dev,NULL)) == 0){
 		return -1;
 	}
 	return 0;
@@ -148,12 +148,38 @@ ufs_mkfs(const char *dev,const struct mkfsmarshal *mkm){
 	if(name == NULL){
 		name = "SprezzaUFS";
 	}
-	if(vspopen_drain("mkfs.ufs -L \"%s\" %s",mkm->name,dev)){
+	if(spawn_rescan(dev,"mkfs.ufs","-L",name,dev,NULL) == 0){
 		return -1;
 	}
 	return 0;
 }
 
+// The mke2fs family share their arguments
+static int
+ext_mkfs(const char *cmd,const char *dev,const char *name,const struct mkfsmarshal *mkm){
+	const char *argv[12];
+	char ext[64];
+	int argc = 0;
+
+	argv[argc++] = cmd;
+	if(mkm->stride && mkm->swidth){
+		snprintf(ext,sizeof(ext),"-Estride=%ju,stripe_width=%ju",mkm->stride,mkm->swidth);
+		argv[argc++] = ext;
+	}
+	if(mkm->force){
+		argv[argc++] = "-F";
+	}
+	argv[argc++] = "-b";
+	argv[argc++] = "-2048";
+	argv[argc++] = "-L";
+	argv[argc++] = name;
+	argv[argc++] = "-O";
+	argv[argc++] = "dir_index,extent";
+	argv[argc++] = dev;
+	argv[argc] = NULL;
+	return spawn_rescanv(dev,argv) ? 0 : -1;
+}
+
 static int
 ext4_mkfs(const char *dev,const struct mkfsmarshal *mkm){
 	// pass -M with mount point FIXME
@@ -167,13 +193,7 @@ ext4_mkfs(const char *dev,const struct mkfsmarshal *mkm){
 	}
 	// FIXME Support a thorough mode or something where we use:
 	// -E lazy_itable_init=0,lazy_journal_init=0 -O ^uninit_bg" or something
-	if(mkm->stride && mkm->swidth){
-		if(vspopen_drain("mkfs.ext4 -Estride=%ju,stripe_width=%ju %s-b -2048 -L \"%s\" -O dir_index,extent %s",
-			mkm->stride,mkm->swidth,
-			mkm->force ? "-F " : "",mkm->name,dev)){
-		}
-	}else if(vspopen_drain("mkfs.ext4 %s-b -2048 -L \"%s\" -O dir_index,extent %s",
-			mkm->force ? "-F " : "",mkm->name,dev)){
+	if(ext_mkfs("mkfs.ext4",dev,name,mkm)){
 		return -1;
 	}
 	return 0;
@@ -190,14 +210,8 @@ ext3_mkfs(const char *dev,const struct mkfsmarshal *mkm){
 	if(name == NULL){
 		name = "SprezzaEXT3";
 	}
-	//if(vspopen_drain("mkfs.ext3 %s-b -2048 -E lazy_itable_init=0,lazy_journal_init=0 -L \"%s\" -O dir_index,extent %s",
-	if(mkm->stride && mkm->swidth){
-		if(vspopen_drain("mkfs.ext3 -Estride=%ju,stripe_width=%ju %s-b -2048 -L \"%s\" -O dir_index,extent %s",
-			mkm->stride,mkm->swidth,
-			mkm->force ? "-F ": "",mkm->name,dev)){
-		}
-	}else if(vspopen_drain("mkfs.ext3 %s-b -2048 -L \"%s\" -O dir_index,extent %s",
-			mkm->force ? "-F ": "",mkm->name,dev)){
+	// FIXME consider -E lazy_itable_init=0,lazy_journal_init=0
+	if(ext_mkfs("mkfs.ext3",dev,name,mkm)){
 		return -1;
 	}
 	return 0;
@@ -214,13 +228,7 @@ ext2_mkfs(const char *dev,const struct mkfsmarshal *mkm){
 	if(name == NULL){
 		name = "SprezzaEXT2";
 	}
-	if(mkm->stride && mkm->swidth){
-		if(vspopen_drain("mkfs.ext2 -Estride=%ju,stripe_width=%ju %s-b -2048 -L \"%s\" -O dir_index,extent %s",
-			mkm->stride,mkm->swidth,
-			mkm->force ? "-F " : "",mkm->name,dev)){
-		}
-	}else if(vspopen_drain("mkfs.ext2 %s-b -2048 -L \"%s\" -O dir_index,extent %s",
-			mkm->force ? "-F " : "",mkm->name,dev)){
+	if(ext_mkfs("mkfs.ext2",dev,name,mkm)){
 		return -1;
 	}
 	return 0;
@@ -231,7 +239,7 @@ mkswap(const char *dev,const struct mkfsmarshal *mfm){
 	const char *name;
 
 	name = mfm->name ? mfm->name : "SprezzaSwap";
-	if(vspopen_drain("mkswap -L %s %s",name,dev)){
+	if(spawn_drain("mkswap","-L",name,dev,NULL)){
 		return -1;
 	}
 	if(swapon(dev,0)){
@@ -600,7 +608,7 @@ err:
 
 int make_filesystem(device *d,const char *pty,const char *name){
 	const struct fs *pt;
-	int force = 0;
+	int force = 0,r;
 
 	if(d == NULL || pty == NULL){
 		diag("Passed NULL arguments, aborting\n");
@@ -632,8 +640,7 @@ int make_filesystem(device *d,const char *pty,const char *name){
 			struct mkfsmarshal marsh;
 
 			memset(&marsh,0,sizeof(marsh));
-			if(snprintf(dbuf,sizeof(dbuf),"/dev/%s",d->name) >= (int)sizeof(dbuf)){
-				diag("Bad name: %s\n",d->name);
+			if(devnode_path(dbuf,sizeof(dbuf),d->name)){
 				return -1;
 			}
 			if(pt->mkfs == NULL){
@@ -650,11 +657,16 @@ int make_filesystem(device *d,const char *pty,const char *name){
 				marsh.stride = d->mddev.stride;
 				marsh.swidth = d->mddev.swidth;
 			}
-			if(pt->mkfs(dbuf,&marsh)){
+			// most mkfs run in the background, to be followed by a
+			// rescan; mkswap must finish first, to swap on it
+			hold_device(d);
+			r = pt->mkfs(dbuf,&marsh);
+			release_device(d);
+			if(r){
 				free(mnttype);
 				return -1;
 			}
-			// FIXME reprobe device?
+			// the rescan will correct this should the mkfs fail
 			free(d->mnttype);
 			d->mnttype = mnttype;
 			return 0;
@@ -706,6 +718,8 @@ int parse_filesystems(const glightui *gui __attribute__ ((unused)),const char *f
 }
 
 int wipe_filesystem(device *d){
+	char dev[PATH_MAX];
+
 	if(!d->mnttype){
 		diag("No filesystem on %s\n",d->name);
 		return -1;
@@ -714,10 +728,12 @@ int wipe_filesystem(device *d){
 		diag("%s is in use (%ux) and cannot be wiped\n",d->name,d->mnt.count);
 		return -1;
 	}
-	if(vspopen_drain("wipefs -a /dev/%s",d->name)){
+	if(devnode_path(dev,sizeof(dev),d->name)){
+		return -1;
+	}
+	if(spawn_rescan(dev,"wipefs","-a",dev,NULL) == 0){
 		return -1;
 	}
-	rescan_blockdev(d);
 	return 0;
 }
 
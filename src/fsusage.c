@@ -0,0 +1,536 @@
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/statvfs.h>
+
+#include "fsusage.h"
+#include "devindex.h"
+
+#define FSUSAGE_BUCKETS 64
+
+// Hung workers can't be reclaimed, so they're only replaced until this many
+// times the pool size are alive. Past that, requests wait for a worker to
+// come back.
+#define FSUSAGE_HUNG_FACTOR 4
+
+typedef struct fsentry {
+	struct fsentry *next;	// hash chain
+	struct fsentry *qnext;	// request queue
+	fsusage fu;		// age is computed on the way out
+	uint64_t taken;		// monotonic ns of the figures, 0 if none
+	uint64_t started;	// monotonic ns the outstanding call began
+	unsigned queued: 1;	// on the request queue
+	unsigned busy: 1;	// held by a worker (call and callback)
+	unsigned hung: 1;	// outstanding call ran past the timeout
+	unsigned forgotten: 1;	// freed once its worker is done with it
+	fillhist bytes;		// bytes used
+	fillhist inodes;	// inodes used (empty if the fs has no count)
+	char mnt[];
+} fsentry;
+
+struct fsusage_cache {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;	// broadcast as callbacks return
+	fsentry *buckets[FSUSAGE_BUCKETS];
+	fsentry *queue, **qtail;
+	unsigned threads;
+	unsigned running;
+	unsigned hung;
+	unsigned callbacks;	// underway
+	uint64_t ttlns, timeoutns;
+	fsusagefxn fxn;
+	void *arg;
+	int (*statfxn)(const char *, struct statvfs *);
+	int shutdown;		// no more requests or callbacks
+	int destroyed;		// the last worker out frees the cache
+	fsusage_stats stats;
+};
+
+static inline uint64_t
+monotonic_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline unsigned
+mnt_bucket(const char *mnt){
+	return hash_name(mnt) % FSUSAGE_BUCKETS;
+}
+
+const char *fsusage_state_name(fsusage_state state){
+	switch(state){
+		case FSUSAGE_OK: return "ok";
+		case FSUSAGE_PENDING: return "pending";
+		case FSUSAGE_ERROR: return "error";
+		case FSUSAGE_STALE: return "stale";
+		case FSUSAGE_HUNG: return "hung";
+	}
+	return NULL;
+}
+
+void fillhist_add(fillhist *fh, uint64_t when, uintmax_t used){
+	fh->when[fh->next] = when;
+	fh->used[fh->next] = used;
+	fh->next = (fh->next + 1) % FILLHIST_SAMPLES;
+	if(fh->count < FILLHIST_SAMPLES){
+		++fh->count;
+	}
+}
+
+void fillhist_reset(fillhist *fh){
+	memset(fh, 0, sizeof(*fh));
+}
+
+int fillhist_rate(const fillhist *fh, double *rate){
+	double mt = 0, mu = 0, sxy = 0, sxx = 0;
+	uint64_t t0;
+	uintmax_t u0;
+	unsigned first, i, z;
+
+	if(fh->count < 3){
+		return -1;
+	}
+	// offsets from the newest sample keep the sums well-conditioned
+	first = (fh->next + FILLHIST_SAMPLES - fh->count) % FILLHIST_SAMPLES;
+	z = (fh->next + FILLHIST_SAMPLES - 1) % FILLHIST_SAMPLES;
+	t0 = fh->when[z];
+	u0 = fh->used[z];
+	for(i = 0 ; i < fh->count ; ++i){
+		z = (first + i) % FILLHIST_SAMPLES;
+		mt += (double)(t0 - fh->when[z]) / 1e9;
+		mu += (double)fh->used[z] - (double)u0;
+	}
+	mt /= fh->count;
+	mu /= fh->count;
+	for(i = 0 ; i < fh->count ; ++i){
+		double dt, du;
+
+		z = (first + i) % FILLHIST_SAMPLES;
+		dt = -(double)(t0 - fh->when[z]) / 1e9 + mt;
+		du = (double)fh->used[z] - (double)u0 - mu;
+
+		sxy += dt * du;
+		sxx += dt * dt;
+	}
+	if(sxx <= 0){
+		return -1;
+	}
+	*rate = sxy / sxx;
+	return 0;
+}
+
+// Seconds until left is used up at rate, 0 if never
+static uint64_t
+time_to_fill(uintmax_t left, double rate){
+	double s;
+
+	if(rate <= 0){
+		return 0;
+	}
+	if((s = left / rate) >= (double)UINT64_MAX){
+		return 0;
+	}
+	return s < 1 ? 1 : (uint64_t)s;
+}
+
+// Update the history with fresh figures, and project from it
+static void
+project_usage(fsentry *e, uint64_t now){
+	fsusage *fu = &e->fu;
+
+	fillhist_add(&e->bytes, now, fu->size - fu->free);
+	fu->fillrate = 0;
+	fillhist_rate(&e->bytes, &fu->fillrate);
+	fu->ttf = time_to_fill(fu->avail, fu->fillrate);
+	fu->ifillrate = 0;
+	fu->ittf = 0;
+	if(fu->files){
+		fillhist_add(&e->inodes, now, fu->files - fu->ffree);
+		fillhist_rate(&e->inodes, &fu->ifillrate);
+		fu->ittf = time_to_fill(fu->ffree, fu->ifillrate);
+	}
+}
+
+static const char *
+duration_str(uint64_t s, char *buf, size_t len){
+	if(s < 120){
+		snprintf(buf, len, "%jus", (uintmax_t)s);
+	}else if(s < 120 * 60){
+		snprintf(buf, len, "%jum", (uintmax_t)s / 60);
+	}else if(s < 48 * 3600){
+		snprintf(buf, len, "%juh", (uintmax_t)s / 3600);
+	}else{
+		snprintf(buf, len, "%jud", (uintmax_t)s / 86400);
+	}
+	return buf;
+}
+
+const char *fsusage_eta(const fsusage *fu, char *buf, size_t len){
+	char dur[32];
+
+	if(len){
+		*buf = '\0';
+	}
+	if(fu->state != FSUSAGE_OK && fu->state != FSUSAGE_STALE){
+		return buf;
+	}
+	if(fu->size && fu->avail == 0){
+		snprintf(buf, len, "full");
+	}else if(fu->ittf && (fu->ttf == 0 || fu->ittf < fu->ttf)){
+		snprintf(buf, len, "inodes out in %s", duration_str(fu->ittf, dur, sizeof(dur)));
+	}else if(fu->ttf){
+		snprintf(buf, len, "full in %s", duration_str(fu->ttf, dur, sizeof(dur)));
+	}
+	return buf;
+}
+
+const char *fsusage_summary(const fsusage *fu, char *buf, size_t len){
+	char eta[32];
+	size_t r = 0;
+
+	if(len){
+		*buf = '\0';
+	}
+	if(fu->size){
+		r = snprintf(buf, len, "%u%% used",
+			(unsigned)((double)(fu->size - fu->free) * 100 / fu->size));
+		if(*fsusage_eta(fu, eta, sizeof(eta)) && r < len){
+			r += snprintf(buf + r, len - r, ", %s", eta);
+		}
+	}
+	if(fu->state != FSUSAGE_OK && r < len){
+		snprintf(buf + r, len - r, "%s[%s]", r ? " " : "",
+				fsusage_state_name(fu->state));
+	}
+	return buf;
+}
+
+static fsentry *
+find_entry(struct fsusage_cache *c, const char *mnt){
+	fsentry *e;
+
+	for(e = c->buckets[mnt_bucket(mnt)] ; e ; e = e->next){
+		if(strcmp(e->mnt, mnt) == 0){
+			break;
+		}
+	}
+	return e;
+}
+
+static void
+unhash_entry(struct fsusage_cache *c, fsentry *e){
+	fsentry **lnk;
+
+	for(lnk = &c->buckets[mnt_bucket(e->mnt)] ; *lnk ; lnk = &(*lnk)->next){
+		if(*lnk == e){
+			*lnk = e->next;
+			--c->stats.cached;
+			break;
+		}
+	}
+}
+
+static void
+free_cache(struct fsusage_cache *c){
+	pthread_cond_destroy(&c->cond);
+	pthread_mutex_destroy(&c->lock);
+	free(c);
+}
+
+static void *
+fsusage_worker(void *vc){
+	struct fsusage_cache *c = vc;
+	struct statvfs vfs;
+	int r, err, last;
+	fsentry *e;
+	fsusage fu;
+
+	pthread_mutex_lock(&c->lock);
+	while(!c->shutdown && (e = c->queue)){
+		if((c->queue = e->qnext) == NULL){
+			c->qtail = &c->queue;
+		}
+		e->queued = 0;
+		if(e->forgotten){
+			unhash_entry(c, e);
+			free(e);
+			continue;
+		}
+		e->busy = 1;
+		e->started = monotonic_ns();
+		pthread_mutex_unlock(&c->lock);
+		r = c->statfxn(e->mnt, &vfs);
+		err = errno;
+		pthread_mutex_lock(&c->lock);
+		if(e->hung){
+			--c->hung;
+			e->hung = 0;
+		}
+		e->started = 0;
+		e->taken = monotonic_ns();
+		++c->stats.calls;
+		if(r){
+			++c->stats.errors;
+			e->fu.state = FSUSAGE_ERROR;
+			e->fu.err = err;
+		}else{
+			// a different (or resized) filesystem has a new history
+			if(e->fu.size != (uintmax_t)vfs.f_frsize * vfs.f_blocks){
+				fillhist_reset(&e->bytes);
+				fillhist_reset(&e->inodes);
+			}
+			e->fu.state = FSUSAGE_OK;
+			e->fu.err = 0;
+			e->fu.size = (uintmax_t)vfs.f_frsize * vfs.f_blocks;
+			e->fu.free = (uintmax_t)vfs.f_frsize * vfs.f_bfree;
+			e->fu.avail = (uintmax_t)vfs.f_frsize * vfs.f_bavail;
+			e->fu.files = vfs.f_files;
+			e->fu.ffree = vfs.f_ffree;
+			project_usage(e, e->taken);
+		}
+		if(!c->shutdown && !e->forgotten && c->fxn){
+			fu = e->fu;
+			++c->callbacks;
+			pthread_mutex_unlock(&c->lock);
+			c->fxn(e->mnt, &fu, c->arg);
+			pthread_mutex_lock(&c->lock);
+			--c->callbacks;
+			pthread_cond_broadcast(&c->cond);
+		}
+		e->busy = 0;
+		if(c->destroyed){ // destroy left it to us
+			free(e);
+		}else if(e->forgotten){
+			unhash_entry(c, e);
+			free(e);
+		}
+	}
+	--c->running;
+	last = c->destroyed && c->running == 0;
+	pthread_mutex_unlock(&c->lock);
+	if(last){
+		free_cache(c);
+	}
+	return NULL;
+}
+
+// Called with the lock held. Returns -1 if the pool is full.
+static int
+spawn_worker(struct fsusage_cache *c){
+	pthread_attr_t attr;
+	pthread_t tid;
+	int r;
+
+	if(c->running - c->hung >= c->threads ||
+			c->running >= c->threads * FSUSAGE_HUNG_FACTOR){
+		return -1;
+	}
+	if(pthread_attr_init(&attr)){
+		return -1;
+	}
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if( (r = pthread_create(&tid, &attr, fsusage_worker, c)) == 0){
+		++c->running;
+	}
+	pthread_attr_destroy(&attr);
+	return r ? -1 : 0;
+}
+
+// Called with the lock held. A worker is started for each request, so long
+// as the pool isn't full; workers drain the queue and exit once it's empty.
+static void
+request_usage(struct fsusage_cache *c, fsentry *e){
+	if(e->queued || e->busy || c->shutdown){
+		return;
+	}
+	e->queued = 1;
+	e->qnext = NULL;
+	*c->qtail = e;
+	c->qtail = &e->qnext;
+	spawn_worker(c);
+}
+
+struct fsusage_cache *fsusage_create(unsigned threads, unsigned ttlms,
+			unsigned timeoutms, fsusagefxn fxn, void *arg){
+	struct fsusage_cache *c;
+
+	if(threads == 0 || (c = malloc(sizeof(*c))) == NULL){
+		return NULL;
+	}
+	memset(c, 0, sizeof(*c));
+	if(pthread_mutex_init(&c->lock, NULL)){
+		free(c);
+		return NULL;
+	}
+	if(pthread_cond_init(&c->cond, NULL)){
+		pthread_mutex_destroy(&c->lock);
+		free(c);
+		return NULL;
+	}
+	c->qtail = &c->queue;
+	c->threads = threads;
+	c->ttlns = ttlms * 1000000ull;
+	c->timeoutns = timeoutms * 1000000ull;
+	c->fxn = fxn;
+	c->arg = arg;
+	c->statfxn = statvfs;
+	return c;
+}
+
+void fsusage_set_statvfs(struct fsusage_cache *c,
+			int (*fxn)(const char *, struct statvfs *)){
+	pthread_mutex_lock(&c->lock);
+	c->statfxn = fxn;
+	pthread_mutex_unlock(&c->lock);
+}
+
+int fsusage_get(struct fsusage_cache *c, const char *mnt, fsusage *out){
+	uint64_t now = monotonic_ns();
+	size_t len = strlen(mnt) + 1;
+	fsentry *e;
+
+	pthread_mutex_lock(&c->lock);
+	if((e = find_entry(c, mnt)) == NULL){
+		if((e = malloc(sizeof(*e) + len)) == NULL){
+			pthread_mutex_unlock(&c->lock);
+			return -1;
+		}
+		memset(e, 0, sizeof(*e));
+		memcpy(e->mnt, mnt, len);
+		e->fu.state = FSUSAGE_PENDING;
+		e->next = c->buckets[mnt_bucket(mnt)];
+		c->buckets[mnt_bucket(mnt)] = e;
+		++c->stats.cached;
+	}
+	e->forgotten = 0;
+	if(e->taken == 0 || now - e->taken >= c->ttlns){
+		request_usage(c, e);
+	}
+	*out = e->fu;
+	out->age = e->taken ? now - e->taken : 0;
+	pthread_mutex_unlock(&c->lock);
+	return 0;
+}
+
+void fsusage_forget(struct fsusage_cache *c, const char *mnt){
+	fsentry *e;
+
+	pthread_mutex_lock(&c->lock);
+	if( (e = find_entry(c, mnt)) ){
+		if(e->queued || e->busy){
+			e->forgotten = 1;
+		}else{
+			unhash_entry(c, e);
+			free(e);
+		}
+	}
+	pthread_mutex_unlock(&c->lock);
+}
+
+// A hung mount, noted for its callback
+typedef struct hungnote {
+	struct hungnote *next;
+	fsusage fu;
+	char mnt[];
+} hungnote;
+
+void fsusage_sweep(struct fsusage_cache *c){
+	uint64_t now = monotonic_ns();
+	hungnote *notes = NULL, *n;
+	unsigned b;
+	fsentry *e;
+
+	pthread_mutex_lock(&c->lock);
+	for(b = 0 ; b < FSUSAGE_BUCKETS ; ++b){
+		for(e = c->buckets[b] ; e ; e = e->next){
+			if(e->started){
+				if(e->hung || now - e->started < c->timeoutns){
+					continue;
+				}
+				e->hung = 1;
+				++c->hung;
+				++c->stats.timeouts;
+				e->fu.state = e->fu.state == FSUSAGE_OK ?
+					FSUSAGE_STALE : FSUSAGE_HUNG;
+				if(e->forgotten || c->fxn == NULL || c->shutdown){
+					continue;
+				}
+				if( (n = malloc(sizeof(*n) + strlen(e->mnt) + 1)) ){
+					n->fu = e->fu;
+					n->fu.age = e->taken ? now - e->taken : 0;
+					strcpy(n->mnt, e->mnt);
+					n->next = notes;
+					notes = n;
+				}
+			}else if(!e->forgotten && e->taken && now - e->taken >= c->ttlns){
+				request_usage(c, e);
+			}
+		}
+	}
+	// the pool has shrunk by whatever just hung; let it catch up
+	for(e = c->queue ; e ; e = e->qnext){
+		if(spawn_worker(c)){
+			break;
+		}
+	}
+	if(notes){
+		++c->callbacks;
+	}
+	pthread_mutex_unlock(&c->lock);
+	if(notes == NULL){
+		return;
+	}
+	while( (n = notes) ){
+		notes = n->next;
+		c->fxn(n->mnt, &n->fu, c->arg);
+		free(n);
+	}
+	pthread_mutex_lock(&c->lock);
+	--c->callbacks;
+	pthread_cond_broadcast(&c->cond);
+	pthread_mutex_unlock(&c->lock);
+}
+
+void fsusage_destroy(struct fsusage_cache *c){
+	fsentry *e;
+	unsigned b;
+
+	if(c == NULL){
+		return;
+	}
+	pthread_mutex_lock(&c->lock);
+	c->shutdown = 1;
+	while(c->callbacks){
+		pthread_cond_wait(&c->cond, &c->lock);
+	}
+	c->queue = NULL;
+	c->qtail = &c->queue;
+	for(b = 0 ; b < FSUSAGE_BUCKETS ; ++b){
+		while( (e = c->buckets[b]) ){
+			c->buckets[b] = e->next;
+			if(!e->busy){ // busy entries are freed by their workers
+				free(e);
+			}
+		}
+	}
+	if(c->running){
+		c->destroyed = 1;
+		pthread_mutex_unlock(&c->lock);
+		return;
+	}
+	pthread_mutex_unlock(&c->lock);
+	free_cache(c);
+}
+
+void fsusage_get_stats(struct fsusage_cache *c, fsusage_stats *stats){
+	pthread_mutex_lock(&c->lock);
+	*stats = c->stats;
+	stats->running = c->running;
+	stats->hung = c->hung;
+	pthread_mutex_unlock(&c->lock);
+}
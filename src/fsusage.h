@@ -0,0 +1,123 @@
+#ifndef GROWLIGHT_FSUSAGE
+#define GROWLIGHT_FSUSAGE
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct statvfs;
+
+// statvfs() of a network or FUSE filesystem can block indefinitely, so it's
+// never called from the thread wanting the answer. Figures are cached by
+// mount point, and refreshed once older than the TTL by a small pool of
+// detached workers, at most one call outstanding per mount. A call running
+// past the timeout marks its mount hung; its worker is written off (it can't
+// be cancelled), and no longer counts against the pool.
+typedef enum {
+	FSUSAGE_OK,
+	FSUSAGE_PENDING,	// no figures yet
+	FSUSAGE_ERROR,		// statvfs() failed (see err)
+	FSUSAGE_STALE,		// figures predate a refresh which has hung
+	FSUSAGE_HUNG,		// no figures, and the first statvfs() has hung
+} fsusage_state;
+
+// "ok", "pending", "error", "stale" or "hung", and NULL for anything else.
+const char *fsusage_state_name(fsusage_state state);
+
+typedef struct fsusage {
+	fsusage_state state;
+	int err;		// errno for FSUSAGE_ERROR
+	uintmax_t size;		// bytes
+	uintmax_t free;		// bytes free
+	uintmax_t avail;	// bytes available to the unprivileged
+	uintmax_t files;	// inodes
+	uintmax_t ffree;	// inodes free
+	uint64_t age;		// ns since the figures were taken (0 if none)
+	// Projections from the history of figures for this mount (see fillhist
+	// below). Rates are 0 until there are enough samples to regress over.
+	double fillrate;	// bytes per second (negative if draining)
+	double ifillrate;	// inodes per second
+	uint64_t ttf;		// seconds until avail is exhausted, 0 if never
+	uint64_t ittf;		// seconds until ffree is exhausted, 0 if never
+} fsusage;
+
+// How much of a filesystem is used over time: the last FILLHIST_SAMPLES
+// figures taken (one per TTL, so two to three minutes of history at the
+// default), whence its fill rate is estimated by least squares. A line fit
+// over the window rides out the churn of files being written and deleted
+// better than the difference of two samples would.
+#define FILLHIST_SAMPLES 32
+
+typedef struct fillhist {
+	uint64_t when[FILLHIST_SAMPLES];	// monotonic ns
+	uintmax_t used[FILLHIST_SAMPLES];
+	unsigned count;				// valid samples
+	unsigned next;				// slot for the next sample
+} fillhist;
+
+void fillhist_add(fillhist *fh, uint64_t when, uintmax_t used);
+void fillhist_reset(fillhist *fh);
+
+// Units used per second over the newest count samples. Returns -1, leaving *rate alone,
+// with fewer than three samples or no time between them.
+int fillhist_rate(const fillhist *fh, double *rate);
+
+// Describe the nearer of the two projections as e.g. "full in 3h" or
+// "inodes out in 2d", "full" if no space is available, or "" if neither is
+// filling. Returns buf.
+const char *fsusage_eta(const fsusage *fu, char *buf, size_t len);
+
+// e.g. "62% used, full in 3h", with " [stale]" etc. appended unless the state
+// is FSUSAGE_OK, or "" if there's nothing to say. Returns buf.
+const char *fsusage_summary(const fsusage *fu, char *buf, size_t len);
+
+// Called from a worker, with no lock held, whenever a mount's usage is taken
+// or it's found to be hung.
+typedef void (*fsusagefxn)(const char *mnt, const fsusage *fu, void *arg);
+
+struct fsusage_cache;
+
+// threads is the number of calls which may be outstanding, not counting hung
+// ones. Returns NULL on failure.
+struct fsusage_cache *fsusage_create(unsigned threads, unsigned ttlms,
+			unsigned timeoutms, fsusagefxn fxn, void *arg);
+
+// Copy out the cached usage of mnt, requesting a refresh if it's missing or
+// out of date. Never blocks on the filesystem. Returns -1 on allocation
+// failure.
+int fsusage_get(struct fsusage_cache *c, const char *mnt, fsusage *out);
+
+// Drop mnt from the cache. A call outstanding on it is abandoned.
+void fsusage_forget(struct fsusage_cache *c, const char *mnt);
+
+// Mark calls outstanding past the timeout as hung, and refresh whatever has
+// outlived the TTL. Meant to be called periodically.
+void fsusage_sweep(struct fsusage_cache *c);
+
+// Returns without waiting on hung calls; their workers free what they hold
+// once (if ever) they return. No callbacks are made after this returns.
+void fsusage_destroy(struct fsusage_cache *c);
+
+// Substitute for statvfs(), for testing.
+void fsusage_set_statvfs(struct fsusage_cache *c,
+			int (*fxn)(const char *, struct statvfs *));
+
+typedef struct fsusage_stats {
+	uint64_t calls;		// statvfs() calls completed
+	uint64_t errors;	// of which failed
+	uint64_t timeouts;	// calls which ran past the timeout
+	unsigned cached;	// mounts in the cache
+	unsigned running;	// workers alive, including hung ones
+	unsigned hung;		// workers stuck in a call
+} fsusage_stats;
+
+void fsusage_get_stats(struct fsusage_cache *c, fsusage_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
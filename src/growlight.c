@@ -8,6 +8,7 @@
 #include <limits.h>
 #include <locale.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <getopt.h>
 #include <unistd.h>
 #include <dirent.h>
@@ -49,18 +50,92 @@
 #include "config.h"
 #include "mounts.h"
 #include "target.h"
+#include "workq.h"
+#include "coalesce.h"
+#include "inventory.h"
+#include "devindex.h"
 #include "libblkid.h"
 #include "growlight.h"
 #include "aggregate.h"
 
-#define SYSROOT "/sys/class/block/"
-#define SWAPS "/proc/swaps"
-#define MOUNTS	"/proc/mounts"
-#define FILESYSTEMS	"/proc/filesystems"
-#define DEVROOT "/dev"
-#define DEVMD DEVROOT "/md/"
-#define DEVBYID DEVROOT "/disk/by-id/"
-#define DEVBYPATH DEVROOT "/disk/by-path/"
+// Paths into the live system. All of them can be rebased beneath an alternate
+// root (-r|--root), so that discovery can be run against a fabricated
+// sysfs/devfs/procfs tree (see test/fixture.c).
+static struct {
+	char root[PATH_MAX];		// "" for the live system
+	char sys[PATH_MAX];
+	char dev[PATH_MAX];
+	char devmd[PATH_MAX];
+	char devbyid[PATH_MAX];
+	char devbypath[PATH_MAX];
+	char swaps[PATH_MAX];
+	char mounts[PATH_MAX];
+	char filesystems[PATH_MAX];
+	char diskstats[PATH_MAX];
+	char dmi[PATH_MAX];
+} paths = {
+	.root = "",
+	.sys = "/sys/class/block/",
+	.dev = "/dev",
+	.devmd = "/dev/md/",
+	.devbyid = "/dev/disk/by-id/",
+	.devbypath = "/dev/disk/by-path/",
+	.swaps = "/proc/swaps",
+	.mounts = "/proc/self/mountinfo",
+	.filesystems = "/proc/filesystems",
+	.diskstats = "/proc/diskstats",
+	.dmi = "/sys/devices/virtual/dmi/id",
+};
+
+#define SYSROOT paths.sys
+#define SWAPS paths.swaps
+#define MOUNTS paths.mounts
+#define FILESYSTEMS paths.filesystems
+#define DEVROOT paths.dev
+#define DEVMD paths.devmd
+#define DEVBYID paths.devbyid
+#define DEVBYPATH paths.devbypath
+
+// Rebase all paths beneath root. PCI, udev and ZFS are left alone when using
+// an alternate root, as they'd describe the live system rather than the tree.
+static int
+set_root(const char *root){
+	const char *rel[] = { "/sys/class/block/", "/dev", "/dev/md/",
+		"/dev/disk/by-id/", "/dev/disk/by-path/", "/proc/swaps",
+		"/proc/self/mountinfo", "/proc/filesystems", "/proc/diskstats",
+		"/sys/devices/virtual/dmi/id", };
+	char *abs[] = { paths.sys, paths.dev, paths.devmd, paths.devbyid,
+		paths.devbypath, paths.swaps, paths.mounts, paths.filesystems,
+		paths.diskstats, paths.dmi, };
+	char *rroot;
+	unsigned z;
+
+	if((rroot = realpath(root,NULL)) == NULL){
+		diag("Couldn't resolve root %s (%s)\n",root,strerror(errno));
+		return -1;
+	}
+	if(strcmp(rroot,"/") == 0){
+		rroot[0] = '\0';
+	}
+	for(z = 0 ; z < sizeof(rel) / sizeof(*rel) ; ++z){
+		if((unsigned)snprintf(abs[z],PATH_MAX,"%s%s",rroot,rel[z]) >= PATH_MAX){
+			diag("Root too long: %s\n",rroot);
+			free(rroot);
+			return -1;
+		}
+	}
+	strcpy(paths.root,rroot);
+	free(rroot);
+	return 0;
+}
+
+int devnode_path(char *buf,size_t len,const char *name){
+	if((size_t)snprintf(buf,len,"%s/%s",DEVROOT,name) >= len){
+		diag("Bad name: %s\n",name);
+		return -1;
+	}
+	return 0;
+}
 
 unsigned verbose = 0;
 unsigned finalized = 0;
@@ -73,10 +148,35 @@ static const glightui *gui;
 static struct pci_access *pciacc;
 static pthread_mutex_t lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 
-static unsigned thrcount;
-static pthread_mutex_t barrier = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t barrier_cond = PTHREAD_COND_INITIALIZER;
-static pthread_cond_t discovery_cond = PTHREAD_COND_INITIALIZER;
+// Initial discovery runs on a bounded pool rather than a thread per device.
+static struct workq *discoveryq;
+
+// Bursts of udev and inotify events are coalesced per name over a short
+// window, and the resulting work handed to discoveryq (see queue_event()).
+static struct coalescer *eventq;
+
+// Deep probes of devices registered from sysfs (see queue_probe()). These get
+// their own pool, so that initial discovery completes without them.
+static struct workq *probeq;
+
+// Loaded from -c|--cache, consulted during initial discovery, and written
+// back once it completes (see finish_inventory()). inventory is protected by
+// the growlight lock; invloaded owns the cache until growlight_stop(), since
+// discovery workers might outlive a stalled initial discovery.
+static char *invpath;
+static struct inventory *inventory,*invloaded;
+
+#define EVENT_UDEV	0x01u	// udev block event: rescan the device
+#define EVENT_SYSFS	0x02u	// new entry in SYSROOT: discover it
+#define EVENT_MDALIAS	0x04u	// entry in DEVMD
+#define EVENT_BYPATH	0x08u	// entry in DEVBYPATH
+#define EVENT_BYID	0x10u	// entry in DEVBYID
+#define EVENT_ZPOOLS	0x20u	// udev bdi event (name is ""): rescan zpools
+
+// Depth of this thread's hold on the (recursive) growlight lock. Waiting on a
+// condition variable releases only one level of a recursive mutex, so
+// wait_unlocked() must shed the rest itself.
+static __thread unsigned lockdepth;
 
 static controller virtual_bus = {
 	.name = "Virtual devices",
@@ -87,97 +187,59 @@ static controller virtual_bus = {
 
 static controller *controllers = &virtual_bus;
 
+// Every published device and partition, by name and by devno. Protected by
+// the growlight lock.
+static devindex devices;
+
+// I/O statistics, keyed by devno and allocated on a device's first sample.
+// statslock protects the table and every slot in it, along with the sampler,
+// so that sampling never waits upon discovery (which holds the growlight lock
+// across probes). Nothing may call diag() while holding it, as the UI takes
+// it from its own callbacks. It nests within the growlight lock.
+static pthread_mutex_t statslock = PTHREAD_MUTEX_INITIALIZER;
+static statstable hotstats;
+
 static device *create_new_device(const char *);
 static device *create_new_device_inner(const char *);
 
 // Diagnostics. We keep the last MAXIMUM_LOG_ENTRIES records around for clients
 // to examine at their leisure, ala dmesg(1).
-static unsigned rblast;
-static logent logs[MAXIMUM_LOG_ENTRIES];
-static pthread_mutex_t loglock = PTHREAD_MUTEX_INITIALIZER;
+static logslot logslots[MAXIMUM_LOG_ENTRIES];
+static logring logs = LOGRING_INITIALIZER(logslots,MAXIMUM_LOG_ENTRIES);
 
 const glightui *get_glightui(void){
 	return gui;
 }
 
-static void
-add_log(const char *fmt,va_list vac){
-	va_list vacc;
-	char *b;
-	int len;
-
-	va_copy(vacc,vac);
-	assert(pthread_mutex_lock(&loglock) == 0);
-	if(++rblast == sizeof(logs) / sizeof(*logs)){
-		rblast = 0;
-	}
-	// FIXME reuse the entry!
-	len = vsnprintf(NULL,0,fmt,vac);
-	if( (b = malloc(len + 1)) ){
-		logs[rblast].when = time(NULL);
-		if(logs[rblast].msg){
-			free(logs[rblast].msg);
-		}
-		logs[rblast].msg = b;
-		vsnprintf(b,len + 1,fmt,vacc);
-	}
-	assert(pthread_mutex_unlock(&loglock) == 0);
-	va_end(vacc);
-}
-
-int get_logs(unsigned n,logent *cplogs){
-	unsigned idx = 0;
-	unsigned rb;
-
+int get_logs(unsigned n,logent *cplogs,loglevel level){
 	if(n == 0 || n > MAXIMUM_LOG_ENTRIES){
 		return -1;
 	}
-	assert(pthread_mutex_lock(&loglock) == 0);
-	rb = rblast;
-	while(logs[rb].msg){
-		if((cplogs[idx].msg = strdup(logs[rb].msg)) == NULL){
-			while(idx){
-				free(cplogs[--idx].msg);
-			}
-			return -1;
-		}
-		cplogs[idx].when = logs[rb].when;
-		if(rb-- == 0){
-			rb = sizeof(logs) / sizeof(*logs) - 1;
-		}
-		if(++idx == n){
-			break; // got all requested
-		}
-	}
-	assert(pthread_mutex_unlock(&loglock) == 0);
-	if(idx < n){
-		cplogs[idx].msg = NULL;
-	}
-	return idx;
+	return logring_get(&logs,level,n,cplogs);
 }
 
-void diag(const char *fmt,...){
-	va_list vac,ap;
-
-	va_start(ap,fmt);
-	va_copy(vac,ap);
-	gui->vdiag(fmt,ap);
-	add_log(fmt,vac);
-	va_end(vac);
+void get_log_stats(uint64_t *logged,uint64_t *dropped){
+	*logged = __atomic_load_n(&logs.tickets,__ATOMIC_RELAXED);
+	*dropped = __atomic_load_n(&logs.dropped,__ATOMIC_RELAXED);
 }
 
-void verbf(const char *fmt,...){
+void glog_at(loglevel level,const char *src,const char *fmt,...){
+	const char *base;
 	va_list ap;
 
+	if( (base = strrchr(src,'/')) ){
+		src = base + 1;
+	}
 	va_start(ap,fmt);
-	if(verbose){
+	// without a UI (as in growlight-test), messages go only to the log
+	if(gui && (level != LOGLEVEL_VERBOSE || verbose)){
 		va_list vac;
 
 		va_copy(vac,ap);
 		gui->vdiag(fmt,vac);
 		va_end(vac);
 	}
-	add_log(fmt,ap);
+	logring_vadd(&logs,level,src,fmt,ap);
 	va_end(ap);
 }
 
@@ -339,6 +401,10 @@ find_pcie_controller(unsigned domain,unsigned bus,unsigned dev,unsigned func,
 				c->bandwidth *= c->pcie.lanes_neg;
 			}
 			pci_free_dev(pcidev);
+		}else if((c->name = strdup(c->ident)) == NULL){
+			free_controller(c);
+			free(c);
+			return NULL;
 		}
 		for(pre = &controllers ; *pre ; pre = &(*pre)->next){
 			int r = (*pre)->ident ? strcmp(c->ident,(*pre)->ident) : -1;
@@ -358,6 +424,496 @@ const controller *get_controllers(void){
 	return controllers; // FIXME hugely unsafe
 }
 
+// Readers walk immutable snapshots of the tree rather than holding the
+// growlight lock. Every change to the tree is announced to the UI, so we
+// interpose upon those callbacks to learn when the published snapshot has
+// gone stale (see publish_snapshot()).
+static const glightui *realui;
+static glightui snapui;
+
+// Protects treever, cursnap, and each snapshot's reference count.
+static pthread_mutex_t snaplock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t treever = 1;	// bumped on each change to the tree
+static treesnap *cursnap;	// latest published snapshot, holds a ref
+
+// The rest are protected by the growlight lock.
+static struct timespec lastpublish;
+static int snapfull;		// next publication must copy everything
+static int snaptimerfd = -1;	// trailing publication (see publish_snapshot())
+static int snaptimerarmed;
+
+#define SNAPCHUNK_MIN 4096
+#define SNAPCHUNK_BYTES 65536
+
+// Each snapshot shares its unchanged nodes with (and holds a reference on)
+// the one before it. Every SNAPSHOT_CHAIN_MAX publications the tree is copied
+// whole, bounding the chain, and with it the memory retained.
+#define SNAPSHOT_CHAIN_MAX 16
+
+// Snapshots are carved out of a list of chunks, and freed all at once.
+struct snapchunk {
+	struct snapchunk *next;
+	size_t used,size;
+	max_align_t data[];
+};
+
+static void
+mark_tree_changed(void){
+	pthread_mutex_lock(&snaplock);
+	++treever;
+	pthread_mutex_unlock(&snaplock);
+}
+
+static void *
+snap_adapter_event(controller *c,void *s){
+	c->snapdirty = 1;
+	mark_tree_changed();
+	return realui->adapter_event(c,s);
+}
+
+static void *
+snap_block_event(device *d,void *s){
+	// partitions are copied along with their disk
+	if(d->layout == LAYOUT_PARTITION && d->partdev.parent){
+		d->partdev.parent->snapdirty = 1;
+	}
+	d->snapdirty = 1;
+	mark_tree_changed();
+	return realui->block_event(d,s);
+}
+
+static void
+snap_adapter_free(void *s){
+	mark_tree_changed();
+	realui->adapter_free(s);
+}
+
+static void
+snap_block_free(void *cs,void *s){
+	mark_tree_changed();
+	realui->block_free(cs,s);
+}
+
+static void *
+snap_alloc(treesnap *s,size_t n){
+	struct snapchunk *sc = s->chunks;
+	void *r;
+
+	n = (n + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+	if(sc == NULL || sc->size - sc->used < n){
+		// most publications copy only a device or two, so start small
+		size_t size = sc == NULL ? SNAPCHUNK_MIN :
+			sc->size * 2 > SNAPCHUNK_BYTES ? SNAPCHUNK_BYTES : sc->size * 2;
+
+		if(size < n){
+			size = n;
+		}
+
+		if((sc = malloc(sizeof(*sc) + size)) == NULL){
+			return NULL;
+		}
+		sc->used = 0;
+		sc->size = size;
+		sc->next = s->chunks;
+		s->chunks = sc;
+	}
+	r = (char *)sc->data + sc->used;
+	sc->used += n;
+	return r;
+}
+
+// The snap_* copiers replace a pointer into the live tree with one to a copy
+// in the snapshot, returning -1 if the copy couldn't be allocated.
+static int
+snap_mem(treesnap *s,void **p,size_t n){
+	void *r;
+
+	if(*p){
+		if((r = snap_alloc(s,n)) == NULL){
+			return -1;
+		}
+		memcpy(r,*p,n);
+		*p = r;
+	}
+	return 0;
+}
+
+static inline int
+snap_str(treesnap *s,char **p){
+	return *p ? snap_mem(s,(void **)p,strlen(*p) + 1) : 0;
+}
+
+static inline int
+snap_wcs(treesnap *s,wchar_t **p){
+	return *p ? snap_mem(s,(void **)p,(wcslen(*p) + 1) * sizeof(**p)) : 0;
+}
+
+static int
+snap_strings(treesnap *s,stringlist *sl){
+	unsigned z;
+
+	if(snap_mem(s,(void **)&sl->list,sizeof(*sl->list) * sl->count)){
+		return -1;
+	}
+	for(z = 0 ; z < sl->count ; ++z){
+		if(snap_str(s,&sl->list[z])){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int
+snap_slaves(treesnap *s,mdslave **p){
+	mdslave *md;
+
+	for(md = *p ; md ; md = md->next){
+		if(snap_mem(s,(void **)p,sizeof(**p)) || snap_str(s,&(*p)->name)){
+			return -1;
+		}
+		p = &(*p)->next;
+	}
+	return 0;
+}
+
+static device *
+snap_device(treesnap *s,const device *d,controller *c,device *parent){
+	device *n,**pt;
+	const device *p;
+
+	if((n = snap_alloc(s,sizeof(*n))) == NULL){
+		return NULL;
+	}
+	memcpy(n,d,sizeof(*n));
+	n->next = NULL;
+	n->parts = NULL;
+	n->c = c;
+	n->strings.chunks = NULL; // its strings are copied into the snapshot
+	n->hnext_name = n->hnext_devno = NULL;
+	n->snapcopy = NULL;
+	if(snap_str(s,&n->model) || snap_str(s,&n->revision) ||
+			snap_str(s,&n->bypath) || snap_str(s,&n->byid) ||
+			snap_str(s,&n->uuid) || snap_str(s,&n->label) ||
+			snap_str(s,&n->mnttype) || snap_str(s,&n->sched) ||
+			snap_strings(s,&n->mnt) || snap_strings(s,&n->mntops)){
+		return NULL;
+	}
+	switch(n->layout){
+	case LAYOUT_NONE:
+		// biossha1 is a SHA1 digest (see mbrsha1())
+		if(snap_mem(s,&n->blkdev.biossha1,20) ||
+				snap_str(s,&n->blkdev.pttable) ||
+				snap_str(s,&n->blkdev.serial) ||
+				snap_str(s,&n->blkdev.wwn)){
+			return NULL;
+		}
+		break;
+	case LAYOUT_MDADM:
+		if(snap_str(s,&n->mddev.level) || snap_slaves(s,&n->mddev.slaves) ||
+				snap_str(s,&n->mddev.uuid) ||
+				snap_str(s,&n->mddev.mdname) ||
+				snap_str(s,&n->mddev.pttable)){
+			return NULL;
+		}
+		break;
+	case LAYOUT_DM:
+		if(snap_str(s,&n->dmdev.level) || snap_slaves(s,&n->dmdev.slaves) ||
+				snap_str(s,&n->dmdev.uuid) ||
+				snap_str(s,&n->dmdev.dmname) ||
+				snap_str(s,&n->dmdev.pttable)){
+			return NULL;
+		}
+		break;
+	case LAYOUT_PARTITION:
+		n->partdev.parent = parent;
+		if(snap_str(s,&n->partdev.uuid) || snap_wcs(s,&n->partdev.pname)){
+			return NULL;
+		}
+		break;
+	case LAYOUT_ZPOOL:
+		if(snap_str(s,&n->zpool.level)){
+			return NULL;
+		}
+		break;
+	}
+	pt = &n->parts;
+	for(p = d->parts ; p ; p = p->next){
+		if((*pt = snap_device(s,p,c,n)) == NULL){
+			return NULL;
+		}
+		pt = &(*pt)->next;
+	}
+	return n;
+}
+
+static void
+free_snapshot(treesnap *s){
+	struct snapchunk *sc;
+	treesnap *base;
+
+	while( (sc = s->chunks) ){
+		s->chunks = sc->next;
+		free(sc);
+	}
+	base = s->base;
+	free(s);
+	if(base){
+		put_snapshot(base);
+	}
+}
+
+// Room for n pointers in one of copy_tree()'s scratch arrays.
+static void **
+snap_scratch(void ***arr,unsigned *size,unsigned n){
+	if(n > *size){
+		void **tmp;
+
+		if((tmp = realloc(*arr,sizeof(*tmp) * n)) == NULL){
+			return NULL;
+		}
+		*arr = tmp;
+		*size = n;
+	}
+	return *arr;
+}
+
+static void **snapctrls,**snapdevs;	// copy_tree() scratch
+static unsigned snapctrlsize,snapdevsize;
+
+// Call with the growlight lock held. Builds the snapshot following base
+// (NULL to copy everything). Lists are walked back to front, so that each
+// node's successor is settled before it is: a device is copied (with its
+// partitions) only if it's new or was announced changed, and otherwise is
+// shared with base, unless its next link changed, in which case it gets a
+// shallow copy sharing its strings and partitions. Controllers likewise. Each
+// live node's snapcopy is updated as we go; should we fail, the next
+// publication copies everything.
+static treesnap *
+copy_tree(uint64_t version,treesnap *base){
+	controller *nextc = NULL;
+	unsigned cn = 0,ci;
+	controller *c;
+	treesnap *s;
+	int full;
+
+	full = snapfull || base == NULL || base->depth >= SNAPSHOT_CHAIN_MAX;
+	if((s = malloc(sizeof(*s))) == NULL){
+		snapfull = 1;
+		return NULL;
+	}
+	memset(s,0,sizeof(*s));
+	s->version = version;
+	s->refs = 1;
+	for(c = controllers ; c ; c = c->next){
+		if(snap_scratch(&snapctrls,&snapctrlsize,cn + 1) == NULL){
+			goto err;
+		}
+		snapctrls[cn++] = c;
+	}
+	for(ci = cn ; ci-- ; ){
+		controller *cc,*ccopy;
+		device *d,*nextd = NULL;
+		unsigned dn = 0,di;
+		int cdirty,changed = 0;
+
+		c = snapctrls[ci];
+		cc = full ? NULL : c->snapcopy;
+		cdirty = cc == NULL || c->snapdirty;
+		// its devices point up to it, so copy it ahead of them; it's
+		// discarded if nothing beneath it changed
+		if((ccopy = snap_alloc(s,sizeof(*ccopy))) == NULL){
+			goto err;
+		}
+		if(cdirty){
+			memcpy(ccopy,c,sizeof(*ccopy));
+			if(snap_str(s,&ccopy->name) || snap_str(s,&ccopy->sysfs) ||
+					snap_str(s,&ccopy->driver) || snap_str(s,&ccopy->ident) ||
+					snap_str(s,&ccopy->fwver) || snap_str(s,&ccopy->biosver)){
+				goto err;
+			}
+			ccopy->snapcopy = NULL;
+		}else{
+			memcpy(ccopy,cc,sizeof(*ccopy));
+		}
+		for(d = c->blockdevs ; d ; d = d->next){
+			if(snap_scratch(&snapdevs,&snapdevsize,dn + 1) == NULL){
+				goto err;
+			}
+			snapdevs[dn++] = d;
+		}
+		for(di = dn ; di-- ; ){
+			device *old,*n,*p;
+
+			d = snapdevs[di];
+			// a changed controller means fresh copies throughout
+			old = cdirty ? NULL : d->snapcopy;
+			if(old == NULL || d->snapdirty){
+				if((n = snap_device(s,d,ccopy,NULL)) == NULL){
+					goto err;
+				}
+			}else if(old->next != nextd){
+				if((n = snap_alloc(s,sizeof(*n))) == NULL){
+					goto err;
+				}
+				memcpy(n,old,sizeof(*n));
+				n->c = ccopy;
+			}else{
+				n = old;
+			}
+			if(n != old){
+				n->next = nextd;
+				changed = 1;
+			}
+			d->snapcopy = n;
+			d->snapdirty = 0;
+			++s->devices;
+			for(p = d->parts ; p ; p = p->next){
+				p->snapdirty = 0;
+			}
+			for(p = n->parts ; p ; p = p->next){
+				++s->devices;
+			}
+			nextd = n;
+		}
+		if(!cdirty && !changed && cc->next == nextc){
+			ccopy = cc;
+		}else{
+			ccopy->blockdevs = nextd;
+			ccopy->next = nextc;
+		}
+		c->snapcopy = ccopy;
+		c->snapdirty = 0;
+		nextc = ccopy;
+	}
+	s->controllers = nextc;
+	if(!full){
+		pthread_mutex_lock(&snaplock);
+		++base->refs;
+		pthread_mutex_unlock(&snaplock);
+		s->base = base;
+		s->depth = base->depth + 1;
+	}
+	snapfull = 0;
+	return s;
+
+err:
+	snapfull = 1;
+	free_snapshot(s);
+	return NULL;
+}
+
+// Arm the trailing publication for ms from now, unless it's already armed.
+static void
+arm_snapshot_timer(long ms){
+	struct itimerspec its;
+
+	if(snaptimerfd < 0 || snaptimerarmed){
+		return;
+	}
+	memset(&its,0,sizeof(its));
+	its.it_value.tv_sec = ms / 1000;
+	its.it_value.tv_nsec = ms % 1000 * 1000000 + 1;
+	if(timerfd_settime(snaptimerfd,0,&its,NULL) == 0){
+		snaptimerarmed = 1;
+	}
+}
+
+// Call with the growlight lock held. Publishes a snapshot of the tree if it
+// has changed since the last publication, and (unless forced) if at least
+// SNAPSHOT_PUBLISH_MS have passed since then, so that a stream of changes
+// costs one publication per period rather than one per change. A publication
+// held back arms a timer, so that the last of a burst isn't left unpublished.
+static void
+publish_snapshot(int force){
+	struct timespec now;
+	treesnap *s,*old;
+	uint64_t ver;
+	long elapsed;
+
+	pthread_mutex_lock(&snaplock);
+	ver = treever;
+	s = cursnap;
+	pthread_mutex_unlock(&snaplock);
+	if(s && s->version == ver){
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	elapsed = (now.tv_sec - lastpublish.tv_sec) * 1000ll +
+			(now.tv_nsec - lastpublish.tv_nsec) / 1000000;
+	if(!force && s && elapsed < SNAPSHOT_PUBLISH_MS){
+		arm_snapshot_timer(SNAPSHOT_PUBLISH_MS - elapsed);
+		return;
+	}
+	// s remains referenced by cursnap, which only we replace
+	if((s = copy_tree(ver,s)) == NULL){
+		diag("Couldn't publish device snapshot\n");
+		return;
+	}
+	lastpublish = now;
+	pthread_mutex_lock(&snaplock);
+	old = cursnap;
+	cursnap = s;
+	pthread_mutex_unlock(&snaplock);
+	if(old){
+		put_snapshot(old);
+	}
+}
+
+// The trailing publication timer fired (on the event thread).
+static void
+snapshot_timer(void){
+	uint64_t expirations;
+
+	while(read(snaptimerfd,&expirations,sizeof(expirations)) > 0){
+		;
+	}
+	lock_growlight();
+	snaptimerarmed = 0;
+	publish_snapshot(1);
+	unlock_growlight();
+}
+
+const treesnap *get_snapshot(void){
+	treesnap *s;
+
+	if(pthread_mutex_trylock(&lock) == 0){
+		publish_snapshot(1);
+		assert(pthread_mutex_unlock(&lock) == 0);
+	}
+	pthread_mutex_lock(&snaplock);
+	if( (s = cursnap) ){
+		++s->refs;
+	}
+	pthread_mutex_unlock(&snaplock);
+	return s;
+}
+
+void put_snapshot(const treesnap *cs){
+	treesnap *s = (treesnap *)cs;
+	unsigned refs;
+
+	pthread_mutex_lock(&snaplock);
+	refs = --s->refs;
+	pthread_mutex_unlock(&snaplock);
+	if(refs == 0){
+		free_snapshot(s);
+	}
+}
+
+static void
+retire_snapshot(void){
+	treesnap *s;
+
+	pthread_mutex_lock(&snaplock);
+	s = cursnap;
+	cursnap = NULL;
+	++treever;
+	pthread_mutex_unlock(&snaplock);
+	if(s){
+		put_snapshot(s);
+	}
+}
+
 static void clobber_device(device *);
 
 // Prepare a device for being rescanned
@@ -369,9 +925,9 @@ internal_device_reset(device *d){
 	switch(d->layout){
 		case LAYOUT_NONE:{
 			free(d->blkdev.biossha1); d->blkdev.biossha1 = NULL;
-			free(d->blkdev.pttable); d->blkdev.pttable = NULL;
-			free(d->blkdev.serial); d->blkdev.serial = NULL;
-			free(d->blkdev.wwn); d->blkdev.wwn = NULL;
+			d->blkdev.pttable = NULL;
+			d->blkdev.serial = NULL;
+			d->blkdev.wwn = NULL;
 			if(d->c){
 				d->c->demand -= transport_bw(d->blkdev.transport);
 			}
@@ -384,10 +940,10 @@ internal_device_reset(device *d){
 				free(md->name);
 				free(md);
 			}
-			free(d->mddev.level); d->mddev.level = NULL;
-			free(d->mddev.uuid); d->mddev.uuid = NULL;
-			free(d->mddev.mdname); d->mddev.mdname = NULL;
-			free(d->mddev.pttable); d->mddev.pttable = NULL;
+			d->mddev.level = NULL;
+			d->mddev.uuid = NULL;
+			d->mddev.mdname = NULL;
+			d->mddev.pttable = NULL;
 			d->mddev.degraded = 0;
 			d->mddev.resync = 0;
 			break;
@@ -399,10 +955,10 @@ internal_device_reset(device *d){
 				free(md->name);
 				free(md);
 			}
-			free(d->dmdev.level); d->dmdev.level = NULL;
-			free(d->dmdev.uuid); d->dmdev.uuid = NULL;
-			free(d->dmdev.dmname); d->dmdev.dmname = NULL;
-			free(d->dmdev.pttable); d->dmdev.pttable = NULL;
+			d->dmdev.level = NULL;
+			d->dmdev.uuid = NULL;
+			d->dmdev.dmname = NULL;
+			d->dmdev.pttable = NULL;
 			d->mddev.degraded = 0;
 			break;
 		}case LAYOUT_PARTITION:{
@@ -417,11 +973,13 @@ internal_device_reset(device *d){
 		d->parts = p->next;
 		clobber_device(p);
 	}
-	free(d->sched); d->sched = NULL;
+	d->sched = NULL;
 	free(d->uuid); d->uuid = NULL;
 	free(d->label); d->label = NULL;
-	free(d->model); d->model = NULL;
-	free(d->revision); d->revision = NULL;
+	d->model = NULL;
+	d->revision = NULL;
+	// everything nulled above without being freed lived here
+	arena_reset(&d->strings);
 	d->slave = 0;
 	unlock_growlight();
 }
@@ -429,6 +987,9 @@ internal_device_reset(device *d){
 static void
 free_device(device *d){
 	if(d){
+		lock_growlight();
+		devindex_del(&devices,d);
+		unlock_growlight();
 		if(d->c){
 			// FIXME we haven't yet updated the adapter's demanded
 			// bandwidth, so this will reflect out of date info
@@ -444,6 +1005,7 @@ free_device(device *d){
 		d->mntsize = 0;
 		free(d->bypath);
 		free(d->byid);
+		arena_free(&d->strings);
 	}
 }
 
@@ -474,6 +1036,8 @@ free_devtable(void){
 		free_controller(c);
 		free(c);
 	}
+	devindex_free(&devices);
+	statstable_free(&hotstats);
 }
 
 static uintmax_t
@@ -560,6 +1124,22 @@ check_slavery(device *d,int subfd){
 	return 0;
 }
 
+// Whether the sysfs directory fd is that of a partition, in which case its
+// number is read into *pnum (0 if it couldn't be). This spares testing for
+// "partition" before reading it.
+static int
+sysfs_partition_p(int fd,const char *name,unsigned long *pnum){
+	if(get_sysfs_uint(fd,"partition",pnum) == 0){
+		return 1;
+	}
+	if(errno == ENOENT){
+		return 0;
+	}
+	diag("Couldn't determine pnum for %s (%s)\n",name,strerror(errno));
+	*pnum = 0;
+	return 1;
+}
+
 // Pass a directory handle fd, and the bare name of the device
 // Return -1 on error, 0 on success, 1 if the device is a partition, and we
 // successfully look up the containing disk (in which case lookup_device()
@@ -567,8 +1147,6 @@ check_slavery(device *d,int subfd){
 static int
 explore_sysfs_node_inner(DIR *dir,int fd,const char *name,device *d,int recurse){
 	struct dirent *dire;
-	unsigned long ul;
-	unsigned b;
 	int sdevfd;
 
 	if(sysfs_exist_p(fd,"partition")){
@@ -586,87 +1164,118 @@ explore_sysfs_node_inner(DIR *dir,int fd,const char *name,device *d,int recurse)
 		}
 		buf[r] = '\0';
 		if((dev = strrchr(buf,'/')) == NULL){
-			diag("Bad link: "SYSROOT"%s->%s\n",name,buf);
+			diag("Bad link: %s%s->%s\n",SYSROOT,name,buf);
 			return -1;
 		}
 		*dev++ = '\0';
 		if(strcmp(dev,name)){
-			diag("Invalid link: "SYSROOT"%s->%s/%s\n",name,buf,dev);
+			diag("Invalid link: %s%s->%s/%s\n",SYSROOT,name,buf,dev);
 			return -1;
 		}
 		if((dev = strrchr(buf,'/')) == NULL){
-			diag("Bad toplink: "SYSROOT"%s->%s\n",name,buf);
+			diag("Bad toplink: %s%s->%s\n",SYSROOT,name,buf);
 			return -1;
 		}
 		++dev;
 		if(create_new_device_inner(dev) == NULL){
-			diag("Couldn't get disk: "SYSROOT"%s->%s/%s\n",name,buf,dev);
+			diag("Couldn't get disk: %s%s->%s/%s\n",SYSROOT,name,buf,dev);
 			return -1;
 		}
 		return 1;
 	}
 	// FIXME move all this crap into the loop below
 	if(sysfs_exist_p(fd,"loop")){
-		if((d->model = get_sysfs_string(fd,"loop/backing_file")) == NULL){
+		if((d->model = get_sysfs_string_arena(fd,"loop/backing_file",&d->strings)) == NULL){
 			diag("Couldn't get backing file: %s\n",name);
 			return -1;
 		}
 	}
-	if(get_sysfs_bool(fd,"removable",&b)){
-		diag("Couldn't determine removability for %s (%s)\n",name,strerror(errno));
-	}else{
-		d->blkdev.removable = !!b;
-	}
-	if(get_sysfs_uint(fd,"size",&ul)){
-		diag("Couldn't determine size for %s (%s)\n",name,strerror(errno));
-	}else{
-		d->size = ul;
-	}
 	// Check for "device" to determine if it's real or virtual
 	if((sdevfd = openat(fd,"device",O_RDONLY|O_CLOEXEC|O_DIRECTORY)) > 0){
+		sysfs_attr devattrs[] = {
+			{ .node = "model", .type = SYSFS_STRING, .val = &d->model, .arena = &d->strings, },
+			{ .node = "rev", .type = SYSFS_STRING, .val = &d->revision, .arena = &d->strings, },
+		};
+
 		d->blkdev.realdev = 1;
-		if((d->model = get_sysfs_string(sdevfd,"model")) == NULL){
-			verbf("Couldn't get a model for %s (%s)\n",name,strerror(errno));
+		get_sysfs_attrs(sdevfd,devattrs,sizeof(devattrs) / sizeof(*devattrs));
+		if(devattrs[0].err){
+			verbf("Couldn't get a model for %s (%s)\n",name,strerror(devattrs[0].err));
 		}
-		if((d->revision = get_sysfs_string(sdevfd,"rev")) == NULL){
-			verbf("Couldn't get a revision for %s (%s)\n",name,strerror(errno));
+		if(devattrs[1].err){
+			verbf("Couldn't get a revision for %s (%s)\n",name,strerror(devattrs[1].err));
 		}
 		verbf("\tModel: %s revision %s S/N %s\n",
 				d->model ? d->model : "n/a",
 				d->revision ? d->revision : "n/a",
 				d->blkdev.serial ? d->blkdev.serial : "n/a");
 		close(sdevfd);
-		// sysfs returns 1 for loop, mdadm, some other things...annoying :/ this
-		// does not apply to the physical/logical sector sizes (see below)
-		if(get_sysfs_bool(fd,"queue/rotational",&b)){
-			diag("Couldn't determine rotation for %s (%s)\n",name,strerror(errno));
+	}
+	// sysfs returns 1 for queue/rotational for loop, mdadm, some other
+	// things...annoying :/ so it's only read for real devices. This does
+	// not apply to the physical/logical sector sizes.
+	{
+		unsigned long size,physsec,logsec;
+		unsigned removable,rotational;
+		sysfs_attr attrs[] = {
+			{ .node = "removable", .type = SYSFS_BOOL, .val = &removable, },
+			{ .node = "size", .type = SYSFS_UINT, .val = &size, },
+			{ .node = "dev", .type = SYSFS_DEVNO, .val = &d->devno, },
+			{ .node = "queue/scheduler", .type = SYSFS_STRING, .val = &d->sched, .arena = &d->strings, },
+			{ .node = "queue/physical_block_size", .type = SYSFS_UINT, .val = &physsec, },
+			{ .node = "queue/logical_block_size", .type = SYSFS_UINT, .val = &logsec, },
+			{ .node = "queue/rotational", .type = SYSFS_BOOL, .val = &rotational, },
+		};
+		unsigned n = sizeof(attrs) / sizeof(*attrs);
+
+		get_sysfs_attrs(fd,attrs,d->blkdev.realdev ? n : n - 1);
+		if(attrs[0].err){
+			diag("Couldn't determine removability for %s (%s)\n",name,strerror(attrs[0].err));
+		}else{
+			d->blkdev.removable = !!removable;
+		}
+		if(attrs[1].err){
+			diag("Couldn't determine size for %s (%s)\n",name,strerror(attrs[1].err));
+		}else{
+			d->size = size;
+		}
+		if(attrs[2].err){
+			verbf("Couldn't determine devno for %s (%s)\n",name,strerror(attrs[2].err));
+			d->devno = 0;
+		}
+		if(attrs[3].err){
+			diag("Couldn't determine scheduler for %s (%s)\n",name,strerror(attrs[3].err));
+		}
+		if(attrs[4].err){
+			if(attrs[4].err != ENOENT){
+				diag("Couldn't get physical sector for %s (%s)\n",name,strerror(attrs[4].err));
+			}
+		}else{
+			d->physsec = physsec;
+		}
+		if(attrs[5].err){
+			if(attrs[5].err != ENOENT){
+				diag("Couldn't get logical sector for %s (%s)\n",name,strerror(attrs[5].err));
+			}
 		}else{
-			if(!b){
-				d->blkdev.rotation = -1;
+			d->logsec = logsec;
+		}
+		if(d->blkdev.realdev){
+			if(attrs[6].err){
+				diag("Couldn't determine rotation for %s (%s)\n",name,strerror(attrs[6].err));
 			}else{
-				d->blkdev.rotation = 0;
+				d->blkdev.rotation = rotational ? 0 : -1;
 			}
 		}
 	}
-	if((d->sched = get_sysfs_string(fd,"queue/scheduler")) == NULL){
-		diag("Couldn't determine scheduler for %s (%s)\n",name,strerror(errno));
-	}
 	while(errno = 0, (dire = readdir(dir)) != NULL){
 		int subfd;
 
 		if(dire->d_type == DT_DIR){
 			if(strcmp(dire->d_name,"queue") == 0){
-				if(get_sysfs_uint(fd,"queue/physical_block_size",&ul)){
-					diag("Couldn't get physical sector for %s (%s)\n",name,strerror(errno));
-				}else{
-					d->physsec = ul;
-				}
-				if(get_sysfs_uint(fd,"queue/logical_block_size",&ul)){
-					diag("Couldn't get logical sector for %s (%s)\n",name,strerror(errno));
-				}else{
-					d->logsec = ul;
-				}
+				// read above
 			}else if((subfd = openat(fd,dire->d_name,O_RDONLY|O_CLOEXEC|O_DIRECTORY)) > 0){
+				unsigned long pnum;
 				dev_t devno;
 
 				// Check for "md" to determine if it's an MDADM device
@@ -690,29 +1299,30 @@ explore_sysfs_node_inner(DIR *dir,int fd,const char *name,device *d,int recurse)
 						close(subfd);
 						return -1;
 					}
-				}else if(sysfs_exist_p(subfd,"partition")){
-					unsigned long sz,pnum,fsect;
+				}else if(sysfs_partition_p(subfd,dire->d_name,&pnum)){
+					unsigned long sz,fsect;
+					sysfs_attr attrs[] = {
+						{ .node = "dev", .type = SYSFS_DEVNO, .val = &devno, },
+						{ .node = "start", .type = SYSFS_UINT, .val = &fsect, },
+						{ .node = "size", .type = SYSFS_UINT, .val = &sz, },
+					};
 					device *p;
 					int hfd;
 
-					if(sysfs_devno(subfd,&devno)){
+					get_sysfs_attrs(subfd,attrs,sizeof(attrs) / sizeof(*attrs));
+					if(attrs[0].err){
 						close(subfd);
 						return -1;
 					}
-					if(get_sysfs_uint(subfd,"partition",&pnum)){
-						diag("Couldn't determine pnum for %s (%s)\n",
-								dire->d_name,strerror(errno));
-						pnum = 0;
-					}
 					verbf("\tPartition %lu at %s\n",pnum,dire->d_name);
-					if(get_sysfs_uint(subfd,"start",&fsect)){
+					if(attrs[1].err){
 						diag("Couldn't determine first sector for %s (%s)\n",
-								dire->d_name,strerror(errno));
+								dire->d_name,strerror(attrs[1].err));
 						sz = 0;
 					}
-					if(get_sysfs_uint(subfd,"size",&sz)){
+					if(attrs[2].err){
 						diag("Couldn't determine size for %s (%s)\n",
-								dire->d_name,strerror(errno));
+								dire->d_name,strerror(attrs[2].err));
 						sz = 0;
 					}
 					if((p = add_partition_inner(d,dire->d_name,devno,pnum,fsect,sz)) == NULL){
@@ -768,7 +1378,11 @@ parse_pci_busid(const char *busid,unsigned long *domain,unsigned long *bus,
         char *e,*sysfs;
 	int dir,r;
 
-        cur = busid + strlen("/sys/devices/pci");
+	// busid is canonical, and thus carries any alternate root
+	if(strncmp(busid,paths.root,strlen(paths.root))){
+		return NULL;
+	}
+        cur = busid + strlen(paths.root) + strlen("/sys/devices/pci");
         // FIXME clean this cut-and-paste crap up
         if(*cur == '-'){ // strtoul() admits leading negations
                 return NULL;
@@ -900,27 +1514,610 @@ void add_new_virtual_blockdev(device *d){
 		d->c = &virtual_bus;
 		d->next = virtual_bus.blockdevs;
 		virtual_bus.blockdevs = d;
+		if(devindex_add(&devices,d)){
+			diag("Couldn't index %s\n",d->name);
+		}
 		d->uistate = gui->block_event(d,d->uistate);
 	unlock_growlight();
 }
 
-static inline device *
-rescan(const char *name,device *d){
-	char buf[PATH_MAX] = "";
-	int fd,r;
+// Add a device and all its partitions to the index. Must hold the lock.
+static void
+index_device(device *d){
+	device *p;
 
-	// Not an optimization, but rather insurance that we don't perform an
-	// overlapping copy when d->name is passed in as name.
-	if(strcmp(d->name,name)){
-		strcpy(d->name,name);
+	if(devindex_add(&devices,d)){
+		diag("Couldn't index %s\n",d->name);
 	}
-	d->swapprio = SWAP_INVALID;
-	if(readlinkat(sysfd,name,buf,sizeof(buf)) < 0){
-		diag("Couldn't read link at %s%s (%s)\n",
-			SYSROOT,name,strerror(errno));
-		clobber_device(d);
-		return NULL;
-	}else{
+	for(p = d->parts ; p ; p = p->next){
+		if(devindex_add(&devices,p)){
+			diag("Couldn't index %s\n",p->name);
+		}
+	}
+}
+
+// Strip leading "/", "./", "../" and "dev/" components, so that /dev/sda and
+// sda both refer to the same device.
+static const char *
+strip_devprefix(const char *name){
+	size_t s;
+
+	do{
+		if(strncmp(name,"/",1) == 0){
+			s = 1;
+		}else if(strncmp(name,"./",2) == 0){
+			s = 2;
+		}else if(strncmp(name,"../",3) == 0){
+			s = 3;
+		}else if(strncmp(name,"dev/",4) == 0){
+			s = 4;
+		}else{
+			s = 0;
+		}
+		name += s;
+	}while(s);
+	return name;
+}
+
+// Probe a partition's superblock through the disk's blkid probe pr (rather
+// than opening the partition), and take its flags from the disk's blkid
+// partition list. Returns -1 if the superblock couldn't be probed.
+static int
+probe_partition(device *d,device *p,blkid_probe pr,blkid_partlist ppl,
+						const char *pttable){
+	unsigned long long flags;
+	blkid_partition part;
+
+	if((part = blkid_partlist_devno_to_partition(ppl,p->devno)) == NULL){
+		return 0;
+	}
+	if(probe_blkid_partition(pr,part,p)){
+		return -1;
+	}
+	flags = blkid_partition_get_flags(part);
+	if(strcmp(pttable,"gpt") == 0){
+		// FIXME verify bootable flag?
+	}else{
+		if(blkid_partition_is_logical(part)){
+			p->partdev.ptstate.logical = 1;
+		}
+		if(blkid_partition_is_extended(part)){
+			p->partdev.ptstate.extended = 1;
+		}
+		if(blkid_partition_is_primary(part)){
+			if(d->blkdev.biossha1){
+				d->blkdev.biosboot = !zerombrp(d->blkdev.biossha1);
+			}
+		}
+		// BIOS boot flag byte ought not be set to anything but 0 unless
+		// we're on a primary partition and doing BIOS+MBR booting, in
+		// which case it must be 0x80.
+		if((flags & 0xff) != 0){
+			if(p->partdev.ptype != PARTROLE_PRIMARY || ((flags & 0xffu) != 0x80)
+					|| p->partdev.ptstate.logical || p->partdev.ptstate.extended){
+				diag("Warning: BIOS+MBR boot byte was %02llx on %s (0x%u)\n",
+						flags & 0xffu,p->name,p->partdev.ptype);
+			}
+		}
+	}
+	p->partdev.flags = flags;
+	return 0;
+}
+
+// Wait on cond with the growlight lock, which must be held, released entirely
+// rather than just our innermost hold upon it.
+static void
+wait_unlocked(pthread_cond_t *cond){
+	unsigned depth = lockdepth,z;
+
+	for(z = 1 ; z < depth ; ++z){
+		assert(pthread_mutex_unlock(&lock) == 0);
+	}
+	pthread_cond_wait(cond,&lock);
+	for(z = 1 ; z < depth ; ++z){
+		assert(pthread_mutex_lock(&lock) == 0);
+	}
+}
+
+static __thread unsigned uished; // what the UI's shed() returned
+
+// Broadcast as a device's last hold_device() is released.
+static pthread_cond_t busycond = PTHREAD_COND_INITIALIZER;
+
+// Look up the device named name, first waiting until nobody holds it (or the
+// disk it's part of) with the growlight lock shed, so that it can be freed.
+// Other devices are never waited upon. growlight must be locked.
+static device *
+await_device(const char *name){
+	device *d;
+
+	while( (d = devindex_name(&devices,name)) ){
+		const device *disk = d->layout == LAYOUT_PARTITION ? d->partdev.parent : d;
+
+		if(disk->busy == 0){
+			break;
+		}
+		verbf("Waiting on the holder of %s\n",disk->name);
+		wait_unlocked(&busycond);
+	}
+	return d;
+}
+
+// A device registered from sysfs whose deep probes are outstanding. Each is
+// run by one probe_job() on probeq, which takes from the urgent list (see
+// prioritize_probe()) before the normal one. The scratch device is a copy of
+// what sysfs told us, probed without the growlight lock and then adopted into
+// the tree if the registration (seq) is still current. The lists are
+// protected by the growlight lock, and probecond is broadcast as each
+// completes.
+struct probereq {
+	struct probereq *next;
+	char name[NAME_MAX + 1];
+	uint64_t seq;
+	device *scratch;
+};
+
+static struct probereq *probes,*urgentprobes;
+static pthread_cond_t probecond = PTHREAD_COND_INITIALIZER;
+static uint64_t probeseqs;
+
+static void
+free_scratch(device *s){
+	device *p;
+
+	if(s == NULL){
+		return;
+	}
+	while( (p = s->parts) ){
+		s->parts = p->next;
+		free_scratch(p);
+	}
+	switch(s->layout){
+		case LAYOUT_NONE:
+			free(s->blkdev.biossha1);
+			free(s->blkdev.pttable);
+			free(s->blkdev.serial);
+			free(s->blkdev.wwn);
+			break;
+		case LAYOUT_MDADM: free(s->mddev.pttable); break;
+		case LAYOUT_DM: free(s->dmdev.pttable); break;
+		case LAYOUT_PARTITION:
+			free(s->partdev.uuid);
+			free(s->partdev.pname);
+			break;
+		default: break;
+	}
+	free(s->mnttype);
+	free(s->uuid);
+	free(s->label);
+	free(s);
+}
+
+// Copy what deep_probe() needs of a freshly-explored device (sizes are still
+// as sysfs reports them, in sectors).
+static device *
+probe_scratch(const device *d){
+	device *s,*p,**pp;
+	const device *dp;
+
+	if((s = malloc(sizeof(*s))) == NULL){
+		return NULL;
+	}
+	memset(s,0,sizeof(*s));
+	strcpy(s->name,d->name);
+	s->layout = d->layout;
+	s->c = d->c;
+	s->devno = d->devno;
+	s->size = d->size;
+	s->logsec = d->logsec;
+	s->physsec = d->physsec;
+	s->swapprio = SWAP_INVALID;
+	if(s->layout == LAYOUT_NONE){
+		s->blkdev.realdev = d->blkdev.realdev;
+		s->blkdev.removable = d->blkdev.removable;
+	}
+	pp = &s->parts;
+	for(dp = d->parts ; dp ; dp = dp->next){
+		if((p = malloc(sizeof(*p))) == NULL){
+			free_scratch(s);
+			return NULL;
+		}
+		memset(p,0,sizeof(*p));
+		strcpy(p->name,dp->name);
+		p->layout = LAYOUT_PARTITION;
+		p->c = dp->c;
+		p->devno = dp->devno;
+		p->size = dp->size;
+		p->swapprio = SWAP_INVALID;
+		p->partdev.fsector = dp->partdev.fsector;
+		p->partdev.lsector = dp->partdev.lsector;
+		p->partdev.pnumber = dp->partdev.pnumber;
+		p->partdev.parent = s;
+		*pp = p;
+		pp = &p->next;
+	}
+	return s;
+}
+
+// Deep probes of a device registered from sysfs, through dfd, which is open
+// on it: SG_IO/NVMe identification, SMART, the MBR hash, and libblkid (or the
+// inventory cache in place of all of these). The disk is opened only the once;
+// its partitions are probed through dfd at their offsets.
+static int
+deep_probe_fd(device *d,struct inventory *inv,const char *devbuf,int dfd){
+	blkid_parttable ptbl;
+	blkid_partlist ppl;
+	blkid_probe pr;
+	int pars,cached = 0;
+
+	if(d->layout == LAYOUT_NONE && d->blkdev.realdev){
+		int roflag;
+
+		if(ioctl(dfd,BLKROGET,&roflag) == 0){
+			verbf("Block R/O flag: %d (%s)\n",roflag,d->name);
+			if(roflag){
+				d->roflag = 1;
+			}
+		}
+		if(inv && !d->blkdev.removable &&
+				(d->blkdev.invtoken = inventory_token(dfd,d)) &&
+				inventory_restore(inv,d) > 0){
+			verbf("\tRestored %s from inventory cache\n",d->name);
+			cached = 1;
+			if(d->c->transport == TRANSPORT_ATA ||
+					d->c->transport == TRANSPORT_NVME){
+				d->blkdev.smartstale = 1;
+			}
+		}else if(d->c->transport == TRANSPORT_ATA){
+			if(sg_interrogate(d,dfd)){
+				return -1;
+			}
+			probe_smart(d);
+		}else if(d->c->transport == TRANSPORT_NVME){
+			if(nvme_interrogate(d, dfd)){
+				return -1;
+			}
+		}else if(d->c->transport == TRANSPORT_USB){
+			d->blkdev.transport = SERIAL_USB;
+		}else if(d->c->transport == TRANSPORT_USB2){
+			d->blkdev.transport = SERIAL_USB2;
+		}else if(d->c->transport == TRANSPORT_USB3){
+			d->blkdev.transport = SERIAL_USB3;
+		}
+		if(cached){
+			// biossha1 came from the cache
+		}else if((d->blkdev.biossha1 = malloc(20)) == NULL){
+			diag("Couldn't alloc SHA1 buf (%s)\n",strerror(errno));
+			return -1;
+		}else if(mbrsha1(d, dfd, d->blkdev.biossha1)){
+			verbf("Couldn't read MBR for %s\n", d->name);
+			free(d->blkdev.biossha1);
+			d->blkdev.biossha1 = NULL;
+		}
+	}
+	// Removable media is probed by name, so that libblkid can tell us
+	// whether it's loaded; everything else through dfd.
+	if(cached){
+		// as were the partition table and filesystem probes
+	}else if((d->layout == LAYOUT_NONE && d->blkdev.removable ?
+			probe_blkid_superblock(devbuf,&pr,d) :
+			probe_blkid_fd(dfd,devbuf,&pr,d)) == 0){
+		if( (ppl = blkid_probe_get_partitions(pr)) ){
+			const char *pttable;
+			device *p;
+
+			if((ptbl = blkid_partlist_get_table(ppl)) == NULL){
+				diag("Couldn't probe partition table of %s (%s)\n",d->name,strerror(errno));
+				blkid_free_probe(pr);
+				return -1;
+			}
+			pars = blkid_partlist_numof_partitions(ppl);
+			pttable = blkid_parttable_get_type(ptbl);
+			verbf("\t%d partition%s, table type %s\n",
+					pars,pars == 1 ? "" : "s",
+					pttable);
+			switch(d->layout){
+				case LAYOUT_NONE: assert((d->blkdev.pttable = strdup(pttable))); break;
+				case LAYOUT_MDADM: assert((d->mddev.pttable = strdup(pttable))); break;
+				case LAYOUT_DM: assert((d->dmdev.pttable = strdup(pttable))); break;
+				default: diag("Bad layout %d\n",d->layout); assert(0); break;
+			}
+			for(p = d->parts ; p ; p = p->next){
+				if(probe_partition(d,p,pr,ppl,pttable)){
+					blkid_free_probe(pr);
+					return -1;
+				}
+			}
+		}else{
+			device *p;
+
+			// adopt_probe() eliminates them from the tree
+			verbf("\tNo partition table\n");
+			while( (p = d->parts) ){
+				d->parts = p->next;
+				free_scratch(p);
+			}
+		}
+		blkid_free_probe(pr);
+	}else if((d->layout != LAYOUT_NONE || !d->blkdev.removable) || errno != ENOMEDIUM){
+		diag("Couldn't probe %s (%s)\n",d->name,strerror(errno));
+		return -1;
+	}else{
+		verbf("\tDevice is unloaded/inaccessible\n");
+		d->blkdev.unloaded = 1;
+	}
+	return 0;
+}
+
+// Open a scratch device, and deep-probe it through that one fd. Run without
+// the growlight lock. Returns non-zero if the device couldn't be probed.
+static int
+deep_probe(device *d,struct inventory *inv){
+	char devbuf[PATH_MAX];
+	int dfd,r;
+
+	snprintf(devbuf,sizeof(devbuf),"%s/%s",DEVROOT,d->name);
+	// a hotplugged device's node might not yet have been created
+	if((dfd = openat(devfd,d->name,O_NONBLOCK|O_RDONLY|O_CLOEXEC)) < 0 &&
+			errno == ENOENT && wait_devnode(devbuf,DEVNODE_WAIT_MS) == 0){
+		dfd = openat(devfd,d->name,O_NONBLOCK|O_RDONLY|O_CLOEXEC);
+	}
+	if(dfd < 0){
+		diag("Couldn't open %s (%s)\n",devbuf,strerror(errno));
+		return -1;
+	}
+	r = deep_probe_fd(d,inv,devbuf,dfd);
+	close(dfd);
+	return r;
+}
+
+// Move *src into *dst if we learned it.
+static inline void
+adopt_string(char **dst,char **src){
+	if(*src){
+		free(*dst);
+		*dst = *src;
+		*src = NULL;
+	}
+}
+
+// As adopt_string(), for strings which live in d's arena. The scratch copy
+// is left to free_scratch().
+static inline void
+adopt_arena_string(device *d,char **dst,const char *src){
+	if(src){
+		*dst = arena_strdup(&d->strings,src);
+	}
+}
+
+static void
+adopt_fs(device *d,device *s){
+	adopt_string(&d->mnttype,&s->mnttype);
+	adopt_string(&d->uuid,&s->uuid);
+	adopt_string(&d->label,&s->label);
+	if(s->swapprio != SWAP_INVALID && d->swapprio == SWAP_INVALID){
+		d->swapprio = s->swapprio;
+	}
+}
+
+// Take the results of deep_probe() (err being its return) from the scratch
+// device s into d, and announce them. growlight must be locked.
+static void
+adopt_probe(device *d,device *s,int err){
+	unsigned changes = DEVCHANGE_PROBED | DEVCHANGE_CONTENT;
+	device **pp,*p,*sp;
+
+	d->probe_pending = 0;
+	for(p = d->parts ; p ; p = p->next){
+		p->probe_pending = 0;
+	}
+	if(err){
+		// it remains in the tree as sysfs described it
+		diag("Couldn't complete probes of %s\n",d->name);
+		d->changes = DEVCHANGE_PROBED;
+		d->uistate = gui->block_event(d,d->uistate);
+		d->changes = 0;
+		return;
+	}
+	if(s->roflag){
+		d->roflag = 1;
+	}
+	adopt_fs(d,s);
+	switch(d->layout){
+		case LAYOUT_NONE:
+			d->c->demand -= transport_bw(d->blkdev.transport);
+			d->blkdev.transport = s->blkdev.transport;
+			d->c->demand += transport_bw(d->blkdev.transport);
+			d->blkdev.rotation = s->blkdev.rotation;
+			d->blkdev.wcache = s->blkdev.wcache;
+			d->blkdev.rwverify = s->blkdev.rwverify;
+			d->blkdev.smart = s->blkdev.smart;
+			d->blkdev.celsius = s->blkdev.celsius;
+			d->blkdev.biosboot = s->blkdev.biosboot;
+			d->blkdev.unloaded = s->blkdev.unloaded;
+			d->blkdev.smartstale = s->blkdev.smartstale;
+			d->blkdev.invtoken = s->blkdev.invtoken;
+			if(s->blkdev.biossha1){
+				free(d->blkdev.biossha1);
+				d->blkdev.biossha1 = s->blkdev.biossha1;
+				s->blkdev.biossha1 = NULL;
+			}
+			adopt_arena_string(d,&d->blkdev.pttable,s->blkdev.pttable);
+			adopt_arena_string(d,&d->blkdev.serial,s->blkdev.serial);
+			adopt_arena_string(d,&d->blkdev.wwn,s->blkdev.wwn);
+			break;
+		case LAYOUT_MDADM:
+			adopt_arena_string(d,&d->mddev.pttable,s->mddev.pttable);
+			break;
+		case LAYOUT_DM:
+			adopt_arena_string(d,&d->dmdev.pttable,s->dmdev.pttable);
+			break;
+		default:
+			break;
+	}
+	pp = &d->parts;
+	while( (p = *pp) ){
+		for(sp = s->parts ; sp ; sp = sp->next){
+			if(sp->devno == p->devno && strcmp(sp->name,p->name) == 0){
+				break;
+			}
+		}
+		if(sp == NULL){
+			diag("Eliminating malingering partition %s\n",p->name);
+			*pp = p->next;
+			clobber_device(p);
+			changes |= DEVCHANGE_PARTS;
+			continue;
+		}
+		adopt_fs(p,sp);
+		adopt_string(&p->partdev.uuid,&sp->partdev.uuid);
+		if(sp->partdev.pname){
+			free(p->partdev.pname);
+			p->partdev.pname = sp->partdev.pname;
+			sp->partdev.pname = NULL;
+		}
+		p->partdev.ptype = sp->partdev.ptype;
+		p->partdev.flags = sp->partdev.flags;
+		p->partdev.ptstate = sp->partdev.ptstate;
+		pp = &p->next;
+	}
+	if(d->layout == LAYOUT_NONE){
+		d->blkdev.first_usable = lookup_first_usable_sector(d);
+		d->blkdev.last_usable = lookup_last_usable_sector(d);
+	}
+	verbf("Probed %s\n",d->name);
+	d->changes = changes;
+	d->uistate = gui->block_event(d,d->uistate);
+	d->changes = 0;
+}
+
+static void
+probe_job(void *unused){
+	struct probereq *req;
+	struct inventory *inv;
+	device *d;
+	int err;
+
+	(void)unused;
+	lock_growlight();
+	if( (req = urgentprobes) ){
+		urgentprobes = req->next;
+	}else if( (req = probes) ){
+		probes = req->next;
+	}
+	inv = inventory;
+	unlock_growlight();
+	if(req == NULL){
+		return;
+	}
+	err = deep_probe(req->scratch,inv);
+	lock_growlight();
+	if((d = await_device(req->name)) && d->probe_pending &&
+			d->probeseq == req->seq){
+		adopt_probe(d,req->scratch,err);
+	}
+	pthread_cond_broadcast(&probecond);
+	unlock_growlight();
+	free_scratch(req->scratch);
+	free(req);
+}
+
+// Mark d and its partitions as awaiting deep probes of s, a probe_scratch()
+// copy of d, and queue them. On failure, d is left as sysfs described it.
+// Takes ownership of s. growlight must be locked.
+static void
+queue_probe(device *d,device *s){
+	struct probereq *req,**pp;
+	device *p;
+
+	if((req = malloc(sizeof(*req))) == NULL){
+		diag("Couldn't queue probes of %s (%s)\n",d->name,strerror(errno));
+		free_scratch(s);
+		return;
+	}
+	strcpy(req->name,d->name);
+	req->seq = d->probeseq = ++probeseqs;
+	req->scratch = s;
+	req->next = NULL;
+	for(pp = &probes ; *pp ; pp = &(*pp)->next){
+		;
+	}
+	*pp = req;
+	if(probeq == NULL || workq_submit(probeq,probe_job,NULL)){
+		diag("Couldn't queue probes of %s\n",d->name);
+		*pp = NULL;
+		free_scratch(s);
+		free(req);
+		return;
+	}
+	d->probe_pending = 1;
+	for(p = d->parts ; p ; p = p->next){
+		p->probe_pending = 1;
+	}
+}
+
+int prioritize_probe(const device *d){
+	struct probereq **pp,*req;
+	int r = -1;
+
+	lock_growlight();
+	if(d->layout == LAYOUT_PARTITION){
+		d = d->partdev.parent;
+	}
+	if(d->probe_pending){
+		r = 0;
+		for(pp = &probes ; (req = *pp) ; pp = &req->next){
+			if(req->seq == d->probeseq){
+				*pp = req->next;
+				for(pp = &urgentprobes ; *pp ; pp = &(*pp)->next){
+					;
+				}
+				*pp = req;
+				req->next = NULL;
+				break;
+			}
+		}
+	}
+	unlock_growlight();
+	return r;
+}
+
+device *await_probe(device *d){
+	char name[NAME_MAX + 1],disk[NAME_MAX + 1];
+	const device *dd;
+
+	dd = d->layout == LAYOUT_PARTITION ? d->partdev.parent : d;
+	if(!dd->probe_pending){
+		return d;
+	}
+	strcpy(name,d->name);
+	strcpy(disk,dd->name);
+	prioritize_probe(dd);
+	while((dd = devindex_name(&devices,disk)) && dd->probe_pending){
+		wait_unlocked(&probecond);
+	}
+	return devindex_name(&devices,name);
+}
+
+static inline device *
+rescan(const char *name,device *d){
+	char buf[PATH_MAX] = "";
+	device *scratch = NULL;
+	int fd,r;
+
+	// Not an optimization, but rather insurance that we don't perform an
+	// overlapping copy when d->name is passed in as name.
+	if(strcmp(d->name,name)){
+		strcpy(d->name,name);
+	}
+	d->swapprio = SWAP_INVALID;
+	d->probe_pending = 0;
+	if(readlinkat(sysfd,name,buf,sizeof(buf)) < 0){
+		diag("Couldn't read link at %s%s (%s)\n",
+			SYSROOT,name,strerror(errno));
+		clobber_device(d);
+		return NULL;
+	}else{
 		verbf("%s -> %s\n",name,buf);
 	}
 	lock_growlight();
@@ -951,181 +2148,446 @@ rescan(const char *name,device *d){
 		unlock_growlight();
 		return d;
 	}
-	if(d->c == &virtual_bus && d->layout == LAYOUT_NONE){
-		d->blkdev.realdev = 0;
-		d->blkdev.smart = -1;
+	if(d->c == &virtual_bus && d->layout == LAYOUT_NONE){
+		d->blkdev.realdev = 0;
+		d->blkdev.smart = -1;
+	}
+	// FIXME instead, we should read stats now, so we can have a valid
+	// delta on the next regularly scheduled read...
+	if(d->devno){
+		devstats *ds;
+
+		pthread_mutex_lock(&statslock);
+		if( (ds = statstable_devno(&hotstats,d->devno)) ){
+			devstats_restart(ds);
+		}
+		pthread_mutex_unlock(&statslock);
+	}
+	// Register the device as sysfs describes it, and leave the deep probes
+	// to probeq (see queue_probe()). Allow d->model to run the checks on
+	// validly-filebacked loop devices.
+	if((d->layout == LAYOUT_NONE && (d->blkdev.realdev || d->model))
+			|| (d->layout == LAYOUT_MDADM) || (d->layout == LAYOUT_DM)){
+		if((scratch = probe_scratch(d)) == NULL){
+			diag("Couldn't allocate space for %s\n",name);
+			clobber_device(d);
+			return NULL;
+		}
+	}
+	if(d->logsec || d->physsec){
+		device *p;
+
+		verbf("\tLogical sector size: %uB Physical sector size: %uB\n",
+				d->logsec,d->physsec);
+		d->size *= 512; // global across sysfs, applies for instance to optical
+		for(p = d->parts ; p ; p = p->next){
+			p->logsec = d->logsec;
+			p->physsec = d->physsec;
+			p->size *= p->logsec;
+			p->partdev.alignment = alignment(p->partdev.fsector * p->logsec);
+		}
+	}
+	if(d->layout == LAYOUT_NONE){
+		d->blkdev.first_usable = lookup_first_usable_sector(d);
+		d->blkdev.last_usable = lookup_last_usable_sector(d);
+	}
+	lock_growlight();
+		d->next = d->c->blockdevs;
+		d->c->blockdevs = d;
+		index_device(d);
+		if(d->layout == LAYOUT_NONE){
+			d->c->demand += transport_bw(d->blkdev.transport);
+		}
+		if(scratch){
+			queue_probe(d,scratch);
+		}
+		d->changes = d->probe_pending ? DEVCHANGE_ALL & ~DEVCHANGE_PROBED : DEVCHANGE_ALL;
+		d->uistate = gui->block_event(d,d->uistate);
+		d->changes = 0;
+	unlock_growlight();
+	return d;
+}
+
+// A partition as currently described by sysfs, for refresh_device().
+struct sysfs_part {
+	char name[NAME_MAX + 1];
+	dev_t devno;
+	unsigned long pnum,fsect,sz;
+	unsigned matched: 1;	// corresponds to an existing partition
+	unsigned added: 1;	// new since the last scan
+};
+
+// Read the partition subdirectories of a disk's sysfs node. Returns the number
+// found, having allocated *parts, or -1 on error.
+static int
+read_sysfs_parts(DIR *dir,const char *name,struct sysfs_part **parts){
+	struct sysfs_part *sp = NULL,*tmp;
+	struct dirent *dire;
+	int n = 0;
+
+	while(errno = 0, (dire = readdir(dir)) != NULL){
+		unsigned long pnum;
+		int subfd,r;
+
+		if(dire->d_type != DT_DIR || dire->d_name[0] == '.'){
+			continue;
+		}
+		if((subfd = openat(dirfd(dir),dire->d_name,O_RDONLY|O_CLOEXEC|O_DIRECTORY)) < 0){
+			continue;
+		}
+		// a missing "partition" means it isn't one
+		if((r = get_sysfs_uint(subfd,"partition",&pnum)) == 0 || errno != ENOENT){
+			sysfs_attr attrs[] = {
+				{ .node = "dev", .type = SYSFS_DEVNO, },
+				{ .node = "start", .type = SYSFS_UINT, },
+				{ .node = "size", .type = SYSFS_UINT, },
+			};
+
+			if((tmp = realloc(sp,sizeof(*sp) * (n + 1))) == NULL){
+				close(subfd);
+				free(sp);
+				return -1;
+			}
+			sp = tmp;
+			memset(&sp[n],0,sizeof(*sp));
+			strcpy(sp[n].name,dire->d_name);
+			sp[n].pnum = pnum;
+			attrs[0].val = &sp[n].devno;
+			attrs[1].val = &sp[n].fsect;
+			attrs[2].val = &sp[n].sz;
+			if(r || get_sysfs_attrs(subfd,attrs,sizeof(attrs) / sizeof(*attrs))){
+				diag("Couldn't read partition %s of %s\n",dire->d_name,name);
+				close(subfd);
+				free(sp);
+				return -1;
+			}
+			++n;
+		}
+		close(subfd);
+	}
+	if(errno){
+		diag("Error walking sysfs:%s (%s)\n",name,strerror(errno));
+		free(sp);
+		return -1;
+	}
+	*parts = sp;
+	return n;
+}
+
+// Recount a device's holders from its sysfs node, returning non-zero if the
+// count changed.
+static int
+recount_holders(device *d,int fd){
+	int old = d->slave;
+	int hfd;
+
+	if((hfd = openat(fd,"holders",O_RDONLY|O_CLOEXEC|O_DIRECTORY)) < 0){
+		return 0;
+	}
+	d->slave = 0;
+	// check_slavery() closes hfd
+	if(check_slavery(d,hfd)){
+		d->slave = old;
+		return 0;
+	}
+	return d->slave != old;
+}
+
+static int
+strchanged(const char *a,const char *b){
+	if(a == NULL || b == NULL){
+		return a != b;
+	}
+	return strcmp(a,b);
+}
+
+// Filesystem and partition identity, captured before a reprobe so that we can
+// tell whether it changed anything.
+typedef struct sigsnap {
+	char *mnttype,*uuid,*label,*partuuid;
+	unsigned ptype;
+} sigsnap;
+
+static void
+sigsnap_take(sigsnap *s,const device *d){
+	memset(s,0,sizeof(*s));
+	s->mnttype = d->mnttype ? strdup(d->mnttype) : NULL;
+	s->uuid = d->uuid ? strdup(d->uuid) : NULL;
+	s->label = d->label ? strdup(d->label) : NULL;
+	if(d->layout == LAYOUT_PARTITION){
+		s->partuuid = d->partdev.uuid ? strdup(d->partdev.uuid) : NULL;
+		s->ptype = d->partdev.ptype;
+	}
+}
+
+// Compares against d, and releases the snapshot.
+static int
+sigsnap_changed(sigsnap *s,const device *d){
+	int r;
+
+	r = strchanged(s->mnttype,d->mnttype) || strchanged(s->uuid,d->uuid) ||
+		strchanged(s->label,d->label);
+	if(d->layout == LAYOUT_PARTITION){
+		r = r || strchanged(s->partuuid,d->partdev.uuid) ||
+			s->ptype != d->partdev.ptype;
+	}
+	free(s->mnttype);
+	free(s->uuid);
+	free(s->label);
+	free(s->partuuid);
+	return r;
+}
+
+// Update the MBR hash of a real disk, open on dfd, returning non-zero if it
+// changed.
+static int
+refresh_mbrsha1(device *d,int dfd){
+	unsigned char sha1[20];
+	int r;
+
+	if(mbrsha1(d,dfd,sha1)){
+		verbf("Couldn't read MBR for %s\n",d->name);
+		r = d->blkdev.biossha1 != NULL;
+		free(d->blkdev.biossha1);
+		d->blkdev.biossha1 = NULL;
+		return r;
+	}
+	if(d->blkdev.biossha1 == NULL){
+		if((d->blkdev.biossha1 = malloc(sizeof(sha1))) == NULL){
+			return 0;
+		}
+	}else if(memcmp(d->blkdev.biossha1,sha1,sizeof(sha1)) == 0){
+		return 0;
+	}
+	memcpy(d->blkdev.biossha1,sha1,sizeof(sha1));
+	return 1;
+}
+
+// Bring a known, unaggregated disk up to date in place following a change
+// event on it or on one of its partitions (origin), rather than discarding
+// and rediscovering it. The sysfs attributes and partition list are diffed
+// against d. SG_IO/NVMe identification and SMART are not rerun, the MBR is
+// only rehashed when the event was on the disk or its partitions changed, and
+// libblkid only reprobes partitions which are new, saw the event (as origin,
+// or as marked by defer_rescan()), or sit in a changed partition table.
+// Statistics (and their history), mounts and uistate are preserved; only when
+// partitions changed are the mounts reattributed, and then from the table
+// already held, which the event thread keeps current. A single block_event()
+// is issued with d->changes describing what changed (none at all if nothing
+// did). Returns 0 on success, -1 on error, or 1 if d ought instead be rescanned
+// from scratch: it's no longer the same device, its media has come or gone,
+// or it isn't a case we handle incrementally. growlight must be locked.
+static int
+refresh_device(device *d,const char *origin){
+	char buf[PATH_MAX],devbuf[PATH_MAX];
+	struct sysfs_part *sp = NULL;
+	unsigned long ul,logsec,physsec;
+	unsigned changes = 0;
+	uintmax_t size;
+	int fd,n,z;
+	dev_t devno;
+	char *sched;
+	device **pp,*p;
+	DIR *dir;
+
+	// a device still awaiting its deep probes is simply registered anew
+	if(d->layout != LAYOUT_NONE || d->blkdev.unloaded || d->probe_pending){
+		return 1;
+	}
+	if((n = readlinkat(sysfd,d->name,buf,sizeof(buf) - 1)) < 0){
+		return 1;
+	}
+	buf[n] = '\0';
+	if(parse_bus_topology(buf) != d->c){
+		return 1;
+	}
+	if((fd = openat(sysfd,buf,O_RDONLY|O_CLOEXEC|O_DIRECTORY)) < 0){
+		return 1;
+	}
+	sched = NULL;
+	{
+		sysfs_attr attrs[] = {
+			{ .node = "dev", .type = SYSFS_DEVNO, .val = &devno, },
+			{ .node = "size", .type = SYSFS_UINT, .val = &ul, },
+			{ .node = "queue/logical_block_size", .type = SYSFS_UINT, .val = &logsec, },
+			{ .node = "queue/physical_block_size", .type = SYSFS_UINT, .val = &physsec, },
+			{ .node = "queue/scheduler", .type = SYSFS_STRING, .val = &sched, },
+		};
+
+		// the scheduler is optional; everything else must be read
+		get_sysfs_attrs(fd,attrs,sizeof(attrs) / sizeof(*attrs));
+		if(attrs[0].err || devno != d->devno || attrs[1].err || attrs[2].err ||
+				attrs[3].err || logsec != d->logsec || physsec != d->physsec){
+			free(sched);
+			close(fd);
+			return 1;
+		}
+	}
+	// sysfs sizes are always in 512-byte units (see rescan())
+	size = d->logsec || d->physsec ? ul * 512 : ul;
+	if(size != d->size){
+		if(d->blkdev.removable && (size == 0 || d->size == 0)){
+			free(sched);
+			close(fd);
+			return 1;
+		}
+		d->size = size;
+		changes |= DEVCHANGE_SIZE;
+	}
+	if(sched){
+		if(strchanged(sched,d->sched)){
+			d->sched = arena_strdup(&d->strings,sched);
+			changes |= DEVCHANGE_ATTRS;
+		}
+		free(sched);
+	}
+	if(recount_holders(d,fd)){
+		changes |= DEVCHANGE_ATTRS;
+	}
+	if((dir = fdopendir(fd)) == NULL){
+		diag("Couldn't get DIR * from fd %d for %s (%s)\n",
+				fd,d->name,strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if((n = read_sysfs_parts(dir,d->name,&sp)) < 0){
+		closedir(dir);
+		return -1;
+	}
+	// Drop partitions which are gone, or have been moved or renumbered
+	for(pp = &d->parts ; (p = *pp) ; ){
+		for(z = 0 ; z < n ; ++z){
+			if(strcmp(sp[z].name,p->name) == 0){
+				break;
+			}
+		}
+		if(z < n && sp[z].devno == p->devno && sp[z].pnum == p->partdev.pnumber &&
+				sp[z].fsect == p->partdev.fsector &&
+				sp[z].fsect + sp[z].sz - 1 == p->partdev.lsector){
+			sp[z].matched = 1;
+			pp = &p->next;
+			continue;
+		}
+		verbf("\tPartition %s is gone or changed\n",p->name);
+		*pp = p->next;
+		clobber_device(p);
+		changes |= DEVCHANGE_PARTS;
+	}
+	for(z = 0 ; z < n ; ++z){
+		if(sp[z].matched){
+			continue;
+		}
+		verbf("\tPartition %lu at %s\n",sp[z].pnum,sp[z].name);
+		if((p = add_partition_inner(d,sp[z].name,sp[z].devno,sp[z].pnum,
+						sp[z].fsect,sp[z].sz)) == NULL){
+			closedir(dir);
+			free(sp);
+			return -1;
+		}
+		p->logsec = d->logsec;
+		p->physsec = d->physsec;
+		p->size *= p->logsec;
+		p->partdev.alignment = alignment(p->partdev.fsector * p->logsec);
+		if(devindex_add(&devices,p)){
+			diag("Couldn't index %s\n",p->name);
+		}
+		sp[z].added = 1;
+		changes |= DEVCHANGE_PARTS;
 	}
-	// FIXME instead, we should read stats now, so we can have a valid
-	// delta on the next regularly scheduled read...
-	d->stats.sectors_read = ~0;
-	d->stats.sectors_written = ~0;
-	// Allow d->model to run the checks on validly-filebacked loop devices
-	if((d->layout == LAYOUT_NONE && (d->blkdev.realdev || d->model))
-			|| (d->layout == LAYOUT_MDADM) || (d->layout == LAYOUT_DM)){
-		char devbuf[PATH_MAX];
+	for(p = d->parts ; p ; p = p->next){
+		int pfd;
+
+		if((pfd = openat(dirfd(dir),p->name,O_RDONLY|O_CLOEXEC|O_DIRECTORY)) >= 0){
+			if(recount_holders(p,pfd)){
+				changes |= DEVCHANGE_ATTRS;
+			}
+			close(pfd);
+		}
+	}
+	closedir(dir); // close(2)s fd
+	if(d->blkdev.realdev || d->model){
 		blkid_parttable ptbl;
 		blkid_partlist ppl;
+		const char *pttable;
 		blkid_probe pr;
-		int pars;
-		int dfd;
-
-		if(d->layout == LAYOUT_NONE && d->blkdev.realdev){
-			int roflag;
-
-			if((dfd = openat(devfd,name,O_NONBLOCK|O_RDONLY|O_CLOEXEC)) < 0){
-				diag("Couldn't open " DEVROOT "/%s (%s)\n",name,strerror(errno));
-				clobber_device(d);
-				return NULL;
-			}
-			if(ioctl(dfd,BLKROGET,&roflag) == 0){
-				verbf("Block R/O flag: %d (%s)\n",roflag,name);
-				if(roflag){
-					d->roflag = 1;
-				}
-			}
-			if(d->c->transport == TRANSPORT_ATA){
-				if(sg_interrogate(d,dfd)){
-					close(dfd);
-					clobber_device(d);
-					return NULL;
-				}
-				probe_smart(d);
-			}else if(d->c->transport == TRANSPORT_NVME){
-				if(nvme_interrogate(d, dfd)){
-					close(dfd);
-					clobber_device(d);
-					return NULL;
-				}
-			}else if(d->c->transport == TRANSPORT_USB){
-				d->blkdev.transport = SERIAL_USB;
-			}else if(d->c->transport == TRANSPORT_USB2){
-				d->blkdev.transport = SERIAL_USB2;
-			}else if(d->c->transport == TRANSPORT_USB3){
-				d->blkdev.transport = SERIAL_USB3;
-			}
-			if((d->blkdev.biossha1 = malloc(20)) == NULL){
-				diag("Couldn't alloc SHA1 buf (%s)\n",strerror(errno));
-				close(dfd);
-				clobber_device(d);
-				return NULL;
-			}
-			if(mbrsha1(d, dfd, d->blkdev.biossha1)){
-				verbf("Couldn't read MBR for %s\n", name);
-				free(d->blkdev.biossha1);
-				d->blkdev.biossha1 = NULL;
+		sigsnap snap;
+		int all,dfd;
+
+		// the disk is opened once, for the MBR and all blkid probes
+		snprintf(devbuf,sizeof(devbuf),"%s/%s",DEVROOT,d->name);
+		if((dfd = openat(devfd,d->name,O_NONBLOCK|O_RDONLY|O_CLOEXEC)) < 0){
+			diag("Couldn't open %s (%s)\n",devbuf,strerror(errno));
+			free(sp);
+			return 1;
+		}
+		if(d->blkdev.realdev && (strcmp(origin,d->name) == 0 || (changes & DEVCHANGE_PARTS))){
+			if(refresh_mbrsha1(d,dfd)){
+				changes |= DEVCHANGE_CONTENT;
 			}
+		}
+		sigsnap_take(&snap,d);
+		if(probe_blkid_fd(dfd,devbuf,&pr,d)){
+			sigsnap_changed(&snap,d);
 			close(dfd);
+			free(sp);
+			return 1;
 		}
-		snprintf(devbuf,sizeof(devbuf),DEVROOT "/%s",name);
-		// FIXME move all this to its own function
-		if(probe_blkid_superblock(devbuf,&pr,d) == 0){
-			if( (ppl = blkid_probe_get_partitions(pr)) ){
-				const char *pttable;
-				device *p;
-
-				if((ptbl = blkid_partlist_get_table(ppl)) == NULL){
-					diag("Couldn't probe partition table of %s (%s)\n",name,strerror(errno));
-					clobber_device(d);
-					blkid_free_probe(pr);
-					return NULL;
-				}
-				pars = blkid_partlist_numof_partitions(ppl);
+		if(sigsnap_changed(&snap,d)){
+			changes |= DEVCHANGE_CONTENT;
+		}
+		pttable = NULL;
+		if( (ppl = blkid_probe_get_partitions(pr)) ){
+			if( (ptbl = blkid_partlist_get_table(ppl)) ){
 				pttable = blkid_parttable_get_type(ptbl);
-				verbf("\t%d partition%s, table type %s\n",
-						pars,pars == 1 ? "" : "s",
-						pttable);
-				switch(d->layout){
-					case LAYOUT_NONE: assert((d->blkdev.pttable = strdup(pttable))); break;
-					case LAYOUT_MDADM: assert((d->mddev.pttable = strdup(pttable))); break;
-					case LAYOUT_DM: assert((d->dmdev.pttable = strdup(pttable))); break;
-					default: diag("Bad layout %d\n",d->layout); assert(0); break;
-				}
-				for(p = d->parts ; p ; p = p->next){
-					blkid_partition part;
-
-					part = blkid_partlist_devno_to_partition(ppl,p->devno);
-					if(part){
-						unsigned long long flags;
-
-						if(probe_blkid_superblock(p->name,NULL,p)){
-							clobber_device(d);
-							blkid_free_probe(pr);
-							return NULL;
-						}
-						flags = blkid_partition_get_flags(part);
-						if(strcmp(pttable,"gpt") == 0){
-							// FIXME verify bootable flag?
-						}else{
-							if(blkid_partition_is_logical(part)){
-								p->partdev.ptstate.logical = 1;
-							}
-							if(blkid_partition_is_extended(part)){
-								p->partdev.ptstate.extended = 1;
-							}
-							if(blkid_partition_is_primary(part)){
-								if(d->blkdev.biossha1){
-									d->blkdev.biosboot = !zerombrp(d->blkdev.biossha1);
-								}
-							}
-							if((flags & 0xff) != 0){
-								if(p->partdev.ptype != PARTROLE_PRIMARY || ((flags & 0xffu) != 0x80)
-										|| p->partdev.ptstate.logical || p->partdev.ptstate.extended){
-									diag("Warning: BIOS+MBR boot byte was %02llx on %s (0x%u)\n",
-											flags & 0xffu,p->name,p->partdev.ptype);
-								}
-							}
-						}
-						p->partdev.flags = flags;
-// BIOS boot flag byte ought not be set to anything but 0 unless we're on a
-// primary partition and doing BIOS+MBR booting, in which case it must be 0x80.
-					}
-				}
-			}else{
-				device *p;
-
-				verbf("\tNo partition table\n");
-				while( (p = d->parts) ){
-					diag("Eliminating malingering partition %s\n",p->name);
-					d->parts = p->next;
-					clobber_device(p);
-				}
 			}
-			blkid_free_probe(pr);
-		}else if((d->layout != LAYOUT_NONE || !d->blkdev.removable) || errno != ENOMEDIUM){
-			diag("Couldn't probe %s (%s)\n",name,strerror(errno));
-			clobber_device(d);
-			return NULL;
-		}else{
-			verbf("\tDevice is unloaded/inaccessible\n");
-			d->blkdev.unloaded = 1;
 		}
-	}
-	if(d->logsec || d->physsec){
-		device *p;
-
-		verbf("\tLogical sector size: %uB Physical sector size: %uB\n",
-				d->logsec,d->physsec);
-		d->size *= 512; // global across sysfs, applies for instance to optical
-		for(p = d->parts ; p ; p = p->next){
-			p->logsec = d->logsec;
-			p->physsec = d->physsec;
-			p->size *= p->logsec;
-			p->partdev.alignment = alignment(p->partdev.fsector * p->logsec);
+		if( (all = strchanged(pttable,d->blkdev.pttable)) ){
+			d->blkdev.pttable = NULL;
+			if(pttable){
+				assert((d->blkdev.pttable = arena_strdup(&d->strings,pttable)));
+			}
+			changes |= DEVCHANGE_CONTENT;
+		}
+		for(p = d->parts ; p && pttable ; p = p->next){
+			for(z = 0 ; z < n ; ++z){
+				if(strcmp(sp[z].name,p->name) == 0){
+					break;
+				}
+			}
+			if(!all && !(z < n && sp[z].added) && !p->reprobe &&
+					strcmp(origin,p->name)){
+				continue;
+			}
+			p->reprobe = 0;
+			sigsnap_take(&snap,p);
+			if(probe_partition(d,p,pr,ppl,pttable)){
+				diag("Couldn't probe %s\n",p->name);
+			}
+			if(sigsnap_changed(&snap,p)){
+				changes |= DEVCHANGE_CONTENT;
+			}
 		}
+		blkid_free_probe(pr);
+		close(dfd);
 	}
-	if(d->layout == LAYOUT_NONE){
+	free(sp);
+	if(changes & (DEVCHANGE_SIZE | DEVCHANGE_PARTS | DEVCHANGE_CONTENT)){
 		d->blkdev.first_usable = lookup_first_usable_sector(d);
 		d->blkdev.last_usable = lookup_last_usable_sector(d);
 	}
-	lock_growlight();
-		d->next = d->c->blockdevs;
-		d->c->blockdevs = d;
-		if(d->layout == LAYOUT_NONE){
-			d->c->demand += transport_bw(d->blkdev.transport);
+	if(changes){
+		verbf("Refreshed %s (changes 0x%02x)\n",d->name,changes);
+		d->changes = changes;
+		if(changes & DEVCHANGE_PARTS){
+			// new and moved partitions pick up their mounts from the
+			// current table, and reattribute_mounts() issues the event
+			reattribute_mounts(gui,d);
+		}else{
+			d->uistate = gui->block_event(d,d->uistate);
 		}
-		d->uistate = gui->block_event(d,d->uistate);
-	unlock_growlight();
-	return d;
+		d->changes = 0;
+	}
+	return 0;
 }
 
 static device *
@@ -1144,48 +2606,94 @@ create_new_device_inner(const char *name){
 	return rescan(name,d);
 }
 
+// Names currently being discovered by create_new_device(). Anyone looking up
+// such a name blocks on its entry until the discoverer completes it, which
+// happens exactly once. Entries are reference counted (the discoverer plus
+// any waiters), and freed by whoever drops the last reference. Protected by
+// the growlight lock.
 struct dlist {
 	char *name;
 	struct dlist *next;
+	pthread_cond_t cond;	// broadcast upon completion
+	unsigned refs;
+	int done;
 };
 
 static struct dlist *discovery_active;
 
-static void
+static struct dlist *
 add_to_discovery_list(const char *name){
 	struct dlist *d;
 
 	assert( (d = malloc(sizeof(*d))) );
 	assert( (d->name = strdup(name)) );
+	pthread_cond_init(&d->cond,NULL);
+	d->refs = 1;
+	d->done = 0;
 	d->next = discovery_active;
 	discovery_active = d;
+	return d;
+}
+
+static struct dlist *
+find_discovery(const char *name){
+	struct dlist *d;
+
+	for(d = discovery_active ; d ; d = d->next){
+		if(strcmp(d->name,name) == 0){
+			break;
+		}
+	}
+	return d;
+}
+
+static void
+put_discovery(struct dlist *d){
+	if(--d->refs == 0){
+		pthread_cond_destroy(&d->cond);
+		free(d->name);
+		free(d);
+	}
 }
 
+// Unlink the entry, so that later lookups see the result, and wake waiters.
 static void
-del_from_discovery_list(const char *name){
+complete_discovery(struct dlist *d){
 	struct dlist **pre;
 
 	for(pre = &discovery_active ; *pre ; pre = &(*pre)->next){
-		if(strcmp((*pre)->name,name) == 0){
-			struct dlist *c = *pre;
-
-			*pre = c->next;
-			free(c->name);
-			free(c);
+		if(*pre == d){
+			*pre = d->next;
 			break;
 		}
 	}
+	d->done = 1;
+	pthread_cond_broadcast(&d->cond);
+	put_discovery(d);
+}
+
+// growlight must be locked on entry. The lock is released entirely while
+// waiting (the discoverer needs it to complete), so callers must revalidate
+// anything they looked up beforehand.
+static void
+wait_discovery(struct dlist *d){
+	++d->refs;
+	while(!d->done){
+		wait_unlocked(&d->cond);
+	}
+	put_discovery(d);
 }
 
 static device *
 create_new_device(const char *name){
+	struct dlist *dl;
 	device *d;
 
-	add_to_discovery_list(name);
+	dl = add_to_discovery_list(name);
 	unlock_growlight();
 	d = create_new_device_inner(name);
 	lock_growlight();
-	del_from_discovery_list(name);
+	complete_discovery(dl);
 	return d;
 }
 
@@ -1207,59 +2715,25 @@ controller *lookup_controller(const char *name){
 // growlight must be locked on entry!
 device *lookup_device(const char *name){
 	struct dlist *dl;
-	controller *c;
 	device *d;
-	size_t s;
-
-	do{
-		for(dl = discovery_active ; dl ; dl = dl->next){
-			if(strcmp(name,dl->name) == 0){
-				struct timespec ts;
-
-				// FIXME we're missing the signal somehow; see
-				// bug 387...
-				ts.tv_sec = 0;
-				ts.tv_nsec = 100000000;
-				pthread_cond_timedwait(&discovery_cond,&lock,&ts);
-				break;
-			}
-		}
-	}while(dl);
-	do{
-		if(strncmp(name,"/",1) == 0){
-			s = 1;
-		}else if(strncmp(name,"./",2) == 0){
-			s = 2;
-		}else if(strncmp(name,"../",3) == 0){
-			s = 3;
-		}else if(strncmp(name,"dev/",4) == 0){
-			s = 4;
-		}else{
-			s = 0;
-		}
-		name += s;
-	}while(s);
-	for(c = controllers ; c ; c = c->next){
-		for(d = c->blockdevs ; d ; d = d->next){
-			device *p;
 
-			if(strcmp(name,d->name) == 0){
-				return d;
-			}
-			for(p = d->parts ; p ; p = p->next){
-				if(strcmp(name,p->name) == 0){
-					return p;
-				}
-			}
-		}
+	name = strip_devprefix(name);
+	// another discovery might begin while we wait, thus the loop
+	while( (dl = find_discovery(name)) ){
+		wait_discovery(dl);
 	}
-	if( (d = create_new_device(name)) ){
-		pthread_cond_broadcast(&discovery_cond);
+	if( (d = devindex_name(&devices,name)) ){
+		return d;
 	}
-	return d;
+	return create_new_device(name);
 }
 
-static void *
+// growlight must be locked on entry!
+device *lookup_device_devno(dev_t devno){
+	return devindex_devno(&devices,devno);
+}
+
+static void
 scan_mdalias(void *vname){
 	char buf[PATH_MAX + 1],path[PATH_MAX + 1];
 	char *name = vname;
@@ -1267,17 +2741,17 @@ scan_mdalias(void *vname){
 	int r;
 
 	if(!name){
-		goto done;
+		return;
 	}
 	if((unsigned)snprintf(path,sizeof(path),"%s/%s",DEVMD,name) >= sizeof(path)){
 		diag("Bad link: %s\n",name);
 		free(vname);
-		goto done;
+		return;
 	}
 	if((r = readlink(path,buf,sizeof(buf))) < 0 || (unsigned)r >= sizeof(buf)){;
 		diag("Couldn't read link at %s\n",path);
 		free(vname);
-		goto done;
+		return;
 	}
 	buf[r] = '\0';
 	lock_growlight();
@@ -1285,24 +2759,14 @@ scan_mdalias(void *vname){
 		if(d->layout != LAYOUT_MDADM){
 			diag("Alias %s wasn't an md device (%s)\n",path,buf);
 		}else{
-			free(d->mddev.mdname);
-			d->mddev.mdname = name;
-			name = NULL;
+			d->mddev.mdname = arena_strdup(&d->strings,name);
 		}
 	}
 	unlock_growlight();
-	free(name); // name was set to NULL on success
-
-done:
-	assert(pthread_mutex_lock(&barrier) == 0);
-	if(--thrcount == 0){
-		pthread_cond_signal(&barrier_cond);
-	}
-	assert(pthread_mutex_unlock(&barrier) == 0);
-	return NULL;
+	free(name);
 }
 
-static void *
+static void
 scan_devbypath(void *vname){
 	char buf[PATH_MAX + 1],path[PATH_MAX + 1];
 	char *name = vname;
@@ -1310,17 +2774,17 @@ scan_devbypath(void *vname){
 	int r;
 
 	if(!name){
-		goto done;
+		return;
 	}
 	if((unsigned)snprintf(path,sizeof(path),"%s/%s",DEVBYPATH,name) >= sizeof(path)){
 		diag("Bad link: %s\n",name);
 		free(vname);
-		goto done;
+		return;
 	}
 	if((r = readlink(path,buf,sizeof(buf))) < 0 || (unsigned)r >= sizeof(buf)){;
 		diag("Couldn't read link at %s\n",path);
 		free(vname);
-		goto done;
+		return;
 	}
 	buf[r] = '\0';
 	lock_growlight();
@@ -1331,17 +2795,9 @@ scan_devbypath(void *vname){
 	}
 	unlock_growlight();
 	free(name); // name was set to NULL on success
-
-done:
-	assert(pthread_mutex_lock(&barrier) == 0);
-	if(--thrcount == 0){
-		pthread_cond_signal(&barrier_cond);
-	}
-	assert(pthread_mutex_unlock(&barrier) == 0);
-	return NULL;
 }
 
-static void *
+static void
 scan_devbyid(void *vname){
 	char buf[PATH_MAX + 1],id[PATH_MAX + 1];
 	char *name = vname;
@@ -1349,17 +2805,17 @@ scan_devbyid(void *vname){
 	int r;
 
 	if(!name){
-		goto done;
+		return;
 	}
 	if((unsigned)snprintf(id,sizeof(id),"%s/%s",DEVBYID,name) >= sizeof(id)){
 		diag("Bad link: %s\n",name);
 		free(vname);
-		goto done;
+		return;
 	}
 	if((r = readlink(id,buf,sizeof(buf))) < 0 || (unsigned)r >= sizeof(buf)){;
 		diag("Couldn't read link at %s\n",id);
 		free(vname);
-		goto done;
+		return;
 	}
 	buf[r] = '\0';
 	lock_growlight();
@@ -1370,30 +2826,239 @@ scan_devbyid(void *vname){
 	}
 	unlock_growlight();
 	free(name); // name was set to NULL on success
+}
 
-done:
-	assert(pthread_mutex_lock(&barrier) == 0);
-	if(--thrcount == 0){
-		pthread_cond_signal(&barrier_cond);
+static void
+scan_device(void *name){
+	if(name){
+		lock_growlight();
+		lookup_device(name);
+		unlock_growlight();
 	}
-	assert(pthread_mutex_unlock(&barrier) == 0);
-	return NULL;
+	free(name);
 }
 
-static void *
-scan_device(void *name){
-	device *d;
+static void
+rescan_job(void *name){
+	rescan_device(name);
+	free(name);
+}
+
+static void
+zpool_job(void *unused){
+	free(unused);
+	scan_zpools(gui);
+}
+
+// Repoll SMART for a disk restored from the inventory cache. We probe into a
+// scratch device, so that the growlight lock needn't be held across it.
+static void
+smart_job(void *name){
+	device scratch,*d;
+	int dfd,r = -1;
 
+	memset(&scratch,0,sizeof(scratch));
+	scratch.layout = LAYOUT_NONE;
+	snprintf(scratch.name,sizeof(scratch.name),"%s",(const char *)name);
 	lock_growlight();
-	d = name ? lookup_device(name) : NULL;
+	if( (d = devindex_name(&devices,name)) ){
+		scratch.blkdev.transport = d->blkdev.transport;
+	}
 	unlock_growlight();
-	assert(pthread_mutex_lock(&barrier) == 0);
-	if(--thrcount == 0){
-		pthread_cond_signal(&barrier_cond);
+	if(d == NULL){
+		free(name);
+		return;
+	}
+	if(scratch.blkdev.transport == DIRECT_NVME){
+		if((dfd = openat(devfd,scratch.name,O_NONBLOCK|O_RDONLY|O_CLOEXEC)) >= 0){
+			r = nvme_smart_log(&scratch,dfd);
+			close(dfd);
+		}
+	}else{
+		probe_smart(&scratch);
+		r = 0; // failure is reported as smart == -1, as in rescan()
+	}
+	lock_growlight();
+	if((d = devindex_name(&devices,name)) && d->layout == LAYOUT_NONE &&
+			d->blkdev.smartstale){
+		d->blkdev.smartstale = 0;
+		if(r == 0){
+			d->blkdev.smart = scratch.blkdev.smart;
+			d->blkdev.celsius = scratch.blkdev.celsius;
+			d->uistate = gui->block_event(d,d->uistate);
+		}
 	}
-	assert(pthread_mutex_unlock(&barrier) == 0);
+	unlock_growlight();
 	free(name);
-	return d;
+}
+
+// Once initial discovery is complete, write the tree back to the inventory
+// cache, and queue SMART repolls for the disks which were restored from it.
+// Later rescans always probe.
+static void
+finish_inventory(void){
+	unsigned entries,hits,misses;
+	const controller *c;
+
+	if(invloaded == NULL){
+		return;
+	}
+	lock_growlight();
+	inventory = NULL;
+	inventory_stats(invloaded,&entries,&hits,&misses);
+	verbf("Inventory cache: %u entries, %u hits, %u misses\n",entries,hits,misses);
+	inventory_save(invpath,controllers);
+	for(c = controllers ; c ; c = c->next){
+		device *d;
+
+		for(d = c->blockdevs ; d ; d = d->next){
+			char *name;
+
+			if(d->layout != LAYOUT_NONE || !d->blkdev.smartstale){
+				continue;
+			}
+			if((name = strdup(d->name)) == NULL || workq_submit(discoveryq,smart_job,name)){
+				free(name);
+				d->blkdev.smartstale = 0;
+			}
+		}
+	}
+	unlock_growlight();
+}
+
+// Record an event against name, to be handled by fxn (which frees its
+// argument) once the window closes. If it can't be coalesced, handle it
+// immediately.
+static void
+queue_event(const char *name,unsigned kind,workfxn fxn){
+	char *dup;
+
+	if(eventq && coalescer_add(eventq,name,kind) == 0){
+		return;
+	}
+	if( (dup = strdup(name)) ){
+		fxn(dup);
+	}
+}
+
+// Work queued for a coalesced event. The coalescer holds its kind until the
+// work starts, so that events arriving meanwhile don't queue it again.
+struct eventjob {
+	workfxn fxn;
+	unsigned kind;
+	char name[];
+};
+
+static void
+event_job(void *v){
+	struct eventjob *ej = v;
+	char *name;
+
+	coalescer_release(eventq,ej->name,ej->kind);
+	if( (name = strdup(ej->name)) ){
+		ej->fxn(name);
+	}
+	free(ej);
+}
+
+// Called by coalescer_flush() on the event thread, once per name. Submits one
+// job to the pool per kind of event seen; a rescan subsumes discovery.
+static void
+dispatch_events(const char *name,unsigned kinds,void *unused){
+	static const struct {
+		unsigned kind;
+		workfxn fxn;
+	} jobs[] = {
+		{ EVENT_UDEV, rescan_job, },
+		{ EVENT_SYSFS, scan_device, },
+		{ EVENT_MDALIAS, scan_mdalias, },
+		{ EVENT_BYPATH, scan_devbypath, },
+		{ EVENT_BYID, scan_devbyid, },
+		{ EVENT_ZPOOLS, zpool_job, },
+	};
+	unsigned z;
+
+	(void)unused;
+	if((kinds & EVENT_UDEV) && (kinds & EVENT_SYSFS)){
+		kinds &= ~EVENT_SYSFS;
+		coalescer_release(eventq,name,EVENT_SYSFS);
+	}
+	for(z = 0 ; z < sizeof(jobs) / sizeof(*jobs) ; ++z){
+		struct eventjob *ej;
+
+		if(!(kinds & jobs[z].kind)){
+			continue;
+		}
+		if( (ej = malloc(sizeof(*ej) + strlen(name) + 1)) ){
+			ej->fxn = jobs[z].fxn;
+			ej->kind = jobs[z].kind;
+			strcpy(ej->name,name);
+			if(workq_submit(discoveryq,event_job,ej) == 0){
+				continue;
+			}
+			free(ej);
+		}
+		diag("Couldn't queue event work for %s\n",name);
+		coalescer_release(eventq,name,jobs[z].kind);
+	}
+}
+
+// Events on a partition are coalesced onto its whole disk, which is what
+// rescan_device() refreshes anyway. The partition's sysfs link ends in
+// ".../block/sda/sda1"; a whole disk's in ".../block/sda". Names we can't
+// resolve (e.g. a partition already removed) are used as they are.
+static const char *
+event_disk(const char *name,char *buf,size_t len){
+	char link[PATH_MAX],*base,*parent;
+	ssize_t n;
+
+	if((n = readlinkat(sysfd,name,link,sizeof(link) - 1)) <= 0){
+		return name;
+	}
+	link[n] = '\0';
+	if((base = strrchr(link,'/')) == NULL || strcmp(base + 1,name)){
+		return name;
+	}
+	*base = '\0';
+	if((parent = strrchr(link,'/')) == NULL || strcmp(parent + 1,"block") == 0){
+		return name;
+	}
+	if((size_t)snprintf(buf,len,"%s",parent + 1) >= len){
+		return name;
+	}
+	return buf;
+}
+
+void defer_rescan(const char *name){
+	char disk[NAME_MAX + 1];
+	const char *key;
+	device *p;
+
+	name = strip_devprefix(name);
+	// rescan_device() is handed only the disk, so mark which partition
+	// saw the event, for refresh_device() to reprobe it
+	if((key = event_disk(name,disk,sizeof(disk))) != name){
+		lock_growlight();
+		if((p = devindex_name(&devices,name)) && p->layout == LAYOUT_PARTITION){
+			p->reprobe = 1;
+		}
+		unlock_growlight();
+	}
+	queue_event(key,EVENT_UDEV,rescan_job);
+}
+
+void defer_zpool_scan(void){
+	queue_event("",EVENT_ZPOOLS,zpool_job);
+}
+
+void get_event_counters(coalesce_stats *cs){
+	lock_growlight();
+	if(eventq){
+		coalescer_get_stats(eventq,cs);
+	}else{
+		memset(cs,0,sizeof(*cs));
+	}
+	unlock_growlight();
 }
 
 static inline int
@@ -1406,26 +3071,25 @@ inotify_fd(void){
 	return fd;
 }
 
-typedef void *(*eventfxn)(void *);
+// If discovery stops making progress for this long, stop waiting on it (the
+// stragglers continue to run in the pool).
+#define DISCOVERY_STALL_MS 10000
 
 // If fd >= 0, we use it as an inotify fd, and will set *wd to the
-// acquired watch descriptor. If timeout is set, we will only wait for some
-// finite amount of time for all the threads to complete (see function's end);
-// this is to work around busted hardware, since libblkid doesn't give us a
-// timeout. Theoretically, we oughtn't need a timeout at all, and we should be
-// able to just advance; otherwise, the timeout is buying us anything but
-// hidden bugs. We need address some things before that can happen, though.
-// FIXME
+// acquired watch descriptor. Each symlink found is handed to fxn on the
+// discovery pool. If timeout is set, we will only wait so long as some job
+// completes every DISCOVERY_STALL_MS; this is to work around busted hardware,
+// since libblkid doesn't give us a timeout. Theoretically, we oughtn't need a
+// timeout at all, and we should be able to just advance; otherwise, the
+// timeout is buying us anything but hidden bugs. We need address some things
+// before that can happen, though. FIXME
 static inline int
-watch_dir(int fd,const char *dfp,eventfxn fxn,int *wd,int timeout){
-	pthread_attr_t attr;
+watch_dir(int fd,const char *dfp,workfxn fxn,int *wd,int timeout){
+	workq_stats wstats;
 	struct dirent *d;
 	int r,dfd;
 	DIR *dir;
 
-	pthread_mutex_lock(&barrier);
-	assert(thrcount == 0);
-	pthread_mutex_unlock(&barrier);
 	if(fd >= 0){
 		*wd = inotify_add_watch(fd,dfp,IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO);
 		if(*wd < 0){
@@ -1447,22 +3111,15 @@ watch_dir(int fd,const char *dfp,eventfxn fxn,int *wd,int timeout){
 		closedir(dir);
 		return -1;
 	}
-	if( (r = pthread_attr_init(&attr)) ||
-		(r = pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED))){
-		diag("Couldn't set threads detachable (%s)\n",strerror(errno));
-	}
 	verbf("scanning %s on %d...\n",dfp,dfd);
 	while(d = NULL, errno = 0, (d = readdir(dir)) != NULL){
-		pthread_t tid;
 		if(d->d_type == DT_LNK){
-			pthread_mutex_lock(&barrier);
-			++thrcount;
-			pthread_mutex_unlock(&barrier);
-			if( (r = pthread_create(&tid,&attr,fxn,strdup(d->d_name))) ){
-				diag("Couldn't create thread (%s)\n",strerror(r));
-				pthread_mutex_lock(&barrier);
-				--thrcount;
-				pthread_mutex_unlock(&barrier);
+			char *name = strdup(d->d_name);
+
+			if(name == NULL || workq_submit(discoveryq,fxn,name)){
+				diag("Couldn't queue %s/%s\n",dfp,d->d_name);
+				free(name);
+				errno = 0;
 				break;
 			}
 		}
@@ -1472,36 +3129,28 @@ watch_dir(int fd,const char *dfp,eventfxn fxn,int *wd,int timeout){
 		r = -1;
 	}
 	closedir(dir);
-	pthread_attr_destroy(&attr);
-	pthread_mutex_lock(&barrier);
-	while(thrcount){
-		struct timespec ts;
-
-		if(timeout){
-			verbf("%s blocks on %u devices for up to 1s\n",dfp,thrcount);
-			ts.tv_sec = 0;
-			ts.tv_nsec = 100000000;
-			pthread_cond_timedwait(&discovery_cond,&lock,&ts);
-			pthread_cond_wait(&barrier_cond,&barrier);
-			break;
-		}else{
-			verbf("%s blocks on %u devices\n",dfp,thrcount);
-			pthread_cond_wait(&barrier_cond,&barrier);
-		}
+	workq_get_stats(discoveryq,&wstats);
+	verbf("%s blocks on %ju devices (%u workers)\n",dfp,
+		(uintmax_t)(wstats.submitted - wstats.completed),workq_threads(discoveryq));
+	if(workq_wait(discoveryq,timeout ? DISCOVERY_STALL_MS : 0)){
+		workq_get_stats(discoveryq,&wstats);
+		diag("%s stalled with %ju devices outstanding\n",dfp,
+			(uintmax_t)(wstats.submitted - wstats.completed));
 	}
-	pthread_mutex_unlock(&barrier);
 	return r;
 }
 
 static void
 version(const char *name){
-	diag("%s version %s\n",basename(name),VERSION);
+	glog(LOGLEVEL_INFO,"%s version %s\n",basename(name),VERSION);
 }
 
 static void
 usage(const char *name,int disphelp){
 	diag("usage: %s [ -h|--help ] [ -v|--verbose ] [ -V|--version ]\n"
-		"\t[ -t|--target=path ] [ -i|--import ]%s\n",
+		"\t[ -t|--target=path ] [ -i|--import ] [ -j|--threads=n ]\n"
+		"\t[ -r|--root=path ] [ -c|--cache=file ]\n"
+		"\t[ -s|--stats-interval=ms ] [ -a|--adaptive-stats ]%s\n",
 		basename(name),disphelp ? " [ --disphelp ]" : "");
 }
 
@@ -1509,35 +3158,100 @@ static int
 get_dir_fd(const char *root){
 	int fd;
 
-	if((fd = open(root,O_RDONLY|O_CLOEXEC|O_DIRECTORY)) < 0){
-		diag("Couldn't get dirfd at %s (%s)\n",root,strerror(errno));
+	if((fd = open(root,O_RDONLY|O_CLOEXEC|O_DIRECTORY)) < 0){
+		diag("Couldn't get dirfd at %s (%s)\n",root,strerror(errno));
+	}
+	return fd;
+}
+
+// Whether the diskstats row name is a partition, whose history would largely
+// duplicate its disk's.
+static int
+stats_partition(const char *name){
+	char path[PATH_MAX];
+
+	if((size_t)snprintf(path,sizeof(path),"%s/partition",name) >= sizeof(path)){
+		return 0;
 	}
-	return fd;
+	return faccessat(sysfd,path,F_OK,0) == 0;
 }
 
-// To be called only while holding the growlight lock. ts covers the time since
-// the last stat sampling.
-static void
-update_stats(const diskstats *stats, const struct timeval *tv, int statcount) {
+// The slot each diskstats row mapped to in the previous sample. Rows rarely
+// move, so in the steady state this replaces the devno index lookup. Stats
+// lane only.
+static devstats **rowslots;
+static unsigned rowslotsize;
+
+// To be called while holding statslock. tv covers the time since the last
+// stat sampling. Slots are keyed by devno alone, so the device tree (and the
+// growlight lock) needn't be consulted; those of devnos absent from this
+// sample are released. The devnos whose rates changed are written to updated,
+// which has room for statcount, and their number to *nupdated; idle devices
+// remain idle without troubling the UI. Returns the number of devices which
+// were busy.
+static int
+update_stats(const diskstats *stats, const struct timeval *tv, int statcount,
+		dev_t *updated, unsigned *nupdated) {
+	static unsigned gen;
+	struct timespec ts;
+	int busy = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	*nupdated = 0;
+	++gen;
+	if((unsigned)statcount > rowslotsize){
+		devstats **tmp;
+
+		if((tmp = realloc(rowslots, sizeof(*tmp) * statcount)) == NULL){
+			return 0;
+		}
+		memset(tmp + rowslotsize, 0, sizeof(*tmp) * (statcount - rowslotsize));
+		rowslots = tmp;
+		rowslotsize = statcount;
+	}
 	while(statcount--){
-		const diskstats *ds = &stats[statcount];
-		device *d = lookup_device(ds->name);
-		if(d == NULL){
-			diag("Got stats for unknown device [%s]\n", ds->name);
-			continue;
+		const diskstats *row = &stats[statcount];
+		devstats *ds = rowslots[statcount];
+		statrates prev;
+
+		if(ds == NULL || ds->devno != row->devno){
+			if((ds = statstable_devno(&hotstats, row->devno)) == NULL){
+				if((ds = statstable_alloc(&hotstats, row->devno)) == NULL){
+					rowslots[statcount] = NULL;
+					continue;
+				}
+				ds->keephist = !stats_partition(row->name);
+			}
+			rowslots[statcount] = ds;
 		}
-		if(d->stats.sectors_read == UINTMAX_MAX){
-			d->statdelta.sectors_read = 0;
-			d->statdelta.sectors_written = 0;
-		}else{
-			d->statdelta.sectors_read = ds->total.sectors_read - d->stats.sectors_read;
-			d->statdelta.sectors_written = ds->total.sectors_written - d->stats.sectors_written;
+		ds->gen = gen;
+		prev = ds->rates;
+		devstats_update(ds, &row->total, tv, ts.tv_sec);
+		if(ds->rates.util >= STATS_BUSY_UTIL){
+			++busy;
+		}
+		if(memcmp(&prev, &ds->rates, sizeof(prev))){
+			updated[(*nupdated)++] = row->devno;
 		}
-		d->stats.sectors_read = ds->total.sectors_read;
-		d->stats.sectors_written = ds->total.sectors_written;
-		memcpy(&d->statq, tv, sizeof(*tv));
-		d->uistate = gui->block_event(d, d->uistate);
 	}
+	statstable_sweep(&hotstats, gen);
+	return busy;
+}
+
+void lock_stats(void){
+	pthread_mutex_lock(&statslock);
+}
+
+void unlock_stats(void){
+	pthread_mutex_unlock(&statslock);
+}
+
+const devstats *device_stats(const device *d){
+	static const devstats unsampled;
+	const devstats *ds;
+
+	ds = d->devno ? statstable_devno(&hotstats, d->devno) : NULL;
+	return ds ? ds : &unsampled;
 }
 
 void timeval_subtract(struct timeval *elapsed, const struct timeval *minuend,
@@ -1573,24 +3287,366 @@ glight_pci_init(void){
 }
 
 static pthread_t eventtid;
+static int eventrunning;
+
+// Owned by the stats lane; released once that has been destroyed.
+static diskstats_reader dreader = DISKSTATS_READER_INITIALIZER;
+static struct timeval laststatcheck; // monotonic; stats lane only
+static dev_t *statsupdated;	// changed devnos for stats_event(); stats lane only
+static unsigned statsupdatedsize;
+
+// Disk stats sampling. interval is the configured period; in adaptive mode
+// it's the slowest we'll back off to while idle. armed is the period the
+// timer is currently running at (0 before the event thread arms it).
+// Protected by statslock.
+static struct {
+	unsigned interval;	// ms
+	unsigned armed;		// ms
+	int adaptive;
+	int timerfd;		// copy of the event marshal's stats_timerfd
+} sampler = {
+	.interval = STATS_INTERVAL_DEFAULT,
+	.timerfd = -1,
+};
+
+// Must be called while holding statslock, with a valid timerfd. Returns -1
+// with errno set on failure, to be reported once statslock is released.
+static int
+arm_stats_timer(unsigned ms){
+	struct itimerspec stattimer = {
+		.it_interval = { .tv_sec = ms / 1000, .tv_nsec = ms % 1000 * 1000000, },
+		.it_value = { .tv_sec = ms / 1000, .tv_nsec = ms % 1000 * 1000000, },
+	};
+
+	// on first arming, sample immediately to establish the baseline. One
+	// or both of tv_sec and tv_nsec must be non-zero to prime the timer.
+	if(sampler.armed == 0){
+		stattimer.it_value.tv_sec = 0;
+		stattimer.it_value.tv_nsec = 1;
+	}
+	if(timerfd_settime(sampler.timerfd, 0, &stattimer, NULL)){
+		return -1;
+	}
+	sampler.armed = ms;
+	return 0;
+}
+
+int set_stats_interval(unsigned ms, int adaptive){
+	int r = 0;
+
+	if(ms < STATS_INTERVAL_MIN){
+		ms = STATS_INTERVAL_MIN;
+	}else if(ms > STATS_INTERVAL_MAX){
+		ms = STATS_INTERVAL_MAX;
+	}
+	pthread_mutex_lock(&statslock);
+	sampler.interval = ms;
+	sampler.adaptive = !!adaptive;
+	// not yet running? event_thread() will arm it.
+	if(sampler.timerfd >= 0 && sampler.armed){
+		// adaptive mode restarts from the fast rate, and backs off
+		r = arm_stats_timer(sampler.adaptive ? STATS_INTERVAL_MIN : ms);
+	}
+	pthread_mutex_unlock(&statslock);
+	if(r){
+		diag("Couldn't arm stats timer for %ums (%s)\n", ms, strerror(errno));
+		return r;
+	}
+	verbf("Sampling disk stats every %ums%s\n", ms, adaptive ? " (adaptive)" : "");
+	return ms;
+}
+
+unsigned get_stats_interval(int *adaptive, unsigned *current){
+	unsigned ms;
+
+	pthread_mutex_lock(&statslock);
+	ms = sampler.interval;
+	if(adaptive){
+		*adaptive = sampler.adaptive;
+	}
+	if(current){
+		*current = sampler.armed ? sampler.armed : sampler.interval;
+	}
+	pthread_mutex_unlock(&statslock);
+	return ms;
+}
+
+// Called on the stats lane, holding statslock, following each sample. While
+// anything's busy, sample as fast as we allow; once everything has gone idle,
+// back off by doubling until we reach the configured rate. Returns -1 if the
+// timer couldn't be rearmed.
+static int
+adapt_stats_interval(int busy){
+	unsigned next;
+
+	if(!sampler.adaptive){
+		return 0;
+	}
+	if(busy){
+		next = STATS_INTERVAL_MIN;
+	}else if((next = sampler.armed * 2) > sampler.interval){
+		next = sampler.interval;
+	}
+	if(next != sampler.armed){
+		return arm_stats_timer(next);
+	}
+	return 0;
+}
 
 struct event_marshal {
 	int efd;		// epoll fd
 	int ifd;		// inotify fd
 	int ufd;		// udev_monitor fd
-	int mfd;		// /proc/mounts fd
+	int mfd;		// /proc/self/mountinfo fd
 	int sfd;		// /proc/swaps fd
 	int ffd;		// /proc/filesystems fd
 	int mdwd;		// /dev/md/ fd
 	int syswd;		// /sys/block watch descriptor
 	int bypathwd;		// /dev/disk/by-path watch descriptor
 	int byidwd;		// /dev/disk/by-id watch descriptor
-	int stats_timerfd;	// interval timer, 1Hz, for reading disk stats
+	int stats_timerfd;	// interval timer for reading disk stats
+	int coalescefd;		// closes the event coalescing window
+	int cmdfd;		// external commands' output and exits
+	int snapfd;		// trailing snapshot publication
 };
 
+// The kernel dropped events (IN_Q_OVERFLOW). Queue a scan of every block
+// device; those we already know are left alone by scan_device().
+static void
+resync_sysroot(void){
+	struct dirent *dire;
+	DIR *dir;
+
+	diag("inotify queue overflowed; rescanning %s\n",SYSROOT);
+	if((dir = opendir(SYSROOT)) == NULL){
+		diag("Couldn't open %s (%s)\n",SYSROOT,strerror(errno));
+		return;
+	}
+	while( (dire = readdir(dir)) ){
+		if(dire->d_name[0] != '.'){
+			queue_event(dire->d_name,EVENT_SYSFS,scan_device);
+		}
+	}
+	closedir(dir);
+}
+
+// Read until the inotify fd would block, walking every event in each read,
+// and queue them to the coalescer by watch. Each read can return many
+// events; looking only at the first silently dropped the rest.
+static void
+drain_inotify(const struct event_marshal *em){
+	// static so as not to be on the stack; only the event thread uses it
+	static char buf[65536] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct {
+		int wd;
+		unsigned kind;
+		workfxn fxn;
+		const char *path;
+	} watches[] = {
+		{ em->syswd, EVENT_SYSFS, scan_device, SYSROOT, },
+		{ em->mdwd, EVENT_MDALIAS, scan_mdalias, DEVMD, },
+		{ em->bypathwd, EVENT_BYPATH, scan_devbypath, DEVBYPATH, },
+		{ em->byidwd, EVENT_BYID, scan_devbyid, DEVBYID, },
+	};
+	unsigned counts[sizeof(watches) / sizeof(*watches)] = { 0 };
+	unsigned z;
+	ssize_t s;
+
+	while((s = read(em->ifd,buf,sizeof(buf))) > 0){
+		const struct inotify_event *in;
+		size_t idx;
+
+		for(idx = 0 ; idx + sizeof(*in) <= (size_t)s ; idx += sizeof(*in) + in->len){
+			in = (const struct inotify_event *)(buf + idx);
+			if(in->mask & IN_Q_OVERFLOW){
+				resync_sysroot();
+				continue;
+			}
+			if(in->len == 0){
+				if(!(in->mask & IN_IGNORED)){
+					diag("Nil-file event on unknown watch desc %d\n",in->wd);
+				}
+				continue;
+			}
+			for(z = 0 ; z < sizeof(watches) / sizeof(*watches) ; ++z){
+				if(watches[z].wd >= 0 && in->wd == watches[z].wd){
+					break;
+				}
+			}
+			if(z == sizeof(watches) / sizeof(*watches)){
+				diag("Event on unknown watch desc %d (%s)\n",in->wd,in->name);
+				continue;
+			}
+			queue_event(in->name,watches[z].kind,watches[z].fxn);
+			++counts[z];
+		}
+	}
+	if(s && errno != EAGAIN && errno != EWOULDBLOCK){
+		diag("Error reading inotify event on %d (%s)\n",em->ifd,strerror(errno));
+	}
+	for(z = 0 ; z < sizeof(watches) / sizeof(*watches) ; ++z){
+		if(counts[z]){
+			verbf("%u inotify event%s on %s\n",counts[z],
+					counts[z] == 1 ? "" : "s",watches[z].path);
+		}
+	}
+}
+
+// The event thread only dispatches. What it finds to do runs on one of these
+// lanes (each a workq), so that a slow blkid or SMART probe can't hold up
+// stats sampling or mount table updates, nor the reception of further
+// events. Rescans run on discoveryq, and the deep probes they defer on
+// probeq; the others are single threads, so their work is naturally
+// serialized.
+static struct workq *statsq;	// disk stats sampling
+static struct workq *tablesq;	// mountinfo, /proc/swaps, /proc/filesystems
+
+#define TABLE_MOUNTS		0x1u
+#define TABLE_SWAPS		0x2u
+#define TABLE_FILESYSTEMS	0x4u
+
+// Work requested while a job is already pending on its lane is folded into
+// that job, rather than queued behind it: a stats tick arriving while the
+// last sample is still in progress is skipped, and table changes accumulate
+// in pendingtables until the tables job starts.
+static pthread_mutex_t lanelock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned pendingtables;
+static int statsbusy;
+static uint64_t statsfolded,tablesfolded;
+
+static void
+stats_job(void *unused){
+	const diskstats *dstats;
+	struct timeval now, timeq;
+	unsigned updated;
+	struct timespec ts;
+	int statcount;
+	int busy, rearm;
+
+	(void)unused;
+	// the monotonic clock keeps statq honest across both rate changes and
+	// wall clock adjustments. the sample is stamped when read, so rates
+	// remain correct even if we must then wait on the lock.
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now.tv_sec = ts.tv_sec;
+	now.tv_usec = ts.tv_nsec / 1000;
+	statcount = read_diskstats(&dreader, paths.diskstats, &dstats);
+	if(statcount > 0 && (unsigned)statcount > statsupdatedsize){
+		dev_t *tmp;
+
+		if((tmp = realloc(statsupdated, sizeof(*tmp) * statcount)) == NULL){
+			statcount = -1;
+		}else{
+			statsupdated = tmp;
+			statsupdatedsize = statcount;
+		}
+	}
+	updated = 0;
+	rearm = 0;
+	pthread_mutex_lock(&statslock);
+	timeval_subtract(&timeq, &now, &laststatcheck);
+	if(statcount >= 0){
+		busy = update_stats(dstats, &timeq, statcount, statsupdated, &updated);
+		rearm = adapt_stats_interval(busy);
+		laststatcheck = now;
+	}
+	pthread_mutex_unlock(&statslock);
+	if(rearm){
+		diag("Couldn't rearm stats timer (%s)\n", strerror(errno));
+	}
+	// the UI reads them back through device_stats()
+	if(updated && gui->stats_event){
+		gui->stats_event(statsupdated, updated);
+	}
+	// off the lock, as it may call back into mounts
+	sweep_mount_usage();
+	pthread_mutex_lock(&lanelock);
+	statsbusy = 0;
+	pthread_mutex_unlock(&lanelock);
+}
+
+static void
+tables_job(void *unused){
+	unsigned tables;
+
+	(void)unused;
+	pthread_mutex_lock(&lanelock);
+	tables = pendingtables;
+	pendingtables = 0;
+	pthread_mutex_unlock(&lanelock);
+	lock_growlight();
+	if(tables & TABLE_FILESYSTEMS){
+		verbf("Reparsing %s...\n",FILESYSTEMS);
+		parse_filesystems(gui,FILESYSTEMS);
+	}
+	if(tables & TABLE_MOUNTS){
+		verbf("Updating from %s...\n",MOUNTS);
+		update_mounts(gui,MOUNTS);
+	}
+	if(tables & TABLE_SWAPS){
+		verbf("Reparsing %s...\n",SWAPS);
+		parse_swaps(gui,SWAPS);
+	}
+	unlock_growlight();
+}
+
+static void
+dispatch_stats(void){
+	int submit;
+
+	pthread_mutex_lock(&lanelock);
+	if( (submit = !statsbusy) ){
+		statsbusy = 1;
+	}else{
+		++statsfolded;
+	}
+	pthread_mutex_unlock(&lanelock);
+	if(submit && workq_submit(statsq,stats_job,NULL)){
+		stats_job(NULL);
+	}
+}
+
+static void
+dispatch_table(unsigned table){
+	int submit;
+
+	pthread_mutex_lock(&lanelock);
+	if(!(submit = (pendingtables == 0))){
+		++tablesfolded;
+	}
+	pendingtables |= table;
+	pthread_mutex_unlock(&lanelock);
+	if(submit && workq_submit(tablesq,tables_job,NULL)){
+		tables_job(NULL);
+	}
+}
+
+const char *get_lane_stats(unsigned lane,workq_stats *ws,uint64_t *folded){
+	static const char *names[] = { "stats", "tables", "probe", "deep", };
+	struct workq *wq;
+
+	lock_growlight();
+	switch(lane){
+		case 0: wq = statsq; break;
+		case 1: wq = tablesq; break;
+		case 2: wq = discoveryq; break;
+		case 3: wq = probeq; break;
+		default: unlock_growlight(); return NULL;
+	}
+	if(wq){
+		workq_get_stats(wq,ws);
+	}else{
+		memset(ws,0,sizeof(*ws));
+	}
+	unlock_growlight();
+	pthread_mutex_lock(&lanelock);
+	*folded = lane == 0 ? statsfolded : lane == 1 ? tablesfolded : 0;
+	pthread_mutex_unlock(&lanelock);
+	return names[lane];
+}
+
 static void *
 event_posix_thread(void *unsafe){
-	struct timeval laststatcheck = { .tv_sec = 0, .tv_usec = 0, };
 	const struct event_marshal *em = unsafe;
 	static struct epoll_event events[128]; // static so as not to be on the stack
 	int e,r;
@@ -1600,113 +3656,49 @@ event_posix_thread(void *unsafe){
 			e = epoll_wait(em->efd, events, sizeof(events) / sizeof(*events), 1000/*-1*/);
 			for(r = 0 ; r < e ; ++r){
 				if(events[r].data.fd == em->ifd){
-					char buf[BUFSIZ];
-					ssize_t s;
-
 					assert(events[r].events == EPOLLIN);
-					while((s = read(em->ifd,buf,sizeof(buf))) > 0){
-						const struct inotify_event *in;
-						unsigned idx = 0;
-
-						if(s - idx >= (ptrdiff_t)sizeof(*in)){
-							in = (struct inotify_event *)(buf + idx);
-							idx += sizeof(*in);
-
-							if(in->len == 0){
-								diag("Nil-file event on unknown watch desc %d\n",in->wd);
-							}else{
-								assert(pthread_mutex_lock(&barrier) == 0);
-								++thrcount;
-								assert(pthread_mutex_unlock(&barrier) == 0);
-								if(in->wd == em->syswd){
-									char *name = strdup(in->name);
-									assert(name);
-									scan_device(name);
-								}else if(in->wd == em->mdwd){
-									char *name = strdup(in->name);
-									assert(name);
-									scan_mdalias(name);
-								}else if(in->wd == em->bypathwd){
-									char *name = strdup(in->name);
-									assert(name);
-									scan_devbypath(name);
-								}else if(in->wd == em->byidwd){
-									char *name = strdup(in->name);
-									assert(name);
-									scan_devbyid(name);
-								}else{
-									assert(pthread_mutex_lock(&barrier) == 0);
-									--thrcount;
-									assert(pthread_mutex_unlock(&barrier) == 0);
-									diag("Event on unknown watch desc %d (%s)\n",in->wd,in->name);
-								}
-							}
-						}
-					}
-					if(s && errno != EAGAIN && errno != EWOULDBLOCK){
-						diag("Error reading inotify event on %d (%s)\n",
-								em->ifd,strerror(errno));
-					}
+					drain_inotify(em);
 				}else if(events[r].data.fd == em->ufd){
-					udev_event(gui);
+					udev_event();
+				}else if(events[r].data.fd == em->coalescefd){
+					coalescer_flush(eventq,dispatch_events,NULL);
+				}else if(events[r].data.fd == em->cmdfd){
+					cmd_service();
+				}else if(events[r].data.fd == em->snapfd){
+					snapshot_timer();
 				}else if(events[r].data.fd == em->mfd){
-					verbf("Reparsing %s...\n",MOUNTS);
-					lock_growlight();
-					clear_mounts(controllers);
-					parse_mounts(gui,MOUNTS);
-					unlock_growlight();
+					dispatch_table(TABLE_MOUNTS);
 				}else if(events[r].data.fd == em->sfd){
-					verbf("Reparsing %s...\n",SWAPS);
-					lock_growlight();
-					parse_swaps(gui,SWAPS);
-					unlock_growlight();
+					dispatch_table(TABLE_SWAPS);
 				}else if(events[r].data.fd == em->ffd){
-					verbf("Reparsing %s...\n",FILESYSTEMS);
-					lock_growlight();
-					parse_filesystems(gui,FILESYSTEMS);
-					unlock_growlight();
+					dispatch_table(TABLE_FILESYSTEMS);
 				}else if(events[r].data.fd == em->stats_timerfd){
-					struct timeval now;
 					uint64_t dontcare;
-					diskstats *dstats;
-					int statcount;
 
 					read(em->stats_timerfd, &dontcare, sizeof(dontcare));
-					gettimeofday(&now, NULL);
-					statcount = read_proc_diskstats(&dstats);
-					lock_growlight();
-					struct timeval timeq;
-					timeval_subtract(&timeq, &now, &laststatcheck);
-					if(statcount >= 0){
-						update_stats(dstats, &timeq, statcount);
-					}
-					unlock_growlight();
-					if(statcount >= 0){
-						free(dstats);
-					}
+					dispatch_stats();
 				}else{
 					diag("Unknown fd %d saw event\n",events[r].data.fd);
 				}
 			}
 		}while(e >= 0);
-		diag("Error processing event queue (%s)\n",strerror(errno));
+		glog(LOGLEVEL_ERROR,"Error processing event queue (%s)\n",strerror(errno));
 	}while(1);
 	return NULL;
 }
 
 static int
 event_thread(int ifd,int ufd,int syswd,int bypathwd,int byidwd,int mdwd){
-	struct itimerspec stattimer = {
-		.it_interval = { .tv_sec = 1, .tv_nsec = 0, },
-	};
 	struct event_marshal *em;
 	struct epoll_event ev;
+	int *tablefds[3];
+	unsigned z;
 	int r;
 
 	memset(&ev, 0, sizeof(ev));
 	ev.events = EPOLLIN | EPOLLRDHUP;
 	if((em = malloc(sizeof(*em))) == NULL){
-		diag("Couldn't create event marshal (%s)\n",strerror(errno));
+		glog(LOGLEVEL_ERROR,"Couldn't create event marshal (%s)\n",strerror(errno));
 		return -1;
 	}
 #ifdef HAVE_EPOLL_CREATE1
@@ -1714,20 +3706,20 @@ event_thread(int ifd,int ufd,int syswd,int bypathwd,int byidwd,int mdwd){
 #else
 	if((em->efd = epoll_create(5)) < 0){
 #endif
-		diag("Couldn't create epoll (%s)\n",strerror(errno));
+		glog(LOGLEVEL_ERROR,"Couldn't create epoll (%s)\n",strerror(errno));
 		free(em);
 		return -1;
 	}
 	ev.data.fd = ifd;
 	if(epoll_ctl(em->efd,EPOLL_CTL_ADD,ifd,&ev)){
-		diag("Couldn't add %d to epoll (%s)\n",ifd,strerror(errno));
+		glog(LOGLEVEL_ERROR,"Couldn't add %d to epoll (%s)\n",ifd,strerror(errno));
 		close(em->efd);
 		free(em);
 		return -1;
 	}
 	ev.data.fd = ufd;
-	if(epoll_ctl(em->efd,EPOLL_CTL_ADD,ufd,&ev)){
-		diag("Couldn't add %d to epoll (%s)\n",ufd,strerror(errno));
+	if(ufd >= 0 && epoll_ctl(em->efd,EPOLL_CTL_ADD,ufd,&ev)){
+		glog(LOGLEVEL_ERROR,"Couldn't add %d to epoll (%s)\n",ufd,strerror(errno));
 		close(em->efd);
 		free(em);
 		return -1;
@@ -1743,15 +3735,21 @@ event_thread(int ifd,int ufd,int syswd,int bypathwd,int byidwd,int mdwd){
 		free(em);
 		return -1;
 	}
-	// One or both of tv_sec and tv_nsec must be non-zero to prime the timer
-	stattimer.it_value.tv_sec = 0;
-	stattimer.it_value.tv_nsec = 1;
-	if(timerfd_settime(em->stats_timerfd, 0, &stattimer, NULL)){
+	lock_growlight();
+	pthread_mutex_lock(&statslock);
+	sampler.timerfd = em->stats_timerfd;
+	sampler.armed = 0;
+	if(arm_stats_timer(sampler.adaptive ? STATS_INTERVAL_MIN : sampler.interval)){
+		sampler.timerfd = -1;
+		pthread_mutex_unlock(&statslock);
+		unlock_growlight();
+		diag("Couldn't arm stats timer (%s)\n", strerror(errno));
 		close(em->stats_timerfd);
 		close(em->efd);
 		free(em);
 		return -1;
 	}
+	pthread_mutex_unlock(&statslock);
 	if((em->mfd = open(MOUNTS,O_RDONLY|O_CLOEXEC)) < 0){
 		close(em->stats_timerfd);
 		close(em->efd);
@@ -1775,7 +3773,7 @@ event_thread(int ifd,int ufd,int syswd,int bypathwd,int byidwd,int mdwd){
 	}
 	ev.data.fd = em->stats_timerfd;
 	if(epoll_ctl(em->efd, EPOLL_CTL_ADD, em->stats_timerfd, &ev)){
-		diag("Couldn't add %d to epoll (%s)\n", em->stats_timerfd, strerror(errno));
+		glog(LOGLEVEL_ERROR,"Couldn't add %d to epoll (%s)\n", em->stats_timerfd, strerror(errno));
 		close(em->stats_timerfd);
 		close(em->ffd);
 		close(em->sfd);
@@ -1784,11 +3782,10 @@ event_thread(int ifd,int ufd,int syswd,int bypathwd,int byidwd,int mdwd){
 		free(em);
 		return -1;
 	}
-	// /proc/* always returns readable. On change they return EPOLLERR.
-	ev.events = EPOLLRDHUP;
-	ev.data.fd = em->ffd;
-	if(epoll_ctl(em->efd, EPOLL_CTL_ADD, em->ffd, &ev)){
-		diag("Couldn't add %d to epoll (%s)\n",em->ffd,strerror(errno));
+	em->coalescefd = coalescer_fd(eventq);
+	ev.data.fd = em->coalescefd;
+	if(epoll_ctl(em->efd, EPOLL_CTL_ADD, em->coalescefd, &ev)){
+		glog(LOGLEVEL_ERROR,"Couldn't add %d to epoll (%s)\n", em->coalescefd, strerror(errno));
 		close(em->stats_timerfd);
 		close(em->ffd);
 		close(em->sfd);
@@ -1797,20 +3794,38 @@ event_thread(int ifd,int ufd,int syswd,int bypathwd,int byidwd,int mdwd){
 		free(em);
 		return -1;
 	}
-	ev.data.fd = em->sfd;
-	if(epoll_ctl(em->efd,EPOLL_CTL_ADD,em->sfd,&ev)){
-		diag("Couldn't add %d to epoll (%s)\n",em->sfd,strerror(errno));
-		close(em->stats_timerfd);
-		close(em->ffd);
-		close(em->sfd);
-		close(em->mfd);
-		close(em->efd);
-		free(em);
-		return -1;
+	// Without it, jobs are serviced only by those waiting on them
+	if((em->cmdfd = cmd_runner_fd()) >= 0){
+		ev.data.fd = em->cmdfd;
+		if(epoll_ctl(em->efd, EPOLL_CTL_ADD, em->cmdfd, &ev)){
+			glog(LOGLEVEL_ERROR,"Couldn't add %d to epoll (%s)\n", em->cmdfd, strerror(errno));
+			em->cmdfd = -1;
+		}
+	}
+	if((em->snapfd = snaptimerfd) >= 0){
+		ev.data.fd = em->snapfd;
+		if(epoll_ctl(em->efd, EPOLL_CTL_ADD, em->snapfd, &ev)){
+			glog(LOGLEVEL_ERROR,"Couldn't add %d to epoll (%s)\n", em->snapfd, strerror(errno));
+			em->snapfd = -1;
+		}
 	}
-	ev.data.fd = em->mfd;
-	if(epoll_ctl(em->efd,EPOLL_CTL_ADD,em->mfd,&ev)){
-		diag("Couldn't add %d to epoll (%s)\n",em->mfd,strerror(errno));
+	// /proc/* always returns readable. On change they return EPOLLERR.
+	// An alternate root's tables are plain files, which can't be polled
+	// (EPERM), and are simply never reread.
+	ev.events = EPOLLRDHUP;
+	tablefds[0] = &em->ffd;
+	tablefds[1] = &em->sfd;
+	tablefds[2] = &em->mfd;
+	for(z = 0 ; z < sizeof(tablefds) / sizeof(*tablefds) ; ++z){
+		ev.data.fd = *tablefds[z];
+		if(epoll_ctl(em->efd,EPOLL_CTL_ADD,*tablefds[z],&ev) == 0){
+			continue;
+		}
+		if(errno == EPERM){
+			verbf("Not watching unpollable fd %d\n",*tablefds[z]);
+			continue;
+		}
+		glog(LOGLEVEL_ERROR,"Couldn't add %d to epoll (%s)\n",*tablefds[z],strerror(errno));
 		close(em->stats_timerfd);
 		close(em->ffd);
 		close(em->sfd);
@@ -1820,7 +3835,7 @@ event_thread(int ifd,int ufd,int syswd,int bypathwd,int byidwd,int mdwd){
 		return -1;
 	}
 	if( (r = pthread_create(&eventtid, NULL, event_posix_thread, em)) ){
-		diag("Couldn't create event thread (%s)\n", strerror(r));
+		glog(LOGLEVEL_ERROR,"Couldn't create event thread (%s)\n", strerror(r));
 		close(em->stats_timerfd);
 		close(em->ffd);
 		close(em->sfd);
@@ -1829,6 +3844,7 @@ event_thread(int ifd,int ufd,int syswd,int bypathwd,int byidwd,int mdwd){
 		free(em);
 		return -1;
 	}
+	eventrunning = 1;
 	return 0;
 }
 
@@ -1836,6 +3852,10 @@ static int
 kill_event_thread(void){
 	int r = 0,rr;
 
+	if(!eventrunning){
+		return shutdown_udev();
+	}
+	eventrunning = 0;
 	if( (rr = pthread_cancel(eventtid)) ){
 		diag("Couldn't cancel event thread (%s)\n",strerror(rr));
 		r |= -1;
@@ -1843,6 +3863,11 @@ kill_event_thread(void){
 	if( (rr = pthread_join(eventtid,NULL)) ){
 		diag("Couldn't join event thread (%s)\n",strerror(rr));
 		r |= -1;
+	}else{
+		pthread_mutex_lock(&statslock);
+		sampler.timerfd = -1;
+		sampler.armed = 0;
+		pthread_mutex_unlock(&statslock);
 	}
 	r |= shutdown_udev();
 	return r;
@@ -1864,11 +3889,36 @@ int growlight_init(int argc,char * const *argv,const glightui *ui,int *disphelp)
 			.has_arg = 0,
 			.flag = NULL,
 			.val = 'h',
+		},{
+			.name = "adaptive-stats",
+			.has_arg = 0,
+			.flag = NULL,
+			.val = 'a',
+		},{
+			.name = "cache",
+			.has_arg = 1,
+			.flag = NULL,
+			.val = 'c',
 		},{
 			.name = "import",
 			.has_arg = 0,
 			.flag = NULL,
 			.val = 'i',
+		},{
+			.name = "threads",
+			.has_arg = 1,
+			.flag = NULL,
+			.val = 'j',
+		},{
+			.name = "root",
+			.has_arg = 1,
+			.flag = NULL,
+			.val = 'r',
+		},{
+			.name = "stats-interval",
+			.has_arg = 1,
+			.flag = NULL,
+			.val = 's',
 		},{
 			.name = "target",
 			.has_arg = 2,
@@ -1897,10 +3947,17 @@ int growlight_init(int argc,char * const *argv,const glightui *ui,int *disphelp)
 		},
 	};
 	int fd,opt,longidx,udevfd,syswd,mdwd,bypathwd,byidwd;
-	int import,detcopy;
+	int import,detcopy,adaptive;
+	unsigned statsms,threads;
 	char buf[BUFSIZ];
 
-	gui = ui;
+	realui = ui;
+	snapui = *ui;
+	snapui.adapter_event = snap_adapter_event;
+	snapui.block_event = snap_block_event;
+	snapui.adapter_free = snap_adapter_free;
+	snapui.block_free = snap_block_free;
+	gui = &snapui;
 	if(setlocale(LC_ALL,"") == NULL){
 		diag("Couldn't set locale (%s)\n",strerror(errno));
 		goto err;
@@ -1913,10 +3970,65 @@ int growlight_init(int argc,char * const *argv,const glightui *ui,int *disphelp)
 		detcopy = 0;
 	}
 	import = 0;
+	adaptive = 0;
+	statsms = STATS_INTERVAL_DEFAULT;
+	threads = 0;
 	opterr = 0; // disallow getopt(3) diagnostics to stderr
-	while((opt = getopt_long(argc,argv,":hit:vV",ops,&longidx)) >= 0){
+	while((opt = getopt_long(argc,argv,":ac:hij:r:s:t:vV",ops,&longidx)) >= 0){
 		switch(opt){
-		case 'h':{
+		case 'a':{
+			adaptive = 1;
+			break;
+		}case 'c':{
+			if(invpath){
+				diag("Error: provided -c/--cache twice\n");
+				usage(argv[0],detcopy);
+				return -1;
+			}
+			if((invpath = strdup(optarg)) == NULL){
+				return -1;
+			}
+			break;
+		}case 'j':{
+			char *eptr;
+			unsigned long ul;
+
+			errno = 0;
+			ul = strtoul(optarg,&eptr,10);
+			if(errno || *eptr || ul == 0 || ul > MAX_DISCOVERY_THREADS){
+				diag("-j|--threads requires 1..%u, got %s\n",
+						MAX_DISCOVERY_THREADS,optarg);
+				usage(argv[0],detcopy);
+				return -1;
+			}
+			threads = ul;
+			break;
+		}case 'r':{
+			if(paths.root[0]){
+				diag("Error: provided -r/--root twice\n");
+				usage(argv[0],detcopy);
+				return -1;
+			}
+			if(set_root(optarg)){
+				usage(argv[0],detcopy);
+				return -1;
+			}
+			break;
+		}case 's':{
+			char *eptr;
+			unsigned long ul;
+
+			errno = 0;
+			ul = strtoul(optarg,&eptr,10);
+			if(errno || *eptr || ul < STATS_INTERVAL_MIN || ul > STATS_INTERVAL_MAX){
+				diag("-s|--stats-interval requires %u..%u (ms), got %s\n",
+						STATS_INTERVAL_MIN,STATS_INTERVAL_MAX,optarg);
+				usage(argv[0],detcopy);
+				return -1;
+			}
+			statsms = ul;
+			break;
+		}case 'h':{
 			usage(argv[0],detcopy);
 			return -1;
 		}case 'i':{
@@ -1985,7 +4097,9 @@ int growlight_init(int argc,char * const *argv,const glightui *ui,int *disphelp)
 	verbf("%s %s\nlibblkid %s, libpci 0x%x, libdm %s, glibc %s %s\n",PACKAGE,
 			PACKAGE_VERSION,BLKID_VERSION,PCI_LIB_VERSION,buf,
 			gnu_get_libc_version(),gnu_get_libc_release());
-	if(glight_pci_init()){
+	if(paths.root[0]){
+		verbf("Using alternate root %s\n",paths.root);
+	}else if(glight_pci_init()){
 		diag("Couldn't init libpciaccess (%s)\n",strerror(errno));
 	}else{
 		usepci = 1;
@@ -1994,7 +4108,7 @@ int growlight_init(int argc,char * const *argv,const glightui *ui,int *disphelp)
 		diag("Couldn't cd to %s (%s)\n",SYSROOT,strerror(errno));
 		goto err;
 	}
-	dmi_init();
+	dmi_init(paths.dmi);
 	if((sysfd = get_dir_fd(SYSROOT)) < 0){
 		goto err;
 	}
@@ -2005,10 +4119,40 @@ int growlight_init(int argc,char * const *argv,const glightui *ui,int *disphelp)
 		goto err;
 	}
 	init_special_adapters();
+	if(threads == 0){
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		threads = (cpus > 0 ? cpus : 1) * DISCOVERY_THREADS_PER_CPU;
+		if(threads < DISCOVERY_THREADS_MIN){
+			threads = DISCOVERY_THREADS_MIN;
+		}else if(threads > MAX_DISCOVERY_THREADS){
+			threads = MAX_DISCOVERY_THREADS;
+		}
+	}
+	if((discoveryq = workq_create(threads)) == NULL){
+		diag("Couldn't launch discovery workers\n");
+		goto err;
+	}
+	verbf("Discovering with %u workers\n",workq_threads(discoveryq));
+	if((probeq = workq_create(threads)) == NULL){
+		diag("Couldn't launch probe workers\n");
+		goto err;
+	}
+	if((statsq = workq_create(1)) == NULL || (tablesq = workq_create(1)) == NULL){
+		diag("Couldn't launch event workers\n");
+		goto err;
+	}
+	if((eventq = coalescer_create(EVENT_COALESCE_MS)) == NULL){
+		goto err;
+	}
+	// without it, a held back publication waits upon the next change
+	if((snaptimerfd = timerfd_create(CLOCK_MONOTONIC,TFD_CLOEXEC|TFD_NONBLOCK)) < 0){
+		diag("Couldn't create snapshot timer (%s)\n",strerror(errno));
+	}
 	if(crypt_start()){
 		goto err;
 	}
-	if(init_zfs_support(gui)){
+	if(!paths.root[0] && init_zfs_support(gui)){
 		goto err;
 	}
 	if(import){
@@ -2016,6 +4160,12 @@ int growlight_init(int argc,char * const *argv,const glightui *ui,int *disphelp)
 			goto err;
 		}
 	}
+	if(invpath){
+		if((invloaded = inventory_load(invpath)) == NULL){
+			goto err;
+		}
+		inventory = invloaded;
+	}
 	if(watch_dir(fd,SYSROOT,scan_device,&syswd,1)){
 		goto err;
 	}
@@ -2044,12 +4194,23 @@ int growlight_init(int argc,char * const *argv,const glightui *ui,int *disphelp)
 		goto err;
 	}
 	unlock_growlight();
-	if((udevfd = monitor_udev()) < 0){
+	// the inventory is written back from fully-probed disks
+	if(invloaded && workq_wait(probeq,DISCOVERY_STALL_MS)){
+		diag("Deep probes stalled; caching only those complete\n");
+	}
+	finish_inventory();
+	if(paths.root[0]){
+		udevfd = -1; // a fabricated tree sees no uevents
+	}else if((udevfd = monitor_udev()) < 0){
 		goto err;
 	}
+	set_stats_interval(statsms,adaptive);
 	if(event_thread(fd,udevfd,syswd,bypathwd,byidwd,mdwd)){
 		goto err;
 	}
+	lock_growlight();
+	publish_snapshot(1);
+	unlock_growlight();
 	return 0;
 
 err:
@@ -2057,15 +4218,59 @@ err:
 	return -1;
 }
 
+// How long shutdown waits on each lane's outstanding work. A blkid or SG_IO
+// probe wedged on dead hardware can block indefinitely; past this, its worker
+// is abandoned rather than allowed to hang the exit.
+#define LANE_STOP_MS 5000
+
+// Returns the number of workers abandoned.
+static unsigned
+stop_lane(struct workq **wq,const char *name){
+	unsigned stuck;
+
+	if( (stuck = workq_destroy_deadline(*wq,LANE_STOP_MS)) ){
+		diag("Abandoned %u stuck worker%s on the %s lane\n",
+			stuck,stuck == 1 ? "" : "s",name);
+	}
+	*wq = NULL;
+	return stuck;
+}
+
 int growlight_stop(void){
+	unsigned stuck = 0;
 	int r = 0;
 
 	diag("Killing the event thread...\n");
 	r |= kill_event_thread();
+	// the lanes finish whatever was dispatched to them before exiting
+	stuck += stop_lane(&statsq,"stats");
+	stuck += stop_lane(&tablesq,"tables");
+	stuck += stop_lane(&discoveryq,"probe");
+	stuck += stop_lane(&probeq,"deep");
+	// only now, as event jobs release their holds as they start
+	coalescer_destroy(eventq);
+	eventq = NULL;
+	free_diskstats_reader(&dreader);
+	free(statsupdated);
+	statsupdated = NULL;
+	statsupdatedsize = 0;
+	free(rowslots);
+	rowslots = NULL;
+	rowslotsize = 0;
+	memset(&laststatcheck,0,sizeof(laststatcheck));
+	statsbusy = 0;
+	pendingtables = 0;
 	/*diag("Closing libblkid...\n");
 	r |= close_blkid();*/
-	diag("Freeing devtable...\n");
-	free_devtable();
+	// no usage callbacks may be running once the devices are gone
+	free_mounts();
+	// an abandoned worker may yet return into the devices it was probing
+	if(stuck){
+		diag("Leaving devtable for stuck workers\n");
+	}else{
+		diag("Freeing devtable...\n");
+		free_devtable();
+	}
 	if(usepci){
 		diag("Closing libpci...\n");
 		pci_cleanup(pciacc);
@@ -2075,6 +4280,21 @@ int growlight_stop(void){
 	r |= crypt_stop();
 	close(sysfd); sysfd = -1;
 	close(devfd); devfd = -1;
+	inventory = NULL;
+	inventory_free(invloaded);
+	invloaded = NULL;
+	free(invpath);
+	invpath = NULL;
+	retire_snapshot();
+	if(snaptimerfd >= 0){
+		close(snaptimerfd);
+		snaptimerfd = -1;
+	}
+	snaptimerarmed = 0;
+	free(snapctrls);
+	free(snapdevs);
+	snapctrls = snapdevs = NULL;
+	snapctrlsize = snapdevsize = 0;
 	if(growlight_target){
 		if(!finalized){
 			diag("Didn't finalize target before exiting, uh-oh!\n");
@@ -2123,13 +4343,14 @@ int reset_controller(controller *c){
 }
 
 int benchmark_blockdev(const device *d){
+	const char *argv[] = { "hdparm", "-t", NULL, NULL, };
 	char buf[PATH_MAX];
 
-	if(snprintf(buf,sizeof(buf),"hdparm -t /dev/%s",d->name) >= (int)sizeof(buf)){
-		diag("Name too long: %s\n",d->name);
+	if(devnode_path(buf,sizeof(buf),d->name)){
 		return -1;
 	}
-	if(popen_drain(buf)){
+	argv[2] = buf;
+	if(spawn_bgv(argv) == 0){
 		return -1;
 	}
 	return 0;
@@ -2146,7 +4367,7 @@ rescan_blockdev_internal(const device *d,int killedpart){
 	char buf[PATH_MAX];
 	int fd;
 
-	if(snprintf(buf,sizeof(buf),SYSROOT"/%s/device/rescan",d->name) >= (int)sizeof(buf)){
+	if(snprintf(buf,sizeof(buf),"%s/%s/device/rescan",SYSROOT,d->name) >= (int)sizeof(buf)){
 		diag("Name too long: %s\n",d->name);
 		return -1;
 	}
@@ -2154,7 +4375,7 @@ rescan_blockdev_internal(const device *d,int killedpart){
 		diag("Failed writing to %s/rescan (%s?)\n",d->name,strerror(errno));
 		return -1;
 	}
-	diag("Wrote '1' to %s\n",buf);
+	glog(LOGLEVEL_INFO,"Wrote '1' to %s\n",buf);
 	if((fd = openat(devfd,d->name,O_RDWR|O_CLOEXEC)) < 0){
 		diag("Couldn't open /dev/%s (%s?)\n",d->name,strerror(errno));
 		return -1;
@@ -2183,67 +4404,110 @@ int rescan_blockdev_blkrrpart(const device *d){
 
 void lock_growlight(void){
 	assert(pthread_mutex_lock(&lock) == 0);
+	++lockdepth;
 }
 
 void unlock_growlight(void){
+	if(lockdepth == 1){
+		publish_snapshot(0);
+	}
+	--lockdepth;
 	assert(pthread_mutex_unlock(&lock) == 0);
 }
 
-int rescan_device(const char *name){
-	device **lnk;
-	controller *c;
-	size_t s;
+unsigned shed_growlight(void){
+	unsigned depth = lockdepth,z;
+
+	if(depth == 0){
+		return 0;
+	}
+	publish_snapshot(0);
+	// the UI's lock nests within ours, and must be retaken after it
+	uished = gui->shed ? gui->shed() : 0;
+	lockdepth = 0;
+	for(z = 0 ; z < depth ; ++z){
+		assert(pthread_mutex_unlock(&lock) == 0);
+	}
+	return depth;
+}
 
+void reclaim_growlight(unsigned depth){
+	unsigned z;
+
+	if(depth == 0){
+		return;
+	}
+	for(z = 0 ; z < depth ; ++z){
+		assert(pthread_mutex_lock(&lock) == 0);
+	}
+	lockdepth = depth;
+	if(gui->reclaim){
+		gui->reclaim(uished);
+	}
+}
+
+void hold_device(device *d){
 	lock_growlight();
-	do{
-		if(strncmp(name,"/",1) == 0){
-			s = 1;
-		}else if(strncmp(name,"./",2) == 0){
-			s = 2;
-		}else if(strncmp(name,"../",3) == 0){
-			s = 3;
-		}else if(strncmp(name,"dev/",4) == 0){
-			s = 4;
-		}else{
-			s = 0;
-		}
-		name += s;
-	}while(s);
-	for(c = controllers ; c ; c = c->next){
-		for(lnk = &c->blockdevs ; *lnk ; lnk = &(*lnk)->next){
-			device *d;
+	if(d->layout == LAYOUT_PARTITION){
+		d = d->partdev.parent;
+	}
+	++d->busy;
+	unlock_growlight();
+}
 
-			if(strcmp(name,(*lnk)->name)){
-				if((*lnk)->layout == LAYOUT_NONE){
-					const device *p;
+void release_device(device *d){
+	lock_growlight();
+	if(d->layout == LAYOUT_PARTITION){
+		d = d->partdev.parent;
+	}
+	assert(d->busy);
+	if(--d->busy == 0){
+		pthread_cond_broadcast(&busycond);
+	}
+	unlock_growlight();
+}
 
-					for(p = (*lnk)->parts ; p ; p = p->next){
-						if(strcmp(name,p->name) == 0){
-							break;
-						}
-					}
-					if(p == NULL){
-						continue;
-					}
-				}else{
-					continue;
-				}
-			} // if we get here, we've matched up
-			d = *lnk;
-			*lnk = (*lnk)->next;
+int rescan_device(const char *name){
+	device *d;
+
+	lock_growlight();
+	name = strip_devprefix(name);
+	if( (d = await_device(name)) ){
+		device **lnk;
+		int r;
+
+		if(d->layout == LAYOUT_PARTITION){
+			d = d->partdev.parent;
+		}
+		if((r = refresh_device(d,name)) <= 0){
+			unlock_growlight();
+			return r;
+		}
+		// not something we can refresh; rediscover it from scratch
+		for(lnk = &d->c->blockdevs ; *lnk ; lnk = &(*lnk)->next){
+			if(*lnk == d){
+				break;
+			}
+		}
+		if(*lnk){
+			*lnk = d->next;
+			devindex_del(&devices,d);
 			internal_device_reset(d);
 			// a successful rescan() reinserts the device
-			if(rescan(d->name,d) == NULL){
+			if((d = rescan(d->name,d)) == NULL){
 				unlock_growlight();
 				return -1;
 			}
-			clear_mounts(controllers);
-			parse_mounts(gui,MOUNTS);
+			update_mounts(gui,MOUNTS);
+			reattribute_mounts(gui,d);
 			unlock_growlight();
 			return 0;
 		}
+		unlock_growlight();
+		return 0;
 	}
-	if(create_new_device(name) == NULL){
+	// joins any discovery of name already underway
+	if(lookup_device(name) == NULL){
 		unlock_growlight();
 		return -1;
 	}
@@ -17,7 +17,10 @@ extern "C" {
 #include <sys/types.h>
 
 #include "gpt.h"
+#include "arena.h"
+#include "fsusage.h"
 #include "stats.h"
+#include "logring.h"
 #include "mounts.h"
 #include "ptypes.h"
 #include "target.h"
@@ -25,11 +28,20 @@ extern "C" {
 
 extern unsigned verbose;
 extern unsigned finalized;
-void diag(const char *,...) __attribute__ ((format (printf,1,2)));
-void verbf(const char *,...) __attribute__ ((format (printf,1,2)));
+// Diagnostics go to the UI (verbf()'s only with --verbose) and to the log
+// ring (see get_logs()), tagged with the calling source file.
+void glog_at(loglevel,const char *,const char *,...) __attribute__ ((format (printf,3,4)));
+#define glog(level,...) glog_at((level),__FILE__,__VA_ARGS__)
+#define diag(...) glog_at(LOGLEVEL_WARNING,__FILE__,__VA_ARGS__)
+#define verbf(...) glog_at(LOGLEVEL_VERBOSE,__FILE__,__VA_ARGS__)
 
 extern int sysfd,devfd;
 
+// Write the path of name's device node to buf, beneath the alternate root if
+// one is in use (so that nothing acts on the live system's identically-named
+// device). Returns -1 if it doesn't fit.
+int devnode_path(char *buf,size_t len,const char *name);
+
 #define GUIDSTRLEN 36	// 16 2-char hex pairs with 4 hyphens
 #define FSLABELSIZ 17	// 16 chars + null terminator
 
@@ -51,11 +63,23 @@ typedef struct growlight_ui {
 	// Called for a new blockdev, or when one changes
 	void *(*block_event)(struct device *,void *);
 
+	// Called following each stats sample with the devnos whose rates
+	// changed (not at all if none did), without the growlight lock. Read
+	// the results with device_stats(). Optional.
+	void (*stats_event)(const dev_t *,unsigned);
+
 	// Controller state
 	void (*adapter_free)(void *);
 
 	// Controller state followed by block state
 	void (*block_free)(void *,void *);
+
+	// Called as a thread drops (shed_growlight()) and retakes
+	// (reclaim_growlight()) the growlight lock, to drop and retake any
+	// lock of the UI's nested within it. shed returns what's to be passed
+	// to reclaim. Optional.
+	unsigned (*shed)(void);
+	void (*reclaim)(unsigned);
 } glightui;
 
 const glightui *get_glightui(void);
@@ -99,6 +123,16 @@ typedef struct {
 	char **list;
 } stringlist;
 
+// What a rescan found to have changed, as reported to block_event() through
+// the device's "changes" mask.
+#define DEVCHANGE_SIZE		0x01u	// capacity
+#define DEVCHANGE_MEDIA		0x02u	// removable media inserted or ejected
+#define DEVCHANGE_PARTS		0x04u	// partitions added, removed or moved
+#define DEVCHANGE_CONTENT	0x08u	// partition table or fs signatures
+#define DEVCHANGE_ATTRS		0x10u	// sector sizes, scheduler, holders
+#define DEVCHANGE_PROBED	0x20u	// deferred deep probes completed
+#define DEVCHANGE_ALL		0x3fu	// full (re)discovery
+
 // An (non-link) entry in the device hierarchy, representing a block device.
 // A partition corresponds to one and only one block device (which of course
 // might represent multiple devices, or maybe just a file mounted loopback). A
@@ -111,7 +145,7 @@ typedef struct device {
 	char name[NAME_MAX + 1];	// Entry in /dev or /sys/block
 	struct device *next;		// next block device on this controller
 	// FIXME model/revision should not be in partition
-	char *model,*revision;		// Arbitrary UTF-8 strings
+	char *model,*revision;		// Arbitrary UTF-8 strings (in strings)
 	// FIXME add by-label, and by-uuid links? handle multiple by-* links?
 	char *bypath;			// Alias in /dev/disks/by-path/
 	char *byid;			// Alias in /dev/disks/by-id/
@@ -123,6 +157,7 @@ typedef struct device {
 	char *label;			// *Filesystem* label
 	char *mnttype;			// Type of mount (can be "swap")
 	uintmax_t mntsize;		// Filesystem size in bytes
+	fsusage mntusage;		// Latest statvfs() figures (see fsusage.h)
 	stringlist mnt;			// Active mount points
 	stringlist mntops;		// Corresponding mount options
 	// Ranges from 0 to 32565, 0 highest priority. For our purposes, we
@@ -136,7 +171,7 @@ typedef struct device {
 	unsigned logsec;	// Logical sector size in bytes
 	unsigned physsec;	// Physical sector size in bytes
 	struct controller *c;
-	char *sched;		// I/O scheduler (can be NULL)
+	char *sched;		// I/O scheduler (can be NULL, in strings)
 	unsigned roflag;	// Read-only flag (hdparm -r, blockdev --getro)
 	int slave;		// Number of owning devices
 	union {
@@ -152,10 +187,14 @@ typedef struct device {
 						//  2: supported, on
 						//  (see rwverify_status above)
 			unsigned unloaded: 1;	// No media loaded
+			unsigned smartstale: 1;	// SMART restored from the
+						//  inventory cache, not yet
+						//  repolled
 			void *biossha1;		// SHA1 of first 440 bytes
 			char *pttable;		// Partition table type (can be NULL)
 			char *serial;		// Serial number (can be NULL)
 			char *wwn;		// World Wide Name
+						// (these three in strings)
 			int32_t rotation;	// Rotation rate:
 						// 0 == unknown, -1 == SSD
 
@@ -167,7 +206,11 @@ typedef struct device {
 			int smart;		// -1 for no support, otherwise
 						//  SkSmartOverall enum values
 			uint64_t celsius;	// Last-polled temperature
+			uint64_t invtoken;	// Inventory cache validity
+						//  token, 0 if uncacheable
+						//  (see inventory.h)
 		} blkdev;
+		// The strings of mddev and dmdev are in strings.
 		struct { // mdadm (MDRAID)
 			unsigned long disks;	// RAID disks in md
 			char *level;		// RAID level
@@ -226,14 +269,33 @@ typedef struct device {
 		LAYOUT_ZPOOL,
 	} layout;
 	struct device *parts;	// Partitions (can be NULL)
-	dev_t devno;		// Don't expose this non-persistent datum
-	statpack stats;		// Stats since device came online, as returned
-				//  in most recent call to read_diskstats()
-	statpack statdelta;	// Delta between the current value of stats and
-				//  its previous value (after two samples)
-	struct timeval statq;	// Timespan of statdelta. statdelta is
-				//  defined iff statq is not all 0s.
+	dev_t devno;		// Don't expose this non-persistent datum. Also
+				//  keys its I/O statistics (device_stats()).
 	void *uistate;		// UI-managed opaque state
+	unsigned changes;	// DEVCHANGE_* mask, set only for the duration
+				//  of a block_event() resulting from discovery
+				//  or rescan (0 for stats, mounts, etc.)
+	// Metadata strings learned by discovery (those marked "in strings")
+	// are allocated from here rather than individually, and are all
+	// released together when the device is rescanned from scratch or
+	// freed. They mustn't be passed to free(), and are replaced by
+	// allocating anew from the arena.
+	strarena strings;
+	unsigned probe_pending: 1; // Known only from sysfs so far; identity,
+				//  partition table and filesystems are being
+				//  probed in the background (DEVCHANGE_PROBED)
+	unsigned reprobe: 1;	// partition with an event awaiting its disk's
+				//  refresh (see defer_rescan()). Private.
+	unsigned busy;		// hold_device() count (disks only). Private.
+	uint64_t probeseq;	// registration awaiting deep probes. Private.
+	// Linkage for the name/devno index (see devindex.h). Private.
+	struct device *hnext_name,*hnext_devno;
+	unsigned idxname;	// hash of name when indexed
+	dev_t idxdevno;		// devno when indexed
+	unsigned indexed: 1;
+	// Copy-on-write publication (see get_snapshot()). Private.
+	struct device *snapcopy; // copy in the latest snapshot
+	unsigned snapdirty: 1;	// changed since that copy was made
 } device;
 
 // A block device controller.
@@ -291,6 +353,9 @@ typedef struct controller {
 	struct controller *next;
 	dev_t devno;		// Don't expose this non-persistent datum
 	void *uistate;		// UI-managed opaque state
+	// Copy-on-write publication (see get_snapshot()). Private.
+	struct controller *snapcopy; // copy in the latest snapshot
+	int snapdirty;		// changed since that copy was made
 } controller;
 
 static inline uintmax_t
@@ -310,13 +375,91 @@ last_usable_sector(const device *d){
 }
 
 // Currently, we just blindly hand out references to our internal store. This
-// simply will not fly in the long run -- FIXME
+// simply will not fly in the long run -- FIXME. The tree may only be walked
+// with the growlight lock held. Readers ought prefer get_snapshot().
 const controller *get_controllers(void);
 
+struct snapchunk;
+
+// An immutable copy of the controller/device tree. Pointers within it refer
+// to the snapshot's own copies (including c, parts and partdev.parent), with
+// two exceptions: uistate is shared with the live tree, and hist is NULL.
+typedef struct treesnap {
+	uint64_t version;		// increases with each publication
+	const controller *controllers;
+	unsigned devices;		// block devices and partitions
+	// Private.
+	struct snapchunk *chunks;
+	unsigned refs;
+	struct treesnap *base;		// holds the nodes shared with us
+	unsigned depth;			// length of the chain of bases
+} treesnap;
+
+// Writers publish a new snapshot copy-on-write when they release the
+// growlight lock, at most every SNAPSHOT_PUBLISH_MS while changes stream in
+// (changes held back by that limit are published once it expires). Only the
+// devices announced as changed are copied, along with their ancestors; the
+// rest are shared with the previous snapshot. Upward links (c, and a
+// partition's partdev.parent) can thus reach an earlier copy of the
+// controller or disk, identical but for its list links. get_snapshot() never
+// blocks on the growlight lock: it publishes pending changes if the lock is
+// free, and otherwise returns the latest published version. Each snapshot
+// returned must be released with put_snapshot(). NULL is returned before the
+// first publication.
+#define SNAPSHOT_PUBLISH_MS 50
+const treesnap *get_snapshot(void);
+void put_snapshot(const treesnap *);
+
 // These are similarly no good FIXME
 device *lookup_device(const char *name);
+// Only finds devices which have already been discovered (no discovery is
+// kicked off for an unknown devno). Returns NULL for a devno of 0.
+device *lookup_device_devno(dev_t devno);
 controller *lookup_controller(const char *name);
 
+// Devices are registered from sysfs alone, and then deep-probed (SG_IO/NVMe
+// identification, SMART, the MBR hash, and libblkid) in the background, with
+// probe_pending set until then. prioritize_probe() moves a device's pending
+// probe (its disk's, for a partition) to the head of the line, returning -1
+// if none is pending. await_probe() waits for it to complete; call it with
+// the growlight lock held. The lock is released while waiting, so d is
+// looked up anew by name, and NULL is returned if it went away.
+int prioritize_probe(const device *d);
+device *await_probe(device *d);
+
+// Upper bound for -j|--threads, the size of the discovery and probe worker
+// pools. Their work mostly blocks on sysfs, SG_IO and libblkid rather than
+// using a CPU, so they otherwise default to DISCOVERY_THREADS_PER_CPU workers
+// per online CPU, and no fewer than DISCOVERY_THREADS_MIN.
+#define MAX_DISCOVERY_THREADS 1024
+#define DISCOVERY_THREADS_PER_CPU 4
+#define DISCOVERY_THREADS_MIN 16
+
+// Disk stats sampling period, in milliseconds. In adaptive mode, we sample at
+// STATS_INTERVAL_MIN while any device is at least STATS_BUSY_UTIL percent
+// busy, and back off towards the configured interval once all are idle.
+#define STATS_INTERVAL_MIN 100
+#define STATS_INTERVAL_MAX 60000
+#define STATS_INTERVAL_DEFAULT 1000
+#define STATS_BUSY_UTIL 5.0
+
+// Takes effect immediately if the event thread is running. The interval is
+// clamped to [STATS_INTERVAL_MIN, STATS_INTERVAL_MAX]; the clamped value is
+// returned, or -1 if the timer couldn't be rearmed.
+int set_stats_interval(unsigned ms, int adaptive);
+
+// Returns the configured interval. If current is non-NULL, it receives the
+// interval presently in use (which differs in adaptive mode).
+unsigned get_stats_interval(int *adaptive, unsigned *current);
+
+// d's I/O statistics, or all zeroes (and no history) if it hasn't yet been
+// sampled. They're updated under the stats lock, which is independent of the
+// growlight lock. Hold it (lock_stats()) across the call and any use of the
+// result, and don't call diag() meanwhile.
+void lock_stats(void);
+void unlock_stats(void);
+const devstats *device_stats(const device *d);
+
 // Supported partition table types
 typedef struct pttable_type {
 	char *name;
@@ -358,8 +501,41 @@ int benchmark_blockdev(const device *);
 void lock_growlight(void);
 void unlock_growlight(void);
 
+// Drop all of this thread's holds on the growlight lock (if it has any) while
+// waiting on an external tool, returning the depth to pass back to
+// reclaim_growlight(). Devices may be rescanned and freed meanwhile, save
+// those marked with hold_device().
+unsigned shed_growlight(void);
+void reclaim_growlight(unsigned depth);
+
+// Keep d (and, for a partition, its disk) from being freed by rescans and
+// probe adoption until release_device(), so that it can be used across a
+// shed_growlight(). Those wait on only the held disk. Don't rescan a device
+// while holding it yourself.
+void hold_device(device *d);
+void release_device(device *d);
+
 int rescan_device(const char *);
 
+// Udev and inotify events are collected for EVENT_COALESCE_MS following the
+// first of a burst, and then acted upon once per device by the discovery
+// workers. These queue a rescan of a block device, and of the zpools.
+#define EVENT_COALESCE_MS 50
+void defer_rescan(const char *);
+void defer_zpool_scan(void);
+
+// Events received and collapsed by the coalescer.
+struct coalesce_stats;
+void get_event_counters(struct coalesce_stats *);
+
+// The event thread hands its work off to lanes: 0 samples disk stats, 1
+// reparses the mount, swap and filesystem tables, 2 probes and rescans
+// devices, and 3 runs their deferred deep probes. Fills in the lane's queue
+// statistics and the number of requests folded into a job already pending,
+// and returns its name (NULL past the last lane).
+struct workq_stats;
+const char *get_lane_stats(unsigned,struct workq_stats *,uint64_t *);
+
 void add_new_virtual_blockdev(device *);
 
 int prepare_bios_boot(device *);
@@ -525,17 +701,15 @@ guidstr(const void *guid,char *str){
 // lookup on a TSD (omphalos_ctx_key).
 void diagnostic(const char *,...) __attribute__ ((format (printf,1,2)));
 
-typedef struct logent {
-        char *msg;
-        time_t when;
-} logent;
-
 #define MAXIMUM_LOG_ENTRIES 1024
 
-// Get up to the last n diagnostics. n should not be 0 nor greater than
-// MAXIMUM_LOG_ENTRIES. If there are less than n present, they'll be copied
-// into the first n logents; logent[n].msg will then be NULL.
-int get_logs(unsigned,logent *);
+// Get up to the last n diagnostics at level or more severe, newest first. n
+// should not be 0 nor greater than MAXIMUM_LOG_ENTRIES. Returns the number
+// copied into the logents.
+int get_logs(unsigned,logent *,loglevel);
+
+// Messages logged, and those lost to the ring being lapped mid-write.
+void get_log_stats(uint64_t *logged,uint64_t *dropped);
 
 static inline int
 target_mode_p(void){
@@ -11,19 +11,29 @@
 #include "growlight.h"
 
 int badblock_scan(device *d,unsigned rw){
-	char cmd[PATH_MAX];
+	const char *argv[6];
+	char dev[PATH_MAX];
+	int argc = 0;
 
 	if(d->layout != LAYOUT_NONE){
 		diag("Block scans are performed only on raw block devices\n");
 		return -1;
 	}
-	// FIXME supply -b blocksize argument!
-	if(snprintf(cmd,sizeof(cmd),"badblocks -v -s %s /dev/%s",
-		rw ? d->mnt.count ? "-n" : "-w" : "",d->name) >= (int)sizeof(cmd)){
-		diag("Bad name: %s\n",d->name);
+	if(devnode_path(dev,sizeof(dev),d->name)){
 		return -1;
 	}
-	if(popen_drain(cmd)){
+	// FIXME supply -b blocksize argument!
+	argv[argc++] = "badblocks";
+	argv[argc++] = "-v";
+	argv[argc++] = "-s";
+	if(rw){
+		argv[argc++] = d->mnt.count ? "-n" : "-w";
+	}
+	argv[argc++] = dev;
+	argv[argc] = NULL;
+	// a scan can take hours, so it's left running; its progress and result
+	// go to diag
+	if(spawn_bgv(argv) == 0){
 		return -1;
 	}
 	return 0;
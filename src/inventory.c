@@ -0,0 +1,734 @@
+#include <wchar.h>
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/sysmacros.h>
+
+#include "inventory.h"
+#include "growlight.h"
+
+// The cache is a text file, one tab-separated record per line. A "D" record
+// describes a disk, and is followed by a "P" record for each of its
+// partitions. Absent strings are written as "-"; other strings are escaped
+// (%xx) as necessary to contain neither whitespace, '%', nor a lone "-".
+#define INVENTORY_MAGIC "growlight-inventory 1"
+#define INVENTORY_BUCKETS 256	// power of 2
+#define SHA1LEN 20		// d->blkdev.biossha1 (see mbrsha1())
+
+typedef struct invpart {
+	char *name;
+	unsigned ptype;
+	unsigned long long flags;
+	unsigned logical, extended;
+	char *puuid;		// partition UUID
+	char *pname;		// partition name, multibyte
+	char *mnttype, *uuid, *label;
+} invpart;
+
+typedef struct invdisk {
+	struct invdisk *next;	// hash chain
+	dev_t devno;
+	char *name;
+	uint64_t token;
+	int transport, rotation, smart;
+	unsigned wcache, rwverify, biosboot;
+	unsigned long long celsius;
+	unsigned logsec, physsec;
+	int hassha1;
+	unsigned char sha1[SHA1LEN];
+	char *serial, *wwn, *pttable, *mnttype, *uuid, *label;
+	unsigned pcount;
+	invpart *parts;
+} invdisk;
+
+struct inventory {
+	pthread_mutex_t lock;	// protects the counters; entries are immutable
+	invdisk *buckets[INVENTORY_BUCKETS];
+	unsigned entries, hits, misses;
+};
+
+static inline unsigned
+devno_bucket(dev_t devno){
+	return (major(devno) * 31u + minor(devno)) & (INVENTORY_BUCKETS - 1);
+}
+
+static void
+free_invpart(invpart *p){
+	free(p->name);
+	free(p->puuid);
+	free(p->pname);
+	free(p->mnttype);
+	free(p->uuid);
+	free(p->label);
+}
+
+static void
+free_invdisk(invdisk *d){
+	unsigned z;
+
+	for(z = 0 ; z < d->pcount ; ++z){
+		free_invpart(&d->parts[z]);
+	}
+	free(d->parts);
+	free(d->name);
+	free(d->serial);
+	free(d->wwn);
+	free(d->pttable);
+	free(d->mnttype);
+	free(d->uuid);
+	free(d->label);
+	free(d);
+}
+
+static void
+put_string(FILE *fp, const char *s){
+	if(s == NULL){
+		fputs("\t-", fp);
+		return;
+	}
+	fputc('\t', fp);
+	if(strcmp(s, "-") == 0){
+		fputs("%2d", fp);
+		return;
+	}
+	while(*s){
+		unsigned char c = *s++;
+
+		if(c <= ' ' || c == '%' || c == 0x7f){
+			fprintf(fp, "%%%02x", c);
+		}else{
+			fputc(c, fp);
+		}
+	}
+}
+
+// Unescapes the field in place. Returns 0 for "-", setting *out to NULL.
+static int
+get_string(char *field, char **out){
+	char *w = field, *r = field;
+
+	*out = NULL;
+	if(field == NULL){
+		return -1;
+	}
+	if(strcmp(field, "-") == 0){
+		return 0;
+	}
+	while(*r){
+		if(*r == '%'){
+			unsigned c;
+
+			if(sscanf(r + 1, "%2x", &c) != 1 || c == 0){
+				return -1;
+			}
+			*w++ = c;
+			r += 3;
+		}else{
+			*w++ = *r++;
+		}
+	}
+	*w = '\0';
+	return (*out = strdup(field)) ? 0 : -1;
+}
+
+static int
+get_ull(const char *field, int base, unsigned long long *out){
+	char *e;
+
+	if(field == NULL || *field == '\0'){
+		return -1;
+	}
+	errno = 0;
+	*out = strtoull(field, &e, base);
+	return errno || *e ? -1 : 0;
+}
+
+static int
+get_int(const char *field, int *out){
+	char *e;
+	long l;
+
+	if(field == NULL || *field == '\0'){
+		return -1;
+	}
+	errno = 0;
+	l = strtol(field, &e, 10);
+	if(errno || *e || l < INT_MIN || l > INT_MAX){
+		return -1;
+	}
+	*out = l;
+	return 0;
+}
+
+static int
+get_uint(const char *field, unsigned *out){
+	unsigned long long ull;
+
+	if(get_ull(field, 10, &ull) || ull > UINT_MAX){
+		return -1;
+	}
+	*out = ull;
+	return 0;
+}
+
+static int
+get_sha1(const char *field, invdisk *d){
+	unsigned z;
+
+	if(field && strcmp(field, "-") == 0){
+		d->hassha1 = 0;
+		return 0;
+	}
+	if(field == NULL || strlen(field) != SHA1LEN * 2){
+		return -1;
+	}
+	for(z = 0 ; z < SHA1LEN ; ++z){
+		unsigned c;
+
+		if(sscanf(field + z * 2, "%2x", &c) != 1){
+			return -1;
+		}
+		d->sha1[z] = c;
+	}
+	d->hassha1 = 1;
+	return 0;
+}
+
+// Split at most n tab-separated fields out of line. Returns the number found.
+static unsigned
+split_fields(char *line, char **fields, unsigned n){
+	unsigned z = 0;
+	char *f;
+
+	while(z < n && (f = strsep(&line, "\t")) != NULL){
+		fields[z++] = f;
+	}
+	return line ? n + 1 : z; // extra fields are an error
+}
+
+#define DFIELDS 21
+#define PFIELDS 11
+
+static invdisk *
+parse_disk(char *line){
+	unsigned long long ull, maj, mnr;
+	char *f[DFIELDS];
+	invdisk *d;
+
+	if(split_fields(line, f, DFIELDS) != DFIELDS || strcmp(f[0], "D")){
+		return NULL;
+	}
+	if((d = malloc(sizeof(*d))) == NULL){
+		return NULL;
+	}
+	memset(d, 0, sizeof(*d));
+	if(sscanf(f[1], "%llu:%llu", &maj, &mnr) != 2 || get_string(f[2], &d->name) ||
+			d->name == NULL || get_ull(f[3], 16, &ull) ||
+			get_int(f[4], &d->transport) || get_int(f[5], &d->rotation) ||
+			get_uint(f[6], &d->wcache) || get_uint(f[7], &d->rwverify) ||
+			get_int(f[8], &d->smart) || get_ull(f[9], 10, &d->celsius) ||
+			get_uint(f[10], &d->biosboot) || get_uint(f[11], &d->logsec) ||
+			get_uint(f[12], &d->physsec) || get_sha1(f[13], d) ||
+			get_string(f[14], &d->serial) || get_string(f[15], &d->wwn) ||
+			get_string(f[16], &d->pttable) || get_string(f[17], &d->mnttype) ||
+			get_string(f[18], &d->uuid) || get_string(f[19], &d->label) ||
+			get_uint(f[20], &d->pcount) || ull == 0){
+		d->pcount = 0;
+		free_invdisk(d);
+		return NULL;
+	}
+	d->devno = makedev(maj, mnr);
+	d->token = ull;
+	if(d->pcount){
+		unsigned pcount = d->pcount;
+
+		if((d->parts = calloc(pcount, sizeof(*d->parts))) == NULL){
+			d->pcount = 0;
+			free_invdisk(d);
+			return NULL;
+		}
+	}
+	return d;
+}
+
+static int
+parse_part(char *line, invpart *p){
+	char *f[PFIELDS];
+
+	if(split_fields(line, f, PFIELDS) != PFIELDS || strcmp(f[0], "P")){
+		return -1;
+	}
+	if(get_string(f[1], &p->name) || p->name == NULL || get_uint(f[2], &p->ptype) ||
+			get_ull(f[3], 16, &p->flags) || get_uint(f[4], &p->logical) ||
+			get_uint(f[5], &p->extended) || get_string(f[6], &p->puuid) ||
+			get_string(f[7], &p->pname) || get_string(f[8], &p->mnttype) ||
+			get_string(f[9], &p->uuid) || get_string(f[10], &p->label)){
+		return -1;
+	}
+	return 0;
+}
+
+static void
+discard_entries(struct inventory *inv){
+	unsigned b;
+
+	for(b = 0 ; b < INVENTORY_BUCKETS ; ++b){
+		invdisk *d;
+
+		while( (d = inv->buckets[b]) ){
+			inv->buckets[b] = d->next;
+			free_invdisk(d);
+		}
+	}
+	inv->entries = 0;
+}
+
+struct inventory *inventory_load(const char *path){
+	struct inventory *inv;
+	invdisk *d = NULL;
+	size_t len = 0;
+	char *line = NULL;
+	unsigned lineno = 0, pz = 0;
+	ssize_t r;
+	FILE *fp;
+
+	if((inv = malloc(sizeof(*inv))) == NULL){
+		return NULL;
+	}
+	memset(inv, 0, sizeof(*inv));
+	pthread_mutex_init(&inv->lock, NULL);
+	if((fp = fopen(path, "re")) == NULL){
+		if(errno != ENOENT){
+			diag("Couldn't open inventory cache %s (%s)\n", path, strerror(errno));
+		}
+		return inv;
+	}
+	while((r = getline(&line, &len, fp)) >= 0){
+		if(r && line[r - 1] == '\n'){
+			line[r - 1] = '\0';
+		}
+		if(++lineno == 1){
+			if(strcmp(line, INVENTORY_MAGIC)){
+				verbf("Ignoring inventory cache %s (bad version)\n", path);
+				break;
+			}
+			continue;
+		}
+		if(d && pz < d->pcount){
+			if(parse_part(line, &d->parts[pz])){
+				goto malformed;
+			}
+			++pz;
+		}else{
+			if((d = parse_disk(line)) == NULL){
+				goto malformed;
+			}
+			d->next = inv->buckets[devno_bucket(d->devno)];
+			inv->buckets[devno_bucket(d->devno)] = d;
+			++inv->entries;
+			pz = 0;
+		}
+	}
+	if(d && pz < d->pcount){
+		goto malformed;
+	}
+	free(line);
+	fclose(fp);
+	verbf("Loaded %u disks from inventory cache %s\n", inv->entries, path);
+	return inv;
+
+malformed:
+	diag("Ignoring malformed inventory cache %s (line %u)\n", path, lineno);
+	discard_entries(inv);
+	free(line);
+	fclose(fp);
+	return inv;
+}
+
+// FNV-1a, 64-bit
+static inline uint64_t
+fnv64(uint64_t h, const void *buf, size_t n){
+	const unsigned char *b = buf;
+
+	while(n--){
+		h ^= *b++;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+static int
+hash_region(int fd, off_t off, size_t len, unsigned char *buf, uint64_t *h){
+	size_t got = 0;
+	ssize_t r;
+
+	while(got < len){
+		if((r = pread(fd, buf + got, len - got, off + got)) < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		if(r == 0){
+			break; // short device
+		}
+		got += r;
+	}
+	*h = fnv64(*h, &got, sizeof(got));
+	*h = fnv64(*h, buf, got);
+	return 0;
+}
+
+uint64_t inventory_token(int fd, const device *d){
+	uint64_t h = 14695981039346656037ull;
+	const device *p;
+	unsigned char *buf;
+
+	if((buf = malloc(INVENTORY_TABLE_BYTES)) == NULL){
+		return 0;
+	}
+	h = fnv64(h, &d->size, sizeof(d->size));
+	if(hash_region(fd, 0, INVENTORY_TABLE_BYTES, buf, &h)){
+		verbf("Couldn't read %s for inventory token (%s)\n", d->name, strerror(errno));
+		free(buf);
+		return 0;
+	}
+	// sysfs reports partition offsets in 512-byte units, regardless of
+	// the logical sector size
+	for(p = d->parts ; p ; p = p->next){
+		off_t off = p->partdev.fsector * 512;
+
+		h = fnv64(h, p->name, strlen(p->name));
+		h = fnv64(h, &p->devno, sizeof(p->devno));
+		h = fnv64(h, &p->partdev.fsector, sizeof(p->partdev.fsector));
+		h = fnv64(h, &p->size, sizeof(p->size));
+		if(hash_region(fd, off, INVENTORY_SB_BYTES, buf, &h) ||
+				hash_region(fd, off + INVENTORY_SB2_OFFSET, INVENTORY_SB_BYTES, buf, &h)){
+			verbf("Couldn't read %s for inventory token (%s)\n", p->name, strerror(errno));
+			free(buf);
+			return 0;
+		}
+	}
+	free(buf);
+	return h ? h : 1;
+}
+
+static invdisk *
+find_entry(struct inventory *inv, const device *d){
+	invdisk *e;
+
+	for(e = inv->buckets[devno_bucket(d->devno)] ; e ; e = e->next){
+		if(e->devno == d->devno && strcmp(e->name, d->name) == 0){
+			break;
+		}
+	}
+	if(e == NULL || e->token != d->blkdev.invtoken){
+		return NULL;
+	}
+	return e;
+}
+
+static const invpart *
+find_part(const invdisk *e, const char *name){
+	unsigned z;
+
+	for(z = 0 ; z < e->pcount ; ++z){
+		if(strcmp(e->parts[z].name, name) == 0){
+			return &e->parts[z];
+		}
+	}
+	return NULL;
+}
+
+// Every string we'll need, allocated up front so that failure leaves the
+// device untouched.
+struct strings {
+	char *s[6];
+	wchar_t *pname;
+	void *sha1;
+};
+
+static inline int
+dupstr(const char *s, char **out){
+	return s && (*out = strdup(s)) == NULL ? -1 : 0;
+}
+
+static void
+free_strings(struct strings *st, unsigned n){
+	unsigned z, y;
+
+	for(z = 0 ; z < n ; ++z){
+		for(y = 0 ; y < sizeof(st[z].s) / sizeof(*st[z].s) ; ++y){
+			free(st[z].s[y]);
+		}
+		free(st[z].pname);
+		free(st[z].sha1);
+	}
+	free(st);
+}
+
+static wchar_t *
+mbs_to_wcs(const char *s){
+	mbstate_t ps;
+	wchar_t *w;
+	size_t n;
+
+	memset(&ps, 0, sizeof(ps));
+	if((n = mbsrtowcs(NULL, &s, 0, &ps)) == (size_t)-1){
+		return NULL;
+	}
+	if((w = malloc(sizeof(*w) * (n + 1))) == NULL){
+		return NULL;
+	}
+	memset(&ps, 0, sizeof(ps));
+	mbsrtowcs(w, &s, n + 1, &ps);
+	return w;
+}
+
+static inline void
+set_swap(device *d){
+	if(d->mnttype && strcmp(d->mnttype, "swap") == 0 && d->swapprio == SWAP_INVALID){
+		d->swapprio = SWAP_INACTIVE;
+	}
+}
+
+int inventory_restore(struct inventory *inv, device *d){
+	const invpart **ip = NULL;
+	struct strings *st = NULL;
+	unsigned n = 0, z;
+	const invdisk *e;
+	device *p;
+
+	if(d->layout != LAYOUT_NONE || d->blkdev.invtoken == 0 ||
+			(e = find_entry(inv, d)) == NULL){
+		goto miss;
+	}
+	for(p = d->parts ; p ; p = p->next){
+		++n;
+	}
+	if(n != e->pcount){
+		goto miss;
+	}
+	if((st = calloc(n + 1, sizeof(*st))) == NULL || (n && (ip = calloc(n, sizeof(*ip))) == NULL)){
+		goto err;
+	}
+	for(p = d->parts, z = 0 ; p ; p = p->next, ++z){
+		if((ip[z] = find_part(e, p->name)) == NULL){
+			free(ip);
+			free_strings(st, n + 1);
+			goto miss;
+		}
+		if(dupstr(ip[z]->puuid, &st[z].s[0]) || dupstr(ip[z]->mnttype, &st[z].s[1]) ||
+				dupstr(ip[z]->uuid, &st[z].s[2]) || dupstr(ip[z]->label, &st[z].s[3]) ||
+				(ip[z]->pname && (st[z].pname = mbs_to_wcs(ip[z]->pname)) == NULL)){
+			goto err;
+		}
+	}
+	if(dupstr(e->serial, &st[n].s[0]) || dupstr(e->wwn, &st[n].s[1]) ||
+			dupstr(e->pttable, &st[n].s[2]) || dupstr(e->mnttype, &st[n].s[3]) ||
+			dupstr(e->uuid, &st[n].s[4]) || dupstr(e->label, &st[n].s[5])){
+		goto err;
+	}
+	if(e->hassha1){
+		if((st[n].sha1 = malloc(SHA1LEN)) == NULL){
+			goto err;
+		}
+		memcpy(st[n].sha1, e->sha1, SHA1LEN);
+	}
+	// Nothing can fail from here on; hand the strings over
+	for(p = d->parts, z = 0 ; p ; p = p->next, ++z){
+		free(p->partdev.uuid); p->partdev.uuid = st[z].s[0];
+		free(p->mnttype); p->mnttype = st[z].s[1];
+		free(p->uuid); p->uuid = st[z].s[2];
+		free(p->label); p->label = st[z].s[3];
+		free(p->partdev.pname); p->partdev.pname = st[z].pname;
+		p->partdev.ptype = ip[z]->ptype;
+		p->partdev.flags = ip[z]->flags;
+		p->partdev.ptstate.logical = !!ip[z]->logical;
+		p->partdev.ptstate.extended = !!ip[z]->extended;
+		set_swap(p);
+	}
+	free(d->blkdev.serial); d->blkdev.serial = st[n].s[0];
+	free(d->blkdev.wwn); d->blkdev.wwn = st[n].s[1];
+	free(d->blkdev.pttable); d->blkdev.pttable = st[n].s[2];
+	free(d->mnttype); d->mnttype = st[n].s[3];
+	free(d->uuid); d->uuid = st[n].s[4];
+	free(d->label); d->label = st[n].s[5];
+	free(d->blkdev.biossha1); d->blkdev.biossha1 = st[n].sha1;
+	d->blkdev.transport = e->transport;
+	d->blkdev.rotation = e->rotation;
+	d->blkdev.wcache = !!e->wcache;
+	d->blkdev.rwverify = e->rwverify;
+	d->blkdev.smart = e->smart;
+	d->blkdev.celsius = e->celsius;
+	d->blkdev.biosboot = !!e->biosboot;
+	if(e->logsec){
+		d->logsec = e->logsec;
+	}
+	if(e->physsec){
+		d->physsec = e->physsec;
+	}
+	set_swap(d);
+	free(st);
+	free(ip);
+	pthread_mutex_lock(&inv->lock);
+	++inv->hits;
+	pthread_mutex_unlock(&inv->lock);
+	return 1;
+
+miss:
+	pthread_mutex_lock(&inv->lock);
+	++inv->misses;
+	pthread_mutex_unlock(&inv->lock);
+	return 0;
+
+err:
+	free(ip);
+	if(st){
+		free_strings(st, n + 1);
+	}
+	return -1;
+}
+
+static int
+write_disk(FILE *fp, const device *d){
+	const device *p;
+	unsigned n = 0, z;
+
+	for(p = d->parts ; p ; p = p->next){
+		++n;
+	}
+	fprintf(fp, "D\t%u:%u", major(d->devno), minor(d->devno));
+	put_string(fp, d->name);
+	fprintf(fp, "\t%016llx\t%d\t%d\t%u\t%u\t%d\t%llu\t%u\t%u\t%u\t",
+		(unsigned long long)d->blkdev.invtoken, d->blkdev.transport,
+		d->blkdev.rotation, d->blkdev.wcache, d->blkdev.rwverify,
+		d->blkdev.smart, (unsigned long long)d->blkdev.celsius,
+		d->blkdev.biosboot, d->logsec, d->physsec);
+	if(d->blkdev.biossha1){
+		const unsigned char *sha = d->blkdev.biossha1;
+
+		for(z = 0 ; z < SHA1LEN ; ++z){
+			fprintf(fp, "%02x", sha[z]);
+		}
+	}else{
+		fputc('-', fp);
+	}
+	put_string(fp, d->blkdev.serial);
+	put_string(fp, d->blkdev.wwn);
+	put_string(fp, d->blkdev.pttable);
+	put_string(fp, d->mnttype);
+	put_string(fp, d->uuid);
+	put_string(fp, d->label);
+	fprintf(fp, "\t%u\n", n);
+	for(p = d->parts ; p ; p = p->next){
+		char *pname = NULL;
+
+		if(p->partdev.pname){
+			const wchar_t *w = p->partdev.pname;
+			mbstate_t ps;
+			size_t len;
+
+			memset(&ps, 0, sizeof(ps));
+			if((len = wcsrtombs(NULL, &w, 0, &ps)) == (size_t)-1 ||
+					(pname = malloc(len + 1)) == NULL){
+				return -1;
+			}
+			memset(&ps, 0, sizeof(ps));
+			wcsrtombs(pname, &w, len + 1, &ps);
+		}
+		fputs("P", fp);
+		put_string(fp, p->name);
+		fprintf(fp, "\t%u\t%llx\t%u\t%u", p->partdev.ptype, p->partdev.flags,
+			p->partdev.ptstate.logical, p->partdev.ptstate.extended);
+		put_string(fp, p->partdev.uuid);
+		put_string(fp, pname);
+		put_string(fp, p->mnttype);
+		put_string(fp, p->uuid);
+		put_string(fp, p->label);
+		fputc('\n', fp);
+		free(pname);
+	}
+	return ferror(fp) ? -1 : 0;
+}
+
+int inventory_save(const char *path, const controller *controllers){
+	char tmp[PATH_MAX];
+	const controller *c;
+	unsigned n = 0;
+	FILE *fp;
+	int fd;
+
+	if(snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)){
+		diag("Inventory cache path too long: %s\n", path);
+		return -1;
+	}
+	if((fd = mkostemp(tmp, O_CLOEXEC)) < 0){
+		diag("Couldn't create %s (%s)\n", tmp, strerror(errno));
+		return -1;
+	}
+	if((fp = fdopen(fd, "w")) == NULL){
+		diag("Couldn't open %s (%s)\n", tmp, strerror(errno));
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+	fprintf(fp, "%s\n", INVENTORY_MAGIC);
+	for(c = controllers ; c ; c = c->next){
+		const device *d;
+
+		for(d = c->blockdevs ; d ; d = d->next){
+			if(d->layout != LAYOUT_NONE || d->blkdev.invtoken == 0){
+				continue;
+			}
+			if(write_disk(fp, d)){
+				diag("Couldn't write %s to %s\n", d->name, tmp);
+				fclose(fp);
+				unlink(tmp);
+				return -1;
+			}
+			++n;
+		}
+	}
+	if(fflush(fp) || fsync(fd)){
+		diag("Couldn't write %s (%s)\n", tmp, strerror(errno));
+		fclose(fp);
+		unlink(tmp);
+		return -1;
+	}
+	if(fclose(fp)){
+		diag("Couldn't close %s (%s)\n", tmp, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	if(rename(tmp, path)){
+		diag("Couldn't replace %s (%s)\n", path, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	verbf("Wrote %u disks to inventory cache %s\n", n, path);
+	return 0;
+}
+
+void inventory_stats(struct inventory *inv, unsigned *entries,
+			unsigned *hits, unsigned *misses){
+	pthread_mutex_lock(&inv->lock);
+	*entries = inv->entries;
+	*hits = inv->hits;
+	*misses = inv->misses;
+	pthread_mutex_unlock(&inv->lock);
+}
+
+void inventory_free(struct inventory *inv){
+	if(inv == NULL){
+		return;
+	}
+	discard_entries(inv);
+	pthread_mutex_destroy(&inv->lock);
+	free(inv);
+}
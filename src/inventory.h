@@ -0,0 +1,58 @@
+#ifndef GROWLIGHT_INVENTORY
+#define GROWLIGHT_INVENTORY
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// An on-disk cache of what's expensive to learn about a disk: the results of
+// ATA/NVMe IDENTIFY, SMART, the MBR SHA1, and libblkid's partition table and
+// filesystem probes. Entries are keyed by devno and name, and are only
+// trusted if the disk's validity token (see inventory_token()) hasn't changed
+// since they were written. Only fixed, physical disks (and their partitions)
+// are cached.
+struct inventory;
+struct device;
+struct controller;
+
+// We hash this much from the start of the disk, which covers MBR and GPT
+// (headers and entries, even with 4KiB sectors)...
+#define INVENTORY_TABLE_BYTES (24 * 1024)
+
+// ...and two windows of each partition, holding the superblocks libblkid most
+// commonly finds: ext*, xfs, vfat, LUKS and swap at the start, and btrfs (and
+// swap with 64KiB pages) straddling 64KiB.
+#define INVENTORY_SB_BYTES (8 * 1024)
+#define INVENTORY_SB2_OFFSET (60 * 1024)
+
+// A missing or malformed cache results in an empty inventory. Returns NULL
+// only on allocation failure.
+struct inventory *inventory_load(const char *path);
+
+// Token over the sysfs size and partition layout of d (which must not yet
+// have been probed), the disk's partition table, and the superblock windows of
+// each partition, read through fd. Returns 0 if it couldn't be computed.
+uint64_t inventory_token(int fd, const struct device *d);
+
+// If an entry matches d's devno, name, partitions and d->blkdev.invtoken,
+// fill in d and its partitions from it and return 1. Returns 0 on a miss,
+// and -1 on allocation failure (d is unmodified in both cases).
+int inventory_restore(struct inventory *inv, struct device *d);
+
+// Write every disk in the tree having a validity token, replacing path
+// atomically. Call with the growlight lock held.
+int inventory_save(const char *path, const struct controller *controllers);
+
+// Entries loaded, and restorations which hit and missed.
+void inventory_stats(struct inventory *inv, unsigned *entries,
+			unsigned *hits, unsigned *misses);
+
+void inventory_free(struct inventory *inv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
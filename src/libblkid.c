@@ -8,6 +8,7 @@
 #include <blkid/blkid.h>
 
 #include "fs.h"
+#include "udev.h"
 #include "libblkid.h"
 #include "growlight.h"
 
@@ -51,14 +52,17 @@ int close_blkid(void){
 	return blkid_exit(0);
 }
 
-#include <unistd.h>
-// Takes a /dev/ path, and examines the superblock therein for a valid
-// filesystem or raid superblock.
-int probe_blkid_superblock(const char *dev,blkid_probe *sbp,device *d){
-	char buf[PATH_MAX],*mnttype,*uuid,*label,*partuuid;
+// Run bp over dev, and fold what it finds into d. Whole devices are probed
+// for their topology and partition table as well as their superblock. For a
+// partition, part is its entry in the disk's table, from which its type, UUID
+// and name are taken, and only superblocks are probed. bp is handed back via
+// sbp if it's non-NULL, and otherwise freed.
+static int
+probe_blkid_dev(blkid_probe bp,const char *dev,blkid_probe *sbp,device *d,
+					blkid_partition part){
+	char *mnttype,*uuid,*label,*partuuid;
 	const char *val,*name;
 	unsigned parttype;
-	blkid_probe bp;
 	wchar_t *pname;
 	size_t len;
 	int n;
@@ -66,54 +70,39 @@ int probe_blkid_superblock(const char *dev,blkid_probe *sbp,device *d){
 	pname = NULL;
 	parttype = 0;
 	partuuid = uuid = label = mnttype = NULL;
-	if(strncmp(dev,"/dev/",5)){
-		if(snprintf(buf,sizeof(buf),"/dev/%s",dev) >= (int)sizeof(buf)){
-			diag("Bad name: %s\n",dev);
-			return -1;
+	if(part){
+		char code[16];
+
+		if((val = blkid_partition_get_type_string(part)) == NULL){
+			snprintf(code,sizeof(code),"0x%x",blkid_partition_get_type(part));
+			val = code;
 		}
-		dev = buf;
-	}
-	// This will sometimes fail due to the device node not yet existing. To
-	// get here, however, we had to receive the name in a udev message, or
-	// via discovery -- we've verified a /sys block entry. Go ahead and
-	// loop a time or two, even though it's gross. I'd like a better way to
-	// deal with this, obviously. FIXME
-	{
-		int i;
+		parttype = get_str_code(val);
+		if((val = blkid_partition_get_uuid(part)) && (partuuid = strdup(val)) == NULL){
+			goto err;
+		}
+		if( (val = blkid_partition_get_name(part)) ){
+			mbstate_t ps;
 
-		for(i = 0 ; i < 3 ; ++i){
-			if((bp = blkid_new_probe_from_filename(dev)) == NULL){
-				if(errno == ENOMEDIUM){
-					verbf("Couldn't get blkid probe for %s (%s)\n",dev,strerror(errno));
-					return -1;
-				}
-				diag("Couldn't get blkid probe for %s (%s), retrying...\n",dev,strerror(errno));
-				sleep(1);
-			}else{
-				break;
+			if((pname = malloc(sizeof(*pname) * (strlen(val) + 1))) == NULL){
+				goto err;
 			}
+			memset(&ps,0,sizeof(ps));
+			mbsnrtowcs(pname,&val,strlen(val) + 1,strlen(val) + 1,&ps);
 		}
-		if(bp == NULL){
-			if((bp = blkid_new_probe_from_filename(dev)) == NULL){
-				if(errno != ENOMEDIUM){
-					diag("Couldn't get blkid probe for %s (%s), retrying...\n",dev,strerror(errno));
-					return -1;
-				}
-				return blkid_exit(-1);
-			}
+	}else{
+		if(blkid_probe_enable_topology(bp,1)){
+			diag("Couldn't enable blkid topology for %s (%s)\n",dev,strerror(errno));
+			goto err;
+		}
+		if(blkid_probe_enable_partitions(bp,1)){
+			diag("Couldn't enable blkid partitionprobe for %s (%s)\n",dev,strerror(errno));
+			goto err;
+		}
+		if(blkid_probe_set_partitions_flags(bp,BLKID_PARTS_ENTRY_DETAILS)){
+			diag("Couldn't set blkid partitionflags for %s (%s)\n",dev,strerror(errno));
+			goto err;
 		}
-	}
-	if(blkid_probe_enable_topology(bp,1)){
-		diag("Couldn't enable blkid topology for %s (%s)\n",dev,strerror(errno));
-		return blkid_exit(-1);
-	}
-	if(blkid_probe_enable_partitions(bp,1)){
-		diag("Couldn't enable blkid partitionprobe for %s (%s)\n",dev,strerror(errno));
-		goto err;
-	}
-	if(blkid_probe_set_partitions_flags(bp,BLKID_PARTS_ENTRY_DETAILS)){
-		diag("Couldn't set blkid partitionflags for %s (%s)\n",dev,strerror(errno));
-		goto err;
 	}
 	if(blkid_probe_enable_superblocks(bp,1)){
 		diag("Couldn't enable blkid superprobe for %s (%s)\n",dev,strerror(errno));
@@ -279,8 +268,78 @@ int probe_blkid_superblock(const char *dev,blkid_probe *sbp,device *d){
 
 err:
 	blkid_free_probe(bp);
+	free(partuuid);
 	free(mnttype);
+	free(pname);
 	free(label);
 	free(uuid);
 	return -1;
 }
+
+// Takes a device node path (or a bare device name), and examines the
+// superblock therein for a valid filesystem or raid superblock.
+int probe_blkid_superblock(const char *dev,blkid_probe *sbp,device *d){
+	char buf[PATH_MAX];
+	blkid_probe bp;
+
+	if(strchr(dev,'/') == NULL){
+		if(devnode_path(buf,sizeof(buf),dev)){
+			return -1;
+		}
+		dev = buf;
+	}
+	// This will sometimes fail due to the device node not yet existing. To
+	// get here, however, we had to receive the name in a udev message, or
+	// via discovery -- we've verified a /sys block entry. Wait (boundedly)
+	// for udev to create the node, and try again.
+	if((bp = blkid_new_probe_from_filename(dev)) == NULL && errno == ENOENT){
+		verbf("Waiting on device node %s\n",dev);
+		if(wait_devnode(dev,DEVNODE_WAIT_MS) == 0){
+			bp = blkid_new_probe_from_filename(dev);
+		}else{
+			errno = ENOENT;
+		}
+	}
+	if(bp == NULL){
+		if(errno == ENOMEDIUM){
+			verbf("Couldn't get blkid probe for %s (%s)\n",dev,strerror(errno));
+			return -1;
+		}
+		diag("Couldn't get blkid probe for %s (%s)\n",dev,strerror(errno));
+		return -1;
+	}
+	return probe_blkid_dev(bp,dev,sbp,d,NULL);
+}
+
+int probe_blkid_fd(int fd,const char *dev,blkid_probe *sbp,device *d){
+	blkid_probe bp;
+
+	if((bp = blkid_new_probe()) == NULL){
+		diag("Couldn't get blkid probe for %s (%s)\n",dev,strerror(errno));
+		return -1;
+	}
+	if(blkid_probe_set_device(bp,fd,0,0)){
+		diag("Couldn't set blkid device for %s (%s)\n",dev,strerror(errno));
+		blkid_free_probe(bp);
+		return -1;
+	}
+	return probe_blkid_dev(bp,dev,sbp,d,NULL);
+}
+
+int probe_blkid_partition(blkid_probe disk,blkid_partition part,device *p){
+	blkid_probe bp;
+
+	if((bp = blkid_new_probe()) == NULL){
+		diag("Couldn't get blkid probe for %s (%s)\n",p->name,strerror(errno));
+		return -1;
+	}
+	// libblkid's partition offsets and sizes are in 512-byte sectors
+	if(blkid_probe_set_device(bp,blkid_probe_get_fd(disk),
+				blkid_partition_get_start(part) * 512,
+				blkid_partition_get_size(part) * 512)){
+		diag("Couldn't set blkid device for %s (%s)\n",p->name,strerror(errno));
+		blkid_free_probe(bp);
+		return -1;
+	}
+	return probe_blkid_dev(bp,p->name,NULL,p,part);
+}
@@ -10,6 +10,15 @@ extern "C" {
 struct device;
 
 int probe_blkid_superblock(const char *,blkid_probe *,struct device *);
+
+// As probe_blkid_superblock(), but through fd, which is already open on the
+// device named dev (and must remain so until any returned probe is freed).
+int probe_blkid_fd(int fd,const char *dev,blkid_probe *,struct device *);
+
+// Probe the partition p for superblocks through the fd of its disk's probe,
+// at the offset given by part, its entry in the disk's partition table (from
+// which its type, UUID and name are also taken). No new fd is opened.
+int probe_blkid_partition(blkid_probe disk,blkid_partition part,struct device *p);
 int close_blkid(void);
 
 #ifdef __cplusplus
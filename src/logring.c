@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <sched.h>
+#include <string.h>
+
+#include "logring.h"
+
+const char *loglevel_name(loglevel level){
+	static const char * const names[] = {
+		[LOGLEVEL_ERROR] = "error",
+		[LOGLEVEL_WARNING] = "warning",
+		[LOGLEVEL_INFO] = "info",
+		[LOGLEVEL_VERBOSE] = "verbose",
+	};
+
+	if((unsigned)level >= sizeof(names) / sizeof(*names)){
+		return NULL;
+	}
+	return names[level];
+}
+
+void logring_vadd(logring *lr, loglevel level, const char *src,
+			const char *fmt, va_list va){
+	uint64_t t = __atomic_fetch_add(&lr->tickets, 1, __ATOMIC_RELAXED);
+	logslot *ls = &lr->slots[t % lr->nslots];
+	const uint64_t writing = t * 2 + 1;
+	struct timespec ts;
+	uint64_t seq;
+	int n;
+
+	seq = __atomic_load_n(&ls->seq, __ATOMIC_RELAXED);
+	for(;;){
+		if(seq & 1){ // a writer from the previous lap is still at it
+			sched_yield();
+			seq = __atomic_load_n(&ls->seq, __ATOMIC_RELAXED);
+			continue;
+		}
+		if(seq > writing){ // a later lap already claimed it
+			__atomic_fetch_add(&lr->dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		if(__atomic_compare_exchange_n(&ls->seq, &seq, writing, 1,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+			break;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ls->ent.mono = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	ls->ent.when = time(NULL);
+	ls->ent.src = src;
+	ls->ent.level = level;
+	n = vsnprintf(ls->ent.msg, sizeof(ls->ent.msg), fmt, va);
+	if(n >= (int)sizeof(ls->ent.msg)){
+		size_t flen = strlen(fmt);
+		const char *mark = flen && fmt[flen - 1] == '\n' ?
+					LOGRING_TRUNCATED "\n" : LOGRING_TRUNCATED;
+
+		strcpy(ls->ent.msg + sizeof(ls->ent.msg) - strlen(mark) - 1, mark);
+	}
+	__atomic_store_n(&ls->seq, writing + 1, __ATOMIC_RELEASE);
+}
+
+unsigned logring_get(logring *lr, loglevel level, unsigned n, logent *out){
+	uint64_t t = __atomic_load_n(&lr->tickets, __ATOMIC_ACQUIRE);
+	uint64_t oldest = t > lr->nslots ? t - lr->nslots : 0;
+	unsigned got = 0;
+
+	while(got < n && t-- > oldest){
+		const logslot *ls = &lr->slots[t % lr->nslots];
+		const uint64_t done = t * 2 + 2;
+
+		// skip slots still being written, or since rewritten
+		if(__atomic_load_n(&ls->seq, __ATOMIC_ACQUIRE) != done){
+			continue;
+		}
+		if(ls->ent.level > level){
+			continue;
+		}
+		memcpy(&out[got], &ls->ent, sizeof(*out));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&ls->seq, __ATOMIC_RELAXED) != done){
+			continue;
+		}
+		out[got].msg[sizeof(out[got].msg) - 1] = '\0';
+		++got;
+	}
+	return got;
+}
@@ -0,0 +1,67 @@
+#ifndef GROWLIGHT_LOGRING
+#define GROWLIGHT_LOGRING
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <time.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+// Diagnostics are kept in a ring of fixed, preallocated slots, ala dmesg(1).
+// Any number of threads may log concurrently without a lock or allocation:
+// each takes a ticket (and thus a slot) with a single atomic add, formats
+// directly into the slot, and publishes it by its sequence number. Readers
+// copy out whatever slots are complete, skipping any being rewritten. Should
+// the writers lap the ring so quickly that two of them land on one slot, the
+// older message is the one dropped.
+typedef enum {
+	LOGLEVEL_ERROR,		// failed operations, broken setup
+	LOGLEVEL_WARNING,	// diag()
+	LOGLEVEL_INFO,		// completed operations
+	LOGLEVEL_VERBOSE,	// verbf()
+} loglevel;
+
+// "error", "warning", "info" or "verbose", and NULL for anything else.
+const char *loglevel_name(loglevel level);
+
+// Longer messages are truncated, ending in LOGRING_TRUNCATED (followed by a
+// newline, if the format ended in one). A slot comes to 256 bytes.
+#define LOGRING_MSGLEN 216
+#define LOGRING_TRUNCATED "[...]"
+
+typedef struct logent {
+	uint64_t mono;		// CLOCK_MONOTONIC nanoseconds
+	time_t when;		// wall clock
+	const char *src;	// source subsystem (static string)
+	loglevel level;
+	char msg[LOGRING_MSGLEN];
+} logent;
+
+typedef struct logslot {
+	uint64_t seq;		// 2 * ticket + 1 while written, + 2 once complete
+	logent ent;
+} logslot;
+
+typedef struct logring {
+	logslot *slots;
+	unsigned nslots;
+	uint64_t tickets;	// messages ever logged
+	uint64_t dropped;	// lost to a newer message on the same slot
+} logring;
+
+#define LOGRING_INITIALIZER(s, n) { .slots = (s), .nslots = (n), }
+
+void logring_vadd(logring *lr, loglevel level, const char *src,
+			const char *fmt, va_list va);
+
+// Copy up to n of the most recent messages at level or more severe into out,
+// newest first. Returns the number copied.
+unsigned logring_get(logring *lr, loglevel level, unsigned n, logent *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
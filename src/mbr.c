@@ -25,13 +25,8 @@ int mbrsha1(device *d, int fd, void *buf){
 	unsigned char mbr[MBR_SIZE];
 	ssize_t r;
 
-	if(lseek(fd, 0, SEEK_SET)){
-		int e = errno;
-		diag("Couldn't seek to first byte of %s (%s?)\n", d->name, strerror(errno));
-		errno = e;
-		return -1;
-	}
-	if((r = read(fd, mbr, sizeof(mbr))) < 0){
+	// pread(2), so as not to disturb fd's offset for its other users
+	if((r = pread(fd, mbr, sizeof(mbr), 0)) < 0){
 		diag("Error reading %zu from %s (%s?)\n", sizeof(mbr), d->name, strerror(errno));
 		return -1;
 	}
@@ -71,8 +66,7 @@ wipe_first_sector(device *d,size_t wipe,size_t wipeend){
 		diag("Will only wipe BIOS state for block devices\n");
 		return -1;
 	}
-	if(snprintf(dbuf,sizeof(dbuf),"/dev/%s",d->name) >= (int)sizeof(dbuf)){
-		diag("Bad device name: %s\n",d->name);
+	if(devnode_path(dbuf,sizeof(dbuf),d->name)){
 		return -1;
 	}
 	if((fd = openat(devfd,d->name,O_RDWR|O_CLOEXEC|O_DIRECT)) < 0){
@@ -46,11 +46,11 @@ int explore_md_sysfs(device *d,int dirfd){
 		verbf("Warning: no 'degraded' content in mdadm device %s\n",d->name);
 		d->mddev.degraded = 0;
 	}
-	if((d->mddev.level = get_sysfs_string(dirfd,"level")) == NULL){
+	if((d->mddev.level = get_sysfs_string_arena(dirfd,"level",&d->strings)) == NULL){
 		verbf("Warning: no 'level' content in mdadm device %s\n",d->name);
 		d->mddev.level = 0;
 	}
-	if((d->revision = get_sysfs_string(dirfd,"metadata_version")) == NULL){
+	if((d->revision = get_sysfs_string_arena(dirfd,"metadata_version",&d->strings)) == NULL){
 		verbf("Warning: no 'metadata_version' content in mdadm device %s\n",d->name);
 	}
 	// FIXME there's some archaic rules on mdadm devices making some of them
@@ -59,7 +59,7 @@ int explore_md_sysfs(device *d,int dirfd){
 		return -1;
 	}*/
 	d->mddev.pttable = NULL;
-	if((d->model = strdup("Linux mdadm")) == NULL){
+	if((d->model = arena_strdup(&d->strings,"Linux mdadm")) == NULL){
 		return -1;
 	}
 	enqm = &d->mddev.slaves;
@@ -167,6 +167,8 @@ int explore_md_sysfs(device *d,int dirfd){
 }
 
 int destroy_mdadm(device *d){
+	char dev[PATH_MAX];
+
 	if(d == NULL){
 		diag("Passed a NULL device\n");
 		return -1;
@@ -175,7 +177,10 @@ int destroy_mdadm(device *d){
 		diag("%s is not an MD device\n",d->name);
 		return -1;
 	}
-	if(vspopen_drain("mdadm --stop /dev/%s",d->name)){
+	if(devnode_path(dev,sizeof(dev),d->name)){
+		return -1;
+	}
+	if(spawn_rescan(dev,"mdadm","--stop",dev,NULL) == 0){
 		return -1;
 	}
 	return 0;
@@ -184,27 +189,42 @@ int destroy_mdadm(device *d){
 static int
 generic_mdadm_create(const char *name,const char *metadata,const char *level,
 			char * const *comps,int num,int bitmap){
-	char buf[BUFSIZ] = "";
-	size_t pos;
-	int z;
+	const char *argv[num + 16];
+	char devs[num][PATH_MAX];
+	char count[16];
+	int z,argc = 0;
 
-	pos = 0;
-#define PREFIX "/dev/"
+	snprintf(count,sizeof(count),"%d",num);
+	argv[argc++] = "mdadm";
+	argv[argc++] = "-C";
+	argv[argc++] = name;
+	argv[argc++] = "--auto=md";
+	argv[argc++] = "-e";
+	argv[argc++] = metadata;
+	argv[argc++] = "-l";
+	argv[argc++] = level;
+	argv[argc++] = "-N";
+	argv[argc++] = name;
+	argv[argc++] = "-n";
+	argv[argc++] = count;
+	// FIXME provide a way to let user control write intent bitmap
+	if(bitmap){
+		argv[argc++] = "-b";
+		argv[argc++] = "internal";
+	}
 	for(z = 0 ; z < num ; ++z){
-		if((unsigned)snprintf(buf + pos,sizeof(buf) - pos," %s%s",
-				strcmp(*comps,"missing") ? "/dev/" : "",
-				*comps) >= sizeof(buf) - pos){
-			diag("Too many arguments for MD creation\n");
+		if(strcmp(comps[z],"missing") == 0){
+			argv[argc++] = comps[z];
+			continue;
+		}
+		if(devnode_path(devs[z],sizeof(devs[z]),comps[z])){
 			return -1;
 		}
-		++comps;
-		pos += strlen(buf + pos);
+		argv[argc++] = devs[z];
 	}
-#undef PREFIX
-	// FIXME provide a way to let user control write intent bitmap
-	return vspopen_drain("mdadm -C \"%s\" --auto=md -e %s -l %s -N \"%s\" -n %d%s%s",
-				name,metadata,level,name,num,
-				bitmap ? " -b internal" : "",buf);
+	argv[argc] = NULL;
+	// the array and its components' new holders are announced by udev
+	return spawn_bgv(argv) ? 0 : -1;
 }
 
 int make_mdraid0(const char *name,char * const *comps,int num){
@@ -0,0 +1,215 @@
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sysmacros.h>
+
+#include "mountinfo.h"
+
+// Decode the kernel's octal escapes (\040 for space, etc.) in place.
+static void
+unescape(char *s){
+	char *d = s;
+
+	while(*s){
+		if(s[0] == '\\' && s[1] >= '0' && s[1] <= '3' &&
+				s[2] >= '0' && s[2] <= '7' && s[3] >= '0' && s[3] <= '7'){
+			*d++ = (char)((s[1] - '0') * 64 + (s[2] - '0') * 8 + (s[3] - '0'));
+			s += 4;
+		}else{
+			*d++ = *s++;
+		}
+	}
+	*d = '\0';
+}
+
+// Terminate and return the space-delimited field at *cur, advancing past it.
+// NULL if the line is exhausted.
+static char *
+field(char **cur){
+	char *f = *cur,*e;
+
+	if(*f == '\0'){
+		return NULL;
+	}
+	if( (e = strchr(f,' ')) ){
+		*e = '\0';
+		*cur = e + 1;
+	}else{
+		*cur = f + strlen(f);
+	}
+	return f;
+}
+
+static int
+parse_line(char *line,mountinfo *mi){
+	unsigned maj,mnr;
+	char *f,*end;
+
+	if((f = field(&line)) == NULL){
+		return -1;
+	}
+	mi->id = strtoul(f,&end,10);
+	if(*end || (f = field(&line)) == NULL){
+		return -1;
+	}
+	mi->parent = strtoul(f,&end,10);
+	if(*end || (f = field(&line)) == NULL){
+		return -1;
+	}
+	maj = strtoul(f,&end,10);
+	if(*end != ':'){
+		return -1;
+	}
+	mnr = strtoul(end + 1,&end,10);
+	if(*end){
+		return -1;
+	}
+	mi->devno = makedev(maj,mnr);
+	if((mi->root = field(&line)) == NULL || (mi->mnt = field(&line)) == NULL ||
+			(mi->ops = field(&line)) == NULL){
+		return -1;
+	}
+	// zero or more optional fields, terminated by a lone hyphen
+	do{
+		if((f = field(&line)) == NULL){
+			return -1;
+		}
+	}while(strcmp(f,"-"));
+	if((mi->fs = field(&line)) == NULL || (mi->src = field(&line)) == NULL ||
+			(mi->sops = field(&line)) == NULL){
+		return -1;
+	}
+	unescape(mi->root);
+	unescape(mi->mnt);
+	unescape(mi->src);
+	mi->resolved = 0;
+	return 0;
+}
+
+static int
+mountinfo_cmp(const void *va,const void *vb){
+	const mountinfo *a = va,*b = vb;
+
+	return a->id < b->id ? -1 : a->id > b->id;
+}
+
+int parse_mountinfo(const char *text,size_t len,mounttable *mt){
+	unsigned lines = 0;
+	char *line,*nl;
+	size_t z;
+
+	free_mounttable(mt);
+	for(z = 0 ; z < len ; ++z){
+		lines += text[z] == '\n';
+	}
+	if((mt->text = malloc(len + 1)) == NULL){
+		return -1;
+	}
+	// one more than we need, in case the last line is unterminated
+	if((mt->ents = malloc(sizeof(*mt->ents) * (lines + 1))) == NULL){
+		free_mounttable(mt);
+		return -1;
+	}
+	memcpy(mt->text,text,len);
+	mt->text[len] = '\0';
+	for(line = mt->text ; *line ; line = nl){
+		if( (nl = strchr(line,'\n')) ){
+			*nl++ = '\0';
+		}else{
+			nl = line + strlen(line);
+		}
+		if(parse_line(line,&mt->ents[mt->count]) == 0){
+			++mt->count;
+		}
+	}
+	// the kernel usually lists mounts in ID order already
+	for(z = 1 ; z < mt->count ; ++z){
+		if(mt->ents[z - 1].id > mt->ents[z].id){
+			qsort(mt->ents,mt->count,sizeof(*mt->ents),mountinfo_cmp);
+			break;
+		}
+	}
+	return 0;
+}
+
+int read_mountinfo(const char *path,mounttable *mt){
+	size_t len = 0,size = 8192;
+	char *buf,*tmp;
+	ssize_t r;
+	int fd;
+
+	if((fd = open(path,O_RDONLY|O_CLOEXEC)) < 0){
+		return -1;
+	}
+	if((buf = malloc(size)) == NULL){
+		close(fd);
+		return -1;
+	}
+	// procfs gives us at most a page per read()
+	while((r = read(fd,buf + len,size - len)) > 0 || (r < 0 && errno == EINTR)){
+		if(r < 0){
+			continue;
+		}
+		if((len += r) == size){
+			if((tmp = realloc(buf,size * 2)) == NULL){
+				break;
+			}
+			buf = tmp;
+			size *= 2;
+		}
+	}
+	close(fd);
+	if(r < 0 || len == size){
+		free(buf);
+		return -1;
+	}
+	r = parse_mountinfo(buf,len,mt);
+	free(buf);
+	return r;
+}
+
+void free_mounttable(mounttable *mt){
+	free(mt->ents);
+	free(mt->text);
+	mt->ents = NULL;
+	mt->text = NULL;
+	mt->count = 0;
+}
+
+static int
+same_mount(const mountinfo *a,const mountinfo *b){
+	return a->devno == b->devno && strcmp(a->mnt,b->mnt) == 0 &&
+		strcmp(a->ops,b->ops) == 0 && strcmp(a->fs,b->fs) == 0 &&
+		strcmp(a->src,b->src) == 0 && strcmp(a->root,b->root) == 0;
+}
+
+unsigned diff_mounttables(mounttable *prev,mounttable *cur,
+				mountfxn gone,mountfxn came,void *arg){
+	unsigned p,c,calls = 0;
+
+	for(p = c = 0 ; p < prev->count ; ++p){
+		while(c < cur->count && cur->ents[c].id < prev->ents[p].id){
+			++c;
+		}
+		if(c == cur->count || cur->ents[c].id != prev->ents[p].id ||
+				!same_mount(&prev->ents[p],&cur->ents[c])){
+			gone(&prev->ents[p],arg);
+			++calls;
+		}
+	}
+	for(p = c = 0 ; c < cur->count ; ++c){
+		while(p < prev->count && prev->ents[p].id < cur->ents[c].id){
+			++p;
+		}
+		if(p < prev->count && prev->ents[p].id == cur->ents[c].id &&
+				same_mount(&prev->ents[p],&cur->ents[c])){
+			cur->ents[c].resolved = prev->ents[p].resolved;
+		}else{
+			came(&cur->ents[c],arg);
+			++calls;
+		}
+	}
+	return calls;
+}
@@ -0,0 +1,60 @@
+#ifndef GROWLIGHT_MOUNTINFO
+#define GROWLIGHT_MOUNTINFO
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// A line of /proc/self/mountinfo (see proc(5)). Unlike /proc/mounts, each
+// mount carries an ID which is unique among current mounts, and the device
+// number of the mounted filesystem, so successive tables can be diffed and
+// mounts attributed to devices without resolving their sources.
+typedef struct mountinfo {
+	unsigned id;		// mount ID
+	unsigned parent;	// ID of the parent mount
+	dev_t devno;		// st_dev of the filesystem (major 0 if anonymous)
+	char *root;		// root of the mount within the filesystem
+	char *mnt;		// mount point
+	char *ops;		// per-mount options
+	char *fs;		// filesystem type
+	char *src;		// mount source ("overlay", "tmpfs", etc. if virtual)
+	char *sops;		// per-superblock options
+	unsigned resolved: 1;	// consumer's state, carried across diffs
+} mountinfo;
+
+// Every string points into text, a private copy of the file which is
+// unescaped in place, so a table costs two allocations however many mounts
+// it describes. Zero-initialize before first use.
+typedef struct mounttable {
+	mountinfo *ents;	// sorted by id
+	unsigned count;
+	char *text;
+} mounttable;
+
+// Parse len bytes of mountinfo text, replacing any contents of mt. Malformed
+// lines are skipped. Returns -1 on allocation failure, leaving mt empty.
+int parse_mountinfo(const char *text, size_t len, mounttable *mt);
+
+// Read and parse the mountinfo file at path.
+int read_mountinfo(const char *path, mounttable *mt);
+
+void free_mounttable(mounttable *mt);
+
+// Walk prev and cur in ID order, calling gone() for each mount of prev which
+// is missing or different in cur (a remount changes the options of a mount
+// without changing its ID), and then came() for each mount of cur missing or
+// different in prev. Unchanged mounts of cur inherit prev's resolved flag.
+// Returns the number of calls made.
+typedef void (*mountfxn)(mountinfo *, void *);
+
+unsigned diff_mounttables(mounttable *prev, mounttable *cur,
+				mountfxn gone, mountfxn came, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,5 +1,4 @@
 #include <fcntl.h>
-#include <ctype.h>
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -8,12 +7,13 @@
 #include <stdint.h>
 #include <sys/stat.h>
 #include <sys/mount.h>
-#include <sys/statvfs.h>
+#include <sys/sysmacros.h>
 
 #include "fs.h"
 #include "zfs.h"
-#include "mmap.h"
 #include "mounts.h"
+#include "fsusage.h"
+#include "mountinfo.h"
 #include "growlight.h"
 #include "aggregate.h"
 
@@ -45,221 +45,286 @@ make_parent_directories(const char *path){
 	return 0;
 }
 
-static int
-parse_mount(const char *map,off_t len,char **dev,char **mnt,char **fs,char **ops){
-	const char *t;
-	int r = 0;
-
-	*dev = *mnt = *fs = *ops = NULL;
-	t = map;
-	if(len <= t - map){
-		goto err;
-	}
-	while(isgraph(map[r])){
-		if(++r >= len){
-			goto err;
-		}
-	}
-	if(!isspace(map[r])){
-		goto err;
-	}
-	if(r == t - map){
-		goto err;
+// The mount table as of the most recent parse_mounts() or update_mounts().
+// Protected by the growlight lock.
+static mounttable mounts;
+
+// Filesystem usage is taken off the growlight lock (see fsusage.h), so that
+// a hung NFS or FUSE mount can't wedge us. Refreshed every FSUSAGE_TTL_MS,
+// and marked hung after FSUSAGE_TIMEOUT_MS without an answer.
+#define FSUSAGE_THREADS		4
+#define FSUSAGE_TTL_MS		5000
+#define FSUSAGE_TIMEOUT_MS	2000
+
+static struct fsusage_cache *usage;
+
+// Find the device backing a mount: by device number if it's a real one,
+// otherwise (btrfs, zfs, etc.) by resolving its source.
+static device *
+mount_device(const mountinfo *mi){
+	char buf[PATH_MAX + 1];
+	struct stat st;
+	const char *rp;
+	device *d;
+	int r;
+
+	if(major(mi->devno) && (d = lookup_device_devno(mi->devno))){
+		return d;
 	}
-	if((*dev = strndup(t,r - (t - map))) == NULL){
-		goto err;
+	if(*mi->src != '/'){ // have to get zfs's etc
+		if(fstype_virt_p(mi->fs)){
+			return NULL;
+		}
+		if((d = lookup_device(mi->src)) == NULL){
+			verbf("virtfs %s at %s\n",mi->fs,mi->mnt);
+		}
+		return d;
+	}
+	rp = mi->src;
+	if(lstat(rp,&st) == 0){
+		if(S_ISLNK(st.st_mode)){
+			if((r = readlink(rp,buf,sizeof(buf))) < 0){
+				diag("Couldn't deref %s (%s?)\n",rp,strerror(errno));
+				return NULL;
+			}
+			if((size_t)r >= sizeof(buf)){
+				diag("Name too long for %s (%d?)\n",rp,r);
+				return NULL;
+			}
+			buf[r] = '\0';
+			rp = buf;
+		}
 	}
-	t = map + ++r;
-	if(len <= t - map){
-		goto err;
+	return lookup_device(rp);
+}
+
+static void
+mount_event(const glightui *gui,device *d){
+	if(d->layout == LAYOUT_PARTITION){
+		d = d->partdev.parent;
 	}
-	while(isgraph(map[r])){
-		if(++r >= len){
-			goto err;
+	d->uistate = gui->block_event(d,d->uistate);
+}
+
+// Returns non-zero if the device's view of its usage changed. A mount which
+// stops answering keeps its last figures.
+static int
+apply_usage(device *d,const fsusage *fu){
+	fsusage *mu = &d->mntusage;
+	int changed = mu->state != fu->state;
+
+	if(fu->state == FSUSAGE_OK){
+		changed |= mu->size != fu->size || mu->free != fu->free ||
+			mu->ffree != fu->ffree || mu->ttf != fu->ttf || mu->ittf != fu->ittf;
+		*mu = *fu;
+		d->mntsize = fu->size;
+	}else{
+		mu->state = fu->state;
+		mu->err = fu->err;
+	}
+	return changed;
+}
+
+// Called from an fsusage worker, without the growlight lock.
+static void
+mount_usage(const char *mnt,const fsusage *fu,void *vgui){
+	device *d = NULL;
+	unsigned z;
+
+	if(fu->state == FSUSAGE_STALE || fu->state == FSUSAGE_HUNG){
+		diag("Filesystem at %s isn't responding\n",mnt);
+	}
+	lock_growlight();
+	// the most recent mount at a point is the one statvfs() sees
+	for(z = mounts.count ; z-- ; ){
+		if(mounts.ents[z].resolved && strcmp(mounts.ents[z].mnt,mnt) == 0){
+			d = mount_device(&mounts.ents[z]);
+			break;
 		}
 	}
-	if(!isspace(map[r])){
-		goto err;
+	if(d && apply_usage(d,fu)){
+		mount_event(vgui,d);
 	}
-	if(r == t - map){
-		goto err;
+	unlock_growlight();
+}
+
+// A mount which is no longer present (or was remounted).
+static void
+mount_gone(mountinfo *mi,void *vgui){
+	device *d;
+	unsigned z;
+
+	if(usage){
+		fsusage_forget(usage,mi->mnt);
 	}
-	if((*mnt = strndup(t,r - (t - map))) == NULL){
-		goto err;
+	if(growlight_target && strcmp(mi->mnt,growlight_target) == 0){
+		unmount_target();
 	}
-	t = map + ++r;
-	if(len <= t - map){
-		goto err;
+	if(!mi->resolved || (d = mount_device(mi)) == NULL){
+		return;
 	}
-	while(isgraph(map[r])){
-		if(++r >= len){
-			goto err;
+	for(z = 0 ; z < d->mnt.count ; ++z){
+		if(strcmp(d->mnt.list[z],mi->mnt) == 0){
+			break;
 		}
 	}
-	if(!isspace(map[r])){
-		goto err;
+	if(z == d->mnt.count){
+		return;
+	}
+	// mnt and mntops are parallel
+	free(d->mnt.list[z]);
+	free(d->mntops.list[z]);
+	--d->mnt.count;
+	--d->mntops.count;
+	memmove(&d->mnt.list[z],&d->mnt.list[z + 1],sizeof(*d->mnt.list) * (d->mnt.count - z));
+	memmove(&d->mntops.list[z],&d->mntops.list[z + 1],sizeof(*d->mntops.list) * (d->mntops.count - z));
+	mount_event(vgui,d);
+}
+
+// Attribute mi to d, marking it resolved. Returns non-zero on failure.
+static int
+attach_mount(device *d,mountinfo *mi){
+	fsusage fu;
+
+	if(d->mnttype && strcmp(d->mnttype,mi->fs)){
+		diag("Already had mounttype for %s: %s (got %s)\n",
+				d->name,d->mnttype,mi->fs);
+		free(d->mnttype);
+		free_stringlist(&d->mntops);
+		free_stringlist(&d->mnt);
+		if((d->mnttype = strdup(mi->fs)) == NULL){
+			return -1;
+		}
 	}
-	if(r == t - map){
-		goto err;
+	if(add_string(&d->mnt,mi->mnt)){
+		return -1;
 	}
-	if((*fs = strndup(t,r - (t - map))) == NULL){
-		goto err;
+	if(add_string(&d->mntops,mi->ops)){
+		free(d->mnt.list[--d->mnt.count]);
+		return -1;
 	}
-	t = map + ++r;
-	if(len <= t - map){
-		goto err;
+	mi->resolved = 1;
+	// cached figures are used immediately; otherwise they're on the way
+	if(usage && fsusage_get(usage,mi->mnt,&fu) == 0){
+		apply_usage(d,&fu);
 	}
-	while(isgraph(map[r])){
-		if(++r >= len){
-			goto err;
-		}
+	return 0;
+}
+
+// A new mount (or one which was remounted). Marks it resolved if we found
+// the device it belongs to.
+static void
+mount_came(mountinfo *mi,void *vgui){
+	device *d;
+
+	// We might have mounted a new target atop or above an already
+	// existing one, in which case we'll need possibly recreate the
+	// directory structure on the newly-mounted filesystem.
+	if(growlight_target && strncmp(mi->mnt,growlight_target,strlen(growlight_target)) == 0 &&
+			access(mi->mnt,F_OK) && make_parent_directories(mi->mnt)){
+		// FIXME else remount? otherwise writes go to new filesystem
+		// rather than old...?
+		return;
 	}
-	if(!isspace(map[r])){
-		goto err;
+	if((d = mount_device(mi)) == NULL){
+		return;
 	}
-	if(r == t - map){
-		goto err;
+	if(attach_mount(d,mi)){
+		return;
 	}
-	if((*ops = strndup(t,r - (t - map))) == NULL){
-		goto err;
+	mount_event(vgui,d);
+	if(growlight_target && strcmp(mi->mnt,growlight_target) == 0){
+		mount_target();
 	}
-	t = map + ++r;
-	while(r < len){
-		if(map[r] == '\n'){
-			break;
+}
+
+// Mounts of real devices which weren't yet known when they were parsed.
+static void
+retry_unresolved(const glightui *gui,mounttable *mt){
+	unsigned z;
+
+	for(z = 0 ; z < mt->count ; ++z){
+		mountinfo *mi = &mt->ents[z];
+
+		if(!mi->resolved && major(mi->devno) && lookup_device_devno(mi->devno)){
+			mount_came(mi,(void *)gui);
 		}
-		++r;
 	}
-	if(r >= len){
-		goto err;
-	}
-	++r;
-	return r;
-
-err:
-	diag("Couldn't extract mount info from %s\n",map);
-	free(*dev);
-	free(*mnt);
-	free(*fs);
-	free(*ops);
-	return -1;
 }
 
 int parse_mounts(const glightui *gui,const char *fn){
-	char *mnt,*dev,*ops,*fs;
-	off_t len,idx;
-	char *map;
-	int fd;
+	unsigned z;
 
-	if((map = map_virt_file(fn,&fd,&len)) == MAP_FAILED){
+	if(usage == NULL){
+		usage = fsusage_create(FSUSAGE_THREADS,FSUSAGE_TTL_MS,
+				FSUSAGE_TIMEOUT_MS,mount_usage,(void *)gui);
+		if(usage == NULL){
+			diag("Couldn't create filesystem usage cache\n");
+			return -1;
+		}
+	}
+	if(read_mountinfo(fn,&mounts)){
+		diag("Couldn't read mounts from %s (%s?)\n",fn,strerror(errno));
 		return -1;
 	}
-	idx = 0;
-	dev = mnt = fs = ops = NULL;
-	while(idx < len){
-		char buf[PATH_MAX + 1];
-		struct statvfs vfs;
-		struct stat st;
-		device *d;
-		char *rp;
-		int r;
+	for(z = 0 ; z < mounts.count ; ++z){
+		mount_came(&mounts.ents[z],(void *)gui);
+	}
+	return 0;
+}
 
-		free(dev); free(mnt); free(fs); free(ops);
-		if((r = parse_mount(map + idx,len - idx,&dev,&mnt,&fs,&ops)) < 0){
-			goto err;
-		}
-		idx += r;
-		if(statvfs(mnt,&vfs)){
-			int skip = 0;
-
-			// We might have mounted a new target atop or above an
-			// already existing one, in which case we'll need
-			// possibly recreate the directory structure on the
-			// newly-mounted filesystem.
-			if(growlight_target){
-				if(strncmp(mnt,growlight_target,strlen(growlight_target)) == 0){
-					if(make_parent_directories(mnt) == 0){
-						skip = 1;
-					} // FIXME else remount? otherwise writes
-					// go to new filesystem rather than old...?
-				}
-			}
-			if(!skip){
-				diag("Couldn't stat fs %s (%s?)\n",mnt,strerror(errno));
-				r = -1;
-				continue;
-			}
-		}
-		if(*dev != '/'){ // have to get zfs's etc
-			if(fstype_virt_p(fs)){
-				continue;
-			}
-			if((d = lookup_device(dev)) == NULL){
-				verbf("virtfs %s at %s\n",fs,mnt);
-				continue;
-			}
-		}else{
-			rp = dev;
-			if(lstat(rp,&st) == 0){
-				if(S_ISLNK(st.st_mode)){
-					if((r = readlink(dev,buf,sizeof(buf))) < 0){
-						diag("Couldn't deref %s (%s?)\n",dev,strerror(errno));
-						continue;
-					}
-					if((size_t)r >= sizeof(buf)){
-						diag("Name too long for %s (%d?)\n",dev,r);
-						continue;
-					}
-					buf[r] = '\0';
-					rp = buf;
-				}
-			}
-			if((d = lookup_device(rp)) == NULL){
-				continue;
-			}
-		}
-		free(dev);
-		dev = NULL;
-		if(d->mnttype && strcmp(d->mnttype,fs)){
-			diag("Already had mounttype for %s: %s (got %s)\n",
-					d->name,d->mnttype,fs);
-			free(d->mnttype);
-			d->mnttype = NULL;
-			free_stringlist(&d->mntops);
-			free_stringlist(&d->mnt);
-			d->mnttype = fs;
-		}else{
-			free(fs);
-		}
-		fs = NULL;
-		if(add_string(&d->mnt,mnt)){
-			goto err;
-		}
-		if(add_string(&d->mntops,ops)){
-			goto err;
-		}
-		d->mntsize = (uintmax_t)vfs.f_bsize * vfs.f_blocks;
-		if(d->layout == LAYOUT_PARTITION){
-			d = d->partdev.parent;
+int update_mounts(const glightui *gui,const char *fn){
+	mounttable cur = { .count = 0, };
+	unsigned changes;
+
+	if(read_mountinfo(fn,&cur)){
+		diag("Couldn't read mounts from %s (%s?)\n",fn,strerror(errno));
+		return -1;
+	}
+	// resolutions made here are inherited by the unchanged mounts of cur
+	retry_unresolved(gui,&mounts);
+	changes = diff_mounttables(&mounts,&cur,mount_gone,mount_came,(void *)gui);
+	verbf("%u mount%s changed of %u\n",changes,changes == 1 ? "" : "s",cur.count);
+	free_mounttable(&mounts);
+	mounts = cur;
+	return 0;
+}
+
+void reattribute_mounts(const glightui *gui,device *d){
+	unsigned z;
+	device *p;
+
+	free_stringlist(&d->mnt);
+	free_stringlist(&d->mntops);
+	for(p = d->parts ; p ; p = p->next){
+		free_stringlist(&p->mnt);
+		free_stringlist(&p->mntops);
+	}
+	for(z = 0 ; z < mounts.count ; ++z){
+		mountinfo *mi = &mounts.ents[z];
+
+		if((p = mount_device(mi)) == NULL){
+			continue;
 		}
-		d->uistate = gui->block_event(d,d->uistate);
-		if(growlight_target){
-			if(strcmp(mnt,growlight_target) == 0){
-				mount_target();
-			}
+		if(p == d || (p->layout == LAYOUT_PARTITION && p->partdev.parent == d)){
+			attach_mount(p,mi);
 		}
 	}
-	free(mnt); free(fs); free(ops);
-	mnt = fs = ops = NULL;
-	munmap_virt(map,len);
-	close(fd);
-	return 0;
+	mount_event(gui,d);
+}
 
-err:
-	free(dev); free(mnt); free(fs); free(ops);
-	munmap_virt(map,len);
-	close(fd);
-	return -1;
+void sweep_mount_usage(void){
+	if(usage){
+		fsusage_sweep(usage);
+	}
+}
+
+void free_mounts(void){
+	// must not be called with the growlight lock held, lest we wait on a
+	// callback which is waiting on the lock
+	fsusage_destroy(usage);
+	usage = NULL;
+	free_mounttable(&mounts);
 }
 
 int mmount(device *d,const char *targ,unsigned mntops,const void *data){
@@ -304,15 +369,18 @@ int mmount(device *d,const char *targ,unsigned mntops,const void *data){
 			}
 		}
 	}
-	snprintf(name,sizeof(name),"/dev/%s",d->name);
+	if(devnode_path(name,sizeof(name),d->name)){
+		free(rname);
+		return -1;
+	}
 	// Use the original path for the actual mount
 	if(mount(name,targ,d->mnttype,mntops,data)){
-		diag("Error mounting %s (%u) at %s (%s?)\n",
+		glog(LOGLEVEL_ERROR,"Error mounting %s (%u) at %s (%s?)\n",
 				name,mntops,targ,strerror(errno));
 		free(rname);
 		return -1;
 	}
-	diag("Mounted %s at %s\n",d->name,targ);
+	glog(LOGLEVEL_INFO,"Mounted %s at %s\n",d->name,targ);
 	free(rname);
 	return 0;
 }
@@ -328,12 +396,12 @@ int unmount(device *d,const char *path){
 		if(path && strcmp(d->mnt.list[z],path) == 0){
 			continue;
 		}
-		diag("Unmounting %s from %s\n",d->name,d->mnt.list[z]);
+		glog(LOGLEVEL_INFO,"Unmounting %s from %s\n",d->name,d->mnt.list[z]);
 		if(strcmp(d->mnt.list[z],growlight_target) == 0){
 			unmount_target();
 		}
 		if(umount2(d->mnt.list[z],UMOUNT_NOFOLLOW)){
-			diag("Error unmounting %s at %s (%s?)\n",
+			glog(LOGLEVEL_ERROR,"Error unmounting %s at %s (%s?)\n",
 					d->name,d->mnt.list[z],strerror(errno));
 			return -1;
 		}
@@ -9,9 +9,22 @@ struct device;
 struct controller;
 struct growlight_ui;
 
-// (Re)parse the specified file having /proc/mounts format. Remember that
-// /proc/mounts must be poll()ed with POLLPRI, not POLLIN!
+// Mounts are read from /proc/self/mountinfo (see mountinfo.h). Remember that
+// it must be poll()ed with POLLPRI, not POLLIN!
+//
+// parse_mounts() attributes every mount in the file to its device, and is
+// meant to follow clear_mounts(). update_mounts() diffs the file against the
+// table last read, and touches only those devices gaining or losing mounts
+// (plus any device discovered since it last failed to find one).
+// reattribute_mounts() reattaches the table's mounts to a single disk and its
+// partitions, for after it has been rescanned (and maybe repartitioned).
 int parse_mounts(const struct growlight_ui *,const char *);
+int update_mounts(const struct growlight_ui *,const char *);
+void reattribute_mounts(const struct growlight_ui *,struct device *);
+// Filesystem usage is refreshed in the background; call this periodically
+// (without the growlight lock) to keep it moving and notice hung mounts.
+void sweep_mount_usage(void);
+void free_mounts(void);
 int mmount(struct device *,const char *,unsigned,const void *);
 int unmount(struct device *,const char *);
 void clear_mounts(struct controller *);
@@ -1,7 +1,10 @@
 #include <assert.h>
 #include <ctype.h>
+#include <poll.h>
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <locale.h>
@@ -531,6 +534,16 @@ static unsigned count_adapters;
 // dequeue + single selection
 static reelbox *current_adapter,*top_reelbox,*last_reelbox;
 
+// Written by stats_callback() to wake next_input()
+static int statspipe[2] = { -1, -1, };
+
+// Devnos whose stats changed since the last redraw_stats(). Should too many
+// accumulate, everything is redrawn.
+#define STATSDIRTY_MAX 256
+static pthread_mutex_t statsdirtylock = PTHREAD_MUTEX_INITIALIZER;
+static dev_t statsdirty[STATSDIRTY_MAX];
+static unsigned statsdirtycount;	// > STATSDIRTY_MAX: redraw everything
+
 #define START_COL 1		// Room to leave for borders
 #define PAD_COLS(cols) ((cols))
 
@@ -956,7 +969,7 @@ print_blockbar(WINDOW *w,const blockobj *bo,int y,int sx,int ex,int selected){
 		{ .attr = 0, .chars = L" ", },
 		{ .attr = 0, .chars = L" ", },
 	};
-	char pre[PREFIXSTRLEN + 1];
+	char pre[PREFIXSTRLEN + 1],use[64],zstr[PREFIXSTRLEN + 68];
 	const char *selstr = NULL;
 	wchar_t wbuf[ex - sx + 2];
 	int targco,mountco,partco;
@@ -973,26 +986,33 @@ print_blockbar(WINDOW *w,const blockobj *bo,int y,int sx,int ex,int selected){
 			COLOR_PAIR(PART_COLOR0) : COLOR_PAIR(FS_COLOR);
 
 		assert(wattrset(w,A_BOLD|co) == OK);
-		qprefix(zs,1,pre,sizeof(pre),1);
-		if(!d->mnt.count || swprintf(wbuf,sizeof(wbuf),L" %s%s%ls%s%ls%s%s%sat %s ",
+		// size, and how full it is (and is getting) if mounted
+		zstr[0] = '\0';
+		if(zs){
+			qprefix(zs,1,pre,sizeof(pre),1);
+			fsusage_summary(&d->mntusage,use,sizeof(use));
+			snprintf(zstr,sizeof(zstr),"(%s%s%s)",pre,
+					d->mnt.count && *use ? ", " : "",
+					d->mnt.count ? use : "");
+		}
+		if(!d->mnt.count || swprintf(wbuf,sizeof(wbuf),L" %s%s%ls%s%ls%s%sat %s ",
 			d->label ? "" : "nameless ",
 			d->mnttype,
 			d->label ? L" “" : L"",
 			d->label ? d->label : "",
 			d->label ? L"” " : L" ",
-			zs ? "(" : "", zs ? pre : "", zs ? ") " : "",
+			zstr, *zstr ? " " : "",
 			d->mnt.list[0]) >= (int)(sizeof(wbuf))){
-			if(swprintf(wbuf,sizeof(wbuf),L" %s%s%ls%s%ls%s%s%s ",
+			if(swprintf(wbuf,sizeof(wbuf),L" %s%s%ls%s%ls%s ",
 				d->label ? "" : "nameless ",
 				d->mnttype,
 				d->label ? L" “" : L"",
 				d->label ? d->label : "",
 				d->label ? L"” " : L" ",
-				zs ? "(" : "", zs ? pre : "", zs ? ")" : ""
+				zstr
 				) >= (int)(sizeof(wbuf))){
-				if((unsigned)swprintf(wbuf,sizeof(wbuf),L" %s%s%s%s ",
-					d->mnttype,
-					zs ? "(" : "", zs ? pre : "", zs ? ")" : ""
+				if((unsigned)swprintf(wbuf,sizeof(wbuf),L" %s%s ",
+					d->mnttype,zstr
 					) >= sizeof(wbuf)){
 					assert((unsigned)swprintf(wbuf,sizeof(wbuf),L"%s",d->mnttype) < sizeof(wbuf));
 				}
@@ -1183,7 +1203,10 @@ print_dev(const reelbox *rb,const blockobj *bo,int line,int rows,
 	switch(bo->d->layout){
 case LAYOUT_NONE:
 		if(bo->d->blkdev.realdev){
-			if(bo->d->blkdev.removable){
+			if(bo->d->probe_pending){
+				assert(wattrset(rb->win,COLOR_PAIR(VIRTUAL_COLOR)) == OK);
+				strncpy(rolestr,"probing",sizeof(rolestr));
+			}else if(bo->d->blkdev.removable){
 				assert(wattrset(rb->win,COLOR_PAIR(OPTICAL_COLOR)) == OK);
 				strncpy(rolestr,"removable",sizeof(rolestr));
 			}else if(bo->d->blkdev.rotation >= 0){
@@ -1394,11 +1417,13 @@ case LAYOUT_ZPOOL:
 				mvwprintw(rb->win,sumline,START_COL,"up  ");
 			}
 		}
+		// bytes per second, independent of the sampling interval
+		const statrates *rates;
 		uintmax_t io;
-		io = bo->d->statdelta.sectors_read;
-		io += bo->d->statdelta.sectors_written;
-		io *= bo->d->logsec;
-		// FIXME normalize according to timeq
+		lock_stats();
+		rates = &device_stats(bo->d)->rates;
+		io = rates->rbytes + rates->wbytes;
+		unlock_stats();
 		wattrset(rb->win, COLOR_PAIR(SELECTED_COLOR));
 		// FIXME 'i' shows up only when there are fewer than 3 sigfigs
 		// to the left of the decimal point...very annoying
@@ -2602,7 +2627,7 @@ fs_do(const char *name){
 		locked_diag("Cannot make filesystems in empty space");
 	}
 	if(r == 0){
-		locked_diag("Successfully created %s filesystem",pending_fstype);
+		locked_diag("Creating %s filesystem",pending_fstype);
 	}
 	redraw_adapter(current_adapter);
 	destroy_fs_forms();
@@ -3171,8 +3196,13 @@ ncurses_setup(void){
 	}
 	ESCDELAY = 100;
 	keypad(stdscr,TRUE);
-	if(nodelay(stdscr,FALSE) != OK){
-		errstr = "Couldn't set blocking input\n";
+	// next_input() polls, so that stats redraws can wake it
+	if(nodelay(stdscr,TRUE) != OK){
+		errstr = "Couldn't set nonblocking input\n";
+		goto err;
+	}
+	if(pipe2(statspipe,O_CLOEXEC|O_NONBLOCK)){
+		errstr = "Couldn't create stats pipe\n";
 		goto err;
 	}
 	if(setup_colors() != OK){
@@ -3231,6 +3261,9 @@ select_adapter_dev(reelbox *rb,blockobj *bo,int delta){
 		rb->selline = -1;
 	}else{
 		rb->selline += delta;
+		if(bo->d->probe_pending){ // the user's looking at it
+			prioritize_probe(bo->d);
+		}
 	}
 	return redraw_adapter(rb);
 }
@@ -3244,6 +3277,9 @@ select_adapter_node(reelbox *rb,struct blockobj *bo,int delta){
 		rb->selline = -1;
 	}else{
 		rb->selline += delta;
+		if(bo->d->probe_pending){ // the user's looking at it
+			prioritize_probe(bo->d);
+		}
 	}
 	redraw_adapter(rb);
 }
@@ -3400,6 +3436,31 @@ detail_fs(WINDOW *hw,const device *d,int row){
 	}
 }
 
+// Derived I/O figures for the most recent stats interval. Built up in a
+// buffer so that it can be clipped to the window width in one go.
+static void
+detail_stats(WINDOW *hw,const device *d,int row,int cols){
+	char rbuf[BPREFIXSTRLEN + 1],wbuf[BPREFIXSTRLEN + 1];
+	statrates rates;
+	char line[128];
+
+	lock_stats();
+	rates = device_stats(d)->rates;
+	unlock_stats();
+	snprintf(line,sizeof(line),"%.1fr/%.1fw IOPS %.2f/%.2fms %sB/%sB/s QD %.2f %.1f%% busy",
+			rates.reads,rates.writes,
+			rates.rlatency,rates.wlatency,
+			bprefix(rates.rbytes,1,rbuf,sizeof(rbuf),1),
+			bprefix(rates.wbytes,1,wbuf,sizeof(wbuf),1),
+			rates.qdepth,rates.util);
+	mvwprintw(hw,row,START_COL,"I/O: ");
+	wattroff(hw,A_BOLD);
+	if(cols - 2 - 5 > 0){
+		wprintw(hw,"%-*.*s",cols - 2 - 5,cols - 2 - 5,line);
+	}
+	wattron(hw,A_BOLD);
+}
+
 // One must not call diag() from any function called by update_details(), or
 // else you will get one of a deadlock or a stack overflow due to corecursion.
 static int
@@ -3545,6 +3606,9 @@ update_details(WINDOW *hw){
 	wattroff(hw,A_BOLD);
 	waddstr(hw,d->sched ? d->sched : "custom");
 	wattron(hw,A_BOLD);
+	if(rows > 9){
+		detail_stats(hw,d,8,cols);
+	}
 	if(blockobj_unloadedp(b)){
 		mvwprintw(hw,6,START_COL,"Media is not loaded");
 		return 0;
@@ -3635,6 +3699,8 @@ static const wchar_t *helps[] = {
 	L"'k'/'↑': navigate up          'j'/'↓': navigate down",
 	L"'⇞PageUp': previous adapter   ⇟PageDown': next adapter",
 	L"'/': search                   'p': configure loop device",
+	L"'<': sample stats slower      '>': sample stats faster",
+	L"'a': toggle adaptive stats sampling",
 	NULL
 };
 
@@ -3722,6 +3788,26 @@ unlock_ncurses(void){
 	unlock_growlight();
 }	
 
+// Called by growlight as we drop its lock to wait on a tool. Other threads
+// take bfl within the growlight lock, so it must go too. bfl is recursive, so
+// unlocking it fails once we no longer hold it.
+static unsigned
+shed_ncurses(void){
+	unsigned depth = 0;
+
+	while(pthread_mutex_unlock(&bfl) == 0){
+		++depth;
+	}
+	return depth;
+}
+
+static void
+reclaim_ncurses(unsigned depth){
+	while(depth--){
+		assert(pthread_mutex_lock(&bfl) == 0);
+	}
+}
+
 // Used in growlight callbacks, since the growlight lock will already be held
 // in any such case.
 static inline void
@@ -4339,18 +4425,14 @@ dump_diags(void){
 	int y,r;
 
 	y = sizeof(l) / sizeof(*l);
-	if((y = get_logs(y,l)) < 0){
+	if((y = get_logs(y,l,verbose ? LOGLEVEL_VERBOSE : LOGLEVEL_INFO)) < 0){
 		return -1;
 	}
 	for(r = 0 ; r < y ; ++r){
 		char tbuf[27];
 
-		if(l[r].msg == NULL){
-			break;
-		}
 		assert(ctime_r(&l[r].when,tbuf));
 		fprintf(stderr,"%s %s",tbuf,l[r].msg);
-		free(l[r].msg);
 	}
 	return 0;
 }
@@ -4364,7 +4446,7 @@ update_diags(struct panel_state *ps){
 	getmaxyx(w,y,x);
 	y = getmaxy(w) - 2;
 	assert(x > 26 + START_COL * 2); // see ctime_r(3)
-	if((y = get_logs(y,l)) < 0){
+	if((y = get_logs(y,l,verbose ? LOGLEVEL_VERBOSE : LOGLEVEL_INFO)) < 0){
 		return -1;
 	}
 	assert(wattrset(w,SUBDISPLAY_ATTR) == OK);
@@ -4374,9 +4456,6 @@ update_diags(struct panel_state *ps){
 		size_t tb;
 		int p;
 
-		if(l[r].msg == NULL){
-			break;
-		}
 		if(localtime_r(&l[r].when,&tm) == NULL){
 			break;
 		}
@@ -4397,7 +4476,6 @@ update_diags(struct panel_state *ps){
 			*c = ' ';
 		}
 		assert(mvwprintw(w,y - r,START_COL,"%-*.*s",x - 2,x - 2,tbuf) != ERR);
-		free(l[r].msg);
 	}
 	return 0;
 }
@@ -4426,7 +4504,7 @@ err:
 	return ERR;
 }
 
-static const int DETAILROWS = 7; // FIXME make it dynamic based on selections
+static const int DETAILROWS = 8; // FIXME make it dynamic based on selections
 
 static int
 display_details(WINDOW *mainw,struct panel_state *ps){
@@ -4555,10 +4633,11 @@ env_details(WINDOW *hw,int rows){
 
 static void
 detail_mounts(WINDOW *w,int *row,int maxy,const device *d){
-	char buf[PREFIXSTRLEN + 1],b[256];
+	char buf[PREFIXSTRLEN + 1],b[256],use[64];
 	int cols = getmaxx(w),r;
 	unsigned z;
 
+	fsusage_summary(&d->mntusage,use,sizeof(use));
 	assert(d->mnt.count == d->mntops.count);
 	for(z = 0 ; z < d->mnt.count ; ++z){
 		if(*row == maxy){
@@ -4580,7 +4659,8 @@ detail_mounts(WINDOW *w,int *row,int maxy,const device *d){
 			return;
 		}
 		wattroff(w,A_BOLD);
-		if((r = snprintf(b,sizeof(b)," %s %s",d->mnt.list[z],d->mntops.list[z])) >= (int)sizeof(b)){
+		if((r = snprintf(b,sizeof(b)," %s %s%s%s",d->mnt.list[z],d->mntops.list[z],
+						*use ? " " : "",use)) >= (int)sizeof(b)){
 			b[sizeof(b) - 1] = '\0';
 		}
 		mvwhline(w,*row,START_COL,' ',cols - 2);
@@ -4629,7 +4709,7 @@ detail_targets(WINDOW *w,int *row,int both,const device *d){
 }
 
 static int
-map_details(WINDOW *hw){
+map_details_tree(WINDOW *hw,const controller *ctrls){
 	const controller *c;
 	int y,rows,cols;
 	char *fstab;
@@ -4687,7 +4767,7 @@ map_details(WINDOW *hw){
 		return 0;
 	}
 	wattrset(hw,A_BOLD|COLOR_PAIR(FORMTEXT_COLOR));
-	for(c = get_controllers() ; c ; c = c->next){
+	for(c = ctrls ; c ; c = c->next){
 		const device *d;
 
 		for(d = c->blockdevs ; d ; d = d->next){
@@ -4707,7 +4787,7 @@ map_details(WINDOW *hw){
 	}
 	// Now list the existing maps, a superset of the targets
 	wattrset(hw,A_BOLD|COLOR_PAIR(SUBDISPLAY_COLOR));
-	for(c = get_controllers() ; c ; c = c->next){
+	for(c = ctrls ; c ; c = c->next){
 		const device *d;
 
 		for(d = c->blockdevs ; d ; d = d->next){
@@ -4732,6 +4812,20 @@ map_details(WINDOW *hw){
 	return 0;
 }
 
+// The maps walk every device, so they're drawn from a snapshot
+static int
+map_details(WINDOW *hw){
+	const treesnap *snap;
+	int r;
+
+	snap = get_snapshot();
+	r = map_details_tree(hw,snap ? snap->controllers : get_controllers());
+	if(snap){
+		put_snapshot(snap);
+	}
+	return r;
+}
+
 static int
 display_enviroment(WINDOW *mainw,struct panel_state *ps){
 	memset(ps,0,sizeof(*ps));
@@ -5144,7 +5238,7 @@ kill_filesystem_confirm(const char *op){
 			return;
 		}
 		redraw_adapter(current_adapter);
-		locked_diag("Wiped filesystem on %s",d->name);
+		locked_diag("Wiping filesystem on %s",d->name);
 		return;
 	}
 	locked_diag("filesystem wipe was cancelled");
@@ -5473,7 +5567,7 @@ fsck_partition(void){
 	}
 	if(fsck_suitable_p(d)){
 		if(check_partition(d) == 0){
-			locked_diag("Validated filesystem on %s",d->name);
+			locked_diag("Checking filesystem on %s",d->name);
 		}
 	}
 }
@@ -6265,11 +6359,138 @@ unset_target(void){
 	locked_diag("Successfully left target mode");
 }
 
+// Halve (faster) or double (slower) the stats sampling interval, or toggle
+// adaptive sampling (dir == 0).
+static void
+adjust_sampling(int dir){
+	unsigned ms;
+	int adaptive;
+
+	ms = get_stats_interval(&adaptive, NULL);
+	if(dir > 0){
+		ms /= 2;
+	}else if(dir < 0){
+		ms *= 2;
+	}else{
+		adaptive = !adaptive;
+	}
+	if(ms < STATS_INTERVAL_MIN){
+		ms = STATS_INTERVAL_MIN;
+	}else if(ms > STATS_INTERVAL_MAX){
+		ms = STATS_INTERVAL_MAX;
+	}
+	if(set_stats_interval(ms, adaptive) < 0){
+		diag("Couldn't change stats sampling interval");
+	}else{
+		diag("Sampling stats every %ums%s", ms, adaptive ? " (adaptive)" : "");
+	}
+}
+
+// Stats are sampled on their own lane, which mustn't wait on the growlight
+// lock (nor on us). stats_callback() just notes which devices changed and
+// wakes the input loop, which redraws their adapters once it can take the
+// locks.
+static void
+stats_callback(const dev_t *devnos,unsigned n){
+	int wake;
+	ssize_t r;
+	char c = 0;
+
+	pthread_mutex_lock(&statsdirtylock);
+	wake = statsdirtycount == 0;
+	if(statsdirtycount + n > STATSDIRTY_MAX){
+		statsdirtycount = STATSDIRTY_MAX + 1;
+	}else{
+		memcpy(statsdirty + statsdirtycount,devnos,sizeof(*devnos) * n);
+		statsdirtycount += n;
+	}
+	pthread_mutex_unlock(&statsdirtylock);
+	if(wake){
+		r = write(statspipe[1],&c,1);
+		(void)r;
+	}
+}
+
+static int
+adapter_stats_dirty(const reelbox *rb,const dev_t *dirty,unsigned n){
+	const blockobj *bo;
+	unsigned z;
+
+	if(n > STATSDIRTY_MAX){
+		return 1;
+	}
+	for(bo = rb->as->bobjs ; bo ; bo = bo->next){
+		for(z = 0 ; z < n ; ++z){
+			if(bo->d->devno == dirty[z]){
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void
+redraw_stats(void){
+	dev_t dirty[STATSDIRTY_MAX];
+	char buf[64];
+	reelbox *rb;
+	unsigned n;
+
+	while(read(statspipe[0],buf,sizeof(buf)) > 0){
+		;
+	}
+	pthread_mutex_lock(&statsdirtylock);
+	if((n = statsdirtycount) <= STATSDIRTY_MAX){
+		memcpy(dirty,statsdirty,sizeof(*dirty) * n);
+	}
+	statsdirtycount = 0;
+	pthread_mutex_unlock(&statsdirtylock);
+	if(n == 0){
+		return;
+	}
+	lock_ncurses();
+	for(rb = top_reelbox ; rb ; rb = rb->next){
+		if(adapter_stats_dirty(rb,dirty,n)){
+			redraw_adapter(rb);
+		}
+	}
+	unlock_ncurses();
+}
+
+// Wait for a key, redrawing stats meanwhile. Returns ERR if stdin fails.
+// Signals (i.e. SIGWINCH) wake the poll, whereupon getch() yields any
+// KEY_RESIZE.
+static int
+next_input(void){
+	struct pollfd pfds[2];
+	int ch;
+
+	while((ch = getch()) == ERR){
+		pfds[0].fd = STDIN_FILENO;
+		pfds[0].events = POLLIN;
+		pfds[1].fd = statspipe[0];
+		pfds[1].events = POLLIN;
+		if(poll(pfds,2,-1) < 0){
+			if(errno != EINTR){
+				return ERR;
+			}
+			continue;
+		}
+		if(!(pfds[0].revents & POLLIN) && (pfds[0].revents & (POLLERR|POLLHUP|POLLNVAL))){
+			return ERR;
+		}
+		if(pfds[1].revents & POLLIN){
+			redraw_stats();
+		}
+	}
+	return ch;
+}
+
 static void
 handle_ncurses_input(WINDOW *w){
 	int ch,r;
 
-	while((ch = getch()) != ERR){
+	while((ch = next_input()) != ERR){
 		if(ch == 12){ // CTRL+L FIXME
 			lock_ncurses();
 			wrefresh(curscr);
@@ -6520,6 +6741,15 @@ handle_ncurses_input(WINDOW *w){
 				unlock_ncurses();
 				break;
 			}
+			case '<':
+				adjust_sampling(-1);
+				break;
+			case '>':
+				adjust_sampling(1);
+				break;
+			case 'a':
+				adjust_sampling(0);
+				break;
 			case 'A':
 				lock_ncurses();
 				if(actform){
@@ -7082,8 +7312,11 @@ int main(int argc,char * const *argv){
 		.boxinfo = boxinfo,
 		.adapter_event = adapter_callback,
 		.block_event = block_callback,
+		.stats_event = stats_callback,
 		.adapter_free = adapter_free,
 		.block_free = block_free,
+		.shed = shed_ncurses,
+		.reclaim = reclaim_ncurses,
 	};
 	WINDOW *w;
 	struct panel_state *ps;
@@ -129,8 +129,7 @@ struct nvme_smart_log {
 #define NVME_ADMIN_GET_LOG_PAGE 2
 #define NVME_ADMIN_IDENTIFY 6
 
-static int
-nvme_smart_log(struct device *d, int fd){
+int nvme_smart_log(struct device *d, int fd){
 	struct nvme_admin_cmd nvmeio;
 	struct nvme_smart_log smart;
 
@@ -9,6 +9,10 @@ struct device;
 
 int nvme_interrogate(struct device *, int sd);
 
+// Refresh only the SMART status and temperature (nvme_interrogate() does
+// this itself).
+int nvme_smart_log(struct device *, int sd);
+
 #ifdef __cplusplus
 }
 #endif
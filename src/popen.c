@@ -1,128 +1,756 @@
-#include <assert.h>
-#include <wchar.h>
+#include <time.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <spawn.h>
 #include <stdio.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
-#include <stdarg.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
 
 #include "popen.h"
 #include "growlight.h"
 
-#define REDIRECTERR " 2>&1 < /dev/null"
-static char *
-sanitize_cmd(const char *cmd){
-	char *tmp,*san = NULL;
-	size_t left,len = 0;
-	mbstate_t ps;
-	size_t conv;
+extern char **environ;
 
-	memset(&ps,0,sizeof(ps));
-	left = strlen(cmd) + 1;
-	do{
-		unsigned escape;
-		wchar_t w;
+#define CMD_LINEMAX 256		// longer lines are passed on in pieces
+#define CMD_ARGMAX 64		// for spawn_drain()
+#define CMD_READS 16		// reads per job per service, so none starve
+#define CMD_REAP_MS 20		// retry period for reaping without a pidfd
 
-		if((conv = mbrtowc(&w,cmd,left,&ps)) == (size_t)-1){
-			diag("Error converting multibyte: %s\n",cmd);
-			free(san);
-			return NULL;
-		}
-		if(conv == (size_t)-2){
-			// FIXME ended unexpectedly...are we feeding bad data?
-			diag("Multibyte ended unexpectedly: %s\n",cmd);
+typedef struct cmdjob {
+	struct cmdjob *next;
+	unsigned id;
+	pid_t pid;
+	int outfd;		// read end of the output pipe, -1 after EOF
+	int pidfd;		// -1 if unsupported, or once reaped
+	int exited;		// reaped, yielding wstatus (-1 if lost)
+	int reaping;		// EOF without a pidfd, and not yet exited
+	int wstatus;
+	int waited;		// claimed by cmd_wait()
+	int cancelled;
+	uint64_t started;	// monotonic ns
+	uint64_t killat;	// when to SIGKILL a cancelled job, 0 if not
+	cmdlinefxn lines;
+	cmddonefxn done;
+	void *arg;
+	cmdresult res;		// output accumulates here
+	size_t linelen;
+	char line[CMD_LINEMAX];
+	char desc[64];
+} cmdjob;
+
+// The job list is protected by lock. A job with a done callback is serviced
+// through the epoll set, by whichever thread holds servicelock; any other job
+// is serviced only by its waiter, and never enters the set. Either way, only
+// one thread touches a running job's pipe, line buffer, or output, so these
+// can be worked on without holding lock. Nothing is passed to diag() (nor any
+// callback made) with lock held: a UI thread calling diag() while waiting on
+// a job might hold a lock diag() needs.
+static struct {
+	pthread_once_t once;
+	pthread_mutex_t lock;
+	pthread_mutex_t servicelock;
+	int efd;		// epoll over pipes, pidfds and the timer
+	int timerfd;		// escalates cancellations, retries reaps
+	cmdjob *jobs;		// oldest first
+	unsigned nextid;
+} runner = {
+	.once = PTHREAD_ONCE_INIT,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.servicelock = PTHREAD_MUTEX_INITIALIZER,
+	.efd = -1,
+	.timerfd = -1,
+	.nextid = 1,
+};
+
+// epoll data is the job ID (shifted past a bit distinguishing pidfds from
+// pipes), never a pointer, so stale events for a finished job are harmless.
+// IDs start at 1, leaving 0 for the timer.
+#define EV_PIDFD 1ull
+
+static inline uint64_t
+monotonic_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+runner_setup(void){
+	struct epoll_event ev;
+	int efd, tfd;
+
+	if((efd = epoll_create1(EPOLL_CLOEXEC)) < 0){
+		glog(LOGLEVEL_ERROR, "Couldn't create command epoll (%s?)\n", strerror(errno));
+		return;
+	}
+	if((tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0){
+		glog(LOGLEVEL_ERROR, "Couldn't create command timer (%s?)\n", strerror(errno));
+		close(efd);
+		return;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = 0;
+	if(epoll_ctl(efd, EPOLL_CTL_ADD, tfd, &ev)){
+		glog(LOGLEVEL_ERROR, "Couldn't add %d to epoll (%s?)\n", tfd, strerror(errno));
+		close(tfd);
+		close(efd);
+		return;
+	}
+	runner.timerfd = tfd;
+	runner.efd = efd;
+}
+
+static int
+runner_init(void){
+	pthread_once(&runner.once, runner_setup);
+	return runner.efd < 0 ? -1 : 0;
+}
+
+int cmd_runner_fd(void){
+	if(runner_init()){
+		return -1;
+	}
+	return runner.efd;
+}
+
+static int
+open_pidfd(pid_t pid){
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	(void)pid;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static void
+describe_argv(const char * const *argv, char *buf, size_t len){
+	size_t off = 0;
+
+	*buf = '\0';
+	while(*argv && off < len){
+		off += snprintf(buf + off, len - off, "%s%s", off ? " " : "", *argv);
+		++argv;
+	}
+}
+
+// Called with the lock held
+static cmdjob *
+find_job(unsigned id){
+	cmdjob *j;
+
+	for(j = runner.jobs ; j ; j = j->next){
+		if(j->id == id){
 			break;
 		}
-		if(conv == 0){ // done!
+	}
+	return j;
+}
+
+// Called with the lock held
+static void
+unlink_job(cmdjob *j){
+	cmdjob **lnk;
+
+	for(lnk = &runner.jobs ; *lnk ; lnk = &(*lnk)->next){
+		if(*lnk == j){
+			*lnk = j->next;
 			break;
 		}
-		left -= conv;
-		if(w == L'(' || w == L')'){
-			escape = 1;
-		}else if(w == '$'){
-			escape = 1;
-		}else{
-			escape = 0;
-		}
-		if((tmp = realloc(san,sizeof(*san) * (len + conv + escape))) == NULL){
-			free(san);
-			return NULL;
-		}
-		san = tmp;
-		if(escape){
-			san[len] = '\\';
-			++len;
-		}
-		memcpy(san + len,cmd,conv);
-		len += conv;
-		cmd += conv;
-	}while(conv);
-	if((tmp = realloc(san,sizeof(*san) * (len + 1 + strlen(REDIRECTERR)))) == NULL){
-		free(san);
-		return NULL;
-	}
-	san = tmp;
-	strcpy(san + len,REDIRECTERR);
-	return san;
-}
-
-int popen_drain(const char *cmd){
-	char buf[128],*safecmd;
-	FILE *fd;
-
-	if((safecmd = sanitize_cmd(cmd)) == NULL){
-		return -1;
 	}
-	diag("Running \"%s\"...\n",safecmd);
-	if((fd = popen(safecmd,"re")) == NULL){
-		diag("Couldn't run %s (%s?)\n",safecmd,strerror(errno));
-		free(safecmd);
-		return -1;
+}
+
+// Called with the lock held. Arm the timer for the earliest pending SIGKILL,
+// or sooner if a background job awaits reaping.
+static void
+arm_timer(uint64_t now){
+	struct itimerspec its;
+	uint64_t next = 0;
+	cmdjob *j;
+
+	for(j = runner.jobs ; j ; j = j->next){
+		if(j->killat && (next == 0 || j->killat < next)){
+			next = j->killat;
+		}
+		if(j->reaping && !j->exited && (next == 0 || now + CMD_REAP_MS * 1000000ull < next)){
+			next = now + CMD_REAP_MS * 1000000ull;
+		}
 	}
-	while(fgets(buf,sizeof(buf),fd)){
-		diag("%s",buf);
+	memset(&its, 0, sizeof(its));
+	if(next){
+		next = next > now ? next - now : 1;
+		its.it_value.tv_sec = next / 1000000000ull;
+		its.it_value.tv_nsec = next % 1000000000ull;
 	}
-	if(!feof(fd)){
-		diag("Error reading from '%s' (%s?)\n",safecmd,strerror(errno));
-		pclose(fd);
+	timerfd_settime(runner.timerfd, 0, &its, NULL);
+}
+
+unsigned cmd_spawn(const char * const *argv, cmdlinefxn lines,
+			cmddonefxn done, void *arg){
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	char full[BUFSIZ];
+	struct epoll_event ev;
+	sigset_t none, dfl;
+	int fds[2], r;
+	cmdjob *j;
+	unsigned id;
+
+	if(argv == NULL || argv[0] == NULL){
+		diag("Provided NULL command\n");
+		return 0;
+	}
+	if(runner_init()){
+		return 0;
+	}
+	if((j = malloc(sizeof(*j))) == NULL){
+		return 0;
+	}
+	memset(j, 0, sizeof(*j));
+	describe_argv(argv, full, sizeof(full));
+	describe_argv(argv, j->desc, sizeof(j->desc));
+	if(pipe2(fds, O_CLOEXEC)){
+		diag("Couldn't create pipe (%s?)\n", strerror(errno));
+		free(j);
+		return 0;
+	}
+	if(fcntl(fds[0], F_SETFL, O_NONBLOCK)){
+		diag("Couldn't make pipe non-blocking (%s?)\n", strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
+		free(j);
+		return 0;
+	}
+	// the dup2()ed descriptors lose FD_CLOEXEC; the originals close on exec
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_adddup2(&fa, fds[1], STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&fa, fds[1], STDERR_FILENO);
+	sigemptyset(&none);
+	sigemptyset(&dfl);
+	sigaddset(&dfl, SIGPIPE);
+	sigaddset(&dfl, SIGINT);
+	sigaddset(&dfl, SIGQUIT);
+	sigaddset(&dfl, SIGTERM);
+	sigaddset(&dfl, SIGHUP);
+	sigaddset(&dfl, SIGCHLD);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &none);
+	posix_spawnattr_setsigdefault(&attr, &dfl);
+	posix_spawnattr_setpgroup(&attr, 0);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+				POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+	r = posix_spawnp(&j->pid, argv[0], &fa, &attr, (char * const *)argv, environ);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&fa);
+	close(fds[1]);
+	if(r){
+		glog(LOGLEVEL_ERROR, "Couldn't run %s (%s?)\n", argv[0], strerror(r));
+		close(fds[0]);
+		free(j);
+		return 0;
+	}
+	j->outfd = fds[0];
+	j->pidfd = open_pidfd(j->pid);
+	j->started = monotonic_ns();
+	j->res.status = -1;
+	j->lines = lines;
+	j->done = done;
+	j->arg = arg;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	pthread_mutex_lock(&runner.lock);
+	if((id = runner.nextid++) == 0){
+		id = runner.nextid++;
+	}
+	j->id = id;
+	ev.data.u64 = (uint64_t)id << 1;
+	if(done && epoll_ctl(runner.efd, EPOLL_CTL_ADD, j->outfd, &ev)){
+		r = errno;
+		pthread_mutex_unlock(&runner.lock);
+		diag("Couldn't add %d to epoll (%s?)\n", j->outfd, strerror(r));
+		kill(-j->pid, SIGKILL);
+		waitpid(j->pid, NULL, 0);
+		close(j->outfd);
+		if(j->pidfd >= 0){
+			close(j->pidfd);
+		}
+		free(j);
+		return 0;
+	}
+	// without a pidfd, the job is reaped upon EOF on its pipe
+	ev.data.u64 |= EV_PIDFD;
+	if(done && j->pidfd >= 0 && epoll_ctl(runner.efd, EPOLL_CTL_ADD, j->pidfd, &ev)){
+		close(j->pidfd);
+		j->pidfd = -1;
+	}
+	if(runner.jobs){
+		cmdjob *last = runner.jobs;
+
+		while(last->next){
+			last = last->next;
+		}
+		last->next = j;
+	}else{
+		runner.jobs = j;
+	}
+	pthread_mutex_unlock(&runner.lock);
+	glog(LOGLEVEL_INFO, "Running \"%s\" as job %u...\n", full, id);
+	return id;
+}
+
+int cmd_cancel(unsigned id){
+	uint64_t now = monotonic_ns();
+	char desc[sizeof(((cmdjob *)NULL)->desc)];
+	cmdjob *j;
+
+	pthread_mutex_lock(&runner.lock);
+	if((j = find_job(id)) == NULL || j->exited){
+		pthread_mutex_unlock(&runner.lock);
 		return -1;
 	}
-	if(pclose(fd)){
-		diag("Error running '%s'\n",safecmd);
+	if(j->cancelled){
+		pthread_mutex_unlock(&runner.lock);
+		return 0;
+	}
+	j->cancelled = 1;
+	kill(-j->pid, SIGTERM);
+	j->killat = now + CMD_KILL_MS * 1000000ull;
+	arm_timer(now);
+	strcpy(desc, j->desc);
+	pthread_mutex_unlock(&runner.lock);
+	glog(LOGLEVEL_INFO, "Cancelled job %u (%s)\n", id, desc);
+	return 0;
+}
+
+// Called with the lock held. SIGKILL whatever has outlasted its cancellation,
+// noting up to n of their IDs in killed, and leaving the rest for next time.
+static unsigned
+kill_expired(uint64_t now, unsigned *killed, unsigned n){
+	unsigned count = 0;
+	cmdjob *j;
+
+	for(j = runner.jobs ; j && count < n ; j = j->next){
+		if(j->killat && j->killat <= now){
+			if(!j->exited){
+				kill(-j->pid, SIGKILL);
+				killed[count++] = j->id;
+			}
+			j->killat = 0;
+		}
+	}
+	arm_timer(now);
+	return count;
+}
+
+static void service_job(unsigned id, int pidfdev);
+
+// Called with servicelock held, when the timer fires.
+static void
+run_timer(void){
+	unsigned killed[16], reap[16], n, r = 0, z;
+	uint64_t dontcare;
+	cmdjob *j;
+
+	while(read(runner.timerfd, &dontcare, sizeof(dontcare)) > 0){
+		;
+	}
+	pthread_mutex_lock(&runner.lock);
+	for(j = runner.jobs ; j && r < sizeof(reap) / sizeof(*reap) ; j = j->next){
+		if(j->reaping && !j->exited){
+			reap[r++] = j->id;
+		}
+	}
+	n = kill_expired(monotonic_ns(), killed, sizeof(killed) / sizeof(*killed));
+	pthread_mutex_unlock(&runner.lock);
+	for(z = 0 ; z < n ; ++z){
+		diag("Killed job %u\n", killed[z]);
+	}
+	for(z = 0 ; z < r ; ++z){
+		service_job(reap[z], 0);
+	}
+}
+
+static void
+emit_line(cmdjob *j){
+	j->line[j->linelen] = '\0';
+	if(j->lines){
+		j->lines(j->id, j->line, j->arg);
+	}else{
+		diag("%s\n", j->line);
+	}
+	j->linelen = 0;
+}
+
+static void
+consume_output(cmdjob *j, const char *buf, size_t len){
+	size_t z, take;
+	char *tmp;
+
+	take = len;
+	if(j->res.outlen + take > CMD_CAPTURE_MAX){
+		take = CMD_CAPTURE_MAX - j->res.outlen;
+	}
+	if(take && (tmp = realloc(j->res.output, j->res.outlen + take + 1))){
+		j->res.output = tmp;
+		memcpy(j->res.output + j->res.outlen, buf, take);
+		j->res.outlen += take;
+		j->res.output[j->res.outlen] = '\0';
+	}
+	for(z = 0 ; z < len ; ++z){
+		if(buf[z] == '\n'){
+			emit_line(j);
+			continue;
+		}
+		j->line[j->linelen++] = buf[z];
+		if(j->linelen == sizeof(j->line) - 1){
+			emit_line(j);
+		}
+	}
+}
+
+static void
+drain_output(cmdjob *j){
+	char buf[4096];
+	ssize_t r = -1;
+	unsigned z;
+
+	for(z = 0 ; z < CMD_READS ; ++z){
+		if((r = read(j->outfd, buf, sizeof(buf))) <= 0){
+			break;
+		}
+		consume_output(j, buf, r);
+	}
+	if(r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)){
+		close(j->outfd); // removes it from the epoll set
+		j->outfd = -1;
+		if(j->linelen){
+			emit_line(j);
+		}
+	}
+}
+
+// Never blocks; the job is left unreaped if it's still running.
+static void
+reap_job(cmdjob *j){
+	int r, ws;
+
+	do{
+		r = waitpid(j->pid, &ws, WNOHANG);
+	}while(r < 0 && errno == EINTR);
+	if(r == 0){
+		return;
+	}
+	pthread_mutex_lock(&runner.lock);
+	j->exited = 1;
+	j->wstatus = r > 0 ? ws : -1;
+	j->killat = 0;
+	pthread_mutex_unlock(&runner.lock);
+	if(j->pidfd >= 0){
+		close(j->pidfd);
+		j->pidfd = -1;
+	}
+}
+
+static void
+decode_result(cmdjob *j){
+	cmdresult *res = &j->res;
+
+	if(j->wstatus >= 0 && WIFEXITED(j->wstatus)){
+		res->status = WEXITSTATUS(j->wstatus);
+	}else if(j->wstatus >= 0 && WIFSIGNALED(j->wstatus)){
+		res->status = 128 + WTERMSIG(j->wstatus);
+	}else{
+		res->status = -1;
+	}
+	res->cancelled = j->cancelled;
+	res->ns = monotonic_ns() - j->started;
+	if(res->output == NULL && (res->output = malloc(1))){
+		res->output[0] = '\0';
+	}
+}
+
+// Called with servicelock held, for jobs with a done callback
+static void
+finish_job(cmdjob *j){
+	decode_result(j);
+	pthread_mutex_lock(&runner.lock);
+	unlink_job(j);
+	pthread_mutex_unlock(&runner.lock);
+	j->done(j->id, &j->res, j->arg);
+	free(j->res.output);
+	free(j);
+}
+
+static void
+service_job(unsigned id, int pidfdev){
+	cmdjob *j;
+
+	pthread_mutex_lock(&runner.lock);
+	if((j = find_job(id)) == NULL){
+		pthread_mutex_unlock(&runner.lock);
+		return;
+	}
+	pthread_mutex_unlock(&runner.lock);
+	if(pidfdev){
+		if(j->pidfd >= 0){
+			reap_job(j);
+		}
+	}else if(j->outfd >= 0){
+		drain_output(j);
+	}
+	// EOF almost always means the job has exited (or is about to). If it
+	// hasn't, don't wait on it here; the timer tries again shortly.
+	if(j->outfd < 0 && !j->exited && j->pidfd < 0){
+		reap_job(j);
+		if(!j->exited && !j->reaping){
+			pthread_mutex_lock(&runner.lock);
+			j->reaping = 1;
+			arm_timer(monotonic_ns());
+			pthread_mutex_unlock(&runner.lock);
+		}
+	}
+	if(j->outfd < 0 && j->exited){
+		finish_job(j);
+	}
+}
+
+void cmd_service(void){
+	struct epoll_event evs[16];
+	int n, z;
+
+	if(runner_init()){
+		return;
+	}
+	pthread_mutex_lock(&runner.servicelock);
+	while((n = epoll_wait(runner.efd, evs, sizeof(evs) / sizeof(*evs), 0)) > 0){
+		for(z = 0 ; z < n ; ++z){
+			if(evs[z].data.u64 == 0){
+				run_timer();
+			}else{
+				service_job(evs[z].data.u64 >> 1, evs[z].data.u64 & EV_PIDFD);
+			}
+		}
+	}
+	pthread_mutex_unlock(&runner.servicelock);
+}
+
+int cmd_wait(unsigned id, cmdresult *res){
+	unsigned killed[1];
+	cmdjob *j;
+
+	pthread_mutex_lock(&runner.lock);
+	if((j = find_job(id)) == NULL || j->done || j->waited){
+		pthread_mutex_unlock(&runner.lock);
 		return -1;
 	}
+	j->waited = 1;
+	pthread_mutex_unlock(&runner.lock);
+	while(j->outfd >= 0 || !j->exited){
+		struct pollfd pfds[2];
+		nfds_t n = 0;
+
+		if(j->outfd >= 0){
+			pfds[n].fd = j->outfd;
+			pfds[n++].events = POLLIN;
+		}
+		if(j->pidfd >= 0){
+			pfds[n].fd = j->pidfd;
+			pfds[n++].events = POLLIN;
+		}
+		// wake periodically, lest the event thread not be escalating
+		// cancellations. Without a pidfd, a job lingering past EOF is
+		// polled for every CMD_REAP_MS.
+		poll(n ? pfds : NULL, n, n ? 100 : CMD_REAP_MS);
+		if(j->outfd >= 0){
+			drain_output(j);
+		}
+		if(!j->exited && (j->pidfd >= 0 || j->outfd < 0)){
+			reap_job(j);
+		}
+		pthread_mutex_lock(&runner.lock);
+		n = kill_expired(monotonic_ns(), killed, 1);
+		pthread_mutex_unlock(&runner.lock);
+		if(n){
+			diag("Killed job %u\n", killed[0]);
+		}
+	}
+	decode_result(j);
+	pthread_mutex_lock(&runner.lock);
+	unlink_job(j);
+	pthread_mutex_unlock(&runner.lock);
+	*res = j->res;
+	free(j);
 	return 0;
 }
 
-int vpopen_drain(const char *cmd,wchar_t * const *args){
-	char buf[BUFSIZ];
+void cmdresult_free(cmdresult *res){
+	free(res->output);
+	res->output = NULL;
+	res->outlen = 0;
+}
+
+unsigned cmd_jobs(cmdjob_info *out, unsigned n){
+	uint64_t now = monotonic_ns();
+	unsigned count = 0;
+	cmdjob *j;
+
+	pthread_mutex_lock(&runner.lock);
+	for(j = runner.jobs ; j && count < n ; j = j->next){
+		out[count].id = j->id;
+		out[count].pid = j->pid;
+		out[count].ns = now - j->started;
+		out[count].cancelled = j->cancelled;
+		strcpy(out[count].cmd, j->desc);
+		++count;
+	}
+	pthread_mutex_unlock(&runner.lock);
+	return count;
+}
+
+int spawn_drainv(const char * const *argv){
+	unsigned id, depth;
+	cmdresult res;
 	int r;
 
-	if((r = snprintf(buf,sizeof(buf),"%s ",cmd)) >= (int)sizeof(buf)){
+	if((id = cmd_spawn(argv, NULL, NULL, NULL)) == 0){
 		return -1;
 	}
-	while(*args){
-		int rr;
+	// mkfs and friends can run for minutes; don't hold up the tree meanwhile
+	depth = shed_growlight();
+	r = cmd_wait(id, &res);
+	reclaim_growlight(depth);
+	if(r){
+		return -1;
+	}
+	if( (r = res.status) ){
+		glog(LOGLEVEL_ERROR, "Error running '%s' (%s %d)\n", argv[0],
+			r > 128 ? "signal" : "status", r > 128 ? r - 128 : r);
+	}
+	cmdresult_free(&res);
+	return r ? -1 : 0;
+}
+
+int spawn_drain(const char *cmd, ...){
+	const char *argv[CMD_ARGMAX + 1];
+	unsigned argc = 0;
+	va_list va;
 
-		if((rr = snprintf(buf + r,sizeof(buf) - r,"%ls ",*args)) >= (int)(sizeof(buf) - r)){
+	argv[argc++] = cmd;
+	va_start(va, cmd);
+	while( (argv[argc] = va_arg(va, const char *)) ){
+		if(++argc == CMD_ARGMAX){
+			va_end(va);
+			diag("Too many arguments for %s\n", cmd);
 			return -1;
 		}
-		r += rr;
-		++args;
 	}
-	return popen_drain(buf);
+	va_end(va);
+	return spawn_drainv(argv);
+}
+
+int wspawn_drain(const char *cmd, wchar_t * const *args){
+	const char *argv[CMD_ARGMAX + 1];
+	unsigned argc, z;
+	int r = -1;
+
+	argv[0] = cmd;
+	for(argc = 1 ; args[argc - 1] ; ++argc){
+		size_t len;
+		char *a;
+
+		if(argc == CMD_ARGMAX){
+			diag("Too many arguments for %s\n", cmd);
+			goto done;
+		}
+		if((len = wcstombs(NULL, args[argc - 1], 0)) == (size_t)-1){
+			diag("Error converting multibyte: %ls\n", args[argc - 1]);
+			goto done;
+		}
+		if((a = malloc(len + 1)) == NULL){
+			goto done;
+		}
+		wcstombs(a, args[argc - 1], len + 1);
+		argv[argc] = a;
+	}
+	argv[argc] = NULL;
+	r = spawn_drainv(argv);
+
+done:
+	for(z = 1 ; z < argc ; ++z){
+		free((char *)argv[z]);
+	}
+	return r;
+}
+
+static void
+report_job(unsigned id, const cmdresult *res, void *arg){
+	(void)arg;
+	if(res->status == 0){
+		glog(LOGLEVEL_INFO, "Job %u completed in %.1fs\n", id, res->ns / 1e9);
+	}else if(res->status > 128){
+		glog(res->cancelled ? LOGLEVEL_INFO : LOGLEVEL_ERROR,
+			"Job %u %s by signal %d after %.1fs\n", id,
+			res->cancelled ? "cancelled" : "killed",
+			res->status - 128, res->ns / 1e9);
+	}else{
+		glog(LOGLEVEL_ERROR, "Job %u failed with status %d after %.1fs\n", id,
+			res->status, res->ns / 1e9);
+	}
+}
+
+unsigned spawn_bgv(const char * const *argv){
+	return cmd_spawn(argv, NULL, report_job, NULL);
 }
 
-int vspopen_drain(const char *fmt,...){
-	char buf[BUFSIZ];
+static void
+report_and_rescan(unsigned id, const cmdresult *res, void *arg){
+	char *name = arg;
+
+	report_job(id, res, NULL);
+	defer_rescan(name);
+	free(name);
+}
+
+unsigned spawn_rescanv(const char *name, const char * const *argv){
+	unsigned id;
+	char *dup;
+
+	if((dup = strdup(name)) == NULL){
+		return 0;
+	}
+	if((id = cmd_spawn(argv, NULL, report_and_rescan, dup)) == 0){
+		free(dup);
+	}
+	return id;
+}
+
+unsigned spawn_rescan(const char *name, const char *cmd, ...){
+	const char *argv[CMD_ARGMAX + 1];
+	unsigned argc = 0;
 	va_list va;
 
-	va_start(va,fmt);
-	if(vsnprintf(buf,sizeof(buf),fmt,va) >= (int)sizeof(buf)){
-		va_end(va);
-		diag("Bad command: %s ...\n",fmt);
-		return -1;
+	argv[argc++] = cmd;
+	va_start(va, cmd);
+	while( (argv[argc] = va_arg(va, const char *)) ){
+		if(++argc == CMD_ARGMAX){
+			va_end(va);
+			diag("Too many arguments for %s\n", cmd);
+			return 0;
+		}
 	}
 	va_end(va);
-	return popen_drain(buf);
+	return spawn_rescanv(name, argv);
 }
@@ -6,10 +6,91 @@ extern "C" {
 #endif
 
 #include <wchar.h>
+#include <stdint.h>
+#include <sys/types.h>
 
-int popen_drain(const char *);
-int vpopen_drain(const char *,wchar_t * const *);
-int vspopen_drain(const char *,...) __attribute__ ((format (printf,1,2)));
+// External tools are run without a shell: argv is handed to posix_spawnp(),
+// with stdin from /dev/null, and stdout and stderr sharing a non-blocking
+// pipe. Background jobs' pipes (and pidfds, where the kernel has them) are
+// gathered into one epoll set, serviced by the event thread, so any number of
+// them can run at once without a thread apiece. Other jobs are serviced by
+// whoever waits on them. Each job runs in its own process group, so
+// cancellation reaches whatever it forks.
+
+// Output beyond this much is passed to the line callback, but not captured.
+#define CMD_CAPTURE_MAX (64 * 1024)
+
+// A cancelled job is sent SIGTERM, and SIGKILL if it's still around this
+// much later.
+#define CMD_KILL_MS 3000
+
+typedef struct cmdresult {
+	int status;		// exit status, 128 + signal if killed, -1 if lost
+	int cancelled;		// cmd_cancel() was called on it
+	uint64_t ns;		// how long it ran
+	char *output;		// stdout and stderr, NUL-terminated
+	size_t outlen;
+} cmdresult;
+
+// Called with each line of output (without its newline) as it arrives.
+typedef void (*cmdlinefxn)(unsigned id, const char *line, void *arg);
+
+// Called once the job has exited and its output is drained. res and its
+// output are freed upon return.
+typedef void (*cmddonefxn)(unsigned id, const cmdresult *res, void *arg);
+
+// Start argv[0], looked up in PATH. If lines is NULL, output goes to diag().
+// If done is NULL, the job must be collected with cmd_wait(), and its lines
+// are passed on from there; otherwise, callbacks are made from whichever
+// thread calls cmd_service(), and mustn't wait on jobs themselves. Returns
+// the job's ID, or 0 on failure.
+unsigned cmd_spawn(const char * const *argv, cmdlinefxn lines,
+			cmddonefxn done, void *arg);
+
+// Returns -1 if there's no such running job.
+int cmd_cancel(unsigned id);
+
+// Block until a job spawned without a done callback completes, reading its
+// output meanwhile. Free res with cmdresult_free(). Returns -1 if there's no
+// such job, or it's already being waited on.
+int cmd_wait(unsigned id, cmdresult *res);
+
+void cmdresult_free(cmdresult *res);
+
+typedef struct cmdjob_info {
+	unsigned id;
+	pid_t pid;
+	uint64_t ns;		// running for
+	int cancelled;
+	char cmd[64];		// argv, space-separated (and truncated)
+} cmdjob_info;
+
+// Describe up to n running jobs, oldest first. Returns the number described.
+unsigned cmd_jobs(cmdjob_info *out, unsigned n);
+
+// The event loop polls this for readability, and calls cmd_service() when
+// it's ready; background jobs make no progress otherwise. Returns -1 if the
+// runner couldn't be set up.
+int cmd_runner_fd(void);
+void cmd_service(void);
+
+// Run a command to completion, passing its output to diag(). The caller's
+// hold on the growlight lock is shed meanwhile (see shed_growlight()), so any
+// device used afterwards ought be held with hold_device().
+// Returns 0 if it exited with status 0.
+int spawn_drainv(const char * const *argv);
+int spawn_drain(const char *cmd, ...) __attribute__ ((sentinel));
+int wspawn_drain(const char *cmd, wchar_t * const *args);
+
+// Run a command in the background, passing its output to diag(), and noting
+// there how it exited once it's done. Returns its job ID, or 0 on failure.
+unsigned spawn_bgv(const char * const *argv);
+
+// As spawn_bgv(), and then rescan the device name (see defer_rescan()) once
+// it's done, however it exited. Tools which rewrite a device (mkfs, wipefs,
+// fsck, etc.) are run this way, so the UI needn't wait on them.
+unsigned spawn_rescanv(const char *name, const char * const *argv);
+unsigned spawn_rescan(const char *name, const char *cmd, ...) __attribute__ ((sentinel));
 
 #ifdef __cplusplus
 }
@@ -383,6 +383,8 @@ int uuid_partition(device *d,const void *uuid){
 }
 
 int check_partition(device *d){
+	char cmd[NAME_MAX],dev[PATH_MAX];
+
 	if(d->mnt.count){
 		diag("Will not check mounted filesystem %s\n",d->name);
 		return -1;
@@ -391,8 +393,15 @@ int check_partition(device *d){
 		diag("No filesystem on %s\n",d->name);
 		return -1;
 	}
+	if(snprintf(cmd,sizeof(cmd),"fsck.%s",d->mnttype) >= (int)sizeof(cmd)){
+		diag("Bad filesystem type: %s\n",d->mnttype);
+		return -1;
+	}
+	if(devnode_path(dev,sizeof(dev),d->name)){
+		return -1;
+	}
 	// FIXME not every filesystem supports -y
-	if(vspopen_drain("fsck.%s -y -C 0 /dev/%s",d->mnttype,d->name)){
+	if(spawn_rescan(dev,cmd,"-y","-C","0",dev,NULL) == 0){
 		return -1;
 	}
 	return 0;
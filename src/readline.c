@@ -15,10 +15,12 @@
 #include "zfs.h"
 #include "swap.h"
 #include "stats.h"
+#include "workq.h"
 #include "sysfs.h"
 #include "popen.h"
 #include "ptypes.h"
 #include "config.h"
+#include "coalesce.h"
 #include "mounts.h"
 #include "target.h"
 #include "secure.h"
@@ -60,6 +62,43 @@
 static unsigned lights_off;
 static unsigned use_terminfo;
 
+// Listings run against a snapshot of the device tree, without taking the
+// growlight lock (see tty_ui()). NULL while running any other command.
+static const treesnap *view;
+
+static inline const controller *
+view_controllers(void){
+	return view ? view->controllers : get_controllers();
+}
+
+// lookup_device() returns live devices, and might kick off discovery. Within
+// a snapshot, we search only what it holds.
+static const device *
+view_lookup(const char *name){
+	const controller *c;
+
+	if(!view){
+		return lookup_device(name);
+	}
+	for(c = view->controllers ; c ; c = c->next){
+		const device *d;
+
+		for(d = c->blockdevs ; d ; d = d->next){
+			const device *p;
+
+			if(strcmp(d->name,name) == 0){
+				return d;
+			}
+			for(p = d->parts ; p ; p = p->next){
+				if(strcmp(p->name,name) == 0){
+					return p;
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
 static int
 use_terminfo_color(int ansicolor,int boldp){
 	if(use_terminfo){
@@ -212,12 +251,17 @@ lookup_wcontroller(const wchar_t *dev){
 static device *
 lookup_wdevice(const wchar_t *dev){
 	char sdev[NAME_MAX];
+	device *d;
 
 	if(snprintf(sdev,sizeof(sdev),"%ls",dev) >= (int)sizeof(sdev)){
 		fprintf(stderr,"Bad device name: %ls\n",dev);
 		return NULL;
 	}
-	return lookup_device(sdev);
+	// commands act upon what the deep probes find
+	if((d = lookup_device(sdev)) == NULL){
+		return NULL;
+	}
+	return await_probe(d);
 }
 
 static int
@@ -271,17 +315,18 @@ static int print_dev_mplex(const device *,int,int);
 
 static int
 print_mounts(const device *d){
-	char buf[PREFIXSTRLEN + 1];
+	char buf[PREFIXSTRLEN + 1],use[64];
 	int r = 0,rr;
 	unsigned z;
 
+	fsusage_summary(&d->mntusage,use,sizeof(use));
 	for(z = 0 ; z < d->mnt.count ; ++z){
-		r += rr = printf("%-*.*s %-5.5s %-36.36s %-6.6s " PREFIXFMT "\n %s %s\n",
+		r += rr = printf("%-*.*s %-5.5s %-36.36s %-6.6s " PREFIXFMT "%s%s\n %s %s\n",
 				FSLABELSIZ,FSLABELSIZ,d->label ? d->label : "n/a",
 				d->mnttype,
 				d->uuid ? d->uuid : "n/a", d->name,
 				d->mntsize ? qprefix(d->mntsize,1,buf,sizeof(buf),0) : "",
-				d->mnt.list[z],d->mntops.list[z]);
+				*use ? " " : "",use,d->mnt.list[z],d->mntops.list[z]);
 		if(rr < 0){
 			return -1;
 		}
@@ -384,22 +429,67 @@ print_partition(const device *p,int descend){
 
 static int
 print_drive_stats(const device *d) {
-	printf("%-10.10s %16ju %16ju %16ju %16ju\n", d->name,
-		d->stats.sectors_read,
-		d->statdelta.sectors_read,
-		d->stats.sectors_written,
-		d->statdelta.sectors_written);
+	char rbuf[BPREFIXSTRLEN + 1], wbuf[BPREFIXSTRLEN + 1];
+	const statrates *rates;
+	statrates r;
+
+	lock_stats();
+	r = device_stats(d)->rates;
+	unlock_stats();
+	rates = &r;
+
+	printf("%-10.10s %8.1f %8.1f %8sB %8sB %8.2f %8.2f %6.2f %5.1f%%\n", d->name,
+		rates->reads,
+		rates->writes,
+		bprefix(rates->rbytes, 1, rbuf, sizeof(rbuf), 1),
+		bprefix(rates->wbytes, 1, wbuf, sizeof(wbuf), 1),
+		rates->rlatency,
+		rates->wlatency,
+		rates->qdepth,
+		rates->util);
 	return 0;
 }
 
 static int
 print_drive_stats_identified(const device *d) {
-	printf("SecRead    %16ju SecReadΔ    %16ju\n"
-	       "SecWritten %16ju SecWrittenΔ %16ju\n",
-		d->stats.sectors_read,
-		d->statdelta.sectors_read,
-		d->stats.sectors_written,
-		d->statdelta.sectors_written);
+	const statpack *s, *sd;
+	const statrates *rates;
+	devstats ds;
+
+	lock_stats();
+	ds = *device_stats(d);
+	unlock_stats();
+	s = &ds.stats;
+	sd = &ds.statdelta;
+	rates = &ds.rates;
+
+	printf("Reads      %16ju Δ %16ju Merged    %16ju Δ %16ju\n"
+	       "SecRead    %16ju Δ %16ju msReading %16ju Δ %16ju\n"
+	       "Writes     %16ju Δ %16ju Merged    %16ju Δ %16ju\n"
+	       "SecWritten %16ju Δ %16ju msWriting %16ju Δ %16ju\n"
+	       "Discards   %16ju Δ %16ju Merged    %16ju Δ %16ju\n"
+	       "SecDiscard %16ju Δ %16ju msDiscard %16ju Δ %16ju\n"
+	       "msIO       %16ju Δ %16ju Weighted  %16ju Δ %16ju\n"
+	       "In flight  %16ju\n",
+		s->reads_completed, sd->reads_completed,
+		s->reads_merged, sd->reads_merged,
+		s->sectors_read, sd->sectors_read,
+		s->ms_reading, sd->ms_reading,
+		s->writes_completed, sd->writes_completed,
+		s->writes_merged, sd->writes_merged,
+		s->sectors_written, sd->sectors_written,
+		s->ms_writing, sd->ms_writing,
+		s->discards_completed, sd->discards_completed,
+		s->discards_merged, sd->discards_merged,
+		s->sectors_discarded, sd->sectors_discarded,
+		s->ms_discarding, sd->ms_discarding,
+		s->ms_ios, sd->ms_ios,
+		s->weighted_ms_ios, sd->weighted_ms_ios,
+		s->ios_in_progress);
+	printf("IOPS r/w/d %.1f/%.1f/%.1f Latency r/w %.2f/%.2fms QD %.2f Busy %.1f%%\n",
+		rates->reads, rates->writes, rates->discards,
+		rates->rlatency, rates->wlatency,
+		rates->qdepth, rates->util);
 	return 0;
 }
 
@@ -588,7 +678,7 @@ print_dm(const device *d,int prefix,int descend){
 		return r;
 	}
 	for(md = d->dmdev.slaves ; md ; md = md->next){
-		device *s = lookup_device(md->name);
+		const device *s = view_lookup(md->name);
 
 		if(s){
 			r += rr = print_dev_mplex(s,1,descend);
@@ -638,7 +728,7 @@ print_mdadm(const device *d,int prefix,int descend){
 		return r;
 	}
 	for(md = d->mddev.slaves ; md ; md = md->next){
-		device *s = lookup_device(md->name);
+		const device *s = view_lookup(md->name);
 
 		if(s){
 			r += rr = print_dev_mplex(s,1,descend);
@@ -783,7 +873,7 @@ adapter(wchar_t * const *args,const char *arghelp){
 		usage(args,arghelp);
 		return -1;
 	}
-	for(ci = get_controllers() ; ci ; ci = ci->next){
+	for(ci = view_controllers() ; ci ; ci = ci->next){
 		if(print_controller(ci,descend) < 0){
 			return -1;
 		}
@@ -799,7 +889,7 @@ walk_devices(int (*fxn)(const device *,int),int descend){
 	const controller *c;
 	int rr,r = 0;
 
-	for(c = get_controllers() ; c ; c = c->next){
+	for(c = view_controllers() ; c ; c = c->next){
 		const device *d;
 
 		for(d = c->blockdevs ; d ; d = d->next){
@@ -829,7 +919,7 @@ zpool(wchar_t * const *args,const char *arghelp){
 	}else if(wcscmp(args[1],L"-v") == 0 && args[2] == NULL){
 		descend = 1;
 	}else{
-		if(vpopen_drain("zpool",args + 1)){
+		if(wspawn_drain("zpool",args + 1)){
 			usage(args,arghelp);
 			return -1;
 		}
@@ -849,7 +939,7 @@ zfs(wchar_t * const *args,const char *arghelp){
 		usage(args,arghelp);
 		return -1;
 	}
-	if(vpopen_drain("zfs",args + 1)){
+	if(wspawn_drain("zfs",args + 1)){
 		return -1;
 	}
 	return 0;
@@ -864,7 +954,7 @@ dm(wchar_t * const *args,const char *arghelp){
 	}else if(wcscmp(args[1],L"-v") == 0 && args[2] == NULL){
 		descend = 1;
 	}else{
-		if(vpopen_drain("dmsetup",args + 1)){
+		if(wspawn_drain("dmsetup",args + 1)){
 			usage(args,arghelp);
 			return -1;
 		}
@@ -891,7 +981,7 @@ mdadm(wchar_t * const *args,const char *arghelp){
 	}else if(wcscmp(args[1],L"-v") == 0 && args[2] == NULL){
 		descend = 1;
 	}else{
-		if(vpopen_drain("mdadm",args + 1)){
+		if(wspawn_drain("mdadm",args + 1)){
 			usage(args,arghelp);
 			return -1;
 		}
@@ -900,7 +990,7 @@ mdadm(wchar_t * const *args,const char *arghelp){
 	}
 	printf("%-10.10s %-36.36s " PREFIXFMT " %5.5s %-6.6s%-6.6s%-6.6s\n",
 			"Device","UUID","Bytes","PSect","Table","Disks","Level");
-	for(c = get_controllers() ; c ; c = c->next){
+	for(c = view_controllers() ; c ; c = c->next){
 		device *d;
 
 		if(c->bus != BUS_VIRTUAL){
@@ -963,7 +1053,7 @@ blockdev_dump(int descend){
 
 	printf("%-10.10s %-16.16s %4.4s " PREFIXFMT " %5.5s Flags %-6.6s%-16.16s %-4.4s\n",
 			"Device","Model","Rev","Bytes","PSect","Table","WWN","PHY");
-	for(c = get_controllers() ; c ; c = c->next){
+	for(c = view_controllers() ; c ; c = c->next){
 		const device *d;
 
 		for(d = c->blockdevs ; d ; d = d->next){
@@ -981,7 +1071,8 @@ blockdev_dump(int descend){
 
 static inline int
 blockdev_details(const device *d){
-	char buf[BUFSIZ];
+	const char *argv[4];
+	char buf[PATH_MAX];
 	unsigned z;
 
 	if(print_drive(d,1) < 0){
@@ -1010,30 +1101,34 @@ blockdev_details(const device *d){
 		printf("Serial number: %s\n",d->blkdev.serial ? d->blkdev.serial : "n/a");
 		printf("Transport: %s\n", transport_str(d->blkdev.transport));
 		if(d->blkdev.transport == DIRECT_NVME){
-			if(snprintf(buf,sizeof(buf),"nvme id-ctrl /dev/%s",d->name) >= (int)sizeof(buf)){
-				return -1;
-			}
+			argv[0] = "nvme";
+			argv[1] = "id-ctrl";
 		}else{ // probably shouldn't for e.g. USB? maybe should? FIXME
-			if(snprintf(buf,sizeof(buf),"hdparm -I /dev/%s",d->name) >= (int)sizeof(buf)){
-				return -1;
-			}
+			argv[0] = "hdparm";
+			argv[1] = "-I";
 		}
 	}else if(d->layout == LAYOUT_MDADM){
-		if(snprintf(buf,sizeof(buf),"mdadm --detail /dev/%s",d->name) >= (int)sizeof(buf)){
-			return -1;
-		}
+		argv[0] = "mdadm";
+		argv[1] = "--detail";
 	}else if(d->layout == LAYOUT_DM){
-		if(snprintf(buf,sizeof(buf),"dmsetup info /dev/%s",d->name) >= (int)sizeof(buf)){
-			return -1;
-		}
+		argv[0] = "dmsetup";
+		argv[1] = "info";
 	}else if(d->layout == LAYOUT_ZPOOL){
-		if(snprintf(buf,sizeof(buf),"zpool status %s",d->name) >= (int)sizeof(buf)){
-			return -1;
-		}
+		argv[0] = "zpool";
+		argv[1] = "status";
 	}else{
 		return 0;
 	}
-	if(popen_drain(buf)){
+	if(d->layout == LAYOUT_ZPOOL){
+		if(snprintf(buf,sizeof(buf),"%s",d->name) >= (int)sizeof(buf)){
+			return -1;
+		}
+	}else if(devnode_path(buf,sizeof(buf),d->name)){
+		return -1;
+	}
+	argv[2] = buf;
+	argv[3] = NULL;
+	if(spawn_drainv(argv)){
 		return -1;
 	}
 	return 0;
@@ -1351,7 +1446,7 @@ partition(wchar_t * const *args,const char *arghelp){
 	}
 	printf("%-10.10s %-36.36s " PREFIXFMT " %-4.4s %s\n",
 			"Partition","UUID","Bytes","Role","Name");
-	for(c = get_controllers() ; c ; c = c->next){
+	for(c = view_controllers() ; c ; c = c->next){
 		const device *d;
 
 		for(d = c->blockdevs ; d ; d = d->next){
@@ -1375,7 +1470,7 @@ mounts(wchar_t * const *args,const char *arghelp){
 	printf("%-*.*s %-5.5s %-36.36s %s " PREFIXFMT "\n",
 			FSLABELSIZ,FSLABELSIZ,"Label",
 			"Type","UUID","Device","Bytes");
-	for(c = get_controllers() ; c ; c = c->next){
+	for(c = view_controllers() ; c ; c = c->next){
 		const device *d;
 
 		for(d = c->blockdevs ; d ; d = d->next){
@@ -1686,7 +1781,7 @@ static int
 grubmap(wchar_t * const *args,const char *arghelp){
 	ZERO_ARG_CHECK(args,arghelp);
 
-	if(popen_drain("grub-mkdevicemap -m /dev/stdout")){
+	if(spawn_drain("grub-mkdevicemap","-m","/dev/stdout",NULL)){
 		return -1;
 	}
 	return 0;
@@ -1827,9 +1922,9 @@ version(wchar_t * const *args,const char *arghelp){
 "++'''''#++++++++++++++++++++++++++++++++'''''++++++++++##########++++''++++++'''"
 "++#++++++++++++++++++++++++++++++++++++++++#++++++++++++#########++++'+''''''+++\n");
 	use_terminfo_color(COLOR_WHITE,1);
-	ret |= popen_drain("mkswap --version");
+	ret |= spawn_drain("mkswap","--version",NULL);
 	printf("\n");
-	ret |= popen_drain("grub-mkdevicemap --version");
+	ret |= spawn_drain("grub-mkdevicemap","--version",NULL);
 	if(print_zfs_version(stdout) < 0){
 		ret |= -1;
 	}
@@ -1896,30 +1991,45 @@ target(wchar_t * const *args,const char *arghelp){
 
 static int
 diags(wchar_t * const *args,const char *arghelp){
-	logent logs[MAXIMUM_LOG_ENTRIES];
+	static logent logs[MAXIMUM_LOG_ENTRIES];
+	loglevel level = LOGLEVEL_VERBOSE;
+	uint64_t logged,dropped;
 	unsigned idx;
 	int z;
 
 	idx = sizeof(logs) / sizeof(*logs);
 	if(args[1]){
-		if(!args[2]){
-			uintmax_t ull;
+		uintmax_t ull;
 
-			if(wstrtoull(args[1],&ull)){
+		if(wstrtoull(args[1],&ull)){
+			usage(args,arghelp);
+			return -1;
+		}
+		if(ull > idx || ull == 0){
+			fprintf(stderr,"Request no more than %u log records, and no fewer than 1\n",idx);
+			return -1;
+		}
+		idx = ull;
+		if(args[2]){
+			char lname[16];
+			const char *n;
+
+			if(args[3] || wcstombs(lname,args[2],sizeof(lname)) >= sizeof(lname)){
 				usage(args,arghelp);
 				return -1;
 			}
-			if(ull > idx || ull == 0){
-				fprintf(stderr,"Request no more than %u log records, and no fewer than 1\n",idx);
+			for(level = LOGLEVEL_ERROR ; (n = loglevel_name(level)) ; ++level){
+				if(strcmp(n,lname) == 0){
+					break;
+				}
+			}
+			if(n == NULL){
+				fprintf(stderr,"Unknown log level: %s\n",lname);
 				return -1;
 			}
-			idx = ull;
-		}else{
-			usage(args,arghelp);
-			return -1;
 		}
 	}
-	if((z = get_logs(idx,logs)) < 0){
+	if((z = get_logs(idx,logs,level)) < 0){
 		return -1;
 	}
 	while(z--){
@@ -1929,23 +2039,93 @@ diags(wchar_t * const *args,const char *arghelp){
 			fprintf(stderr,"Bad timestamp at index %d! %s\n",z,logs[z].msg);
 		}else{
 			tbuf[strlen(tbuf) - 1] = ' '; // kill newline
-			printf("%s%s",tbuf,logs[z].msg);
+			printf("%s%s: %s",tbuf,logs[z].src,logs[z].msg);
 		}
-		free(logs[z].msg);
+	}
+	get_log_stats(&logged,&dropped);
+	if(dropped){
+		printf("(%ju of %ju messages were lost to contention)\n",
+				(uintmax_t)dropped,(uintmax_t)logged);
 	}
 	fflush(stdout);
 	return 0;
 }
 
+static void
+print_rollup(const char *span, const statrollup *r){
+	if(r->n == 0){
+		printf("%-6.6s %s\n", span, "no data");
+		return;
+	}
+	printf("%-6.6s %8.1f %8.1f %8.1f %8.2f %8.2f %8.2f %5.1f%% %5.1f%% %5.1f%%\n", span,
+		r->min.iops, r->avg.iops, r->max.iops,
+		r->min.latency, r->avg.latency, r->max.latency,
+		r->min.util, r->avg.util, r->max.util);
+}
+
+// min/avg/max over recent spans, from the per-device history rings
+static int
+print_drive_history(const device *d){
+	static const struct {
+		const char *span;
+		unsigned secs;		// from the fine tier, if non-zero
+		unsigned mins;		// otherwise from the coarse tier
+	} spans[] = {
+		{ "10s", 10, 0, }, { "1m", 60, 0, }, { "10m", STATHIST_SECONDS, 0, },
+		{ "1h", 0, 60, }, { "24h", 0, STATHIST_MINUTES, },
+	};
+	statrollup r[sizeof(spans) / sizeof(*spans)];
+	const stathist *hist;
+	struct timespec ts;
+	unsigned s;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	// roll up under the stats lock, and print once it's dropped
+	lock_stats();
+	if( (hist = device_stats(d)->hist) ){
+		for(s = 0 ; s < sizeof(spans) / sizeof(*spans) ; ++s){
+			if(spans[s].secs){
+				stathist_summarize(hist, ts.tv_sec, spans[s].secs, &r[s]);
+			}else{
+				stathist_rollup(hist, ts.tv_sec, spans[s].mins, &r[s]);
+			}
+		}
+	}
+	unlock_stats();
+	if(hist == NULL){
+		printf("No history %s for %s\n", d->layout == LAYOUT_PARTITION ?
+				"is kept" : "yet", d->name);
+		return 0;
+	}
+	use_terminfo_color(COLOR_WHITE, 1);
+	printf("Span       IOPS min      avg      max  Lat min      avg      max  Busy min   avg   max\n");
+	use_terminfo_color(COLOR_BLUE, 1);
+	for(s = 0 ; s < sizeof(spans) / sizeof(*spans) ; ++s){
+		print_rollup(spans[s].span, &r[s]);
+	}
+	return 0;
+}
+
 static int
 stats(wchar_t * const *args, const char *arghelp){
 	const controller *c;
 
-	ZERO_ARG_CHECK(args, arghelp);
+	if(args[1]){
+		device *d;
+
+		if(args[2]){
+			usage(args, arghelp);
+			return -1;
+		}
+		if((d = lookup_wdevice(args[1])) == NULL){
+			return -1;
+		}
+		return print_drive_history(d);
+	}
 	use_terminfo_color(COLOR_WHITE, 1);
-	printf("Device         Sectors read          SRead Δ  Sectors written       SWritten Δ\n");
+	printf("Device        rIOPS    wIOPS    Read/s  Written/s  rLat ms  wLat ms     QD  Busy\n");
 	use_terminfo_color(COLOR_BLUE,1);
-	for(c = get_controllers() ; c ; c = c->next){
+	for(c = view_controllers() ; c ; c = c->next){
 		const device *d;
 
 		for(d = c->blockdevs ; d ; d = d->next){
@@ -1957,6 +2137,113 @@ stats(wchar_t * const *args, const char *arghelp){
 	return 0;
 }
 
+static int
+sampling(wchar_t * const *args, const char *arghelp){
+	unsigned cur, ms;
+	int adaptive;
+	wchar_t *e;
+	long l;
+
+	if(args[1] == NULL){
+		ms = get_stats_interval(&adaptive, &cur);
+		printf("Sampling every %ums%s", ms, adaptive ? " (adaptive" : "");
+		if(adaptive){
+			printf(", currently %ums)", cur);
+		}
+		printf("\n");
+		return 0;
+	}
+	if(args[2] && (wcscmp(args[2], L"adaptive") || args[3])){
+		usage(args, arghelp);
+		return -1;
+	}
+	errno = 0;
+	l = wcstol(args[1], &e, 10);
+	if(errno || *e || l < STATS_INTERVAL_MIN || l > STATS_INTERVAL_MAX){
+		fprintf(stderr, "Interval must be %u..%u (ms), got %ls\n",
+				STATS_INTERVAL_MIN, STATS_INTERVAL_MAX, args[1]);
+		return -1;
+	}
+	if(set_stats_interval(l, args[2] != NULL) < 0){
+		return -1;
+	}
+	return 0;
+}
+
+static int
+counters(wchar_t * const *args, const char *arghelp){
+	coalesce_stats cs;
+	sysfs_stats ss;
+	workq_stats ws;
+	const char *name;
+	uint64_t folded;
+	unsigned z;
+
+	ZERO_ARG_CHECK(args, arghelp);
+	get_event_counters(&cs);
+	printf("Events: %ju received, %ju collapsed, %ju dispatched in %ju windows\n",
+			(uintmax_t)cs.received, (uintmax_t)cs.collapsed,
+			(uintmax_t)cs.dispatched, (uintmax_t)cs.windows);
+	printf("        %ju suppressed, %u pending (peak %u), %u held\n",
+			(uintmax_t)cs.suppressed, cs.pending, cs.maxpending, cs.held);
+	get_sysfs_stats(&ss);
+	printf("Sysfs: %ju attributes, %ju opens, %ju reads, %ju closes\n",
+			(uintmax_t)ss.attrs, (uintmax_t)ss.opens,
+			(uintmax_t)ss.reads, (uintmax_t)ss.closes);
+	printf("%-7.7s %9s %9s %6s %6s %9s %9s %9s %9s\n", "Lane", "Done",
+			"Folded", "Queued", "Peak", "Wait(avg)", "Wait(max)",
+			"Run(avg)", "Run(max)");
+	for(z = 0 ; (name = get_lane_stats(z, &ws, &folded)) ; ++z){
+		uint64_t n = ws.completed ? ws.completed : 1;
+
+		printf("%-7.7s %9ju %9ju %6u %6u %7.1fms %7.1fms %7.1fms %7.1fms\n",
+				name, (uintmax_t)ws.completed, (uintmax_t)folded,
+				ws.queued, ws.maxqueued, ws.waitns / (double)n / 1000000,
+				ws.maxwaitns / 1000000.0, ws.runns / (double)n / 1000000,
+				ws.maxrunns / 1000000.0);
+	}
+	return 0;
+}
+
+static int
+jobs(wchar_t * const *args, const char *arghelp){
+	cmdjob_info ji[32];
+	unsigned n, z;
+	wchar_t *e;
+	long l;
+
+	if(args[1]){
+		if(wcscmp(args[1], L"cancel") || args[2] == NULL || args[3]){
+			usage(args, arghelp);
+			return -1;
+		}
+		errno = 0;
+		l = wcstol(args[2], &e, 10);
+		if(errno || *e || l <= 0 || (unsigned long)l > UINT_MAX){
+			fprintf(stderr, "Not a job ID: %ls\n", args[2]);
+			return -1;
+		}
+		if(cmd_cancel(l)){
+			fprintf(stderr, "No running job %ld\n", l);
+			return -1;
+		}
+		return 0;
+	}
+	n = cmd_jobs(ji, sizeof(ji) / sizeof(*ji));
+	if(n == 0){
+		printf("No jobs are running\n");
+		return 0;
+	}
+	use_terminfo_color(COLOR_WHITE, 1);
+	printf("%6s %7s %9s %s\n", "Job", "PID", "Running", "Command");
+	for(z = 0 ; z < n ; ++z){
+		printf("%6u %7d %8.1fs %s%s\n", ji[z].id, (int)ji[z].pid,
+				ji[z].ns / 1e9, ji[z].cmd,
+				ji[z].cancelled ? " [cancelled]" : "");
+	}
+	return 0;
+}
+
 static int
 quit(wchar_t * const *args,const char *arghelp){
 	ZERO_ARG_CHECK(args,arghelp);
@@ -1968,13 +2255,17 @@ static const struct fxn {
 	const wchar_t *cmd;
 	int (*fxn)(wchar_t * const *,const char *);
 	const char *arghelp;
+	// Without arguments, or with only "-v", only lists devices, and can
+	// run against a snapshot.
+	unsigned snapview: 1;
 } fxns[] = {
 #define FXN(x,args) { .cmd = L###x, .fxn = x, .arghelp = args, }
-	FXN(adapter,"[ \"reset\" adapter ]\n"
+#define VFXN(x,args) { .cmd = L###x, .fxn = x, .arghelp = args, .snapview = 1, }
+	VFXN(adapter,"[ \"reset\" adapter ]\n"
 			"                 | [ \"rescan\" adapter ]\n"
 			"                 | [ \"detail\" adapter ]\n"
 			"                 | [ -v ] no arguments to list all host bus adapters"),
-	FXN(blockdev,"[ \"rescan\" blockdev ]\n"
+	VFXN(blockdev,"[ \"rescan\" blockdev ]\n"
 			"                 | [ \"badblocks\" blockdev [ \"rw\" ] ]\n"
 			"                 | [ \"wipebiosboot\" blockdev ]\n"
 			"                 | [ \"wipedosmbr\" blockdev ]\n"
@@ -1984,7 +2275,7 @@ static const struct fxn {
 			"                    | no arguments to list supported table types\n"
 			"                 | [ \"detail\" blockdev ]\n"
 			"                 | [ -v ] no arguments to list all blockdevs"),
-	FXN(partition,"[ \"del\" partition ]\n"
+	VFXN(partition,"[ \"del\" partition ]\n"
 			"                 | [ \"add\" blockdev size/range name type ]\n"
 			"                    size: a single number, interpreted as bytes\n"
 			"                    range: num:num, num: or :num, interpreted as sectors\n"
@@ -1995,7 +2286,7 @@ static const struct fxn {
 			"                 | [ \"setflag\" [ partition \"on\"|\"off\" flag ] ]\n"
 			"                    | no arguments to list supported flags\n"
 			"                 | [ -v ] no arguments to list all partitions"),
-	FXN(fs,"[ \"mkfs\" [ partition fstype name ] ]\n"
+	VFXN(fs,"[ \"mkfs\" [ partition fstype name ] ]\n"
 			"                 | no arguments to list supported fs types\n"
 			"                 | [ \"fsck\" ks ]\n"
 			"                 | [ \"wipefs\" fs ]\n"
@@ -2005,13 +2296,13 @@ static const struct fxn {
 			"                 | [ \"mount\" blockdev mountpoint type options ]\n"
 			"                 | [ \"umount\" blockdev ]\n"
 			"                 | no arguments to list all filesystems"),
-	FXN(swap,"[ \"on\"|\"off\" swapdevice ]\n"
+	VFXN(swap,"[ \"on\"|\"off\" swapdevice ]\n"
 			"                 | no arguments to list all swaps"),
-	FXN(mdadm,"[ arguments passed directly through to mdadm(8) ]\n"
+	VFXN(mdadm,"[ arguments passed directly through to mdadm(8) ]\n"
 			"                 | [ -v ] no arguments to list all md devices"),
-	FXN(dm,"[ arguments passed directly through to dmsetup(8) ]\n"
+	VFXN(dm,"[ arguments passed directly through to dmsetup(8) ]\n"
 			"                 | [ -v ] no arguments to list all devicemaps"),
-	FXN(zpool,"[ arguments passed directly through to zpool(8) ]\n"
+	VFXN(zpool,"[ arguments passed directly through to zpool(8) ]\n"
 			"                 | [ -v ] no arguments to list all zpools"),
 	FXN(zfs,"arguments passed directly through to zfs(8)"),
 	FXN(target,"[ \"set\" path ]\n"
@@ -2021,18 +2312,22 @@ static const struct fxn {
 	FXN(map,"[ mountdev mountpoint options ]\n"
 			"                 | no arguments prints target fstab"),
 	FXN(unmap, "mountpoint"),
-	FXN(stats, ""),
-	FXN(mounts,""),
+	VFXN(stats, "[ blockdev ]"),
+	FXN(sampling, "[ ms [ \"adaptive\" ] ]"),
+	FXN(counters, ""),
+	VFXN(mounts,""),
 	FXN(uefiboot,"root fs map must be defined in GPT partition"),
 	FXN(biosboot,"root fs map must be defined in GPT/MBR partition"),
-	FXN(diags,"[ count ]"),
+	FXN(diags,"[ count [ error|warning|info|verbose ] ]"),
 	FXN(grubmap,""),
 	FXN(benchmark,"blockdev"),
+	FXN(jobs, "[ \"cancel\" id ]"),
 	FXN(troubleshoot,""),
 	FXN(version,""),
 	FXN(help,"[ command ]"),
 	FXN(quit,""),
 	{ .cmd = NULL, .fxn = NULL, .arghelp = NULL, },
+#undef VFXN
 #undef FXN
 };
 
@@ -2095,9 +2390,18 @@ tty_ui(void){
 		}
 		if(fxn->fxn){
 			use_terminfo_color(COLOR_WHITE,1);
-			lock_growlight();
-			z = fxn->fxn(tokes,fxn->arghelp);
-			unlock_growlight();
+			if(fxn->snapview && (!tokes[1] || (wcscmp(tokes[1],L"-v") == 0 && !tokes[2]))){
+				view = get_snapshot();
+			}
+			if(view){
+				z = fxn->fxn(tokes,fxn->arghelp);
+				put_snapshot(view);
+				view = NULL;
+			}else{
+				lock_growlight();
+				z = fxn->fxn(tokes,fxn->arghelp);
+				unlock_growlight();
+			}
 			if(z < 0){
 				printf("\n");
 			}
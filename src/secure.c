@@ -8,15 +8,20 @@
 #include "growlight.h"
 
 int ata_secure_erase(device *d){
+	char dev[PATH_MAX];
+
 	if(d->layout != LAYOUT_NONE){
 		diag("Can only run ATA Erase on ATA-connected blockdevs\n");
 		return -1;
 	}
-	if(vspopen_drain("hdparm --user-master u --security-set-pass erasepw /dev/%s",d->name)){
+	if(devnode_path(dev,sizeof(dev),d->name)){
+		return -1;
+	}
+	if(spawn_drain("hdparm","--user-master","u","--security-set-pass","erasepw",dev,NULL)){
 		diag("Couldn't set ATA user password\n");
 		return -1;
 	}
-	if(vspopen_drain("hdparm --user-master u --security-erase erasepw /dev/%s",d->name)){
+	if(spawn_drain("hdparm","--user-master","u","--security-erase","erasepw",dev,NULL)){
 		diag("Couldn't perform ATA Secure Erase\n");
 		return -1;
 	}
@@ -21,8 +21,7 @@ int probe_smart(device *d){
 		return -1;
 	}
 	d->blkdev.smart = -1;
-	if(snprintf(path,sizeof(path),"/dev/%s",d->name) >= (int)sizeof(path)){
-		diag("Bad name: %s\n",d->name);
+	if(devnode_path(path,sizeof(path),d->name)){
 		return -1;
 	}
 	sk = NULL;
@@ -3,7 +3,7 @@
 #include "growlight.h"
 
 int fstrim(const char *mnt){
-	return vspopen_drain("fstrim -v %s",mnt);
+	return spawn_drain("fstrim","-v",mnt,NULL);
 }
 
 int fstrim_dev(device *d){
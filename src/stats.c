@@ -1,192 +1,551 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <ctype.h>
+#include <string.h>
 #include <stdio.h>
 #include "stats.h"
 #include <unistd.h>
 #include <stdlib.h>
+#include <sys/sysmacros.h>
 #include "growlight.h"
+#include "devindex.h"
 
 const char PROCFS_DISKSTATS[] = "/proc/diskstats";
 
-int read_proc_diskstats(diskstats **stats) {
-	return read_diskstats(PROCFS_DISKSTATS, stats);
+// The fewest per-device fields we'll accept (pre-4.18 kernels), and the most
+// we'll use (4.18+; 5.5 added two flush fields, which we don't yet track).
+#define DISKSTATS_MINFIELDS 11
+#define DISKSTATS_MAXFIELDS 15
+
+int read_proc_diskstats(diskstats_reader *dr, const diskstats **stats) {
+	return read_diskstats(dr, PROCFS_DISKSTATS, stats);
 }
 
-// procfs files can't be mmap()ed, and always advertise a length of 0. They are
-// to be open()ed, read() in one go, and close()d. Returns a heap-allocated
-// image of the procfs file, setting *buflen to the number of bytes read. An
-// existing, empty file will result in a non-NULL return and a *buflen of 0. Any
-// error will result in a return of NULL and an undefined *buflen.
+void free_diskstats_reader(diskstats_reader *dr) {
+	if(dr->fd >= 0){
+		close(dr->fd);
+	}
+	free(dr->buf);
+	free(dr->stats);
+	memset(dr, 0, sizeof(*dr));
+	dr->fd = -1;
+}
+
+// procfs files can't be mmap()ed, and always advertise a length of 0. They
+// must be read() until EOF. We hold the fd open and pread() from offset 0 on
+// each sample, into a buffer which only ever grows (and thus only allocates
+// when the file grows past its previous high-water mark). Returns the number
+// of bytes read, or -1 on error.
 //
-// Technically, this function will work on any file supporting read(), but usual
-// disk files are typically better mmap()ped.
-static char *
-read_procfs_file(const char *path, size_t *buflen) {
-	size_t alloclen = 0;
-	char *buf = NULL;
-	int fd, terrno;
+// Technically, this function will work on any file supporting pread(), but
+// usual disk files are typically better mmap()ped.
+static ssize_t
+read_procfs_file(diskstats_reader *dr, const char *path) {
+	size_t buflen = 0;
 	ssize_t r;
 
-	if((fd = open(path, O_CLOEXEC|O_RDONLY)) < 0){
-		return NULL;
+	if(dr->fd < 0){
+		if((dr->fd = open(path, O_CLOEXEC|O_RDONLY)) < 0){
+			return -1;
+		}
 	}
-	*buflen = 0;
-	r = 0;
-	do{
-		*buflen += r;
-		if(*buflen == alloclen){
-			char *tmp = realloc(buf, alloclen + BUFSIZ);
+	for(;;){
+		if(buflen == dr->bufsize){
+			size_t nsize = dr->bufsize ? dr->bufsize * 2 : BUFSIZ;
+			char *tmp = realloc(dr->buf, nsize);
 			if(tmp == NULL){
-				terrno = errno;
-				free(buf);
-				close(fd);
-				errno = terrno;
-				return NULL;
+				return -1;
 			}
-			buf = tmp;
-			alloclen += BUFSIZ;
+			++dr->allocs;
+			dr->buf = tmp;
+			dr->bufsize = nsize;
 		}
-	}while((r = read(fd, buf + *buflen, alloclen - *buflen)) > 0);
+		if((r = pread(dr->fd, dr->buf + buflen, dr->bufsize - buflen, buflen)) <= 0){
+			break;
+		}
+		buflen += r;
+	}
 	if(r < 0){
-		terrno = errno;
-		diag("Error reading %zu from %s (%s)\n", *buflen, path, strerror(terrno));
-		free(buf);
-		close(fd);
+		int terrno = errno;
+		diag("Error reading %zu from %s (%s)\n", buflen, path, strerror(terrno));
+		close(dr->fd);
+		dr->fd = -1;
 		errno = terrno;
-		return NULL;
+		return -1;
 	}
-	verbf("Read %zub from %s\n", *buflen, path);
-	close(fd);
-	return buf;
+	return buflen;
 }
 
-// Find the offset one past the end of the current line (presumed to start at
-// offset). Offset must be less than or equal to buflen. The returned value
-// will never be greater than buflen.
-static size_t
-find_line_end(const char *buf, size_t offset, size_t buflen) {
-	while(offset < buflen){
-		if(buf[offset] == '\n'){
-			++offset;
-			break;
-		}
-		++offset;
+static inline int
+lex_space(const char **sol, const char *eol) {
+	const char *s = *sol;
+	while(s < eol && (*s == ' ' || *s == '\t')){
+		++s;
+	}
+	if(s == *sol){
+		return -1;
 	}
-	return offset;
+	*sol = s;
+	return 0;
 }
 
-static int
-add_diskstat(diskstats **stats, int devcount, diskstats *dstat) {
-	diskstats *tmp = realloc(*stats, sizeof(**stats) * (devcount + 1));
-	if(tmp == NULL){
+// Lex an unsigned decimal integer. Returns -1 if there isn't at least one
+// digit. Doesn't detect overflow; the kernel's counters are all u64.
+static inline int
+lex_u64(const char **sol, const char *eol, uint64_t *val) {
+	const char *s = *sol;
+	uint64_t v = 0;
+	while(s < eol && *s >= '0' && *s <= '9'){
+		v = v * 10 + (*s - '0');
+		++s;
+	}
+	if(s == *sol){
 		return -1;
 	}
-	memcpy(&tmp[devcount], dstat, sizeof(*dstat));
-	*stats = tmp;
+	*val = v;
+	*sol = s;
 	return 0;
 }
 
-// Lex the major/minor number and device name. Copy the device name into dstat.
-// Returns the number of characters consumed, or -1 on a lexing failure.
+// Lex up a single line from the diskstats file, which starts at sol and runs
+// up to (not including) eol. The device name is NUL-terminated in place.
 static int
-lex_diskstats_prefix(const char *sol, const char *eol, diskstats *dstat) {
-	const char *start = sol;
-	// Pass any initial whitespace
-	while(sol < eol && isspace(*sol)){
-		++sol;
-	}
-	// Pass major number
-	while(sol < eol && isdigit(*sol)){
-		++sol;
-	}
-	// Should have whitespace now
-	if(sol == eol || !isspace(*sol)){
+lex_diskstats(char *sol, const char *eol, diskstats *dstat) {
+	uint64_t maj, min, fields[DISKSTATS_MAXFIELDS];
+	const char *s = sol;
+	unsigned f;
+
+	lex_space(&s, eol); // initial whitespace is optional
+	if(lex_u64(&s, eol, &maj) || lex_space(&s, eol)){
 		return -1;
 	}
-	// Pass said whitespace
-	do{
-		++sol;
-	}while(sol < eol && isspace(*sol));
-	// Pass minor number
-	while(sol < eol && isdigit(*sol)){
-		++sol;
+	if(lex_u64(&s, eol, &min) || lex_space(&s, eol)){
+		return -1;
 	}
-	// Should have whitespace now
-	if(sol == eol || !isspace(*sol)){
+	char *name = sol + (s - sol);
+	while(s < eol && isgraph((unsigned char)*s)){
+		++s;
+	}
+	if(s == name || s == eol){
 		return -1;
 	}
-	// Pass said whitespace
-	do{
-		++sol;
-	}while(sol < eol && isspace(*sol));
-	unsigned namelen = 0;
-	while(sol < eol && isgraph(*sol)){
-		dstat->name[namelen++] = *sol;
-		++sol;
-		if(namelen >= sizeof(dstat->name)){ // name was too long, aieee
-			return -1;
+	sol[s - sol] = '\0'; // overwrite the whitespace following the name
+	++s;
+	for(f = 0 ; f < DISKSTATS_MAXFIELDS ; ++f){
+		lex_space(&s, eol);
+		if(lex_u64(&s, eol, &fields[f])){
+			break;
 		}
 	}
-	if(namelen == 0){
+	if(f < DISKSTATS_MINFIELDS){
 		return -1;
 	}
-	dstat->name[namelen] = '\0';
-	return sol - start;
+	while(f < DISKSTATS_MAXFIELDS){ // no discard stats prior to 4.18
+		fields[f++] = 0;
+	}
+	dstat->name = name;
+	dstat->devno = makedev(maj, min);
+	dstat->total.reads_completed = fields[0];
+	dstat->total.reads_merged = fields[1];
+	dstat->total.sectors_read = fields[2];
+	dstat->total.ms_reading = fields[3];
+	dstat->total.writes_completed = fields[4];
+	dstat->total.writes_merged = fields[5];
+	dstat->total.sectors_written = fields[6];
+	dstat->total.ms_writing = fields[7];
+	dstat->total.ios_in_progress = fields[8];
+	dstat->total.ms_ios = fields[9];
+	dstat->total.weighted_ms_ios = fields[10];
+	dstat->total.discards_completed = fields[11];
+	dstat->total.discards_merged = fields[12];
+	dstat->total.sectors_discarded = fields[13];
+	dstat->total.ms_discarding = fields[14];
+	return 0;
+}
+
+void statpack_delta(statpack *delta, const statpack *cur, const statpack *prev) {
+	delta->reads_completed = cur->reads_completed - prev->reads_completed;
+	delta->reads_merged = cur->reads_merged - prev->reads_merged;
+	delta->sectors_read = cur->sectors_read - prev->sectors_read;
+	delta->ms_reading = cur->ms_reading - prev->ms_reading;
+	delta->writes_completed = cur->writes_completed - prev->writes_completed;
+	delta->writes_merged = cur->writes_merged - prev->writes_merged;
+	delta->sectors_written = cur->sectors_written - prev->sectors_written;
+	delta->ms_writing = cur->ms_writing - prev->ms_writing;
+	delta->ios_in_progress = cur->ios_in_progress;
+	delta->ms_ios = cur->ms_ios - prev->ms_ios;
+	delta->weighted_ms_ios = cur->weighted_ms_ios - prev->weighted_ms_ios;
+	delta->discards_completed = cur->discards_completed - prev->discards_completed;
+	delta->discards_merged = cur->discards_merged - prev->discards_merged;
+	delta->sectors_discarded = cur->sectors_discarded - prev->sectors_discarded;
+	delta->ms_discarding = cur->ms_discarding - prev->ms_discarding;
+}
+
+void statpack_rates(statrates *rates, const statpack *delta, const struct timeval *q) {
+	double ms = q->tv_sec * 1000.0 + q->tv_usec / 1000.0;
+
+	memset(rates, 0, sizeof(*rates));
+	if(ms <= 0){
+		return;
+	}
+	rates->reads = delta->reads_completed * 1000.0 / ms;
+	rates->writes = delta->writes_completed * 1000.0 / ms;
+	rates->discards = delta->discards_completed * 1000.0 / ms;
+	rates->rbytes = delta->sectors_read * (double)DISKSTATS_SECTOR * 1000.0 / ms;
+	rates->wbytes = delta->sectors_written * (double)DISKSTATS_SECTOR * 1000.0 / ms;
+	if(delta->reads_completed){
+		rates->rlatency = (double)delta->ms_reading / delta->reads_completed;
+	}
+	if(delta->writes_completed){
+		rates->wlatency = (double)delta->ms_writing / delta->writes_completed;
+	}
+	rates->qdepth = delta->weighted_ms_ios / ms;
+	// the kernel's ms counters tick at jiffy granularity, so clamp
+	if((rates->util = delta->ms_ios * 100.0 / ms) > 100){
+		rates->util = 100;
+	}
 }
 
-// Lex up a single line from the diskstats file.
+void devstats_restart(devstats *ds) {
+	ds->stats.sectors_read = UINTMAX_MAX;
+	ds->stats.sectors_written = UINTMAX_MAX;
+}
+
+void devstats_update(devstats *ds, const statpack *total,
+			const struct timeval *q, uint32_t now) {
+	if(ds->stats.sectors_read == UINTMAX_MAX){
+		memset(&ds->statdelta, 0, sizeof(ds->statdelta));
+		memset(&ds->rates, 0, sizeof(ds->rates));
+	}else{
+		statpack_delta(&ds->statdelta, total, &ds->stats);
+		statpack_rates(&ds->rates, &ds->statdelta, q);
+		if(ds->keephist && (ds->hist || (ds->hist = stathist_create()))){
+			stathist_add(ds->hist, now, &ds->rates);
+		}
+	}
+	ds->stats = *total;
+	ds->statq = *q;
+}
+
+// Double the devno index once it's fully loaded.
 static int
-lex_diskstats(const char *sol, const char *eol, diskstats *dstat) {
-	int consumed;
+statstable_grow_index(statstable *st){
+	unsigned nb = st->nbuckets ? st->nbuckets * 2 : STATSTABLE_PAGE;
+	devstats **buckets;
+	unsigned z;
 
-	consumed = lex_diskstats_prefix(sol, eol, dstat);
-	if(consumed < 0){
+	if((buckets = calloc(nb, sizeof(*buckets))) == NULL){
 		return -1;
 	}
-	sol += consumed;
-	// sectorsRead is f3, sectorsWritten is f7
-	uintmax_t f1, f2, f3, f4, f5, f6, f7;
-	consumed = sscanf(sol, "%ju %ju %ju %ju %ju %ju %ju",
-			  &f1, &f2, &f3, &f4, &f5, &f6, &f7);
-	if(consumed != 7){
-		return -1;
+	for(z = 0 ; z < st->nbuckets ; ++z){
+		devstats *ds;
+
+		while( (ds = st->buckets[z]) ){
+			unsigned b = hash_devno(ds->devno) & (nb - 1);
+
+			st->buckets[z] = ds->hnext;
+			ds->hnext = buckets[b];
+			buckets[b] = ds;
+		}
 	}
-	dstat->total.sectors_read = f3;
-	dstat->total.sectors_written = f7;
+	free(st->buckets);
+	st->buckets = buckets;
+	st->nbuckets = nb;
 	return 0;
 }
 
-int read_diskstats(const char *path, diskstats **stats) {
-	diskstats *tmpstats;
-	size_t buflen;
-	char *buf;
+devstats *statstable_alloc(statstable *st, dev_t devno) {
+	devstats *ds;
+	unsigned id, b;
+
+	if(st->count >= st->nbuckets && statstable_grow_index(st)){
+		return NULL;
+	}
+	if(st->nfree){
+		id = st->freeids[--st->nfree];
+	}else{
+		if(st->used == st->npages * STATSTABLE_PAGE){
+			unsigned slots = (st->npages + 1) * STATSTABLE_PAGE;
+			devstats **pages;
+			unsigned *freeids;
+
+			if((pages = realloc(st->pages, sizeof(*pages) * (st->npages + 1))) == NULL){
+				return NULL;
+			}
+			st->pages = pages;
+			if((freeids = realloc(st->freeids, sizeof(*freeids) * slots)) == NULL){
+				return NULL;
+			}
+			st->freeids = freeids;
+			if((pages[st->npages] = malloc(sizeof(**pages) * STATSTABLE_PAGE)) == NULL){
+				return NULL;
+			}
+			++st->npages;
+		}
+		id = st->used++;
+	}
+	ds = &st->pages[id / STATSTABLE_PAGE][id % STATSTABLE_PAGE];
+	memset(ds, 0, sizeof(*ds));
+	ds->id = id;
+	ds->devno = devno;
+	b = hash_devno(devno) & (st->nbuckets - 1);
+	ds->hnext = st->buckets[b];
+	st->buckets[b] = ds;
+	++st->count;
+	devstats_restart(ds);
+	return ds;
+}
+
+devstats *statstable_devno(const statstable *st, dev_t devno) {
+	devstats *ds;
+
+	if(st->nbuckets == 0){
+		return NULL;
+	}
+	for(ds = st->buckets[hash_devno(devno) & (st->nbuckets - 1)] ; ds ; ds = ds->hnext){
+		if(ds->devno == devno){
+			break;
+		}
+	}
+	return ds;
+}
+
+void statstable_release(statstable *st, devstats *ds) {
+	devstats **pp;
 
-	if((buf = read_procfs_file(path, &buflen)) == NULL){
+	if(ds){
+		pp = &st->buckets[hash_devno(ds->devno) & (st->nbuckets - 1)];
+		while(*pp != ds){
+			pp = &(*pp)->hnext;
+		}
+		*pp = ds->hnext;
+		--st->count;
+		stathist_free(ds->hist);
+		ds->hist = NULL;
+		ds->devno = 0;
+		st->freeids[st->nfree++] = ds->id;
+	}
+}
+
+unsigned statstable_sweep(statstable *st, unsigned gen) {
+	unsigned z, n = 0;
+
+	for(z = 0 ; z < st->nbuckets ; ++z){
+		devstats **pp = &st->buckets[z], *ds;
+
+		while( (ds = *pp) ){
+			if(ds->gen != gen){
+				*pp = ds->hnext;
+				--st->count;
+				stathist_free(ds->hist);
+				ds->hist = NULL;
+				ds->devno = 0;
+				st->freeids[st->nfree++] = ds->id;
+				++n;
+			}else{
+				pp = &ds->hnext;
+			}
+		}
+	}
+	return n;
+}
+
+void statstable_free(statstable *st) {
+	unsigned id;
+
+	for(id = 0 ; id < st->used ; ++id){
+		stathist_free(st->pages[id / STATSTABLE_PAGE][id % STATSTABLE_PAGE].hist);
+	}
+	for(id = 0 ; id < st->npages ; ++id){
+		free(st->pages[id]);
+	}
+	free(st->pages);
+	free(st->freeids);
+	free(st->buckets);
+	memset(st, 0, sizeof(*st));
+}
+
+stathist *stathist_create(void) {
+	return calloc(1, sizeof(stathist));
+}
+
+void stathist_free(stathist *sh) {
+	free(sh);
+}
+
+static void
+sample_rates(statsample *s, const statrates *rates) {
+	double completed = rates->reads + rates->writes;
+
+	s->iops = rates->reads + rates->writes + rates->discards;
+	// weight each direction's latency by its share of completions
+	s->latency = completed > 0 ? (rates->rlatency * rates->reads +
+			rates->wlatency * rates->writes) / completed : 0;
+	s->util = rates->util;
+}
+
+// Running mean; n is the count including the new sample.
+static inline void
+merge_avg(statsample *avg, const statsample *s, uint32_t n) {
+	avg->iops += (s->iops - avg->iops) / n;
+	avg->latency += (s->latency - avg->latency) / n;
+	avg->util += (s->util - avg->util) / n;
+}
+
+static inline void
+merge_minmax(statrollup *r, const statsample *s) {
+	if(s->iops < r->min.iops) r->min.iops = s->iops;
+	if(s->latency < r->min.latency) r->min.latency = s->latency;
+	if(s->util < r->min.util) r->min.util = s->util;
+	if(s->iops > r->max.iops) r->max.iops = s->iops;
+	if(s->latency > r->max.latency) r->max.latency = s->latency;
+	if(s->util > r->max.util) r->max.util = s->util;
+}
+
+void stathist_add(stathist *sh, uint32_t now, const statrates *rates) {
+	statbucket *b = &sh->secs[now % STATHIST_SECONDS];
+	uint32_t minute = now / 60;
+	statrollup *r = &sh->mins[minute % STATHIST_MINUTES];
+	statsample s;
+
+	sample_rates(&s, rates);
+	if(b->n == 0 || b->when != now){
+		b->when = now;
+		b->n = 0;
+	}
+	merge_avg(&b->avg, &s, ++b->n);
+	if(r->n == 0 || r->when != minute){
+		r->when = minute;
+		r->n = 0;
+		r->min = r->max = s;
+	}
+	merge_minmax(r, &s);
+	merge_avg(&r->avg, &s, ++r->n);
+}
+
+void stathist_seconds(const stathist *sh, uint32_t now, unsigned n, statbucket *out) {
+	unsigned z;
+
+	for(z = 0 ; z < n ; ++z){
+		uint32_t when = now - (n - 1 - z);
+		const statbucket *b = &sh->secs[when % STATHIST_SECONDS];
+
+		if(b->n && b->when == when){
+			out[z] = *b;
+		}else{
+			memset(&out[z], 0, sizeof(*out));
+			out[z].when = when;
+		}
+	}
+}
+
+void stathist_minutes(const stathist *sh, uint32_t now, unsigned n, statrollup *out) {
+	uint32_t minute = now / 60;
+	unsigned z;
+
+	for(z = 0 ; z < n ; ++z){
+		uint32_t when = minute - (n - 1 - z);
+		const statrollup *r = &sh->mins[when % STATHIST_MINUTES];
+
+		if(r->n && r->when == when){
+			out[z] = *r;
+		}else{
+			memset(&out[z], 0, sizeof(*out));
+			out[z].when = when;
+		}
+	}
+}
+
+void stathist_rollup(const stathist *sh, uint32_t now, unsigned n, statrollup *out) {
+	uint32_t minute = now / 60;
+	unsigned z;
+
+	memset(out, 0, sizeof(*out));
+	for(z = 0 ; z < n ; ++z){
+		uint32_t when = minute - z;
+		const statrollup *r = &sh->mins[when % STATHIST_MINUTES];
+
+		if(r->n && r->when == when){
+			statrollup_merge(out, r);
+		}
+	}
+	out->when = minute;
+}
+
+void statrollup_merge(statrollup *into, const statrollup *r) {
+	uint32_t n;
+
+	if(r->n == 0){
+		return;
+	}
+	if(into->n == 0){
+		*into = *r;
+		return;
+	}
+	n = into->n + r->n;
+	merge_minmax(into, &r->min);
+	merge_minmax(into, &r->max);
+	into->avg.iops += (r->avg.iops - into->avg.iops) * r->n / n;
+	into->avg.latency += (r->avg.latency - into->avg.latency) * r->n / n;
+	into->avg.util += (r->avg.util - into->avg.util) * r->n / n;
+	into->n = n;
+}
+
+void stathist_summarize(const stathist *sh, uint32_t now, unsigned n, statrollup *out) {
+	unsigned z;
+
+	memset(out, 0, sizeof(*out));
+	out->when = now;
+	for(z = 0 ; z < n ; ++z){
+		uint32_t when = now - z;
+		const statbucket *b = &sh->secs[when % STATHIST_SECONDS];
+
+		if(b->n == 0 || b->when != when){
+			continue;
+		}
+		if(out->n == 0){
+			out->min = out->max = b->avg;
+		}
+		merge_minmax(out, &b->avg);
+		merge_avg(&out->avg, &b->avg, ++out->n);
+	}
+}
+
+int read_diskstats(diskstats_reader *dr, const char *path, const diskstats **stats) {
+	ssize_t buflen;
+	unsigned devices;
+	char *sol, *end;
+
+	if((buflen = read_procfs_file(dr, path)) < 0){
 		return -1;
 	}
-	size_t offset = 0; // where our line starts in the file
-	size_t eol; // points one past last byte of line after find_line_end()
-	int devices = 0;
-	*stats = NULL;
-	tmpstats = NULL;
-	while((eol = find_line_end(buf, offset, buflen)) > offset){
-		diskstats dstat;
-		memset(&dstat, 0, sizeof(dstat));
-		if(lex_diskstats(buf + offset, buf + eol, &dstat)){
-			free(tmpstats);
-			free(buf);
-			return -1;
+	devices = 0;
+	sol = dr->buf;
+	end = dr->buf + buflen;
+	while(sol < end){
+		char *eol = memchr(sol, '\n', end - sol);
+		if(eol == NULL){
+			eol = end;
 		}
-		if(add_diskstat(&tmpstats, devices, &dstat)){
-			free(tmpstats);
-			free(buf);
-			return -1;
+		if(eol > sol){
+			if(devices == dr->statsize){
+				unsigned nsize = dr->statsize ? dr->statsize * 2 : 64;
+				diskstats *tmp = realloc(dr->stats, sizeof(*tmp) * nsize);
+				if(tmp == NULL){
+					return -1;
+				}
+				++dr->allocs;
+				dr->stats = tmp;
+				dr->statsize = nsize;
+			}
+			if(lex_diskstats(sol, eol, &dr->stats[devices])){
+				diag("Couldn't lex %s line %u\n", path, devices + 1);
+				return -1;
+			}
+			++devices;
 		}
-		++devices;
-		offset = eol + 1;
+		sol = eol + 1;
 	}
-	free(buf);
-	*stats = tmpstats;
+	*stats = dr->stats;
 	return devices;
 }
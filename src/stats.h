@@ -7,6 +7,9 @@ extern "C" {
 
 #include <limits.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include <sys/types.h>
 
 // See Linux's documentation/iostats.txt for description of the procfs disk
 // statistics. On Linux 4.18+, we have 17 fields:
@@ -17,26 +20,212 @@ extern "C" {
 // iosInProgress msIOs weightedmsIOs
 // discardsComp discardsMerged sectorsDiscarded msDiscarded
 //
-// Prior to 4.18, the last four fields were not present.
+// Prior to 4.18, the last four fields were not present (and are left 0). 5.5
+// added two more (flushesComp msFlushing), which we ignore. Sectors are always
+// 512 bytes here, regardless of the device's logical sector size.
 typedef struct statpack {
+	uint64_t reads_completed;
+	uint64_t reads_merged;
 	uint64_t sectors_read;
+	uint64_t ms_reading;
+	uint64_t writes_completed;
+	uint64_t writes_merged;
 	uint64_t sectors_written;
+	uint64_t ms_writing;
+	uint64_t ios_in_progress;	// a gauge, not a counter
+	uint64_t ms_ios;		// time with at least one I/O in flight
+	uint64_t weighted_ms_ios;	// time spent, times I/Os in flight
+	uint64_t discards_completed;
+	uint64_t discards_merged;
+	uint64_t sectors_discarded;
+	uint64_t ms_discarding;
 } statpack;
 
+#define DISKSTATS_SECTOR 512
+
+// Figures derived from the delta between two samples and the time between
+// them. Latencies are the mean time spent per completed request over the
+// interval (0 if none completed).
+typedef struct statrates {
+	double reads;		// reads completed per second
+	double writes;		// writes completed per second
+	double discards;	// discards completed per second
+	double rbytes;		// bytes read per second
+	double wbytes;		// bytes written per second
+	double rlatency;	// mean milliseconds per completed read
+	double wlatency;	// mean milliseconds per completed write
+	double qdepth;		// mean I/Os in flight (from weighted ms)
+	double util;		// percent of the interval with I/O in flight
+} statrates;
+
+// Counters are differenced (unsigned, so wrapping is handled); the
+// ios_in_progress gauge is copied from cur.
+void statpack_delta(statpack *delta, const statpack *cur, const statpack *prev);
+
+// Derive rates from a delta taken over the span q. A zero span yields all 0s.
+void statpack_rates(statrates *rates, const statpack *delta, const struct timeval *q);
+
+// One point of per-device history. Single precision is plenty for display,
+// and keeps the rings small on hosts with thousands of devices.
+typedef struct statsample {
+	float iops;		// reads + writes + discards completed per second
+	float latency;		// mean ms per completed read or write
+	float util;		// percent busy
+} statsample;
+
+// A second of fine-grained history. Samples landing in the same second are
+// averaged. n == 0 means we have no data for that second.
+typedef struct statbucket {
+	uint32_t when;		// monotonic second
+	uint32_t n;		// samples merged into this bucket
+	statsample avg;
+} statbucket;
+
+// A minute of coarse history, rolled up from every sample in that minute.
+typedef struct statrollup {
+	uint32_t when;		// monotonic minute
+	uint32_t n;
+	statsample min, max, avg;
+} statrollup;
+
+// Two fixed-size rings: 1s resolution for ten minutes, and 1m resolution for
+// a day. Each slot is keyed by its own timestamp, so a slot left over from a
+// previous lap of the ring (i.e. a gap in sampling) is recognized as stale
+// on read, and no fill is needed when time jumps forward. This comes to
+// roughly 70KB per device, so it's kept only for whole disks (see
+// devstats.keephist), and allocated on the first delta.
+#define STATHIST_SECONDS 600
+#define STATHIST_MINUTES 1440
+
+typedef struct stathist {
+	statbucket secs[STATHIST_SECONDS];
+	statrollup mins[STATHIST_MINUTES];
+} stathist;
+
+stathist *stathist_create(void);
+void stathist_free(stathist *sh);
+
+// Fold a set of derived rates, sampled at monotonic second now, into both
+// tiers.
+void stathist_add(stathist *sh, uint32_t now, const statrates *rates);
+
+// Copy the n seconds ending at now (inclusive) into out, oldest first.
+// Seconds for which we have no data come back with n == 0. n must not
+// exceed STATHIST_SECONDS.
+void stathist_seconds(const stathist *sh, uint32_t now, unsigned n, statbucket *out);
+
+// As stathist_seconds(), but for the n minutes ending at the minute
+// containing now. n must not exceed STATHIST_MINUTES.
+void stathist_minutes(const stathist *sh, uint32_t now, unsigned n, statrollup *out);
+
+// Merge the n minutes ending at the minute containing now into a single
+// rollup, without copying them out.
+void stathist_rollup(const stathist *sh, uint32_t now, unsigned n, statrollup *out);
+
+// Summarize the n seconds ending at now into a single rollup (n == 0 in the
+// result if there was no data over the span).
+void stathist_summarize(const stathist *sh, uint32_t now, unsigned n, statrollup *out);
+
+// Fold the rollup r into into, weighting averages by sample count. Empty
+// rollups (n == 0) are ignored.
+void statrollup_merge(statrollup *into, const statrollup *r);
+
+// The per-device state touched on every sampling interval. These live apart
+// from the (largely cold) device structures, in the pages of a statstable, so
+// that the stats pass walks dense memory.
+typedef struct devstats {
+	statpack stats;		// Stats since device came online, as returned
+				//  in most recent call to read_diskstats()
+	statpack statdelta;	// Delta between the current value of stats and
+				//  its previous value (after two samples)
+	struct timeval statq;	// Timespan of statdelta. statdelta is
+				//  defined iff statq is not all 0s.
+	statrates rates;	// IOPS, latency, etc. derived from statdelta
+				//  over statq
+	stathist *hist;		// recent history of rates, NULL until the
+				//  first delta is taken, or if !keephist
+	int keephist;		// maintain hist (set by the owner)
+	unsigned id;		// slot within the owning statstable
+	dev_t devno;		// key within the owning statstable, 0 once
+				//  released (so cached pointers can tell)
+	unsigned gen;		// sample last seen in (see statstable_sweep())
+	struct devstats *hnext;	// devno hash chain
+} devstats;
+
+// Fold a new sample of total counters, taken q after the previous one, into
+// ds (at monotonic second now). The first sample following
+// devstats_restart() only establishes a baseline.
+void devstats_update(devstats *ds, const statpack *total,
+			const struct timeval *q, uint32_t now);
+
+// Forget the baseline, i.e. after the device was rediscovered.
+void devstats_restart(devstats *ds);
+
+// Slots are handed out from fixed pages, so a devstats never moves once
+// allocated (pointers to it remain valid as the table grows), while slots are
+// packed densely by id. Released slots are reused most recent first. Slots
+// are keyed by devno, so that a sample can be applied without reference to
+// the device tree. Zero-initialize before first use. Not threadsafe.
+#define STATSTABLE_PAGE 64
+
+typedef struct statstable {
+	devstats **pages;
+	unsigned npages;
+	unsigned used;		// slots ever handed out
+	unsigned *freeids;	// released slots, reused LIFO
+	unsigned nfree;
+	devstats **buckets;	// devno index, chained through hnext
+	unsigned nbuckets;	// a power of 2, or 0 before the first slot
+	unsigned count;		// slots in use
+} statstable;
+
+// Returns a zeroed slot (restarted) for devno, which mustn't already have
+// one, or NULL on allocation failure.
+devstats *statstable_alloc(statstable *st, dev_t devno);
+
+// NULL if devno has no slot.
+devstats *statstable_devno(const statstable *st, dev_t devno);
+void statstable_release(statstable *st, devstats *ds);
+
+// Release every slot whose gen differs from gen, i.e. those of devices which
+// didn't appear in the latest sample. Returns the number released.
+unsigned statstable_sweep(statstable *st, unsigned gen);
+void statstable_free(statstable *st);
+
 typedef struct diskstats {
-	char name[NAME_MAX + 1];
+	const char *name;	// points into the owning reader's buffer
+	dev_t devno;
 	statpack total;
 } diskstats;
 
-// Reads the entirety of /proc/diskstats, and copies the results we care about
-// into a heap-allocated array of stats objects. We use /proc/diskstats because
-// we'd otherwise need open a sysfs file per partition/block device. The return
-// value is the number of entries in *stats. *stats is NULL iff the return
-// value is less than or equal to 0. An error results in a negative return.
-int read_proc_diskstats(diskstats **stats);
+// Persistent state for read_diskstats(). The file descriptor, the raw file
+// image and the parsed rows are all retained across calls, so steady-state
+// sampling performs neither open(2) nor any allocation. Zero-initialize
+// before first use (but set fd to -1, or use DISKSTATS_READER_INITIALIZER).
+typedef struct diskstats_reader {
+	int fd;			// held open across reads, -1 until first use
+	char *buf;		// image of the file from the most recent read
+	size_t bufsize;		// bytes allocated at buf
+	diskstats *stats;	// rows parsed from buf
+	unsigned statsize;	// rows allocated at stats
+	unsigned allocs;	// (re)allocations performed over our lifetime
+} diskstats_reader;
+
+#define DISKSTATS_READER_INITIALIZER { .fd = -1, }
+
+// Reads the entirety of /proc/diskstats, and lexes the results we care about
+// into the reader's row array. We use /proc/diskstats because we'd otherwise
+// need open a sysfs file per partition/block device. The return value is the
+// number of entries in *stats, which remain valid until the next call using
+// this reader. An error results in a negative return.
+int read_proc_diskstats(diskstats_reader *dr, const diskstats **stats);
+
+// Allows the path to be specified. The path is only opened on the first call
+// (or the first following an error); later calls reread the held descriptor.
+int read_diskstats(diskstats_reader *dr, const char *path, const diskstats **stats);
 
-// Allows the path to be specified.
-int read_diskstats(const char *path, diskstats **stats);
+// Release all resources held by the reader, leaving it ready for reuse.
+void free_diskstats_reader(diskstats_reader *dr);
 
 #ifdef __cplusplus
 }
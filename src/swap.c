@@ -11,6 +11,8 @@
 #include "growlight.h"
 
 int mkswap(device *d){
+	char dev[PATH_MAX];
+
 	if(d->mnttype && strcmp(d->mnttype,"swap")){
 		diag("Won't create swap on %s filesystem at %s\n",
 				d->mnttype,d->name);
@@ -20,7 +22,10 @@ int mkswap(device *d){
 		diag("Already swapping on %s\n",d->name);
 		return -1;
 	}
-	if(vspopen_drain("mkswap -L SprezzaSwap /dev/%s",d->name)){
+	if(devnode_path(dev,sizeof(dev),d->name)){
+		return -1;
+	}
+	if(spawn_drain("mkswap","-L","SprezzaSwap",dev,NULL)){
 		return -1;
 	}
 	return 0;
@@ -29,16 +34,22 @@ int mkswap(device *d){
 // Create swap on the device, and use it
 int swapondev(device *d){
 	char fn[PATH_MAX],*mt;
+	int r;
 
-	if(mkswap(d)){
+	hold_device(d);
+	r = mkswap(d);
+	release_device(d);
+	if(r){
+		return -1;
+	}
+	if(devnode_path(fn,sizeof(fn),d->name)){
 		return -1;
 	}
-	snprintf(fn,sizeof(fn),"/dev/%s",d->name);
 	if((mt = strdup("swap")) == NULL){
 		return -1;
 	}
 	if(swapon(fn,0)){
-		diag("Couldn't swap on %s (%s?)\n",fn,strerror(errno));
+		glog(LOGLEVEL_ERROR,"Couldn't swap on %s (%s?)\n",fn,strerror(errno));
 		free(mt);
 		return -1;
 	}
@@ -52,9 +63,11 @@ int swapondev(device *d){
 int swapoffdev(device *d){
 	char fn[PATH_MAX];
 
-	snprintf(fn,sizeof(fn),"/dev/%s",d->name);
+	if(devnode_path(fn,sizeof(fn),d->name)){
+		return -1;
+	}
 	if(swapoff(fn)){
-		diag("Couldn't stop swapping on %s (%s?)\n",fn,strerror(errno));
+		glog(LOGLEVEL_ERROR,"Couldn't stop swapping on %s (%s?)\n",fn,strerror(errno));
 		return -1;
 	}
 	d->swapprio = SWAP_INACTIVE;
@@ -3,171 +3,246 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <linux/kdev_t.h>
+#include <pthread.h>
+#include <sys/sysmacros.h>
 
 #include "sysfs.h"
 #include "growlight.h"
 
+static pthread_mutex_t statlock = PTHREAD_MUTEX_INITIALIZER;
+static sysfs_stats stats;
+
+static void
+add_stats(const sysfs_stats *ss){
+	pthread_mutex_lock(&statlock);
+	stats.opens += ss->opens;
+	stats.reads += ss->reads;
+	stats.closes += ss->closes;
+	stats.attrs += ss->attrs;
+	pthread_mutex_unlock(&statlock);
+}
+
+void get_sysfs_stats(sysfs_stats *ss){
+	pthread_mutex_lock(&statlock);
+	*ss = stats;
+	pthread_mutex_unlock(&statlock);
+}
+
+// Read the attribute node relative to dirfd into buf, replacing its trailing
+// newline with a NUL. Returns the length of the value, or -1 with errno set.
 // FIXME use libudev or at least mmap.c for this crap
-// FIXME sysfs is UTF-8 not ASCII!
-char *get_sysfs_string(int dirfd,const char *node){
-	char buf[512]; // FIXME
+static ssize_t
+read_attr(int dirfd,const char *node,char *buf,size_t len,sysfs_stats *ss){
 	ssize_t r;
-	int fd;
+	int fd,e;
 
+	++ss->attrs;
 	if((fd = openat(dirfd,node,O_RDONLY|O_NONBLOCK|O_CLOEXEC)) < 0){
-		return NULL;
+		return -1;
 	}
-	if((r = read(fd,buf,sizeof(buf))) <= 0){
-		int e = errno;
-		close(fd);
+	++ss->opens;
+	++ss->reads;
+	r = read(fd,buf,len);
+	e = r < 0 ? errno : r == 0 ? ENODATA : ENAMETOOLONG;
+	++ss->closes;
+	close(fd);
+	if(r <= 0 || (size_t)r >= len || buf[r - 1] != '\n'){
 		errno = e;
-		return NULL;
+		return -1;
 	}
-	if((size_t)r >= sizeof(buf) || buf[r - 1] != '\n'){
-		close(fd);
-		errno = ENAMETOOLONG;
+	buf[--r] = '\0';
+	return r;
+}
+
+// FIXME sysfs is UTF-8 not ASCII!
+static char *
+parse_string(char *buf,ssize_t r,strarena *arena){
+	// Sometimes the sysfs entry has a bunch of spaces at the end, ugh
+	while(r && isspace(buf[r - 1])){
+		buf[--r] = '\0';
+	}
+	if(r == 0){ // huh
+		errno = ENODATA;
 		return NULL;
 	}
-	close(fd);
-	// Sometimes the sysfs entry has a bunch of spaces at the end, ugh
-	while(isspace(buf[r - 1])){
-		buf[r - 1] = '\0';
-		if(--r == 0){ // huh
-			return NULL;
-		}
+	if(arena){
+		return arena_strndup(arena,buf,r);
 	}
 	return strdup(buf);
 }
 
-int sysfs_devno(int dirfd,dev_t *devno){
-	int fd = openat(dirfd,"dev",O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+static int
+parse_devno(const char *buf,dev_t *devno){
 	const char *colon;
-	char buf[512]; // FIXME
-	ssize_t r;
 
-	if(fd < 0){
+	if((colon = strchr(buf,':')) == NULL){
+		errno = EINVAL;
 		return -1;
 	}
-	if((r = read(fd,buf,sizeof(buf))) <= 0){
-		int e = errno;
-		close(fd);
-		errno = e;
+	*devno = makedev(atoi(buf),atoi(colon + 1));
+	return 0;
+}
+
+static int
+parse_uint(const char *buf,unsigned long *b){
+	char *end;
+
+	*b = strtoul(buf,&end,0);
+	if(*end){
+		diag("Malformed sysfs uint: %s\n",buf);
+		errno = EINVAL;
 		return -1;
 	}
-	if((size_t)r >= sizeof(buf) || buf[r - 1] != '\n'){
-		close(fd);
-		errno = ENAMETOOLONG;
+	return 0;
+}
+
+static int
+parse_int(const char *buf,int *b){
+	char *end;
+	long ll;
+
+	ll = strtol(buf,&end,0);
+	if(ll > INT_MAX){
+		diag("Invalid sysfs int: %s\n",buf);
+		errno = ERANGE;
 		return -1;
 	}
-	close(fd);
-	if((colon = strchr(buf,':')) == NULL){
+	*b = ll;
+	if(*end){
+		diag("Malformed sysfs uint: %s\n",buf);
+		errno = EINVAL;
 		return -1;
 	}
-	*devno = MKDEV(atoi(buf),atoi(colon + 1));
 	return 0;
 }
 
-unsigned sysfs_exist_p(int dirfd,const char *node){
-	int fd;
+char *get_sysfs_string_arena(int dirfd,const char *node,strarena *arena){
+	sysfs_stats ss = { .attrs = 0, };
+	char buf[512]; // FIXME
+	ssize_t r;
 
-	if((fd = openat(dirfd,node,O_RDONLY|O_NONBLOCK|O_CLOEXEC)) < 0){
-		return 0;
+	r = read_attr(dirfd,node,buf,sizeof(buf),&ss);
+	add_stats(&ss);
+	if(r < 0){
+		return NULL;
 	}
-	close(fd);
-	return 1;
+	return parse_string(buf,r,arena);
 }
 
-int get_sysfs_bool(int dirfd,const char *node,unsigned *b){
+char *get_sysfs_string(int dirfd,const char *node){
+	return get_sysfs_string_arena(dirfd,node,NULL);
+}
+
+int sysfs_devno(int dirfd,dev_t *devno){
+	sysfs_stats ss = { .attrs = 0, };
 	char buf[512]; // FIXME
 	ssize_t r;
-	int fd;
 
-	if((fd = openat(dirfd,node,O_RDONLY|O_NONBLOCK|O_CLOEXEC)) < 0){
+	r = read_attr(dirfd,"dev",buf,sizeof(buf),&ss);
+	add_stats(&ss);
+	if(r < 0){
 		return -1;
 	}
-	if((r = read(fd,buf,sizeof(buf))) <= 0){
-		int e = errno;
+	return parse_devno(buf,devno);
+}
+
+unsigned sysfs_exist_p(int dirfd,const char *node){
+	sysfs_stats ss = { .attrs = 1, };
+	int fd;
+
+	fd = openat(dirfd,node,O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+	if(fd >= 0){
+		++ss.opens;
+		++ss.closes;
 		close(fd);
-		errno = e;
-		return -1;
 	}
-	if((size_t)r >= sizeof(buf) || buf[r - 1] != '\n'){
-		close(fd);
-		errno = ENAMETOOLONG;
+	add_stats(&ss);
+	return fd >= 0;
+}
+
+int get_sysfs_bool(int dirfd,const char *node,unsigned *b){
+	sysfs_stats ss = { .attrs = 0, };
+	char buf[512]; // FIXME
+	ssize_t r;
+
+	r = read_attr(dirfd,node,buf,sizeof(buf),&ss);
+	add_stats(&ss);
+	if(r < 0){
 		return -1;
 	}
-	close(fd);
-	buf[r - 1] = '\0';
 	*b = strcmp(buf,"0") ? 1 : 0;
 	return 0;
 }
 
 int get_sysfs_uint(int dirfd,const char *node,unsigned long *b){
-	char *end,buf[512]; // FIXME
+	sysfs_stats ss = { .attrs = 0, };
+	char buf[512]; // FIXME
 	ssize_t r;
-	int fd;
 
-	if((fd = openat(dirfd,node,O_RDONLY|O_NONBLOCK|O_CLOEXEC)) < 0){
-		return -1;
-	}
-	if((r = read(fd,buf,sizeof(buf))) <= 0){
-		int e = errno;
-		close(fd);
-		errno = e;
-		return -1;
-	}
-	if((size_t)r >= sizeof(buf) || buf[r - 1] != '\n'){
-		close(fd);
-		errno = ENAMETOOLONG;
+	r = read_attr(dirfd,node,buf,sizeof(buf),&ss);
+	add_stats(&ss);
+	if(r < 0){
 		return -1;
 	}
-	close(fd);
-	buf[r - 1] = '\0';
-	*b = strtoul(buf,&end,0);
-	if(*end){
-		diag("Malformed sysfs uint: %s\n",buf);
-		return -1;
-	}
-	return 0;
+	return parse_uint(buf,b);
 }
 
 int get_sysfs_int(int dirfd,const char *node,int *b){
-	char *end,buf[512]; // FIXME
+	sysfs_stats ss = { .attrs = 0, };
+	char buf[512]; // FIXME
 	ssize_t r;
-	long ll;
-	int fd;
 
-	if((fd = openat(dirfd,node,O_RDONLY|O_NONBLOCK|O_CLOEXEC)) < 0){
-		return -1;
-	}
-	if((r = read(fd,buf,sizeof(buf))) <= 0){
-		int e = errno;
-		close(fd);
-		errno = e;
-		return -1;
-	}
-	if((size_t)r >= sizeof(buf) || buf[r - 1] != '\n'){
-		close(fd);
-		errno = ENAMETOOLONG;
-		return -1;
-	}
-	close(fd);
-	buf[r - 1] = '\0';
-	ll = strtol(buf,&end,0);
-	if(ll > INT_MAX){
-		diag("Invalid sysfs int: %s\n",buf);
+	r = read_attr(dirfd,node,buf,sizeof(buf),&ss);
+	add_stats(&ss);
+	if(r < 0){
 		return -1;
 	}
-	*b = ll;
-	if(*end){
-		diag("Malformed sysfs uint: %s\n",buf);
-		return -1;
+	return parse_int(buf,b);
+}
+
+int get_sysfs_attrs(int dirfd,sysfs_attr *attrs,unsigned n){
+	sysfs_stats ss = { .attrs = 0, };
+	char buf[512];
+	int failed = 0;
+	unsigned z;
+
+	for(z = 0 ; z < n ; ++z){
+		sysfs_attr *a = &attrs[z];
+		ssize_t r;
+
+		if((r = read_attr(dirfd,a->node,buf,sizeof(buf),&ss)) >= 0){
+			switch(a->type){
+				case SYSFS_STRING:
+					r = (*(char **)a->val = parse_string(buf,r,a->arena)) ? 0 : -1;
+					break;
+				case SYSFS_UINT:
+					r = parse_uint(buf,a->val);
+					break;
+				case SYSFS_INT:
+					r = parse_int(buf,a->val);
+					break;
+				case SYSFS_BOOL:
+					*(unsigned *)a->val = strcmp(buf,"0") ? 1 : 0;
+					r = 0;
+					break;
+				case SYSFS_DEVNO:
+					r = parse_devno(buf,a->val);
+					break;
+			}
+		}
+		if(r < 0){
+			a->err = errno;
+			++failed;
+		}else{
+			a->err = 0;
+		}
 	}
-	return 0;
+	add_stats(&ss);
+	return failed;
 }
 
 int write_sysfs(const char *name,const char *str){
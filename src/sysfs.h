@@ -5,16 +5,52 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
 #include <sys/types.h>
+#include "arena.h"
 
 int sysfs_devno(int,dev_t *);
 unsigned sysfs_exist_p(int,const char *);
 char *get_sysfs_string(int,const char *);
+// As get_sysfs_string(), but allocated from the arena.
+char *get_sysfs_string_arena(int,const char *,strarena *);
 int get_sysfs_bool(int,const char *,unsigned *);
 int get_sysfs_int(int,const char *,int *);
 int get_sysfs_uint(int,const char *,unsigned long *);
 int write_sysfs(const char *,const char *);
 
+// A declared set of attributes can be read relative to a held directory fd
+// with a single call to get_sysfs_attrs(). Each value is parsed into *val
+// according to its type; only SYSFS_STRING values are allocated (from arena,
+// if it's set, and otherwise by malloc()). Nodes in subdirectories
+// ("queue/...") are opened directly, relative to the directory fd.
+typedef enum {
+	SYSFS_STRING,	// char **
+	SYSFS_UINT,	// unsigned long *
+	SYSFS_INT,	// int *
+	SYSFS_BOOL,	// unsigned *
+	SYSFS_DEVNO,	// dev_t * (from "major:minor")
+} sysfs_type;
+
+typedef struct sysfs_attr {
+	const char *node;	// relative to the directory fd
+	sysfs_type type;
+	void *val;
+	int err;		// 0 if read, otherwise the errno
+	strarena *arena;	// SYSFS_STRING only, may be NULL
+} sysfs_attr;
+
+// Returns the number of attributes which couldn't be read (their err is set).
+int get_sysfs_attrs(int dirfd,sysfs_attr *attrs,unsigned n);
+
+// Syscalls issued against sysfs attributes by all of the above, process-wide.
+typedef struct sysfs_stats {
+	uint64_t attrs;		// attributes requested
+	uint64_t opens,reads,closes;	// opens counts only successes
+} sysfs_stats;
+
+void get_sysfs_stats(sysfs_stats *);
+
 #ifdef __cplusplus
 }
 #endif
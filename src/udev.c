@@ -1,9 +1,14 @@
+#include <time.h>
+#include <poll.h>
 #include <assert.h>
 #include <errno.h>
 #include <stdio.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <libudev.h>
+#include <sys/inotify.h>
 
 #include "zfs.h"
 #include "udev.h"
@@ -13,7 +18,7 @@
 static struct udev *udev;
 struct udev_monitor *udmon;
 
-int udev_event(const glightui *gui){
+int udev_event(void){
 	struct udev_device *dev;
 
 	while( (dev = udev_monitor_receive_device(udmon)) ){
@@ -23,10 +28,11 @@ int udev_event(const glightui *gui){
 			udev_device_get_devtype(dev),udev_device_get_syspath(dev),
 			udev_device_get_sysname(dev),udev_device_get_sysnum(dev),
 			udev_device_get_devnode(dev));
+		// coalesced, so that a burst of events means one rescan apiece
 		if(strcmp(subsys,"bdi") == 0){
-			scan_zpools(gui);
+			defer_zpool_scan();
 		}else{
-			rescan_device(udev_device_get_sysname(dev));
+			defer_rescan(udev_device_get_sysname(dev));
 		}
 	}
 	return 0;
@@ -75,3 +81,59 @@ int shutdown_udev(void){
 	udev = NULL;
 	return 0;
 }
+
+int wait_devnode(const char *path,unsigned ms){
+	char dir[PATH_MAX],buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct timespec deadline,now;
+	const char *base;
+	int ifd,r = -1,e;
+
+	if(access(path,F_OK) == 0){
+		return 0;
+	}
+	if((base = strrchr(path,'/')) == NULL || (size_t)(base - path) >= sizeof(dir)){
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(dir,path,base - path);
+	dir[base - path] = '\0';
+	if((ifd = inotify_init1(IN_CLOEXEC|IN_NONBLOCK)) < 0){
+		return -1;
+	}
+	if(inotify_add_watch(ifd,dir[0] ? dir : "/",IN_CREATE|IN_MOVED_TO) < 0){
+		goto done;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&deadline);
+	deadline.tv_sec += ms / 1000;
+	if((deadline.tv_nsec += (ms % 1000) * 1000000l) >= 1000000000l){
+		deadline.tv_nsec -= 1000000000l;
+		++deadline.tv_sec;
+	}
+	// checked after establishing the watch, lest we miss its creation
+	while(access(path,F_OK)){
+		struct pollfd pfd = { .fd = ifd, .events = POLLIN, };
+		long left;
+
+		clock_gettime(CLOCK_MONOTONIC,&now);
+		left = (deadline.tv_sec - now.tv_sec) * 1000 +
+			(deadline.tv_nsec - now.tv_nsec) / 1000000;
+		if(left <= 0){
+			errno = ETIMEDOUT;
+			goto done;
+		}
+		if(poll(&pfd,1,left) < 0 && errno != EINTR){
+			goto done;
+		}
+		// we needn't parse the events; path is simply checked anew
+		while(read(ifd,buf,sizeof(buf)) > 0){
+			;
+		}
+	}
+	r = 0;
+
+done:
+	e = errno;
+	close(ifd);
+	errno = e;
+	return r;
+}
@@ -8,9 +8,17 @@ extern "C" {
 #include "growlight.h"
 
 int monitor_udev(void);
-int udev_event(const glightui *);
+int udev_event(void);
 int shutdown_udev(void);
 
+// We often learn of a device (from sysfs, or a udev event) before udev has
+// created its node. wait_devnode() blocks until path exists, watching its
+// directory with inotify rather than polling, for at most ms milliseconds.
+// Returns 0 once it exists, and -1 otherwise (with errno set to ETIMEDOUT on
+// timeout).
+#define DEVNODE_WAIT_MS 3000
+int wait_devnode(const char *path,unsigned ms);
+
 #ifdef __cplusplus
 }
 #endif
@@ -273,7 +273,7 @@ do_agg(const aggregate_type *at,char * const *selarray,int selections){
 		kill_splash(ps);
 	}
 	if(r == 0){
-		locked_diag("Successfully created %s",pending_aggtype);
+		locked_diag("Creating %s",pending_aggtype);
 	}
 }
 
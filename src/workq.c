@@ -0,0 +1,267 @@
+#include <time.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "workq.h"
+#include "growlight.h"
+
+struct workjob {
+	workfxn fxn;
+	void *arg;
+	uint64_t queued;	// monotonic ns at submission
+	struct workjob *next;
+};
+
+struct workq {
+	pthread_mutex_t lock;
+	pthread_cond_t jobcond;		// signaled on submission and shutdown
+	pthread_cond_t donecond;	// broadcast on each completion
+	struct workjob *head, **tail;
+	struct workjob *freejobs;	// retired jobs, reused by submission
+	unsigned threadcount;
+	unsigned exited;		// workers which have left workq_thread()
+	pthread_t *threads;
+	int shutdown;
+	int abandoned;			// last worker out frees the pool
+	workq_stats stats;
+};
+
+static inline uint64_t
+monotonic_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+free_joblist(struct workjob *job){
+	while(job){
+		struct workjob *tmp = job->next;
+		free(job);
+		job = tmp;
+	}
+}
+
+static void
+free_workq(struct workq *wq){
+	free_joblist(wq->head);
+	free_joblist(wq->freejobs);
+	pthread_cond_destroy(&wq->donecond);
+	pthread_cond_destroy(&wq->jobcond);
+	pthread_mutex_destroy(&wq->lock);
+	free(wq->threads);
+	free(wq);
+}
+
+static void *
+workq_thread(void *vwq){
+	struct workq *wq = vwq;
+	struct workjob *job;
+	uint64_t start, ns;
+
+	pthread_mutex_lock(&wq->lock);
+	for(;;){
+		while((job = wq->head) == NULL && !wq->shutdown){
+			pthread_cond_wait(&wq->jobcond, &wq->lock);
+		}
+		if(job == NULL){
+			break;
+		}
+		if((wq->head = job->next) == NULL){
+			wq->tail = &wq->head;
+		}
+		--wq->stats.queued;
+		++wq->stats.running;
+		start = monotonic_ns();
+		ns = start - job->queued;
+		wq->stats.waitns += ns;
+		if(ns > wq->stats.maxwaitns){
+			wq->stats.maxwaitns = ns;
+		}
+		pthread_mutex_unlock(&wq->lock);
+		job->fxn(job->arg);
+		ns = monotonic_ns() - start;
+		pthread_mutex_lock(&wq->lock);
+		wq->stats.runns += ns;
+		if(ns > wq->stats.maxrunns){
+			wq->stats.maxrunns = ns;
+		}
+		--wq->stats.running;
+		++wq->stats.completed;
+		job->next = wq->freejobs;
+		wq->freejobs = job;
+		pthread_cond_broadcast(&wq->donecond);
+	}
+	++wq->exited;
+	pthread_cond_broadcast(&wq->donecond);
+	if(wq->abandoned && wq->exited == wq->threadcount){
+		pthread_mutex_unlock(&wq->lock);
+		free_workq(wq);
+		return NULL;
+	}
+	pthread_mutex_unlock(&wq->lock);
+	return NULL;
+}
+
+struct workq *workq_create(unsigned threads){
+	pthread_condattr_t cattr;
+	struct workq *wq;
+	unsigned z;
+	int r;
+
+	if(threads == 0){
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		threads = cpus > 0 ? cpus : 1;
+	}
+	if((wq = malloc(sizeof(*wq))) == NULL){
+		return NULL;
+	}
+	memset(wq, 0, sizeof(*wq));
+	if((wq->threads = malloc(sizeof(*wq->threads) * threads)) == NULL){
+		free(wq);
+		return NULL;
+	}
+	pthread_mutex_init(&wq->lock, NULL);
+	pthread_cond_init(&wq->jobcond, NULL);
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&wq->donecond, &cattr);
+	pthread_condattr_destroy(&cattr);
+	wq->tail = &wq->head;
+	for(z = 0 ; z < threads ; ++z){
+		if( (r = pthread_create(&wq->threads[z], NULL, workq_thread, wq)) ){
+			diag("Couldn't launch worker %u (%s)\n", z, strerror(r));
+			break;
+		}
+		++wq->threadcount;
+	}
+	if(wq->threadcount == 0){
+		workq_destroy(wq);
+		return NULL;
+	}
+	return wq;
+}
+
+int workq_submit(struct workq *wq, workfxn fxn, void *arg){
+	struct workjob *job;
+
+	pthread_mutex_lock(&wq->lock);
+	if( (job = wq->freejobs) ){
+		wq->freejobs = job->next;
+	}else if((job = malloc(sizeof(*job))) == NULL){
+		pthread_mutex_unlock(&wq->lock);
+		return -1;
+	}
+	job->fxn = fxn;
+	job->arg = arg;
+	job->queued = monotonic_ns();
+	job->next = NULL;
+	*wq->tail = job;
+	wq->tail = &job->next;
+	++wq->stats.submitted;
+	if(++wq->stats.queued > wq->stats.maxqueued){
+		wq->stats.maxqueued = wq->stats.queued;
+	}
+	pthread_cond_signal(&wq->jobcond);
+	pthread_mutex_unlock(&wq->lock);
+	return 0;
+}
+
+int workq_wait(struct workq *wq, unsigned stallms){
+	int r = 0;
+
+	pthread_mutex_lock(&wq->lock);
+	while(wq->stats.completed != wq->stats.submitted){
+		uint64_t completed = wq->stats.completed;
+		struct timespec ts;
+
+		if(stallms == 0){
+			pthread_cond_wait(&wq->donecond, &wq->lock);
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_sec += stallms / 1000;
+		ts.tv_nsec += stallms % 1000 * 1000000ll;
+		if(ts.tv_nsec >= 1000000000){
+			ts.tv_nsec -= 1000000000;
+			++ts.tv_sec;
+		}
+		while(completed == wq->stats.completed){
+			if(pthread_cond_timedwait(&wq->donecond, &wq->lock, &ts) == ETIMEDOUT){
+				break;
+			}
+		}
+		if(completed == wq->stats.completed){
+			r = -1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&wq->lock);
+	return r;
+}
+
+unsigned workq_destroy_deadline(struct workq *wq, unsigned deadlinems){
+	struct timespec ts;
+	unsigned z, stuck;
+
+	if(wq == NULL){
+		return 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += deadlinems / 1000;
+	ts.tv_nsec += deadlinems % 1000 * 1000000ll;
+	if(ts.tv_nsec >= 1000000000){
+		ts.tv_nsec -= 1000000000;
+		++ts.tv_sec;
+	}
+	pthread_mutex_lock(&wq->lock);
+	wq->shutdown = 1;
+	pthread_cond_broadcast(&wq->jobcond);
+	// workers drain the queue before exiting
+	while(wq->exited < wq->threadcount){
+		if(deadlinems == 0){
+			pthread_cond_wait(&wq->donecond, &wq->lock);
+		}else if(pthread_cond_timedwait(&wq->donecond, &wq->lock, &ts) == ETIMEDOUT){
+			break;
+		}
+	}
+	if( (stuck = wq->threadcount - wq->exited) ){
+		// those not yet started are never run, and their workers
+		// exit as soon as their current jobs return
+		free_joblist(wq->head);
+		wq->head = NULL;
+		wq->tail = &wq->head;
+		wq->stats.queued = 0;
+		for(z = 0 ; z < wq->threadcount ; ++z){
+			pthread_detach(wq->threads[z]);
+		}
+		wq->abandoned = 1;
+		pthread_mutex_unlock(&wq->lock);
+		return stuck;
+	}
+	pthread_mutex_unlock(&wq->lock);
+	for(z = 0 ; z < wq->threadcount ; ++z){
+		pthread_join(wq->threads[z], NULL);
+	}
+	free_workq(wq);
+	return 0;
+}
+
+void workq_destroy(struct workq *wq){
+	workq_destroy_deadline(wq, 0);
+}
+
+unsigned workq_threads(const struct workq *wq){
+	return wq->threadcount;
+}
+
+void workq_get_stats(struct workq *wq, workq_stats *stats){
+	pthread_mutex_lock(&wq->lock);
+	*stats = wq->stats;
+	pthread_mutex_unlock(&wq->lock);
+}
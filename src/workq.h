@@ -0,0 +1,62 @@
+#ifndef GROWLIGHT_WORKQ
+#define GROWLIGHT_WORKQ
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// A fixed-size pool of worker threads servicing a FIFO of jobs. Used in place
+// of a detached thread per job, so that discovering thousands of devices
+// doesn't mean thousands of threads contending for the growlight lock (and
+// issuing SG_IO/libblkid probes) all at once.
+typedef void (*workfxn)(void *);
+
+struct workq;
+
+// Launch a pool of the specified size. 0 means one thread per online CPU.
+// Returns NULL on failure.
+struct workq *workq_create(unsigned threads);
+
+// Queue fxn(arg) to be run on some worker. Returns -1 if the job couldn't be
+// queued, in which case it will not be run.
+int workq_submit(struct workq *wq, workfxn fxn, void *arg);
+
+// Block until every job submitted thus far has completed. If stallms is
+// non-zero, give up (returning -1) should stallms milliseconds pass without
+// any job completing; the outstanding jobs continue to run. This keeps one
+// wedged device from hanging everything else, without bounding how long a
+// large (but progressing) workload may take.
+int workq_wait(struct workq *wq, unsigned stallms);
+
+// Wait for all work to complete, then join and free the workers.
+void workq_destroy(struct workq *wq);
+
+// As workq_destroy(), but give up once deadlinems have passed (0 waits
+// forever). Jobs yet to start are then dropped, and workers still running a
+// job are abandoned (a hung probe can't be cancelled); the last of them to
+// return frees the pool. Returns the number of workers abandoned.
+unsigned workq_destroy_deadline(struct workq *wq, unsigned deadlinems);
+
+unsigned workq_threads(const struct workq *wq);
+
+typedef struct workq_stats {
+	uint64_t submitted;
+	uint64_t completed;
+	unsigned queued;	// submitted, but not yet picked up
+	unsigned running;	// currently executing on a worker
+	unsigned maxqueued;	// high-water mark of queued
+	uint64_t waitns;	// total time jobs spent queued before starting
+	uint64_t maxwaitns;	// longest any job spent queued
+	uint64_t runns;		// total time spent running completed jobs
+	uint64_t maxrunns;	// longest any job ran
+} workq_stats;
+
+void workq_get_stats(struct workq *wq, workq_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
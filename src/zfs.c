@@ -153,7 +153,7 @@ zpoolcb(zpool_handle_t *zhp,void *arg){
 	}
 	memset(d,0,sizeof(*d));
 	strcpy(d->name,name);
-	d->model = strdup("LLNL ZoL");
+	d->model = arena_strdup(&d->strings,"LLNL ZoL");
 	d->uuid = strdup(guid);
 	d->layout = LAYOUT_ZPOOL;
 	d->swapprio = SWAP_INVALID;
@@ -344,24 +344,27 @@ int destroy_zpool(device *d __attribute__ ((unused))){
 #endif
 static int
 generic_make_zpool(const char *type,const char *name,char * const *vdevs,int num){
-	char buf[BUFSIZ];
-	size_t pos;
-	int z;
+	const char *argv[num + 7];
+	char devs[num][PATH_MAX];
+	int z,argc = 0;
 
-	pos = 0;
-#define PREFIX "/dev/"
+	argv[argc++] = "zpool";
+	argv[argc++] = "create";
+	argv[argc++] = "-f";
+	argv[argc++] = "-oashift=12";
+	argv[argc++] = name;
+	argv[argc++] = type;
 	for(z = 0 ; z < num ; ++z){
-		if((unsigned)snprintf(buf + pos,sizeof(buf) - pos," %s%s",PREFIX,*vdevs) >= sizeof(buf) - pos){
-			diag("Too many arguments for zpool creation\n");
+		if(devnode_path(devs[z],sizeof(devs[z]),vdevs[z])){
 			return -1;
 		}
-		++vdevs;
-		pos += strlen(buf + pos);
+		argv[argc++] = devs[z];
 	}
-#undef PREFIX
+	argv[argc] = NULL;
 	// FIXME also, ashift with 512-byte sectors wastes space
 	// FIXME see notes below (make_zfs()) regarding unsafe use of -f
-	return vspopen_drain("zpool create -f -oashift=12 %s %s %s",name,type,buf);
+	// the new pool is picked up by the zpool scan its udev events prompt
+	return spawn_bgv(argv) ? 0 : -1;
 }
 
 int make_zmirror(const char *name,char * const *vdevs,int num){
@@ -388,19 +391,34 @@ int make_raidz3(const char *name,char * const *vdevs,int num){
 //  - no partition table
 //  - no filesystem signature
 int make_zfs(const char *dev,const struct mkfsmarshal *mkm){
-	return vspopen_drain("zpool create -f %s %s",mkm->name,dev);
+	if(mkm->name == NULL){
+		diag("A zpool needs a name\n");
+		return -1;
+	}
+	return spawn_rescan(dev,"zpool","create","-f",mkm->name,dev,NULL) ? 0 : -1;
 }
 
 // Remount a zfs
 int mount_zfs(device *d,const char *targ,unsigned mntops,const void *data){
+	char prop[PATH_MAX + 12];
+	int r;
+
 	if(mntops || data){
 		diag("Invalid arguments to zfs mount: %u %p\n",mntops,data);
 		return -1;
 	}
-	vspopen_drain("zfs unmount %s",d->name); // FIXME
-	if(vspopen_drain("zfs set mountpoint=%s %s",targ,d->name)){
-		vspopen_drain("zfs mount %s",d->name);
+	if(snprintf(prop,sizeof(prop),"mountpoint=%s",targ) >= (int)sizeof(prop)){
+		diag("Bad mountpoint: %s\n",targ);
+		return -1;
+	}
+	hold_device(d);
+	spawn_drain("zfs","unmount",d->name,NULL); // FIXME
+	if(spawn_drain("zfs","set",prop,d->name,NULL)){
+		spawn_drain("zfs","mount",d->name,NULL);
+		release_device(d);
 		return -1;
 	}
-	return vspopen_drain("zfs mount %s",d->name);
+	r = spawn_drain("zfs","mount",d->name,NULL);
+	release_device(d);
+	return r;
 }
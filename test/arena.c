@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/Basic.h>
+#include "../src/arena.h"
+#include "tests.h"
+
+void testARENA(void){
+	char big[ARENA_CHUNK * 2],*s,*t,*u;
+	arena_stats as0,as1;
+	strarena a;
+
+	memset(&a,0,sizeof(a));
+	get_arena_stats(&as0);
+	CU_ASSERT(arena_strdup(&a,NULL) == NULL);
+	CU_ASSERT(a.chunks == NULL);
+	CU_ASSERT_FATAL((s = arena_strdup(&a,"ST4000DM004")) != NULL);
+	CU_ASSERT_FATAL((t = arena_strndup(&a,"0001XYZ",4)) != NULL);
+	CU_ASSERT_STRING_EQUAL(s,"ST4000DM004");
+	CU_ASSERT_STRING_EQUAL(t,"0001");
+	CU_ASSERT(t == s + strlen(s) + 1);
+	// a string larger than a chunk gets its own, without wasting the head
+	memset(big,'x',sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+	CU_ASSERT_FATAL((u = arena_strdup(&a,big)) != NULL);
+	CU_ASSERT_STRING_EQUAL(u,big);
+	CU_ASSERT_FATAL((u = arena_strdup(&a,"gpt")) != NULL);
+	CU_ASSERT(u == t + strlen(t) + 1);
+	CU_ASSERT_STRING_EQUAL(s,"ST4000DM004");
+	get_arena_stats(&as1);
+	CU_ASSERT_EQUAL(as1.chunks - as0.chunks,2);
+	// a reset arena reuses its head chunk
+	arena_reset(&a);
+	CU_ASSERT_FATAL((t = arena_strdup(&a,"mq-deadline")) != NULL);
+	CU_ASSERT(t == s);
+	get_arena_stats(&as0);
+	CU_ASSERT_EQUAL(as0.chunks,as1.chunks);
+	arena_free(&a);
+	CU_ASSERT(a.chunks == NULL);
+	arena_reset(&a);
+	arena_free(&a);
+}
+
+// What discovery stores in a typical disk's arena: model, revision,
+// scheduler, serial, WWN and partition table type
+static const char * const diskstrings[] = {
+	"Samsung SSD 870 EVO 1TB", "SVT01B6Q", "mq-deadline",
+	"S6PTNZ0R123456X", "0x5002538f4212c3d4", "gpt",
+};
+#define DISKSTRINGS (sizeof(diskstrings) / sizeof(*diskstrings))
+
+// A rescan storm over 1000 devices: each rescan drops and relearns every
+// arena-held string, either individually through malloc() or from the device's arena.
+void benchARENA(void){
+	const unsigned devs = 1000,rescans = 100;
+	char *(*strs)[DISKSTRINGS];
+	arena_stats as0,as1;
+	uint64_t t0,t1,t2;
+	unsigned r,d,z;
+	strarena *a;
+
+	CU_ASSERT_FATAL((strs = calloc(devs,sizeof(*strs))) != NULL);
+	CU_ASSERT_FATAL((a = calloc(devs,sizeof(*a))) != NULL);
+	t0 = test_nanos();
+	for(r = 0 ; r < rescans ; ++r){
+		for(d = 0 ; d < devs ; ++d){
+			for(z = 0 ; z < DISKSTRINGS ; ++z){
+				free(strs[d][z]);
+				strs[d][z] = strdup(diskstrings[z]);
+			}
+		}
+	}
+	t1 = test_nanos() - t0;
+	for(d = 0 ; d < devs ; ++d){
+		for(z = 0 ; z < DISKSTRINGS ; ++z){
+			free(strs[d][z]);
+		}
+	}
+	get_arena_stats(&as0);
+	t0 = test_nanos();
+	for(r = 0 ; r < rescans ; ++r){
+		for(d = 0 ; d < devs ; ++d){
+			arena_reset(&a[d]);
+			for(z = 0 ; z < DISKSTRINGS ; ++z){
+				strs[d][z] = arena_strdup(&a[d],diskstrings[z]);
+			}
+		}
+	}
+	t2 = test_nanos();
+	get_arena_stats(&as1);
+	for(d = 0 ; d < devs ; ++d){
+		CU_ASSERT_STRING_EQUAL(strs[d][DISKSTRINGS - 1],diskstrings[DISKSTRINGS - 1]);
+		arena_free(&a[d]);
+	}
+	// every device fits in one chunk, allocated on its first scan
+	CU_ASSERT_EQUAL(as1.chunks - as0.chunks,devs);
+	printf("\n\tarena: %u devices x %u rescans, %u strings each\n",
+			devs,rescans,(unsigned)DISKSTRINGS);
+	printf("\t malloc: %9u allocations, %.1fns/device rescan\n",
+			devs * rescans * (unsigned)DISKSTRINGS,
+			(double)t1 / (devs * rescans));
+	printf("\t  arena: %9ju allocations, %.1fns/device rescan\n",
+			(uintmax_t)(as1.chunks - as0.chunks),
+			(double)(t2 - t0) / (devs * rescans));
+	free(strs);
+	free(a);
+}
@@ -0,0 +1,100 @@
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <CUnit/Basic.h>
+#include "../src/coalesce.h"
+#include "tests.h"
+
+struct flushed {
+	char name[32];
+	unsigned kinds;
+};
+
+static struct flushed seen[16];
+static unsigned seencount;
+
+static void
+record(const char *name, unsigned kinds, void *arg){
+	(void)arg;
+	if(seencount < sizeof(seen) / sizeof(*seen)){
+		snprintf(seen[seencount].name, sizeof(seen[seencount].name), "%s", name);
+		seen[seencount].kinds = kinds;
+	}
+	++seencount;
+}
+
+void testCOALESCE(void){
+	struct pollfd pfd;
+	struct coalescer *c;
+	coalesce_stats cs;
+	unsigned z;
+
+	CU_ASSERT_FATAL((c = coalescer_create(20)) != NULL);
+	pfd.fd = coalescer_fd(c);
+	pfd.events = POLLIN;
+	// nothing pending, nothing armed
+	CU_ASSERT_EQUAL(poll(&pfd, 1, 40), 0);
+	// a burst: 100 events on sda, one on sdb, sdb again of another kind
+	for(z = 0 ; z < 100 ; ++z){
+		CU_ASSERT_EQUAL(coalescer_add(c, "sda", 0x1), 0);
+	}
+	CU_ASSERT_EQUAL(coalescer_add(c, "sdb", 0x1), 0);
+	CU_ASSERT_EQUAL(coalescer_add(c, "sdb", 0x4), 0);
+	coalescer_get_stats(c, &cs);
+	CU_ASSERT_EQUAL(cs.received, 102);
+	CU_ASSERT_EQUAL(cs.collapsed, 100);
+	CU_ASSERT_EQUAL(cs.pending, 2);
+	// the window closes 20ms after the first event
+	CU_ASSERT_EQUAL(poll(&pfd, 1, 1000), 1);
+	seencount = 0;
+	CU_ASSERT_EQUAL(coalescer_flush(c, record, NULL), 2);
+	CU_ASSERT_EQUAL_FATAL(seencount, 2);
+	// dispatched in arrival order
+	CU_ASSERT_STRING_EQUAL(seen[0].name, "sda");
+	CU_ASSERT_EQUAL(seen[0].kinds, 0x1);
+	CU_ASSERT_STRING_EQUAL(seen[1].name, "sdb");
+	CU_ASSERT_EQUAL(seen[1].kinds, 0x5);
+	coalescer_get_stats(c, &cs);
+	CU_ASSERT_EQUAL(cs.dispatched, 2);
+	CU_ASSERT_EQUAL(cs.windows, 1);
+	CU_ASSERT_EQUAL(cs.pending, 0);
+	CU_ASSERT_EQUAL(cs.maxpending, 2);
+	// flushed, and not readable until the next event
+	CU_ASSERT_EQUAL(poll(&pfd, 1, 40), 0);
+	CU_ASSERT_EQUAL(coalescer_add(c, "sda", 0x2), 0);
+	CU_ASSERT_EQUAL(poll(&pfd, 1, 1000), 1);
+	seencount = 0;
+	CU_ASSERT_EQUAL(coalescer_flush(c, record, NULL), 1);
+	CU_ASSERT_EQUAL(seen[0].kinds, 0x2);
+	// sda's 0x1 and 0x2 work and sdb's are held until released, so while
+	// they're queued, repeats are dropped at flush
+	coalescer_get_stats(c, &cs);
+	CU_ASSERT_EQUAL(cs.held, 2);
+	CU_ASSERT_EQUAL(coalescer_add(c, "sda", 0x1), 0);
+	CU_ASSERT_EQUAL(coalescer_add(c, "sdb", 0x2), 0);
+	CU_ASSERT_EQUAL(poll(&pfd, 1, 1000), 1);
+	seencount = 0;
+	CU_ASSERT_EQUAL(coalescer_flush(c, record, NULL), 1);
+	CU_ASSERT_STRING_EQUAL(seen[0].name, "sdb");
+	CU_ASSERT_EQUAL(seen[0].kinds, 0x2);
+	coalescer_get_stats(c, &cs);
+	CU_ASSERT_EQUAL(cs.suppressed, 1);
+	// once its work has started, sda is dispatched anew
+	coalescer_release(c, "sda", 0x3);
+	coalescer_release(c, "sda", 0x3);
+	CU_ASSERT_EQUAL(coalescer_add(c, "sda", 0x1), 0);
+	CU_ASSERT_EQUAL(poll(&pfd, 1, 1000), 1);
+	seencount = 0;
+	CU_ASSERT_EQUAL(coalescer_flush(c, record, NULL), 1);
+	CU_ASSERT_STRING_EQUAL(seen[0].name, "sda");
+	coalescer_release(c, "sda", 0x1);
+	coalescer_release(c, "sdb", 0x7);
+	coalescer_get_stats(c, &cs);
+	CU_ASSERT_EQUAL(cs.held, 0);
+	// pending events and holds are simply dropped on destruction
+	CU_ASSERT_EQUAL(coalescer_add(c, "sdb", 0x1), 0);
+	CU_ASSERT_EQUAL(poll(&pfd, 1, 1000), 1);
+	CU_ASSERT_EQUAL(coalescer_flush(c, record, NULL), 1);
+	CU_ASSERT_EQUAL(coalescer_add(c, "sdc", 0x1), 0);
+	coalescer_destroy(c);
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <CUnit/Basic.h>
+#include <sys/sysmacros.h>
+#include "../src/devindex.h"
+#include "../src/growlight.h"
+#include "tests.h"
+
+static device *
+make_devices(unsigned n){
+	device *devs;
+	unsigned z;
+
+	if((devs = calloc(n,sizeof(*devs))) == NULL){
+		return NULL;
+	}
+	for(z = 0 ; z < n ; ++z){
+		// sdaa, sdab, ... with a partition-ish suffix, to get the long
+		// shared prefixes we see in the wild
+		snprintf(devs[z].name,sizeof(devs[z].name),"sd%c%c%c%u",
+				'a' + z / 676 % 26,'a' + z / 26 % 26,'a' + z % 26,z % 16);
+		devs[z].devno = makedev(8 + z / 4096,z % 4096);
+	}
+	return devs;
+}
+
+void testDEVINDEX(void){
+	const unsigned n = 4096;
+	devindex di;
+	device *devs;
+	unsigned z;
+
+	CU_ASSERT_FATAL((devs = make_devices(n)) != NULL);
+	CU_ASSERT_EQUAL(devindex_init(&di,0),0);
+	CU_ASSERT_PTR_NULL(devindex_name(&di,devs[0].name));
+	for(z = 0 ; z < n ; ++z){
+		CU_ASSERT_EQUAL(devindex_add(&di,&devs[z]),0);
+	}
+	CU_ASSERT_EQUAL(di.count,n);
+	CU_ASSERT(di.count <= di.buckets); // we grew along the way
+	for(z = 0 ; z < n ; ++z){
+		CU_ASSERT_PTR_EQUAL(devindex_name(&di,devs[z].name),&devs[z]);
+		CU_ASSERT_PTR_EQUAL(devindex_devno(&di,devs[z].devno),&devs[z]);
+	}
+	// readding must not duplicate
+	CU_ASSERT_EQUAL(devindex_add(&di,&devs[7]),0);
+	CU_ASSERT_EQUAL(di.count,n);
+	// removal of every other device
+	for(z = 0 ; z < n ; z += 2){
+		devindex_del(&di,&devs[z]);
+	}
+	devindex_del(&di,&devs[0]); // not indexed; must be a no-op
+	CU_ASSERT_EQUAL(di.count,n / 2);
+	for(z = 0 ; z < n ; ++z){
+		if(z % 2){
+			CU_ASSERT_PTR_EQUAL(devindex_name(&di,devs[z].name),&devs[z]);
+		}else{
+			CU_ASSERT_PTR_NULL(devindex_name(&di,devs[z].name));
+			CU_ASSERT_PTR_NULL(devindex_devno(&di,devs[z].devno));
+		}
+	}
+	CU_ASSERT_PTR_NULL(devindex_devno(&di,0));
+	devindex_free(&di);
+	free(devs);
+}
+
+// Lookup cost ought be flat as the device count grows. The linear walk
+// this replaced was O(n) per lookup, and thus O(n^2) per stats tick.
+void benchDEVINDEX(void){
+	const unsigned sizes[] = { 100, 1000, 10000, };
+	unsigned s;
+
+	for(s = 0 ; s < sizeof(sizes) / sizeof(*sizes) ; ++s){
+		const unsigned n = sizes[s];
+		const unsigned lookups = 1000000;
+		uint64_t t0,t1;
+		unsigned z,hits;
+		devindex di;
+		device *devs;
+
+		CU_ASSERT_FATAL((devs = make_devices(n)) != NULL);
+		CU_ASSERT_EQUAL(devindex_init(&di,0),0);
+		for(z = 0 ; z < n ; ++z){
+			devindex_add(&di,&devs[z]);
+		}
+		hits = 0;
+		t0 = test_nanos();
+		for(z = 0 ; z < lookups ; ++z){
+			hits += !!devindex_name(&di,devs[(z * 7919u) % n].name);
+		}
+		t1 = test_nanos();
+		CU_ASSERT_EQUAL(hits,lookups);
+		printf("\n\tdevindex: %5u devices, %.1fns/lookup by name",
+				n,(double)(t1 - t0) / lookups);
+		hits = 0;
+		t0 = test_nanos();
+		for(z = 0 ; z < lookups ; ++z){
+			hits += !!devindex_devno(&di,devs[(z * 7919u) % n].devno);
+		}
+		t1 = test_nanos();
+		CU_ASSERT_EQUAL(hits,lookups);
+		printf(", %.1fns/lookup by devno",(double)(t1 - t0) / lookups);
+		devindex_free(&di);
+		free(devs);
+	}
+	printf("\n");
+}
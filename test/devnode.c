@@ -0,0 +1,64 @@
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <CUnit/Basic.h>
+#include "../src/udev.h"
+#include "tests.h"
+
+static char node[PATH_MAX];
+
+// Play udev, creating the node some time after the prober began waiting.
+static void *
+create_node(void *unused){
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = 100000000, };
+	int fd;
+
+	(void)unused;
+	nanosleep(&ts, NULL);
+	if((fd = open(node, O_CREAT|O_WRONLY|O_CLOEXEC, 0600)) >= 0){
+		close(fd);
+	}
+	return NULL;
+}
+
+static uint64_t
+elapsed_ms(const struct timespec *t0){
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1000 + (t1.tv_nsec - t0->tv_nsec) / 1000000;
+}
+
+void testDEVNODE(void){
+	char dir[] = "/tmp/growlight-devnode-XXXXXX";
+	struct timespec t0;
+	pthread_t tid;
+
+	CU_ASSERT_FATAL(mkdtemp(dir) != NULL);
+	snprintf(node, sizeof(node), "%s/sdz1", dir);
+	// a node which never shows up times out
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	CU_ASSERT_EQUAL(wait_devnode(node, 50), -1);
+	CU_ASSERT_EQUAL(errno, ETIMEDOUT);
+	CU_ASSERT(elapsed_ms(&t0) >= 50);
+	// one created while we wait is seen as soon as it's there
+	CU_ASSERT_FATAL(pthread_create(&tid, NULL, create_node, NULL) == 0);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	CU_ASSERT_EQUAL(wait_devnode(node, 5000), 0);
+	CU_ASSERT(elapsed_ms(&t0) < 1000);
+	pthread_join(tid, NULL);
+	// as is one which already exists
+	CU_ASSERT_EQUAL(wait_devnode(node, 0), 0);
+	// a missing directory is an immediate failure
+	snprintf(node, sizeof(node), "%s/missing/sdz1", dir);
+	CU_ASSERT_EQUAL(wait_devnode(node, 50), -1);
+	snprintf(node, sizeof(node), "%s/sdz1", dir);
+	unlink(node);
+	rmdir(dir);
+}
@@ -0,0 +1,464 @@
+#include <ftw.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/sysmacros.h>
+#include <CUnit/Basic.h>
+#include "../src/dmi.h"
+#include "../src/sysfs.h"
+#include "../src/growlight.h"
+#include "tests.h"
+
+// Fabricates enough of sysfs, devfs and procfs beneath a root for growlight
+// to discover (run with -r|--root). Disks hang off fake PCI controllers, but
+// lack a "device" directory, so they're treated as non-physical: no SG_IO,
+// no libblkid, and no device nodes are needed. What's exercised is the
+// discovery machinery itself: sysfs walks, locking, indexing and callbacks.
+
+static int
+vmkfile(const char *fmt,va_list va,const char *contents){
+	char path[PATH_MAX];
+	FILE *fp;
+
+	if((unsigned)vsnprintf(path,sizeof(path),fmt,va) >= sizeof(path)){
+		return -1;
+	}
+	if((fp = fopen(path,"w")) == NULL){
+		return -1;
+	}
+	if(fputs(contents,fp) == EOF){
+		fclose(fp);
+		return -1;
+	}
+	return fclose(fp) ? -1 : 0;
+}
+
+static int
+mkfile(const char *contents,const char *fmt,...){
+	va_list va;
+	int r;
+
+	va_start(va,fmt);
+	r = vmkfile(fmt,va,contents);
+	va_end(va);
+	return r;
+}
+
+static int
+mkdirf(const char *fmt,...){
+	char path[PATH_MAX];
+	va_list va;
+
+	va_start(va,fmt);
+	if((unsigned)vsnprintf(path,sizeof(path),fmt,va) >= sizeof(path)){
+		va_end(va);
+		return -1;
+	}
+	va_end(va);
+	return mkdir(path,0755) && errno != EEXIST ? -1 : 0;
+}
+
+static int
+symlinkf(const char *target,const char *fmt,...){
+	char path[PATH_MAX];
+	va_list va;
+
+	va_start(va,fmt);
+	if((unsigned)vsnprintf(path,sizeof(path),fmt,va) >= sizeof(path)){
+		va_end(va);
+		return -1;
+	}
+	va_end(va);
+	return symlink(target,path);
+}
+
+// sysfs attributes common to disks and partitions
+static int
+mkblock(const char *dir,unsigned minor,uintmax_t sectors){
+	char buf[64];
+
+	snprintf(buf,sizeof(buf),"259:%u\n",minor);
+	if(mkdirf("%s",dir) || mkfile(buf,"%s/dev",dir)){
+		return -1;
+	}
+	snprintf(buf,sizeof(buf),"%ju\n",sectors);
+	if(mkfile(buf,"%s/size",dir) || mkdirf("%s/holders",dir)){
+		return -1;
+	}
+	return 0;
+}
+
+int make_fixture(const char *root,unsigned controllers,unsigned disks,unsigned parts){
+	const uintmax_t psectors = 2048 * 1024; // 1GiB partitions
+	char pcidir[PATH_MAX],blockdir[PATH_MAX],dir[PATH_MAX],link[PATH_MAX];
+	FILE *stats,*mounts;
+	unsigned c,z,p,minor;
+
+	if(controllers == 0){
+		return -1;
+	}
+	if(mkdirf("%s",root) || mkdirf("%s/sys",root) || mkdirf("%s/sys/class",root) ||
+			mkdirf("%s/sys/class/block",root) || mkdirf("%s/sys/devices",root) ||
+			mkdirf("%s/sys/devices/pci0000:00",root) || mkdirf("%s/dev",root) ||
+			mkdirf("%s/dev/md",root) || mkdirf("%s/dev/disk",root) ||
+			mkdirf("%s/dev/disk/by-id",root) || mkdirf("%s/dev/disk/by-path",root) ||
+			mkdirf("%s/proc",root) || mkdirf("%s/proc/self",root) ||
+			mkdirf("%s/sys/devices/virtual",root) ||
+			mkdirf("%s/sys/devices/virtual/dmi",root) ||
+			mkdirf("%s/sys/devices/virtual/dmi/id",root)){
+		return -1;
+	}
+	if(mkfile("Fixture\n","%s/sys/devices/virtual/dmi/id/bios_vendor",root) ||
+			mkfile("1.0\n","%s/sys/devices/virtual/dmi/id/bios_version",root)){
+		return -1;
+	}
+	for(c = 0 ; c < controllers ; ++c){
+		snprintf(pcidir,sizeof(pcidir),"%s/sys/devices/pci0000:00/0000:%02x:%02x.0",
+				root,c / 32 + 1,c % 32);
+		if(mkdirf("%s",pcidir) || mkdirf("%s/driver",pcidir) ||
+				symlinkf("../../../../module/fixture_hba","%s/driver/module",pcidir) ||
+				mkdirf("%s/host%u",pcidir,c) || mkdirf("%s/host%u/block",pcidir,c)){
+			return -1;
+		}
+	}
+	if(mkfile("nodev\tsysfs\nnodev\tproc\n\text4\n","%s/proc/filesystems",root) ||
+			mkfile("Filename\t\t\t\tType\t\tSize\t\tUsed\t\tPriority\n","%s/proc/swaps",root)){
+		return -1;
+	}
+	snprintf(dir,sizeof(dir),"%s/proc/diskstats",root);
+	if((stats = fopen(dir,"w")) == NULL){
+		return -1;
+	}
+	snprintf(dir,sizeof(dir),"%s/proc/self/mountinfo",root);
+	if((mounts = fopen(dir,"w")) == NULL){
+		fclose(stats);
+		return -1;
+	}
+	minor = 0;
+	for(z = 0 ; z < disks ; ++z){
+		c = z % controllers;
+		snprintf(blockdir,sizeof(blockdir),"%s/sys/devices/pci0000:00/0000:%02x:%02x.0/host%u/block/fxd%u",
+				root,c / 32 + 1,c % 32,c,z);
+		if(mkblock(blockdir,minor,psectors * (parts + 1)) ||
+				mkfile("0\n","%s/removable",blockdir) || mkdirf("%s/queue",blockdir) ||
+				mkfile("[none] mq-deadline\n","%s/queue/scheduler",blockdir) ||
+				mkfile("0\n","%s/queue/rotational",blockdir) ||
+				mkfile("512\n","%s/queue/physical_block_size",blockdir) ||
+				mkfile("512\n","%s/queue/logical_block_size",blockdir)){
+			goto err;
+		}
+		snprintf(link,sizeof(link),"../../devices/pci0000:00/0000:%02x:%02x.0/host%u/block/fxd%u",
+				c / 32 + 1,c % 32,c,z);
+		if(symlinkf(link,"%s/sys/class/block/fxd%u",root,z)){
+			goto err;
+		}
+		snprintf(link,sizeof(link),"../../fxd%u",z);
+		if(symlinkf(link,"%s/dev/disk/by-id/fixture-fxd%u",root,z)){
+			goto err;
+		}
+		fprintf(stats,"259 %u fxd%u 100 0 800 10 200 0 1600 20 0 30 30 0 0 0 0\n",minor,z);
+		++minor;
+		for(p = 1 ; p <= parts ; ++p){
+			if((unsigned)snprintf(dir,sizeof(dir),"%s/fxd%up%u",blockdir,z,p) >= sizeof(dir) ||
+					mkblock(dir,minor,psectors)){
+				goto err;
+			}
+			snprintf(link,sizeof(link),"%u\n",p);
+			if(mkfile(link,"%s/partition",dir)){
+				goto err;
+			}
+			snprintf(link,sizeof(link),"%ju\n",2048 + (p - 1) * psectors);
+			if(mkfile(link,"%s/start",dir)){
+				goto err;
+			}
+			snprintf(link,sizeof(link),"../../devices/pci0000:00/0000:%02x:%02x.0/host%u/block/fxd%u/fxd%up%u",
+					c / 32 + 1,c % 32,c,z,z,p);
+			if(symlinkf(link,"%s/sys/class/block/fxd%up%u",root,z,p)){
+				goto err;
+			}
+			fprintf(stats,"259 %u fxd%up%u 50 0 400 5 100 0 800 10 0 15 15 0 0 0 0\n",minor,z,p);
+			++minor;
+		}
+		// statvfs() is run against the mountpoint, so it must exist
+		if(parts && z < 16){
+			fprintf(mounts,"%u 1 259:%u / / rw,relatime shared:1 - ext4 /dev/fxd%up1 rw\n",
+					100 + z,minor - parts,z);
+		}
+	}
+	if(fclose(mounts) | fclose(stats)){
+		return -1;
+	}
+	return 0;
+
+err:
+	fclose(mounts);
+	fclose(stats);
+	return -1;
+}
+
+static int
+remove_entry(const char *path,const struct stat *st,int flag,struct FTW *ftw){
+	(void)st; (void)flag; (void)ftw;
+	return remove(path);
+}
+
+int remove_fixture(const char *root){
+	return nftw(root,remove_entry,64,FTW_DEPTH|FTW_PHYS);
+}
+
+void testFIXTURE(void){
+	char root[] = "/tmp/growlight-fixture-XXXXXX";
+	char buf[PATH_MAX],path[PATH_MAX];
+	unsigned long ul;
+	dev_t devno;
+	ssize_t r;
+	int fd;
+
+	CU_ASSERT_FATAL(mkdtemp(root) != NULL);
+	CU_ASSERT_FATAL(make_fixture(root,3,5,2) == 0);
+	snprintf(path,sizeof(path),"%s/sys/class/block",root);
+	CU_ASSERT_FATAL((fd = open(path,O_RDONLY|O_DIRECTORY)) >= 0);
+	// fxd4 lives on the second controller
+	r = readlinkat(fd,"fxd4p2",buf,sizeof(buf) - 1);
+	CU_ASSERT(r > 0);
+	buf[r > 0 ? r : 0] = '\0';
+	CU_ASSERT_STRING_EQUAL(buf,"../../devices/pci0000:00/0000:01:01.0/host1/block/fxd4/fxd4p2");
+	CU_ASSERT_EQUAL(get_sysfs_uint(fd,"fxd4p2/partition",&ul),0);
+	CU_ASSERT_EQUAL(ul,2);
+	CU_ASSERT_EQUAL(get_sysfs_uint(fd,"fxd4/queue/logical_block_size",&ul),0);
+	CU_ASSERT_EQUAL(ul,512);
+	close(fd);
+	snprintf(path,sizeof(path),"%s/sys/class/block/fxd4",root);
+	CU_ASSERT_FATAL((fd = open(path,O_RDONLY|O_DIRECTORY)) >= 0);
+	CU_ASSERT_EQUAL(sysfs_devno(fd,&devno),0);
+	CU_ASSERT(devno == makedev(259,12)); // 3 minors per disk
+	close(fd);
+	// DMI is read from beneath the root, not the live system
+	snprintf(path,sizeof(path),"%s/sys/devices/virtual/dmi/id",root);
+	CU_ASSERT_EQUAL(dmi_init(path),0);
+	CU_ASSERT_STRING_EQUAL(get_bios_vendor(),"Fixture");
+	CU_ASSERT_EQUAL(remove_fixture(root),0);
+	CU_ASSERT(access(root,F_OK) < 0);
+}
+
+static unsigned blockevents;
+
+static void
+quiet_vdiag(const char *fmt,va_list va){
+	(void)fmt; (void)va;
+}
+
+static void
+quiet_boxinfo(const char *fmt,...){
+	(void)fmt;
+}
+
+static void *
+count_adapter_event(struct controller *c,void *state){
+	(void)c;
+	return state;
+}
+
+static void *
+count_block_event(struct device *d,void *state){
+	(void)d;
+	++blockevents;
+	return state;
+}
+
+static void
+free_adapter(void *state){
+	(void)state;
+}
+
+static void
+free_block(void *cstate,void *bstate){
+	(void)cstate; (void)bstate;
+}
+
+static const glightui fixture_ui = {
+	.vdiag = quiet_vdiag,
+	.boxinfo = quiet_boxinfo,
+	.adapter_event = count_adapter_event,
+	.block_event = count_block_event,
+	.adapter_free = free_adapter,
+	.block_free = free_block,
+};
+
+// Pull syscr and syscw out of /proc/self/io.
+static int
+read_self_io(uintmax_t *syscr,uintmax_t *syscw){
+	char line[128];
+	FILE *fp;
+	int found = 0;
+
+	if((fp = fopen("/proc/self/io","r")) == NULL){
+		return -1;
+	}
+	while(fgets(line,sizeof(line),fp)){
+		found += sscanf(line,"syscr: %ju",syscr);
+		found += sscanf(line,"syscw: %ju",syscw);
+	}
+	fclose(fp);
+	return found == 2 ? 0 : -1;
+}
+
+// Disks plus partitions in the tree.
+static unsigned
+count_devices(void){
+	const controller *c;
+	unsigned found = 0;
+
+	lock_growlight();
+	for(c = get_controllers() ; c ; c = c->next){
+		const device *d,*p;
+
+		for(d = c->blockdevs ; d ; d = d->next){
+			++found;
+			for(p = d->parts ; p ; p = p->next){
+				++found;
+			}
+		}
+	}
+	unlock_growlight();
+	return found;
+}
+
+// Run in a forked child, so each size starts from a clean process.
+static int
+discover_fixture(const char *root,unsigned expected){
+	char *argv[] = { "growlight-test", "-r", (char *)root, NULL, };
+	uintmax_t cr0 = 0,cw0 = 0,cr1 = 0,cw1 = 0;
+	struct mallinfo2 m0,m1;
+	sysfs_stats ss0,ss1;
+	const treesnap *snap;
+	uint64_t t0,t1,t2,t3;
+	unsigned found;
+
+	read_self_io(&cr0,&cw0);
+	get_sysfs_stats(&ss0);
+	m0 = mallinfo2();
+	t0 = test_nanos();
+	if(growlight_init(3,argv,&fixture_ui,NULL)){
+		return -1;
+	}
+	t1 = test_nanos();
+	m1 = mallinfo2();
+	get_sysfs_stats(&ss1);
+	read_self_io(&cr1,&cw1);
+	found = count_devices();
+	t2 = test_nanos();
+	snap = get_snapshot();
+	t3 = test_nanos();
+	printf("\n\tdiscovery: %5u devices in %8.1fms, %7ju syscr, %5ju syscw, "
+			"%7zuKB heap, %u block events",found,(t1 - t0) / 1000000.0,
+			cr1 - cr0,cw1 - cw0,(m1.uordblks - m0.uordblks) / 1024,blockevents);
+	printf(", %.1f sysfs syscalls/device",found ? (ss1.opens + ss1.reads + ss1.closes -
+			ss0.opens - ss0.reads - ss0.closes) / (double)found : 0.0);
+	fflush(stdout);
+	if(snap == NULL || snap->devices != found){
+		return -1;
+	}
+	printf(", snapshot v%ju in %.3fms",(uintmax_t)snap->version,(t3 - t2) / 1000000.0);
+	put_snapshot(snap);
+	return found == expected ? 0 : -1;
+}
+
+// Sizes are total devices (disks plus partitions), scaling to 10k with
+// GROWLIGHT_BENCH_LARGE set in the environment.
+void benchDISCOVERY(void){
+	const unsigned disks[] = { 10, 100, 333, 3333, };
+	const unsigned parts = 2;
+	unsigned s,n;
+
+	n = getenv("GROWLIGHT_BENCH_LARGE") ? sizeof(disks) / sizeof(*disks) :
+			sizeof(disks) / sizeof(*disks) - 1;
+	for(s = 0 ; s < n ; ++s){
+		char root[] = "/tmp/growlight-fixture-XXXXXX";
+		unsigned expected = disks[s] * (parts + 1);
+		int status;
+		pid_t pid;
+
+		CU_ASSERT_FATAL(mkdtemp(root) != NULL);
+		if(make_fixture(root,disks[s] / 64 + 1,disks[s],parts)){
+			CU_FAIL("couldn't build fixture");
+			remove_fixture(root);
+			continue;
+		}
+		fflush(stdout);
+		if((pid = fork()) == 0){
+			_exit(discover_fixture(root,expected) ? EXIT_FAILURE : EXIT_SUCCESS);
+		}
+		CU_ASSERT_FATAL(pid > 0);
+		CU_ASSERT_EQUAL(waitpid(pid,&status,0),pid);
+		CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+		remove_fixture(root);
+	}
+	printf("\n");
+}
+
+// Startup through growlight_init() with a discovery pool of the given size (0
+// for the default), in its own child, so that wait4() reports its peak RSS
+// alone.
+static void
+bench_pool(const char *root,unsigned expected,unsigned threads){
+	char jarg[16];
+	char *argv[] = { "growlight-test", "-r", (char *)root, "-j", jarg, NULL, };
+	struct rusage ru;
+	uint64_t t0,t1;
+	int status;
+	pid_t pid;
+
+	snprintf(jarg,sizeof(jarg),"%u",threads);
+	fflush(stdout);
+	t0 = test_nanos();
+	if((pid = fork()) == 0){
+		if(growlight_init(threads ? 5 : 3,argv,&fixture_ui,NULL)){
+			_exit(EXIT_FAILURE);
+		}
+		_exit(count_devices() == expected ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	CU_ASSERT_FATAL(pid > 0);
+	CU_ASSERT_EQUAL_FATAL(wait4(pid,&status,0,&ru),pid);
+	t1 = test_nanos();
+	CU_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	printf("\n\tdiscovery -j %-7s %5u devices in %8.1fms, %7ldKB peak RSS",
+			threads ? jarg : "default",expected,(t1 - t0) / 1000000.0,ru.ru_maxrss);
+}
+
+// The pool size's effect on startup, on ~1k devices (~4k with
+// GROWLIGHT_BENCH_LARGE set in the environment). The fixture's disks are
+// never deep-probed, so this shows the cost of the pool itself (threads,
+// contention on the growlight lock) rather than any I/O it overlaps.
+void benchDISCOVERYPOOL(void){
+	const unsigned cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	const unsigned threads[] = { 1, cpus, cpus * 4, 64, 256, 0, };
+	const unsigned disks = getenv("GROWLIGHT_BENCH_LARGE") ? 1333 : 333;
+	const unsigned parts = 2;
+	char root[] = "/tmp/growlight-fixture-XXXXXX";
+	unsigned z;
+
+	CU_ASSERT_FATAL(mkdtemp(root) != NULL);
+	if(make_fixture(root,disks / 64 + 1,disks,parts)){
+		CU_FAIL("couldn't build fixture");
+		remove_fixture(root);
+		return;
+	}
+	for(z = 0 ; z < sizeof(threads) / sizeof(*threads) ; ++z){
+		if(z && threads[z] == threads[z - 1]){
+			continue; // a single CPU
+		}
+		bench_pool(root,disks * (parts + 1),threads[z]);
+	}
+	printf("\n\t(%u online CPUs)\n",cpus);
+	remove_fixture(root);
+}
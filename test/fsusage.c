@@ -0,0 +1,260 @@
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/statvfs.h>
+#include <CUnit/Basic.h>
+#include "../src/fsusage.h"
+#include "tests.h"
+
+// Callbacks are tallied here, and waited upon with waitfor()
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static unsigned callbacks;
+static fsusage lastfu;
+static char lastmnt[64];
+
+// Calls on mounts beginning with "/hung" block until released
+static int released;
+static unsigned stuck;
+
+static void
+usage_cb(const char *mnt,const fsusage *fu,void *arg){
+	(void)arg;
+	pthread_mutex_lock(&lock);
+	++callbacks;
+	lastfu = *fu;
+	snprintf(lastmnt,sizeof(lastmnt),"%s",mnt);
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+static int
+hanging_statvfs(const char *path,struct statvfs *vfs){
+	if(strncmp(path,"/hung",5)){
+		return statvfs(path,vfs);
+	}
+	pthread_mutex_lock(&lock);
+	++stuck;
+	pthread_cond_broadcast(&cond);
+	while(!released){
+		pthread_cond_wait(&cond,&lock);
+	}
+	--stuck;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+	return statvfs("/",vfs);
+}
+
+// Wait up to a second for *count to reach n
+static int
+waitfor(unsigned *count,unsigned n){
+	struct timespec ts;
+	int r = 0;
+
+	clock_gettime(CLOCK_REALTIME,&ts);
+	++ts.tv_sec;
+	pthread_mutex_lock(&lock);
+	while(*count < n && r == 0){
+		r = pthread_cond_timedwait(&cond,&lock,&ts);
+	}
+	r = *count >= n ? 0 : -1;
+	pthread_mutex_unlock(&lock);
+	return r;
+}
+
+void testFSUSAGE(void){
+	struct fsusage_cache *c;
+	fsusage_stats st;
+	unsigned z;
+	fsusage fu;
+
+	callbacks = 0;
+	CU_ASSERT_FATAL((c = fsusage_create(2,60000,1000,usage_cb,NULL)) != NULL);
+	// the first request is answered in the background
+	CU_ASSERT_EQUAL(fsusage_get(c,"/",&fu),0);
+	CU_ASSERT_EQUAL(fu.state,FSUSAGE_PENDING);
+	CU_ASSERT_EQUAL(fu.age,0);
+	CU_ASSERT_EQUAL_FATAL(waitfor(&callbacks,1),0);
+	CU_ASSERT_STRING_EQUAL(lastmnt,"/");
+	CU_ASSERT_EQUAL(lastfu.state,FSUSAGE_OK);
+	CU_ASSERT(lastfu.size > 0);
+	CU_ASSERT(lastfu.avail <= lastfu.free && lastfu.free <= lastfu.size);
+	// and cached thereafter, without another call inside the TTL
+	CU_ASSERT_EQUAL(fsusage_get(c,"/",&fu),0);
+	CU_ASSERT_EQUAL(fu.state,FSUSAGE_OK);
+	CU_ASSERT_EQUAL(fu.size,lastfu.size);
+	fsusage_sweep(c);
+	fsusage_get_stats(c,&st);
+	CU_ASSERT_EQUAL(st.cached,1);
+	CU_ASSERT_EQUAL(st.calls,1);
+	CU_ASSERT_EQUAL(fsusage_get(c,"/nonexistent/growlight",&fu),0);
+	CU_ASSERT_EQUAL_FATAL(waitfor(&callbacks,2),0);
+	CU_ASSERT_EQUAL(lastfu.state,FSUSAGE_ERROR);
+	CU_ASSERT_EQUAL(lastfu.err,ENOENT);
+	// (the worker may yet hold it, in which case it's dropped after)
+	fsusage_forget(c,"/nonexistent/growlight");
+	fsusage_get_stats(c,&st);
+	CU_ASSERT_EQUAL(st.calls,2);
+	CU_ASSERT_EQUAL(st.errors,1);
+	fsusage_destroy(c);
+	// a zero TTL refreshes on every request
+	callbacks = 0;
+	CU_ASSERT_FATAL((c = fsusage_create(1,0,1000,usage_cb,NULL)) != NULL);
+	CU_ASSERT_EQUAL(fsusage_get(c,"/",&fu),0);
+	CU_ASSERT_EQUAL_FATAL(waitfor(&callbacks,1),0);
+	// (a request made while the worker is still calling back is dropped)
+	for(z = 0 ; z < 10 ; ++z){
+		CU_ASSERT_EQUAL(fsusage_get(c,"/",&fu),0);
+		CU_ASSERT_EQUAL(fu.state,FSUSAGE_OK);
+		if(waitfor(&callbacks,2) == 0){
+			break;
+		}
+	}
+	CU_ASSERT(z < 10);
+	fsusage_destroy(c);
+}
+
+void testFSUSAGEHUNG(void){
+	struct fsusage_cache *c;
+	uint64_t t0,worst = 0;
+	fsusage_stats st;
+	unsigned z;
+	fsusage fu;
+
+	callbacks = 0;
+	released = 0;
+	CU_ASSERT_FATAL((c = fsusage_create(1,60000,20,usage_cb,NULL)) != NULL);
+	fsusage_set_statvfs(c,hanging_statvfs);
+	CU_ASSERT_EQUAL(fsusage_get(c,"/hung",&fu),0);
+	CU_ASSERT_EQUAL_FATAL(waitfor(&stuck,1),0);
+	// our only worker is stuck, but requesters never are
+	for(z = 0 ; z < 1000 ; ++z){
+		t0 = test_nanos();
+		CU_ASSERT_EQUAL(fsusage_get(c,"/hung",&fu),0);
+		if(test_nanos() - t0 > worst){
+			worst = test_nanos() - t0;
+		}
+		CU_ASSERT_EQUAL(fu.state,FSUSAGE_PENDING);
+	}
+	usleep(40000);
+	// past the timeout, the mount is marked hung and the pool replenished
+	fsusage_sweep(c);
+	CU_ASSERT_EQUAL_FATAL(waitfor(&callbacks,1),0);
+	CU_ASSERT_STRING_EQUAL(lastmnt,"/hung");
+	CU_ASSERT_EQUAL(lastfu.state,FSUSAGE_HUNG);
+	CU_ASSERT_EQUAL(fsusage_get(c,"/",&fu),0);
+	CU_ASSERT_EQUAL_FATAL(waitfor(&callbacks,2),0);
+	CU_ASSERT_STRING_EQUAL(lastmnt,"/");
+	CU_ASSERT_EQUAL(lastfu.state,FSUSAGE_OK);
+	// still one call at most on the hung mount
+	CU_ASSERT_EQUAL(fsusage_get(c,"/hung",&fu),0);
+	CU_ASSERT_EQUAL(fu.state,FSUSAGE_HUNG);
+	fsusage_get_stats(c,&st);
+	CU_ASSERT_EQUAL(st.timeouts,1);
+	CU_ASSERT_EQUAL(st.hung,1);
+	CU_ASSERT_EQUAL(stuck,1);
+	// an answer, however late, is taken
+	pthread_mutex_lock(&lock);
+	released = 1;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+	CU_ASSERT_EQUAL_FATAL(waitfor(&callbacks,3),0);
+	CU_ASSERT_STRING_EQUAL(lastmnt,"/hung");
+	CU_ASSERT_EQUAL(lastfu.state,FSUSAGE_OK);
+	fsusage_get_stats(c,&st);
+	CU_ASSERT_EQUAL(st.hung,0);
+	// destruction doesn't wait on a hung call, nor is it called back
+	released = 0;
+	fsusage_forget(c,"/hung");
+	CU_ASSERT_EQUAL(fsusage_get(c,"/hung2",&fu),0);
+	CU_ASSERT_EQUAL_FATAL(waitfor(&stuck,1),0);
+	fsusage_destroy(c);
+	pthread_mutex_lock(&lock);
+	released = 1;
+	pthread_cond_broadcast(&cond);
+	while(stuck){
+		pthread_cond_wait(&cond,&lock);
+	}
+	pthread_mutex_unlock(&lock);
+	usleep(10000);
+	CU_ASSERT_EQUAL(callbacks,3);
+	printf("\n\tfsusage: slowest request behind a hung call %.1fus\n",
+			worst / 1000.0);
+}
+
+void testFILLHIST(void){
+	char buf[64];
+	fillhist fh;
+	fsusage fu;
+	double rate;
+	unsigned z;
+
+	memset(&fh,0,sizeof(fh));
+	CU_ASSERT_EQUAL(fillhist_rate(&fh,&rate),-1);
+	fillhist_add(&fh,5000000000ull,1000);
+	fillhist_add(&fh,10000000000ull,1000);
+	CU_ASSERT_EQUAL(fillhist_rate(&fh,&rate),-1);
+	fillhist_add(&fh,15000000000ull,1000);
+	CU_ASSERT_EQUAL(fillhist_rate(&fh,&rate),0);
+	CU_ASSERT_DOUBLE_EQUAL(rate,0,1e-9);
+	// 1MB/s through churn of +-64KB, wrapping the ring several times
+	memset(&fh,0,sizeof(fh));
+	for(z = 0 ; z < FILLHIST_SAMPLES * 3 ; ++z){
+		fillhist_add(&fh,z * 5000000000ull,(1ull << 40) + z * 5000000ull +
+				(z % 2 ? 65536 : -65536));
+	}
+	CU_ASSERT_EQUAL(fh.count,FILLHIST_SAMPLES);
+	CU_ASSERT_EQUAL(fillhist_rate(&fh,&rate),0);
+	CU_ASSERT_DOUBLE_EQUAL(rate,1000000,1000);
+	// a partly refilled history is fit over its new samples alone, whether
+	// or not the old ones were cleared
+	for(z = 0 ; z < 7 ; ++z){
+		fillhist_add(&fh,(FILLHIST_SAMPLES * 3 + z) * 5000000000ull,
+				(1ull << 40) + (FILLHIST_SAMPLES * 3 + z) * 5000000ull);
+	}
+	fh.count = 0;
+	for(z = 0 ; z < 5 ; ++z){
+		fillhist_add(&fh,(FILLHIST_SAMPLES * 4 + z) * 5000000000ull,1000000 - z * 5000);
+	}
+	CU_ASSERT_EQUAL(fillhist_rate(&fh,&rate),0);
+	CU_ASSERT_DOUBLE_EQUAL(rate,-1000,1e-6);
+	fillhist_reset(&fh);
+	CU_ASSERT_EQUAL(fillhist_rate(&fh,&rate),-1);
+	for(z = 0 ; z < 5 ; ++z){
+		fillhist_add(&fh,z * 5000000000ull,1000000 + z * 5000);
+	}
+	CU_ASSERT_EQUAL(fillhist_rate(&fh,&rate),0);
+	CU_ASSERT_DOUBLE_EQUAL(rate,1000,1e-6);
+	// and draining
+	memset(&fh,0,sizeof(fh));
+	for(z = 0 ; z < 8 ; ++z){
+		fillhist_add(&fh,z * 1000000000ull,1000000 - z * 1000);
+	}
+	CU_ASSERT_EQUAL(fillhist_rate(&fh,&rate),0);
+	CU_ASSERT_DOUBLE_EQUAL(rate,-1000,1e-6);
+	// projections are described by whichever runs out first
+	memset(&fu,0,sizeof(fu));
+	fu.state = FSUSAGE_OK;
+	fu.size = 1000;
+	fu.free = fu.avail = 380;
+	CU_ASSERT_STRING_EQUAL(fsusage_summary(&fu,buf,sizeof(buf)),"62% used");
+	fu.ttf = 3 * 3600 + 600;
+	CU_ASSERT_STRING_EQUAL(fsusage_summary(&fu,buf,sizeof(buf)),"62% used, full in 3h");
+	fu.ittf = 90;
+	CU_ASSERT_STRING_EQUAL(fsusage_eta(&fu,buf,sizeof(buf)),"inodes out in 90s");
+	fu.ttf = 0;
+	fu.ittf = 86400 * 9;
+	CU_ASSERT_STRING_EQUAL(fsusage_eta(&fu,buf,sizeof(buf)),"inodes out in 9d");
+	fu.avail = 0;
+	CU_ASSERT_STRING_EQUAL(fsusage_eta(&fu,buf,sizeof(buf)),"full");
+	fu.state = FSUSAGE_STALE;
+	CU_ASSERT_STRING_EQUAL(fsusage_summary(&fu,buf,sizeof(buf)),"62% used, full [stale]");
+	memset(&fu,0,sizeof(fu));
+	fu.state = FSUSAGE_HUNG;
+	CU_ASSERT_STRING_EQUAL(fsusage_summary(&fu,buf,sizeof(buf)),"[hung]");
+	fu.state = FSUSAGE_OK;
+	CU_ASSERT_STRING_EQUAL(fsusage_summary(&fu,buf,sizeof(buf)),"");
+}
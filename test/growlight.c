@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <CUnit/Basic.h>
 #include "../src/growlight.h"
+#include "tests.h"
 
 static int
 init_suite(void) {
@@ -50,6 +51,32 @@ int main() {
 		exit(EXIT_FAILURE);
 	}
 	CU_add_test(suite, "genprefix()", testGENPREFIX);
+	CU_add_test(suite, "devindex", testDEVINDEX);
+	CU_add_test(suite, "devindex benchmark", benchDEVINDEX);
+	CU_add_test(suite, "diskstats", testDISKSTATS);
+	CU_add_test(suite, "diskstats benchmark", benchDISKSTATS);
+	CU_add_test(suite, "statrates", testSTATRATES);
+	CU_add_test(suite, "stathist", testSTATHIST);
+	CU_add_test(suite, "statstable", testSTATSTABLE);
+	CU_add_test(suite, "devstats benchmark", benchDEVSTATS);
+	CU_add_test(suite, "workq", testWORKQ);
+	CU_add_test(suite, "coalesce", testCOALESCE);
+	CU_add_test(suite, "inventory", testINVENTORY);
+	CU_add_test(suite, "devnode", testDEVNODE);
+	CU_add_test(suite, "sysfs", testSYSFS);
+	CU_add_test(suite, "mountinfo", testMOUNTINFO);
+	CU_add_test(suite, "mountinfo benchmark", benchMOUNTINFO);
+	CU_add_test(suite, "fsusage", testFSUSAGE);
+	CU_add_test(suite, "fsusage hung", testFSUSAGEHUNG);
+	CU_add_test(suite, "fill history", testFILLHIST);
+	CU_add_test(suite, "command runner", testCMDRUNNER);
+	CU_add_test(suite, "logring", testLOGRING);
+	CU_add_test(suite, "logring benchmark", benchLOGRING);
+	CU_add_test(suite, "arena", testARENA);
+	CU_add_test(suite, "arena benchmark", benchARENA);
+	CU_add_test(suite, "fixture", testFIXTURE);
+	CU_add_test(suite, "discovery benchmark", benchDISCOVERY);
+	CU_add_test(suite, "discovery pool benchmark", benchDISCOVERYPOOL);
 	CU_basic_set_mode(CU_BRM_VERBOSE);
 	if(CU_basic_run_tests()){
 		fprintf(stderr, "Error %d running CUnit tests\n", CU_get_error());
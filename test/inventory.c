@@ -0,0 +1,189 @@
+#include <wchar.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysmacros.h>
+#include <CUnit/Basic.h>
+#include "../src/inventory.h"
+#include "../src/growlight.h"
+#include "tests.h"
+
+// A disk of 4MiB with two partitions, as sysfs would describe it prior to
+// probing (sizes and offsets in 512-byte sectors).
+static void
+sysfs_disk(device *d, device *p){
+	memset(d, 0, sizeof(*d));
+	memset(p, 0, sizeof(*p) * 2);
+	strcpy(d->name, "sdz");
+	d->devno = makedev(8, 240);
+	d->layout = LAYOUT_NONE;
+	d->swapprio = SWAP_INVALID;
+	d->size = 8192;
+	d->parts = &p[0];
+	p[0].next = &p[1];
+	strcpy(p[0].name, "sdz1");
+	strcpy(p[1].name, "sdz2");
+	p[0].devno = makedev(8, 241);
+	p[1].devno = makedev(8, 242);
+	p[0].partdev.fsector = 2048;
+	p[1].partdev.fsector = 4096;
+	p[0].size = p[1].size = 2048;
+	p[0].layout = p[1].layout = LAYOUT_PARTITION;
+	p[0].swapprio = p[1].swapprio = SWAP_INVALID;
+}
+
+static void
+free_probed(device *d){
+	device *p;
+
+	for(p = d->parts ; p ; p = p->next){
+		free(p->partdev.uuid);
+		free(p->partdev.pname);
+		free(p->mnttype);
+		free(p->uuid);
+		free(p->label);
+	}
+	free(d->blkdev.serial);
+	free(d->blkdev.wwn);
+	free(d->blkdev.pttable);
+	free(d->blkdev.biossha1);
+	free(d->mnttype);
+	free(d->uuid);
+	free(d->label);
+}
+
+static int
+write_at(int fd, off_t off, const char *s){
+	return pwrite(fd, s, strlen(s), off) == (ssize_t)strlen(s) ? 0 : -1;
+}
+
+void testINVENTORY(void){
+	char img[] = "/tmp/growlight-inventory-XXXXXX";
+	char cache[sizeof(img) + 6];
+	unsigned entries, hits, misses;
+	unsigned char sha1[20];
+	struct inventory *inv;
+	controller c;
+	device d, p[2];
+	uint64_t tok;
+	FILE *fp;
+	int fd;
+
+	setlocale(LC_ALL, "C.UTF-8");
+	CU_ASSERT_FATAL((fd = mkstemp(img)) >= 0);
+	snprintf(cache, sizeof(cache), "%s.cache", img);
+	CU_ASSERT_FATAL(ftruncate(fd, 8192 * 512) == 0);
+	CU_ASSERT(write_at(fd, 510, "\x55\xaa") == 0);
+	CU_ASSERT(write_at(fd, 2048 * 512 + 1024, "ext4sb") == 0);
+	sysfs_disk(&d, p);
+	CU_ASSERT((tok = inventory_token(fd, &d)) != 0);
+	CU_ASSERT_EQUAL(inventory_token(fd, &d), tok);
+	// a filesystem created within a partition changes the token...
+	CU_ASSERT(write_at(fd, 4096 * 512 + 4096, "SWAPSPACE2") == 0);
+	CU_ASSERT(inventory_token(fd, &d) != tok);
+	tok = inventory_token(fd, &d);
+	CU_ASSERT(write_at(fd, 4096 * 512 + 65536 + 64, "_BHRfS_M") == 0);
+	CU_ASSERT(inventory_token(fd, &d) != tok);
+	tok = inventory_token(fd, &d);
+	// data between the superblock windows isn't read
+	CU_ASSERT(write_at(fd, 4096 * 512 + 32768, "data") == 0);
+	CU_ASSERT_EQUAL(inventory_token(fd, &d), tok);
+	// ...as does a change to the partition layout
+	p[1].size = 1024;
+	CU_ASSERT(inventory_token(fd, &d) != tok);
+	p[1].size = 2048;
+	CU_ASSERT_EQUAL(inventory_token(fd, &d), tok);
+
+	// a missing cache is an empty one
+	CU_ASSERT_FATAL((inv = inventory_load(cache)) != NULL);
+	inventory_stats(inv, &entries, &hits, &misses);
+	CU_ASSERT_EQUAL(entries, 0);
+	inventory_free(inv);
+
+	// write out a probed disk
+	memset(&c, 0, sizeof(c));
+	c.blockdevs = &d;
+	d.c = &c;
+	d.blkdev.invtoken = tok;
+	d.blkdev.transport = SERIAL_ATAIII;
+	d.blkdev.rotation = 7200;
+	d.blkdev.wcache = 1;
+	d.blkdev.rwverify = RWVERIFY_SUPPORTED_OFF;
+	d.blkdev.smart = 1;
+	d.blkdev.celsius = 37;
+	d.logsec = 512;
+	d.physsec = 4096;
+	memset(sha1, 0xa5, sizeof(sha1));
+	d.blkdev.biossha1 = malloc(sizeof(sha1));
+	memcpy(d.blkdev.biossha1, sha1, sizeof(sha1));
+	d.blkdev.serial = strdup("WD-1234 5678");
+	d.blkdev.wwn = strdup("50014ee2b1a2c3d4");
+	d.blkdev.pttable = strdup("gpt");
+	p[0].partdev.uuid = strdup("2b1bd8f4-4c6d-4a0e-9bb0-0c8c7ad0f0e1");
+	p[0].partdev.pname = wcsdup(L"root été 100%");
+	p[0].partdev.ptype = 0x8300;
+	p[0].partdev.flags = 0x8000000000000004ull;
+	p[0].mnttype = strdup("ext4");
+	p[0].label = strdup("-");
+	p[1].mnttype = strdup("swap");
+	p[1].partdev.ptype = 0x8200;
+	CU_ASSERT_EQUAL(inventory_save(cache, &c), 0);
+	free_probed(&d);
+
+	CU_ASSERT_FATAL((inv = inventory_load(cache)) != NULL);
+	// a hit restores everything we'd otherwise have probed
+	sysfs_disk(&d, p);
+	d.blkdev.invtoken = tok;
+	CU_ASSERT_EQUAL(inventory_restore(inv, &d), 1);
+	CU_ASSERT_EQUAL(d.blkdev.transport, SERIAL_ATAIII);
+	CU_ASSERT_EQUAL(d.blkdev.rotation, 7200);
+	CU_ASSERT_EQUAL(d.blkdev.wcache, 1);
+	CU_ASSERT_EQUAL(d.blkdev.rwverify, RWVERIFY_SUPPORTED_OFF);
+	CU_ASSERT_EQUAL(d.blkdev.smart, 1);
+	CU_ASSERT_EQUAL(d.blkdev.celsius, 37);
+	CU_ASSERT_EQUAL(d.physsec, 4096);
+	CU_ASSERT(d.blkdev.biossha1 && memcmp(d.blkdev.biossha1, sha1, sizeof(sha1)) == 0);
+	CU_ASSERT(d.blkdev.serial && strcmp(d.blkdev.serial, "WD-1234 5678") == 0);
+	CU_ASSERT(d.blkdev.pttable && strcmp(d.blkdev.pttable, "gpt") == 0);
+	CU_ASSERT(d.mnttype == NULL && d.uuid == NULL);
+	CU_ASSERT(p[0].partdev.pname && wcscmp(p[0].partdev.pname, L"root été 100%") == 0);
+	CU_ASSERT_EQUAL(p[0].partdev.flags, 0x8000000000000004ull);
+	CU_ASSERT_EQUAL(p[0].partdev.ptype, 0x8300);
+	CU_ASSERT(p[0].label && strcmp(p[0].label, "-") == 0);
+	CU_ASSERT(p[0].uuid == NULL);
+	CU_ASSERT(p[1].mnttype && strcmp(p[1].mnttype, "swap") == 0);
+	CU_ASSERT_EQUAL(p[1].swapprio, SWAP_INACTIVE);
+	free_probed(&d);
+	// a different token, name or set of partitions is a miss
+	sysfs_disk(&d, p);
+	d.blkdev.invtoken = tok + 1;
+	CU_ASSERT_EQUAL(inventory_restore(inv, &d), 0);
+	d.blkdev.invtoken = tok;
+	strcpy(p[1].name, "sdz3");
+	CU_ASSERT_EQUAL(inventory_restore(inv, &d), 0);
+	strcpy(p[1].name, "sdz2");
+	p[0].next = NULL;
+	CU_ASSERT_EQUAL(inventory_restore(inv, &d), 0);
+	CU_ASSERT(d.blkdev.serial == NULL && p[0].partdev.uuid == NULL);
+	inventory_stats(inv, &entries, &hits, &misses);
+	CU_ASSERT_EQUAL(entries, 1);
+	CU_ASSERT_EQUAL(hits, 1);
+	CU_ASSERT_EQUAL(misses, 3);
+	inventory_free(inv);
+
+	// a damaged cache is ignored
+	CU_ASSERT_FATAL((fp = fopen(cache, "a")) != NULL);
+	fputs("D\t8:0\tsda\tnot-a-token\n", fp);
+	fclose(fp);
+	CU_ASSERT_FATAL((inv = inventory_load(cache)) != NULL);
+	inventory_stats(inv, &entries, &hits, &misses);
+	CU_ASSERT_EQUAL(entries, 0);
+	inventory_free(inv);
+
+	close(fd);
+	unlink(img);
+	unlink(cache);
+}
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <CUnit/Basic.h>
+#include "../src/logring.h"
+#include "tests.h"
+
+static void
+logit(logring *lr,loglevel level,const char *fmt,...){
+	va_list va;
+
+	va_start(va,fmt);
+	logring_vadd(lr,level,"test",fmt,va);
+	va_end(va);
+}
+
+void testLOGRING(void){
+	logslot slots[8];
+	logring lr = LOGRING_INITIALIZER(slots,8);
+	char big[LOGRING_MSGLEN * 2];
+	logent out[8];
+	unsigned z;
+
+	memset(slots,0,sizeof(slots));
+	CU_ASSERT_EQUAL(logring_get(&lr,LOGLEVEL_VERBOSE,8,out),0);
+	logit(&lr,LOGLEVEL_WARNING,"disk %s gone\n","sda");
+	logit(&lr,LOGLEVEL_VERBOSE,"probing %u\n",2u);
+	logit(&lr,LOGLEVEL_ERROR,"fatal\n");
+	CU_ASSERT_EQUAL(logring_get(&lr,LOGLEVEL_VERBOSE,8,out),3);
+	CU_ASSERT_STRING_EQUAL(out[0].msg,"fatal\n");
+	CU_ASSERT_STRING_EQUAL(out[1].msg,"probing 2\n");
+	CU_ASSERT_STRING_EQUAL(out[2].msg,"disk sda gone\n");
+	CU_ASSERT_STRING_EQUAL(out[2].src,"test");
+	CU_ASSERT(out[0].mono >= out[1].mono && out[1].mono >= out[2].mono);
+	// filtering by severity
+	CU_ASSERT_EQUAL(logring_get(&lr,LOGLEVEL_WARNING,8,out),2);
+	CU_ASSERT_EQUAL(out[1].level,LOGLEVEL_WARNING);
+	CU_ASSERT_EQUAL(logring_get(&lr,LOGLEVEL_ERROR,8,out),1);
+	CU_ASSERT_EQUAL(logring_get(&lr,LOGLEVEL_VERBOSE,1,out),1);
+	CU_ASSERT_STRING_EQUAL(out[0].msg,"fatal\n");
+	// long messages are truncated, and say so
+	memset(big,'x',sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+	logit(&lr,LOGLEVEL_INFO,"%s",big);
+	CU_ASSERT_EQUAL(logring_get(&lr,LOGLEVEL_INFO,1,out),1);
+	CU_ASSERT_EQUAL(strlen(out[0].msg),LOGRING_MSGLEN - 1);
+	CU_ASSERT_STRING_EQUAL(out[0].msg + LOGRING_MSGLEN - 1 - strlen(LOGRING_TRUNCATED),
+				LOGRING_TRUNCATED);
+	logit(&lr,LOGLEVEL_INFO,"%s\n",big);
+	CU_ASSERT_EQUAL(logring_get(&lr,LOGLEVEL_INFO,1,out),1);
+	CU_ASSERT_STRING_EQUAL(out[0].msg + LOGRING_MSGLEN - 2 - strlen(LOGRING_TRUNCATED),
+				LOGRING_TRUNCATED "\n");
+	CU_ASSERT(out[0].msg[0] == 'x');
+	// only the most recent nslots survive
+	for(z = 0 ; z < 20 ; ++z){
+		logit(&lr,LOGLEVEL_INFO,"%u",z);
+	}
+	CU_ASSERT_EQUAL(logring_get(&lr,LOGLEVEL_VERBOSE,8,out),8);
+	CU_ASSERT_STRING_EQUAL(out[0].msg,"19");
+	CU_ASSERT_STRING_EQUAL(out[7].msg,"12");
+	CU_ASSERT_EQUAL(lr.tickets,25);
+	CU_ASSERT_EQUAL(lr.dropped,0);
+	CU_ASSERT_PTR_NULL(loglevel_name(LOGLEVEL_VERBOSE + 1));
+	CU_ASSERT_STRING_EQUAL(loglevel_name(LOGLEVEL_INFO),"info");
+}
+
+// The logging of a 4,000-device discovery (some dozen verbf()s per device)
+// from 64 threads, through the ring and through the mutex, two vsnprintf()s
+// and a malloc() per message that it replaced.
+#define BENCH_THREADS 64
+#define BENCH_MSGS (4000 * 12 / BENCH_THREADS)
+#define BENCH_SLOTS 1024
+
+static logslot benchslots[BENCH_SLOTS];
+static logring benchring = LOGRING_INITIALIZER(benchslots,BENCH_SLOTS);
+
+static struct {
+	pthread_mutex_t lock;
+	unsigned last;
+	char *msgs[BENCH_SLOTS];
+} benchlocked = { .lock = PTHREAD_MUTEX_INITIALIZER, };
+
+static void
+locked_vadd(const char *fmt,va_list vac){
+	va_list vacc;
+	char *b;
+	int len;
+
+	va_copy(vacc,vac);
+	pthread_mutex_lock(&benchlocked.lock);
+	if(++benchlocked.last == BENCH_SLOTS){
+		benchlocked.last = 0;
+	}
+	len = vsnprintf(NULL,0,fmt,vac);
+	if( (b = malloc(len + 1)) ){
+		free(benchlocked.msgs[benchlocked.last]);
+		benchlocked.msgs[benchlocked.last] = b;
+		vsnprintf(b,len + 1,fmt,vacc);
+	}
+	pthread_mutex_unlock(&benchlocked.lock);
+	va_end(vacc);
+}
+
+static void
+benchlog(int locked,const char *fmt,...){
+	va_list va;
+
+	va_start(va,fmt);
+	if(locked){
+		locked_vadd(fmt,va);
+	}else{
+		logring_vadd(&benchring,LOGLEVEL_VERBOSE,"bench",fmt,va);
+	}
+	va_end(va);
+}
+
+static void *
+bench_thread(void *locked){
+	unsigned z;
+
+	for(z = 0 ; z < BENCH_MSGS ; ++z){
+		benchlog(!!locked,"\tModel: %s revision %s S/N %s (%u)\n",
+				"ST4000DM004-2CV104","0001","ZFN0ABCD",z);
+	}
+	return NULL;
+}
+
+static uint64_t
+bench_run(int locked){
+	pthread_t tids[BENCH_THREADS];
+	uint64_t t0;
+	unsigned z;
+
+	t0 = test_nanos();
+	for(z = 0 ; z < BENCH_THREADS ; ++z){
+		CU_ASSERT_FATAL(pthread_create(&tids[z],NULL,bench_thread,locked ? &tids : NULL) == 0);
+	}
+	for(z = 0 ; z < BENCH_THREADS ; ++z){
+		pthread_join(tids[z],NULL);
+	}
+	return test_nanos() - t0;
+}
+
+void benchLOGRING(void){
+	const unsigned total = BENCH_THREADS * BENCH_MSGS;
+	static logent out[BENCH_SLOTS];
+	uint64_t locked,ring;
+	unsigned z;
+
+	locked = bench_run(1);
+	ring = bench_run(0);
+	CU_ASSERT_EQUAL(benchring.tickets,total);
+	// a slot is only unreadable if its final message was dropped
+	CU_ASSERT(logring_get(&benchring,LOGLEVEL_VERBOSE,BENCH_SLOTS,out) +
+			benchring.dropped >= BENCH_SLOTS);
+	printf("\n\tlogring: %u threads, %u messages: locked %.1fms (%u mallocs), "
+			"ring %.1fms (%ju dropped)\n",BENCH_THREADS,total,
+			locked / 1000000.0,total,ring / 1000000.0,
+			(uintmax_t)benchring.dropped);
+	for(z = 0 ; z < BENCH_SLOTS ; ++z){
+		free(benchlocked.msgs[z]);
+	}
+}
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysmacros.h>
+#include <CUnit/Basic.h>
+#include "../src/mountinfo.h"
+#include "tests.h"
+
+static const char mounts0[] =
+	"26 1 8:2 / / rw,relatime shared:1 - ext4 /dev/sda2 rw\n"
+	"22 26 0:21 / /proc rw,nosuid,nodev,noexec,relatime shared:12 - proc proc rw\n"
+	"40 26 8:1 / /boot\\040efi rw,relatime shared:29 - vfat /dev/sda1 rw,fmask=0022\n"
+	"this line is garbage\n"
+	"31 26 0:27 / /home rw,relatime shared:15 master:3 - btrfs /dev/sdb rw,space_cache\n";
+
+// /boot efi was remounted read-only, /proc went away, and an overlay came
+static const char mounts1[] =
+	"26 1 8:2 / / rw,relatime shared:1 - ext4 /dev/sda2 rw\n"
+	"31 26 0:27 / /home rw,relatime shared:15 master:3 - btrfs /dev/sdb rw,space_cache\n"
+	"40 26 8:1 / /boot\\040efi ro,relatime shared:29 - vfat /dev/sda1 rw,fmask=0022\n"
+	"612 26 0:88 / /var/lib/docker/overlay2/a/merged rw - overlay overlay rw,lowerdir=/x";
+
+struct diffs {
+	unsigned gone[8],came[8];
+	unsigned ngone,ncame;
+};
+
+static void
+gone(mountinfo *mi,void *vd){
+	struct diffs *d = vd;
+
+	d->gone[d->ngone++] = mi->id;
+}
+
+static void
+came(mountinfo *mi,void *vd){
+	struct diffs *d = vd;
+
+	d->came[d->ncame++] = mi->id;
+	mi->resolved = 1;
+}
+
+void testMOUNTINFO(void){
+	mounttable m0,m1;
+	struct diffs d;
+
+	memset(&m0,0,sizeof(m0));
+	memset(&m1,0,sizeof(m1));
+	CU_ASSERT_FATAL(parse_mountinfo(mounts0,strlen(mounts0),&m0) == 0);
+	CU_ASSERT_FATAL(m0.count == 4);
+	// sorted by id, escapes decoded, optional fields skipped
+	CU_ASSERT_EQUAL(m0.ents[0].id,22);
+	CU_ASSERT_EQUAL(m0.ents[3].id,40);
+	CU_ASSERT_STRING_EQUAL(m0.ents[3].mnt,"/boot efi");
+	CU_ASSERT_EQUAL(m0.ents[3].devno,makedev(8,1));
+	CU_ASSERT_STRING_EQUAL(m0.ents[3].fs,"vfat");
+	CU_ASSERT_STRING_EQUAL(m0.ents[3].src,"/dev/sda1");
+	CU_ASSERT_STRING_EQUAL(m0.ents[3].sops,"rw,fmask=0022");
+	CU_ASSERT_EQUAL(m0.ents[2].parent,26);
+	CU_ASSERT_STRING_EQUAL(m0.ents[2].fs,"btrfs");
+	CU_ASSERT_STRING_EQUAL(m0.ents[2].ops,"rw,relatime");
+	// everything is new against an empty table
+	memset(&d,0,sizeof(d));
+	CU_ASSERT_EQUAL(diff_mounttables(&m1,&m0,gone,came,&d),4);
+	CU_ASSERT_EQUAL(d.ncame,4);
+	m0.ents[1].resolved = 0; // as if /'s device were unknown
+	// the final line lacks its newline
+	CU_ASSERT_FATAL(parse_mountinfo(mounts1,strlen(mounts1),&m1) == 0);
+	CU_ASSERT_FATAL(m1.count == 4);
+	memset(&d,0,sizeof(d));
+	CU_ASSERT_EQUAL(diff_mounttables(&m0,&m1,gone,came,&d),4);
+	CU_ASSERT_EQUAL(d.ngone,2);
+	CU_ASSERT_EQUAL(d.gone[0],22);
+	CU_ASSERT_EQUAL(d.gone[1],40);
+	CU_ASSERT_EQUAL(d.ncame,2);
+	CU_ASSERT_EQUAL(d.came[0],40);
+	CU_ASSERT_EQUAL(d.came[1],612);
+	// unchanged mounts carry their resolution across
+	CU_ASSERT_EQUAL(m1.ents[0].id,26);
+	CU_ASSERT_EQUAL(m1.ents[0].resolved,0);
+	CU_ASSERT_EQUAL(m1.ents[1].id,31);
+	CU_ASSERT_EQUAL(m1.ents[1].resolved,1);
+	// and an identical table is no change at all
+	memset(&d,0,sizeof(d));
+	CU_ASSERT_EQUAL(diff_mounttables(&m1,&m1,gone,came,&d),0);
+	free_mounttable(&m0);
+	free_mounttable(&m1);
+	CU_ASSERT(m0.ents == NULL && m0.count == 0);
+}
+
+// A container host with 5,000 overlay mounts, on which one container starts.
+void benchMOUNTINFO(void){
+	const unsigned n = 5000,iters = 100;
+	size_t off = 0,size = (n + 1) * 160;
+	unsigned z,calls = 0;
+	mounttable m0,m1;
+	uint64_t t0,t1;
+	struct diffs d;
+	char *text;
+
+	memset(&m0,0,sizeof(m0));
+	memset(&m1,0,sizeof(m1));
+	CU_ASSERT_FATAL((text = malloc(size)) != NULL);
+	for(z = 0 ; z < n ; ++z){
+		off += sprintf(text + off,"%u 26 0:%u / /var/lib/docker/overlay2/%08x/merged "
+				"rw,relatime - overlay overlay rw,lowerdir=/l%u\n",100 + z,z + 100,z,z);
+	}
+	CU_ASSERT_FATAL(parse_mountinfo(text,off,&m0) == 0);
+	off += sprintf(text + off,"%u 26 0:%u / /var/lib/docker/overlay2/new/merged "
+			"rw,relatime - overlay overlay rw\n",100 + n,100 + n);
+	t0 = test_nanos();
+	for(z = 0 ; z < iters ; ++z){
+		memset(&d,0,sizeof(d));
+		CU_ASSERT(parse_mountinfo(text,off,&m1) == 0);
+		calls += diff_mounttables(&m0,&m1,gone,came,&d);
+	}
+	t1 = test_nanos();
+	CU_ASSERT_EQUAL(calls,iters);
+	printf("\n\tmountinfo: %u mounts, %.1fus/parse+diff, %u change%s/update\n",
+			n + 1,(double)(t1 - t0) / iters / 1000,calls / iters,
+			calls / iters == 1 ? "" : "s");
+	free_mounttable(&m0);
+	free_mounttable(&m1);
+	free(text);
+}
@@ -0,0 +1,118 @@
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <CUnit/Basic.h>
+#include "../src/popen.h"
+#include "tests.h"
+
+// Lines and completions seen by the callbacks. Background jobs are only
+// serviced from cmd_service(), called by this thread, so no locking.
+static char lines[256];
+static unsigned linecount;
+static unsigned donecount;
+static cmdresult lastres;
+
+static void
+line_cb(unsigned id, const char *line, void *arg){
+	size_t len = strlen(lines);
+
+	(void)id;
+	(void)arg;
+	snprintf(lines + len, sizeof(lines) - len, "%s|", line);
+	++linecount;
+}
+
+static void
+done_cb(unsigned id, const cmdresult *res, void *arg){
+	(void)id;
+	(void)arg;
+	lastres = *res;
+	lastres.output = NULL;
+	++donecount;
+}
+
+// Service background jobs until n have completed, or five seconds pass
+static int
+service_until(unsigned n){
+	struct pollfd pfd;
+	unsigned z;
+
+	pfd.fd = cmd_runner_fd();
+	pfd.events = POLLIN;
+	for(z = 0 ; z < 500 && donecount < n ; ++z){
+		poll(&pfd, 1, 10);
+		cmd_service();
+	}
+	return donecount >= n ? 0 : -1;
+}
+
+void testCMDRUNNER(void){
+	const char *echo[] = { "sh", "-c", "echo a; echo b >&2; printf c; exit 3", NULL, };
+	const char *sleep30[] = { "sleep", "30", NULL, };
+	const char *sleep0[] = { "sleep", "0.1", NULL, };
+	const char *missing[] = { "/nonexistent/growlight", NULL, };
+	const char *lingers[] = { "sh", "-c", "exec >/dev/null 2>&1; sleep 0.2", NULL, };
+	cmdjob_info ji[4];
+	unsigned id, ids[4], z;
+	cmdresult res;
+
+	CU_ASSERT_FATAL(cmd_runner_fd() >= 0);
+	CU_ASSERT_EQUAL(spawn_drain("true", NULL), 0);
+	CU_ASSERT_EQUAL(spawn_drain("false", NULL), -1);
+	CU_ASSERT_EQUAL(spawn_drainv(missing), -1);
+	// stdout and stderr arrive on one pipe, as lines and captured whole,
+	// with a partial last line passed on at EOF
+	lines[0] = '\0';
+	linecount = 0;
+	CU_ASSERT_FATAL((id = cmd_spawn(echo, line_cb, NULL, NULL)) != 0);
+	CU_ASSERT_EQUAL(cmd_wait(id, &res), 0);
+	CU_ASSERT_EQUAL(res.status, 3);
+	CU_ASSERT_EQUAL(res.cancelled, 0);
+	CU_ASSERT_STRING_EQUAL(res.output, "a\nb\nc");
+	CU_ASSERT_EQUAL(res.outlen, 5);
+	CU_ASSERT_STRING_EQUAL(lines, "a|b|c|");
+	CU_ASSERT_EQUAL(linecount, 3);
+	cmdresult_free(&res);
+	// a job is collected only once
+	CU_ASSERT_EQUAL(cmd_wait(id, &res), -1);
+	// cancellation reaches the job through its process group
+	CU_ASSERT_FATAL((id = cmd_spawn(sleep30, NULL, NULL, NULL)) != 0);
+	CU_ASSERT_EQUAL(cmd_jobs(ji, 4), 1);
+	CU_ASSERT_EQUAL(ji[0].id, id);
+	CU_ASSERT_STRING_EQUAL(ji[0].cmd, "sleep 30");
+	CU_ASSERT_EQUAL(cmd_cancel(id), 0);
+	CU_ASSERT_EQUAL(cmd_wait(id, &res), 0);
+	CU_ASSERT_EQUAL(res.status, 128 + 15);
+	CU_ASSERT_EQUAL(res.cancelled, 1);
+	CU_ASSERT(res.ns < 1000000000ull);
+	cmdresult_free(&res);
+	CU_ASSERT_EQUAL(cmd_cancel(id), -1);
+	// background jobs run concurrently, without a thread apiece
+	donecount = 0;
+	for(z = 0 ; z < 4 ; ++z){
+		CU_ASSERT_FATAL((ids[z] = cmd_spawn(sleep0, NULL, done_cb, NULL)) != 0);
+	}
+	CU_ASSERT_EQUAL(cmd_jobs(ji, 4), 4);
+	CU_ASSERT_EQUAL(cmd_wait(ids[0], &res), -1);
+	CU_ASSERT_EQUAL_FATAL(service_until(4), 0);
+	CU_ASSERT_EQUAL(lastres.status, 0);
+	CU_ASSERT(lastres.ns < 1000000000ull);
+	CU_ASSERT_EQUAL(cmd_jobs(ji, 4), 0);
+	// a job outliving its EOF is still collected, by either means
+	CU_ASSERT_FATAL((id = cmd_spawn(lingers, NULL, NULL, NULL)) != 0);
+	CU_ASSERT_EQUAL(cmd_wait(id, &res), 0);
+	CU_ASSERT_EQUAL(res.status, 0);
+	CU_ASSERT(res.ns >= 100000000ull);
+	cmdresult_free(&res);
+	CU_ASSERT_FATAL(cmd_spawn(lingers, NULL, done_cb, NULL) != 0);
+	CU_ASSERT_EQUAL_FATAL(service_until(5), 0);
+	CU_ASSERT_EQUAL(lastres.status, 0);
+	CU_ASSERT_EQUAL(cmd_jobs(ji, 4), 0);
+	// and can be cancelled like any other
+	CU_ASSERT_FATAL((id = cmd_spawn(sleep30, NULL, done_cb, NULL)) != 0);
+	CU_ASSERT_EQUAL(cmd_cancel(id), 0);
+	CU_ASSERT_EQUAL_FATAL(service_until(6), 0);
+	CU_ASSERT_EQUAL(lastres.status, 128 + 15);
+	CU_ASSERT_EQUAL(lastres.cancelled, 1);
+	CU_ASSERT_EQUAL(cmd_jobs(ji, 4), 0);
+}
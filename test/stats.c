@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CUnit/Basic.h>
+#include <sys/sysmacros.h>
+#include "../src/stats.h"
+#include "../src/growlight.h"
+#include "tests.h"
+
+// Write the provided text to a new temporary file, returning its path.
+static char *
+write_temp(const char *text){
+	char *path = strdup("/tmp/growlight-test-XXXXXX");
+	FILE *fp;
+	int fd;
+
+	if(path == NULL){
+		return NULL;
+	}
+	if((fd = mkstemp(path)) < 0){
+		free(path);
+		return NULL;
+	}
+	if((fp = fdopen(fd,"w")) == NULL){
+		close(fd);
+		unlink(path);
+		free(path);
+		return NULL;
+	}
+	fputs(text,fp);
+	fclose(fp);
+	return path;
+}
+
+void testDISKSTATS(void){
+	diskstats_reader dr = DISKSTATS_READER_INITIALIZER;
+	const diskstats *ds;
+	char *path;
+
+	// 4.18+ (17 fields), pre-4.18 (14 fields) and 5.5+ (20 fields)
+	path = write_temp(
+		"   8       0 sda 100 2 3000 4 500 6 7000 8 0 10 11 12 13 14 15\n"
+		" 259       1 nvme0n1p1 1 2 3 4 5 6 7 8 9 10 11\n"
+		"   8      16 sdb 9 9 9 9 9 9 1234567890123 9 9 9 9 9 9 9 9 9 9\n");
+	CU_ASSERT_FATAL(path != NULL);
+	CU_ASSERT_EQUAL(read_diskstats(&dr,path,&ds),3);
+	CU_ASSERT_STRING_EQUAL(ds[0].name,"sda");
+	CU_ASSERT_EQUAL(ds[0].devno,makedev(8,0));
+	CU_ASSERT_EQUAL(ds[0].total.reads_completed,100);
+	CU_ASSERT_EQUAL(ds[0].total.reads_merged,2);
+	CU_ASSERT_EQUAL(ds[0].total.sectors_read,3000);
+	CU_ASSERT_EQUAL(ds[0].total.ms_reading,4);
+	CU_ASSERT_EQUAL(ds[0].total.writes_completed,500);
+	CU_ASSERT_EQUAL(ds[0].total.writes_merged,6);
+	CU_ASSERT_EQUAL(ds[0].total.sectors_written,7000);
+	CU_ASSERT_EQUAL(ds[0].total.ms_writing,8);
+	CU_ASSERT_EQUAL(ds[0].total.ios_in_progress,0);
+	CU_ASSERT_EQUAL(ds[0].total.ms_ios,10);
+	CU_ASSERT_EQUAL(ds[0].total.weighted_ms_ios,11);
+	CU_ASSERT_EQUAL(ds[0].total.discards_completed,12);
+	CU_ASSERT_EQUAL(ds[0].total.discards_merged,13);
+	CU_ASSERT_EQUAL(ds[0].total.sectors_discarded,14);
+	CU_ASSERT_EQUAL(ds[0].total.ms_discarding,15);
+	CU_ASSERT_STRING_EQUAL(ds[1].name,"nvme0n1p1");
+	CU_ASSERT_EQUAL(ds[1].devno,makedev(259,1));
+	CU_ASSERT_EQUAL(ds[1].total.sectors_read,3);
+	CU_ASSERT_EQUAL(ds[1].total.weighted_ms_ios,11);
+	CU_ASSERT_EQUAL(ds[1].total.discards_completed,0); // pre-4.18
+	CU_ASSERT_EQUAL(ds[1].total.ms_discarding,0);
+	CU_ASSERT_STRING_EQUAL(ds[2].name,"sdb");
+	CU_ASSERT_EQUAL(ds[2].total.sectors_written,1234567890123ull);
+	free_diskstats_reader(&dr);
+	unlink(path);
+	free(path);
+	// too few fields, and a missing device name
+	path = write_temp("8 0 sda 1 2 3\n");
+	CU_ASSERT_FATAL(path != NULL);
+	CU_ASSERT(read_diskstats(&dr,path,&ds) < 0);
+	free_diskstats_reader(&dr);
+	unlink(path);
+	free(path);
+	path = write_temp("8 0\n");
+	CU_ASSERT_FATAL(path != NULL);
+	CU_ASSERT(read_diskstats(&dr,path,&ds) < 0);
+	free_diskstats_reader(&dr);
+	unlink(path);
+	free(path);
+}
+
+void testSTATRATES(void){
+	statpack prev = { .reads_completed = 1000, .sectors_read = 8000,
+		.ms_reading = 100, .writes_completed = UINT64_MAX - 9,
+		.sectors_written = 0, .ms_writing = 50, .ms_ios = 0,
+		.weighted_ms_ios = 0, .ios_in_progress = 7, };
+	statpack cur = { .reads_completed = 1200, .sectors_read = 10048,
+		.ms_reading = 500, .writes_completed = 40, // wrapped
+		.sectors_written = 4096, .ms_writing = 50, .ms_ios = 250,
+		.weighted_ms_ios = 1000, .ios_in_progress = 3, };
+	struct timeval q = { .tv_sec = 0, .tv_usec = 500000, };
+	statpack delta;
+	statrates r;
+
+	statpack_delta(&delta,&cur,&prev);
+	CU_ASSERT_EQUAL(delta.reads_completed,200);
+	CU_ASSERT_EQUAL(delta.writes_completed,50);
+	CU_ASSERT_EQUAL(delta.ios_in_progress,3); // gauge, not differenced
+	statpack_rates(&r,&delta,&q);
+	CU_ASSERT_DOUBLE_EQUAL(r.reads,400,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(r.writes,100,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(r.rbytes,2048.0 * 512 * 2,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(r.wbytes,4096.0 * 512 * 2,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(r.rlatency,2,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(r.wlatency,0,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(r.qdepth,2,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(r.util,50,0.001);
+	// jiffy rounding can report more busy time than wall time
+	delta.ms_ios = 600;
+	statpack_rates(&r,&delta,&q);
+	CU_ASSERT_DOUBLE_EQUAL(r.util,100,0.001);
+	q.tv_usec = 0;
+	statpack_rates(&r,&delta,&q);
+	CU_ASSERT_DOUBLE_EQUAL(r.reads,0,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(r.util,0,0.001);
+}
+
+static void
+fake_rates(statrates *r,double iops,double latency,double util){
+	memset(r,0,sizeof(*r));
+	r->reads = iops;
+	r->rlatency = latency;
+	r->util = util;
+}
+
+void testSTATHIST(void){
+	statbucket secs[STATHIST_SECONDS];
+	statrollup mins[3],merged,sum;
+	const uint32_t t0 = 6000; // on a minute boundary
+	stathist *sh;
+	statrates r;
+	unsigned z;
+
+	CU_ASSERT_FATAL((sh = stathist_create()) != NULL);
+	// one sample a second for two minutes, ramping up
+	for(z = 0 ; z < 120 ; ++z){
+		fake_rates(&r,z,z / 10.0,z < 60 ? 10 : 90);
+		stathist_add(sh,t0 + z,&r);
+	}
+	// two samples landing in the same second are averaged
+	fake_rates(&r,100,1,0);
+	stathist_add(sh,t0 + 120,&r);
+	fake_rates(&r,200,3,100);
+	stathist_add(sh,t0 + 120,&r);
+	stathist_seconds(sh,t0 + 121,3,secs);
+	CU_ASSERT_EQUAL(secs[0].when,t0 + 119);
+	CU_ASSERT_EQUAL(secs[0].n,1);
+	CU_ASSERT_DOUBLE_EQUAL(secs[0].avg.iops,119,0.001);
+	CU_ASSERT_EQUAL(secs[1].n,2);
+	CU_ASSERT_DOUBLE_EQUAL(secs[1].avg.iops,150,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(secs[1].avg.latency,2,0.001);
+	CU_ASSERT_EQUAL(secs[2].n,0); // nothing yet this second
+	stathist_minutes(sh,t0 + 121,3,mins);
+	CU_ASSERT_EQUAL(mins[0].n,60);
+	CU_ASSERT_DOUBLE_EQUAL(mins[0].min.iops,0,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(mins[0].max.iops,59,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(mins[0].avg.iops,29.5,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(mins[0].avg.util,10,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(mins[1].min.util,90,0.001);
+	CU_ASSERT_EQUAL(mins[2].n,2);
+	CU_ASSERT_DOUBLE_EQUAL(mins[2].max.util,100,0.001);
+	merged = mins[0];
+	statrollup_merge(&merged,&mins[1]);
+	CU_ASSERT_EQUAL(merged.n,120);
+	CU_ASSERT_DOUBLE_EQUAL(merged.min.iops,0,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(merged.max.iops,119,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(merged.avg.iops,59.5,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(merged.avg.util,50,0.001);
+	// the rollup of the same two minutes must agree with the merge
+	stathist_rollup(sh,t0 + 119,2,&sum);
+	CU_ASSERT_EQUAL(sum.n,120);
+	CU_ASSERT_DOUBLE_EQUAL(sum.min.iops,0,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(sum.max.iops,119,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(sum.avg.iops,59.5,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(sum.avg.util,50,0.001);
+	stathist_summarize(sh,t0 + 119,10,&sum);
+	CU_ASSERT_EQUAL(sum.n,10);
+	CU_ASSERT_DOUBLE_EQUAL(sum.min.iops,110,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(sum.avg.iops,114.5,0.001);
+	// after a gap longer than the fine ring, the old seconds must read
+	// as empty rather than as stale data from a previous lap
+	fake_rates(&r,5,5,5);
+	stathist_add(sh,t0 + 120 + STATHIST_SECONDS + 1,&r);
+	stathist_seconds(sh,t0 + 120 + STATHIST_SECONDS + 1,STATHIST_SECONDS,secs);
+	for(z = 0 ; z < STATHIST_SECONDS - 1 ; ++z){
+		CU_ASSERT_EQUAL(secs[z].n,0);
+	}
+	CU_ASSERT_EQUAL(secs[STATHIST_SECONDS - 1].n,1);
+	// likewise for the coarse ring, a day later
+	stathist_minutes(sh,t0 + 60 * STATHIST_MINUTES,3,mins);
+	CU_ASSERT_EQUAL(mins[0].n + mins[1].n + mins[2].n,0);
+	stathist_free(sh);
+}
+
+// After the first read of a 10,000-device file has sized the reader's
+// buffers, further reads ought perform no allocations whatsoever.
+void benchDISKSTATS(void){
+	diskstats_reader dr = DISKSTATS_READER_INITIALIZER;
+	const unsigned lines = 10000,iters = 100;
+	const diskstats *ds;
+	unsigned z,allocs;
+	uint64_t t0,t1;
+	size_t off = 0;
+	char *text,*path;
+
+	CU_ASSERT_FATAL((text = malloc(lines * 128)) != NULL);
+	for(z = 0 ; z < lines ; ++z){
+		off += sprintf(text + off,"%4u %7u sd%c%c%c %u 0 %u 0 %u 0 %u 0 0 %u %u 0 0 0 0\n",
+				8 + z / 1024,z % 1024,'a' + z / 676 % 26,'a' + z / 26 % 26,
+				'a' + z % 26,z,z * 8,z,z * 16,z,z);
+	}
+	path = write_temp(text);
+	free(text);
+	CU_ASSERT_FATAL(path != NULL);
+	CU_ASSERT_EQUAL(read_diskstats(&dr,path,&ds),(int)lines);
+	allocs = dr.allocs;
+	t0 = test_nanos();
+	for(z = 0 ; z < iters ; ++z){
+		CU_ASSERT_EQUAL(read_diskstats(&dr,path,&ds),(int)lines);
+	}
+	t1 = test_nanos();
+	CU_ASSERT_EQUAL(dr.allocs,allocs);
+	CU_ASSERT_EQUAL(ds[lines - 1].total.sectors_written,(lines - 1) * 16ull);
+	printf("\n\tdiskstats: %u lines, %.1fus/read, %u allocs in first read, "
+			"%u in %u further reads\n",lines,(double)(t1 - t0) / iters / 1000,
+			allocs,dr.allocs - allocs,iters);
+	free_diskstats_reader(&dr);
+	unlink(path);
+	free(path);
+}
+
+void testSTATSTABLE(void){
+	const unsigned n = STATSTABLE_PAGE * 3 + 1;
+	struct timeval q = { .tv_sec = 1, .tv_usec = 0, };
+	devstats **ds,*d;
+	unsigned z,live;
+	statstable st;
+	statpack sp;
+
+	memset(&st,0,sizeof(st));
+	CU_ASSERT_FATAL((ds = calloc(n,sizeof(*ds))) != NULL);
+	for(z = 0 ; z < n ; ++z){
+		CU_ASSERT_FATAL((ds[z] = statstable_alloc(&st,makedev(8,z))) != NULL);
+		CU_ASSERT_EQUAL(ds[z]->id,z);
+		ds[z]->rates.util = z;
+	}
+	CU_ASSERT_EQUAL(st.npages,4);
+	CU_ASSERT_EQUAL(st.count,n);
+	// the devno index survives its growth
+	for(z = 0 ; z < n ; ++z){
+		CU_ASSERT(statstable_devno(&st,makedev(8,z)) == ds[z]);
+	}
+	CU_ASSERT(statstable_devno(&st,makedev(9,0)) == NULL);
+	// growth never moves a slot, and slots within a page are adjacent
+	for(z = 0 ; z < n ; ++z){
+		CU_ASSERT_EQUAL(ds[z]->rates.util,z);
+	}
+	CU_ASSERT(ds[1] == ds[0] + 1);
+	// the first sample is only a baseline
+	memset(&sp,0,sizeof(sp));
+	sp.reads_completed = 100;
+	sp.ms_ios = 250;
+	ds[5]->keephist = 1;
+	devstats_update(ds[5],&sp,&q,1);
+	CU_ASSERT_EQUAL(ds[5]->rates.reads,0);
+	CU_ASSERT(ds[5]->hist == NULL);
+	devstats_update(ds[6],&sp,&q,1);
+	devstats_update(ds[6],&sp,&q,2);
+	CU_ASSERT(ds[6]->hist == NULL); // not wanted
+	sp.reads_completed = 300;
+	sp.ms_ios = 750;
+	devstats_update(ds[5],&sp,&q,2);
+	CU_ASSERT_DOUBLE_EQUAL(ds[5]->rates.reads,200,0.001);
+	CU_ASSERT_DOUBLE_EQUAL(ds[5]->rates.util,50,0.001);
+	CU_ASSERT(ds[5]->hist != NULL);
+	devstats_restart(ds[5]);
+	devstats_update(ds[5],&sp,&q,3);
+	CU_ASSERT_EQUAL(ds[5]->rates.reads,0);
+	// released slots are reused, zeroed and without history
+	statstable_release(&st,ds[5]);
+	statstable_release(&st,ds[9]);
+	CU_ASSERT(statstable_devno(&st,makedev(8,5)) == NULL);
+	CU_ASSERT(statstable_devno(&st,makedev(8,4)) == ds[4]);
+	CU_ASSERT_EQUAL(st.count,n - 2);
+	CU_ASSERT_FATAL((d = statstable_alloc(&st,makedev(9,9))) != NULL);
+	CU_ASSERT(d == ds[9] && d->devno == makedev(9,9));
+	CU_ASSERT(statstable_devno(&st,makedev(9,9)) == d);
+	CU_ASSERT_FATAL((d = statstable_alloc(&st,makedev(9,5))) != NULL);
+	CU_ASSERT(d == ds[5] && d->hist == NULL && d->rates.util == 0);
+	CU_ASSERT_EQUAL(d->keephist,0);
+	CU_ASSERT_EQUAL(d->stats.sectors_read,UINTMAX_MAX);
+	CU_ASSERT_FATAL((d = statstable_alloc(&st,makedev(9,n))) != NULL);
+	CU_ASSERT_EQUAL(d->id,n);
+	// a sweep releases the slots absent from the latest sample
+	for(z = 0 ; z < 4 ; ++z){
+		ds[z]->gen = 7;
+	}
+	live = st.count;
+	CU_ASSERT_EQUAL(statstable_sweep(&st,7),live - 4);
+	CU_ASSERT_EQUAL(st.count,4);
+	CU_ASSERT(statstable_devno(&st,makedev(8,3)) == ds[3]);
+	CU_ASSERT(statstable_devno(&st,makedev(8,4)) == NULL);
+	CU_ASSERT(statstable_alloc(&st,makedev(8,4)) != NULL);
+	statstable_free(&st);
+	CU_ASSERT(st.pages == NULL && st.used == 0);
+	free(ds);
+}
+
+// The per-interval state as it was laid out before the statstable: inline
+// amidst each device's descriptive data.
+struct inlinedev {
+	device d;
+	devstats hot;
+};
+
+// The per-device work of update_stats() over 1,000 devices, with the hot
+// state inline in each device versus packed in a statstable.
+void benchDEVSTATS(void){
+	const unsigned n = 1000,iters = 1000;
+	struct timeval q = { .tv_sec = 1, .tv_usec = 0, };
+	struct inlinedev *inl;
+	uint64_t t0,t1,t2;
+	devstats **hot;
+	statstable st;
+	statpack sp;
+	unsigned i,z;
+
+	memset(&st,0,sizeof(st));
+	memset(&sp,0,sizeof(sp));
+	CU_ASSERT_FATAL((inl = calloc(n,sizeof(*inl))) != NULL);
+	CU_ASSERT_FATAL((hot = calloc(n,sizeof(*hot))) != NULL);
+	for(z = 0 ; z < n ; ++z){
+		devstats_restart(&inl[z].hot);
+		inl[z].hot.keephist = 1;
+		CU_ASSERT_FATAL((hot[z] = statstable_alloc(&st,z + 1)) != NULL);
+		hot[z]->keephist = 1;
+	}
+	t0 = test_nanos();
+	for(i = 0 ; i < iters ; ++i){
+		sp.reads_completed = sp.ms_ios = i;
+		for(z = 0 ; z < n ; ++z){
+			devstats_update(&inl[z].hot,&sp,&q,i);
+		}
+	}
+	t1 = test_nanos();
+	for(i = 0 ; i < iters ; ++i){
+		sp.reads_completed = sp.ms_ios = i;
+		for(z = 0 ; z < n ; ++z){
+			devstats_update(hot[z],&sp,&q,i);
+		}
+	}
+	t2 = test_nanos();
+	for(z = 0 ; z < n ; ++z){
+		CU_ASSERT_DOUBLE_EQUAL(hot[z]->rates.reads,inl[z].hot.rates.reads,0.001);
+		stathist_free(inl[z].hot.hist);
+	}
+	printf("\n\tdevstats: %u devices, %.1fus/interval inline (%zuB stride), "
+			"%.1fus/interval packed (%zuB stride)\n",n,
+			(double)(t1 - t0) / iters / 1000,sizeof(*inl),
+			(double)(t2 - t1) / iters / 1000,sizeof(devstats));
+	statstable_free(&st);
+	free(inl);
+	free(hot);
+}
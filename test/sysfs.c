@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <CUnit/Basic.h>
+#include "../src/sysfs.h"
+#include "tests.h"
+
+static int
+put_attr(const char *dir, const char *node, const char *val){
+	char path[PATH_MAX];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, node);
+	if((fp = fopen(path, "w")) == NULL){
+		return -1;
+	}
+	fputs(val, fp);
+	return fclose(fp);
+}
+
+void testSYSFS(void){
+	char dir[] = "/tmp/growlight-sysfs-XXXXXX";
+	char sub[PATH_MAX], *sched = NULL, *model = NULL;
+	unsigned long size, lsec, psec;
+	unsigned removable, rot;
+	sysfs_stats ss0, ss1;
+	dev_t devno;
+	int fd;
+
+	CU_ASSERT_FATAL(mkdtemp(dir) != NULL);
+	snprintf(sub, sizeof(sub), "%s/queue", dir);
+	CU_ASSERT_FATAL(mkdir(sub, 0755) == 0);
+	CU_ASSERT(put_attr(dir, "dev", "8:16\n") == 0);
+	CU_ASSERT(put_attr(dir, "size", "1953525168\n") == 0);
+	CU_ASSERT(put_attr(dir, "removable", "0\n") == 0);
+	CU_ASSERT(put_attr(dir, "model", "\n") == 0);
+	CU_ASSERT(put_attr(dir, "queue/scheduler", "[mq-deadline] none   \n") == 0);
+	CU_ASSERT(put_attr(dir, "queue/rotational", "1\n") == 0);
+	CU_ASSERT(put_attr(dir, "queue/logical_block_size", "512\n") == 0);
+	CU_ASSERT(put_attr(dir, "queue/physical_block_size", "4096 \n") == 0);
+	CU_ASSERT_FATAL((fd = open(dir, O_RDONLY|O_DIRECTORY)) >= 0);
+	{
+		sysfs_attr attrs[] = {
+			{ .node = "dev", .type = SYSFS_DEVNO, .val = &devno, },
+			{ .node = "size", .type = SYSFS_UINT, .val = &size, },
+			{ .node = "removable", .type = SYSFS_BOOL, .val = &removable, },
+			{ .node = "model", .type = SYSFS_STRING, .val = &model, },
+			{ .node = "queue/scheduler", .type = SYSFS_STRING, .val = &sched, },
+			{ .node = "queue/rotational", .type = SYSFS_BOOL, .val = &rot, },
+			{ .node = "queue/logical_block_size", .type = SYSFS_UINT, .val = &lsec, },
+			{ .node = "queue/physical_block_size", .type = SYSFS_UINT, .val = &psec, },
+			{ .node = "queue/missing", .type = SYSFS_UINT, .val = &psec, },
+		};
+
+		get_sysfs_stats(&ss0);
+		// an empty model, the malformed physical sector size, and the
+		// missing node fail; everything else is read
+		CU_ASSERT_EQUAL(get_sysfs_attrs(fd, attrs, sizeof(attrs) / sizeof(*attrs)), 3);
+		get_sysfs_stats(&ss1);
+		CU_ASSERT_EQUAL(devno, makedev(8, 16));
+		CU_ASSERT_EQUAL(size, 1953525168ul);
+		CU_ASSERT_EQUAL(removable, 0);
+		CU_ASSERT_EQUAL(attrs[3].err, ENODATA);
+		CU_ASSERT(model == NULL);
+		CU_ASSERT(sched && strcmp(sched, "[mq-deadline] none") == 0);
+		CU_ASSERT_EQUAL(rot, 1);
+		CU_ASSERT_EQUAL(lsec, 512);
+		CU_ASSERT_EQUAL(attrs[7].err, EINVAL);
+		CU_ASSERT_EQUAL(attrs[8].err, ENOENT);
+		// nine attributes, of which the missing one was never opened
+		CU_ASSERT_EQUAL(ss1.attrs - ss0.attrs, 9);
+		CU_ASSERT_EQUAL(ss1.opens - ss0.opens, 8);
+		CU_ASSERT_EQUAL(ss1.reads - ss0.reads, 8);
+		CU_ASSERT_EQUAL(ss1.closes - ss0.closes, 8);
+	}
+	// the single-attribute readers agree
+	CU_ASSERT_EQUAL(get_sysfs_uint(fd, "queue/logical_block_size", &lsec), 0);
+	CU_ASSERT_EQUAL(lsec, 512);
+	CU_ASSERT_EQUAL(sysfs_devno(fd, &devno), 0);
+	CU_ASSERT_EQUAL(devno, makedev(8, 16));
+	CU_ASSERT_EQUAL(sysfs_exist_p(fd, "queue/missing"), 0);
+	free(sched);
+	close(fd);
+	CU_ASSERT(remove_fixture(dir) == 0);
+}
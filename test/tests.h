@@ -0,0 +1,53 @@
+#ifndef GROWLIGHT_TEST_TESTS
+#define GROWLIGHT_TEST_TESTS
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <time.h>
+#include <stdint.h>
+
+// Monotonic nanoseconds, for the benchmarks
+static inline uint64_t
+test_nanos(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void testDEVINDEX(void);
+void benchDEVINDEX(void);
+void testDISKSTATS(void);
+void benchDISKSTATS(void);
+void testSTATRATES(void);
+void testSTATHIST(void);
+void testSTATSTABLE(void);
+void benchDEVSTATS(void);
+void testWORKQ(void);
+void testCOALESCE(void);
+void testINVENTORY(void);
+void testDEVNODE(void);
+void testSYSFS(void);
+void testMOUNTINFO(void);
+void benchMOUNTINFO(void);
+void testFSUSAGE(void);
+void testFSUSAGEHUNG(void);
+void testFILLHIST(void);
+void testCMDRUNNER(void);
+void testLOGRING(void);
+void benchLOGRING(void);
+void testARENA(void);
+void benchARENA(void);
+int make_fixture(const char *,unsigned,unsigned,unsigned);
+int remove_fixture(const char *);
+void testFIXTURE(void);
+void benchDISCOVERY(void);
+void benchDISCOVERYPOOL(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
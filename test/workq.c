@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <CUnit/Basic.h>
+#include "../src/workq.h"
+#include "tests.h"
+
+static pthread_mutex_t testlock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned jobsrun;
+
+static void
+count_job(void *arg){
+	unsigned *seen = arg;
+
+	pthread_mutex_lock(&testlock);
+	++jobsrun;
+	pthread_mutex_unlock(&testlock);
+	++*seen;
+}
+
+static void
+stall_job(void *arg){
+	usleep(*(unsigned *)arg * 1000);
+}
+
+// Stands in for a probe wedged on dead hardware, until released
+static pthread_cond_t testcond = PTHREAD_COND_INITIALIZER;
+static int wedged;
+
+static void
+wedge_job(void *arg){
+	(void)arg;
+	pthread_mutex_lock(&testlock);
+	wedged = 1;
+	pthread_cond_broadcast(&testcond);
+	while(wedged){
+		pthread_cond_wait(&testcond,&testlock);
+	}
+	pthread_mutex_unlock(&testlock);
+}
+
+void testWORKQ(void){
+	const unsigned jobs = 10000;
+	unsigned shortms = 10;
+	struct workq *wq;
+	workq_stats ws;
+	unsigned *seen;
+	unsigned z,ms;
+
+	CU_ASSERT_FATAL((seen = calloc(jobs,sizeof(*seen))) != NULL);
+	CU_ASSERT_FATAL((wq = workq_create(4)) != NULL);
+	CU_ASSERT_EQUAL(workq_threads(wq),4);
+	jobsrun = 0;
+	for(z = 0 ; z < jobs ; ++z){
+		CU_ASSERT_EQUAL(workq_submit(wq,count_job,&seen[z]),0);
+	}
+	CU_ASSERT_EQUAL(workq_wait(wq,0),0);
+	CU_ASSERT_EQUAL(jobsrun,jobs);
+	for(z = 0 ; z < jobs ; ++z){ // each exactly once
+		CU_ASSERT_EQUAL(seen[z],1);
+	}
+	workq_get_stats(wq,&ws);
+	CU_ASSERT_EQUAL(ws.submitted,jobs);
+	CU_ASSERT_EQUAL(ws.completed,jobs);
+	CU_ASSERT_EQUAL(ws.queued,0);
+	CU_ASSERT_EQUAL(ws.running,0);
+	// a job which outlasts the stall timeout
+	ms = 300;
+	CU_ASSERT_EQUAL(workq_submit(wq,stall_job,&ms),0);
+	CU_ASSERT_EQUAL(workq_wait(wq,50),-1);
+	CU_ASSERT_EQUAL(workq_wait(wq,1000),0);
+	workq_get_stats(wq,&ws);
+	CU_ASSERT(ws.maxrunns >= ms * 1000000ull);
+	CU_ASSERT(ws.runns >= ws.maxrunns);
+	CU_ASSERT(ws.waitns >= ws.maxwaitns);
+	workq_destroy(wq);
+	// 0 threads means one per CPU
+	CU_ASSERT_FATAL((wq = workq_create(0)) != NULL);
+	CU_ASSERT_EQUAL(workq_threads(wq),(unsigned)sysconf(_SC_NPROCESSORS_ONLN));
+	// destruction runs everything still queued
+	jobsrun = 0;
+	for(z = 0 ; z < 100 ; ++z){
+		workq_submit(wq,count_job,&seen[z]);
+	}
+	workq_destroy(wq);
+	CU_ASSERT_EQUAL(jobsrun,100);
+	// a wedged job is abandoned at the deadline, and what's queued behind
+	// it is dropped; the pool is freed once it returns
+	CU_ASSERT_FATAL((wq = workq_create(2)) != NULL);
+	CU_ASSERT_EQUAL(workq_submit(wq,wedge_job,NULL),0);
+	pthread_mutex_lock(&testlock);
+	while(!wedged){
+		pthread_cond_wait(&testcond,&testlock);
+	}
+	pthread_mutex_unlock(&testlock);
+	ms = 100;
+	CU_ASSERT_EQUAL(workq_submit(wq,stall_job,&ms),0);
+	jobsrun = 0;
+	for(z = 0 ; z < 100 ; ++z){
+		workq_submit(wq,count_job,&seen[z]);
+	}
+	CU_ASSERT_EQUAL(workq_destroy_deadline(wq,50),2);
+	CU_ASSERT(jobsrun < 100);
+	pthread_mutex_lock(&testlock);
+	wedged = 0;
+	pthread_cond_broadcast(&testcond);
+	pthread_mutex_unlock(&testlock);
+	usleep(150000);
+	// and one which finishes in time is destroyed as usual
+	CU_ASSERT_FATAL((wq = workq_create(2)) != NULL);
+	CU_ASSERT_EQUAL(workq_submit(wq,stall_job,&shortms),0);
+	CU_ASSERT_EQUAL(workq_destroy_deadline(wq,1000),0);
+	free(seen);
+}